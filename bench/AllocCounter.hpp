@@ -0,0 +1,65 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+
+/*
+ * Counts heap allocations made anywhere in the process, libdnn.so included,
+ * by interposing malloc and friends over glibc's. operator new ends up in
+ * malloc, so Eigen temporaries and std containers are counted too.
+ * Include from exactly one translation unit of a benchmark executable.
+ * */
+
+extern "C" {
+	void* __libc_malloc(size_t);
+	void* __libc_calloc(size_t, size_t);
+	void* __libc_realloc(void*, size_t);
+	void* __libc_memalign(size_t, size_t);
+}
+
+namespace bench
+{
+	inline std::atomic<unsigned long> allocations{0};
+
+	inline unsigned long allocationCount()
+	{
+		return allocations.load(std::memory_order_relaxed);
+	}
+}
+
+extern "C" {
+	void* malloc(size_t n) noexcept
+	{
+		bench::allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_malloc(n);
+	}
+
+	void* calloc(size_t count, size_t n) noexcept
+	{
+		bench::allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_calloc(count, n);
+	}
+
+	void* realloc(void* p, size_t n) noexcept
+	{
+		bench::allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_realloc(p, n);
+	}
+
+	int posix_memalign(void** p, size_t alignment, size_t n) noexcept
+	{
+		bench::allocations.fetch_add(1, std::memory_order_relaxed);
+		*p = __libc_memalign(alignment, n);
+		return *p ? 0 : ENOMEM;
+	}
+
+	void* aligned_alloc(size_t alignment, size_t n) noexcept
+	{
+		bench::allocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_memalign(alignment, n);
+	}
+}
+
+#endif //ALLOC_COUNTER_HPP
@@ -0,0 +1,249 @@
+#include "AllocCounter.hpp"
+#include "../include/Network.hpp"
+#include "../include/Layer.hpp"
+#include "../include/InferenceModel.hpp"
+#include <Eigen/Core>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Microbenchmarks of the dense layer and network hot paths over a grid of
+ * layer widths, batch sizes, activations and thread counts. Results go to
+ * stdout (or --out=file) as JSON, one record per benchmark and grid point:
+ *
+ *   layer_forward       Layer::forwardPass, width -> width
+ *   layer_backward      Layer::backwardPass on a given loss gradient
+ *   layer_update        Layer::updateWeights
+ *   network_predict     Network::predictBatch, width -> width -> width -> 1
+ *   network_train_step  Network::trainStep on the same network
+ *   inference_predict   InferenceModel::predict on the same network, frozen
+ *
+ * Usage:
+ *   dnnbench [--widths=64,256,1024] [--batches=1,32,256]
+ *         [--activations=relu,tanh,sigmoid] [--threads=1,2,...]
+ *         [--min-time=0.05] [--out=results.json]
+ * */
+
+using Mat = NN::Mat;
+
+struct Options
+{
+	std::vector<NN::int_t> widths{64, 256, 1024};
+	std::vector<NN::int_t> batches{1, 32, 256};
+	std::vector<std::string> activations{"relu", "tanh", "sigmoid"};
+	std::vector<int> threads;
+	//seconds each benchmark keeps repeating its step
+	double minTime = 0.05;
+	std::string out;
+};
+
+struct Result
+{
+	double secondsPerStep;
+	double allocationsPerStep;
+};
+
+std::vector<std::string> splitList(const std::string& list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while(std::getline(ss, item, ',')){
+		if(not item.empty()){
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+template<typename T>
+std::vector<T> parseList(const std::string& list)
+{
+	std::vector<T> values;
+	for(const auto& item : splitList(list)){
+		values.push_back(static_cast<T>(std::atol(item.c_str())));
+	}
+	return values;
+}
+
+Options parseOptions(int argc, char** argv)
+{
+	Options opts;
+	for(int t = 1; t <= static_cast<int>(std::thread::hardware_concurrency()); t *= 2){
+		opts.threads.push_back(t);
+	}
+	for(int i = 1; i < argc; i++){
+		std::string arg = argv[i];
+		auto value = arg.substr(arg.find('=') + 1);
+		if(arg.rfind("--widths=", 0) == 0){
+			opts.widths = parseList<NN::int_t>(value);
+		} else if(arg.rfind("--batches=", 0) == 0){
+			opts.batches = parseList<NN::int_t>(value);
+		} else if(arg.rfind("--activations=", 0) == 0){
+			opts.activations = splitList(value);
+		} else if(arg.rfind("--threads=", 0) == 0){
+			opts.threads = parseList<int>(value);
+		} else if(arg.rfind("--min-time=", 0) == 0){
+			opts.minTime = std::atof(value.c_str());
+		} else if(arg.rfind("--out=", 0) == 0){
+			opts.out = value;
+		} else {
+			std::cerr << "unknown option " << arg << '\n';
+			std::exit(1);
+		}
+	}
+	return opts;
+}
+
+//runs step a few times to warm up, then until minTime has passed
+Result measure(const std::function<void()>& step, double minTime)
+{
+	for(int i = 0; i < 3; i++){
+		step();
+	}
+	long steps = 0;
+	const auto allocsBefore = bench::allocationCount();
+	const auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed(0.0);
+	//check the clock every few steps so tiny kernels aren't timing the timer
+	long chunk = 1;
+	while(elapsed.count() < minTime){
+		for(long i = 0; i < chunk; i++){
+			step();
+		}
+		steps += chunk;
+		elapsed = std::chrono::steady_clock::now() - start;
+		if(elapsed.count() < minTime / 16){
+			chunk *= 2;
+		}
+	}
+	const auto allocs = bench::allocationCount() - allocsBefore;
+	return Result{elapsed.count() / steps, static_cast<double>(allocs) / steps};
+}
+
+class JsonWriter
+{
+	std::ostream& os;
+
+	bool first = true;
+
+public:
+
+	explicit JsonWriter(std::ostream& _os)
+		: os(_os)
+	{
+		os << "{\n  \"context\": {\"threads_available\": " << std::thread::hardware_concurrency()
+		   << ", \"eigen_simd\": \"" << Eigen::SimdInstructionSetsInUse() << "\"},\n"
+		   << "  \"benchmarks\": [";
+	};
+
+	~JsonWriter()
+	{
+		os << "\n  ]\n}\n";
+	}
+
+	void record(const std::string& name, NN::int_t width, NN::int_t batch,
+		    const std::string& activation, int threads, double flopsPerStep, const Result& r)
+	{
+		os << (first ? "\n" : ",\n");
+		first = false;
+		os << "    {\"name\": \"" << name << "\", \"width\": " << width
+		   << ", \"batch\": " << batch << ", \"activation\": \"" << activation
+		   << "\", \"threads\": " << threads
+		   << ", \"ns_per_step\": " << r.secondsPerStep * 1e9
+		   << ", \"samples_per_sec\": " << batch / r.secondsPerStep
+		   << ", \"gflops\": " << flopsPerStep / r.secondsPerStep * 1e-9
+		   << ", \"allocations_per_step\": " << r.allocationsPerStep << "}";
+		os.flush();
+	}
+};
+
+void benchLayer(JsonWriter& json, const Options& opts, NN::int_t width, NN::int_t batch,
+		const std::string& activation, int threads)
+{
+	Mat x = Mat::Random(batch, width);
+	Mat delta = Mat::Random(batch, width);
+	NN::Layer layer(std::make_pair(batch, width), width, activation);
+	layer.setNumThreads(threads);
+	Eigen::setNbThreads(threads);
+	layer.setUpdateParams(1.0e-6, 0.9);
+	layer.forwardPass(x);
+	layer.backwardPass(delta);
+
+	const double gemmFlops = 2.0 * batch * (width + 1) * width;
+
+	json.record("layer_forward", width, batch, activation, threads, gemmFlops,
+		    measure([&]{ layer.forwardPass(x); }, opts.minTime));
+
+	json.record("layer_backward", width, batch, activation, threads, gemmFlops,
+		    measure([&]{ layer.backwardPass(delta); }, opts.minTime));
+
+	//u = m u - lr g; w += u
+	json.record("layer_update", width, batch, activation, threads, 4.0 * (width + 1) * width,
+		    measure([&]{ layer.updateWeights(); }, opts.minTime));
+}
+
+void benchNetwork(JsonWriter& json, const Options& opts, NN::int_t width, NN::int_t batch,
+		  const std::string& activation, int threads)
+{
+	Mat x = Mat::Random(batch, width);
+	Mat y = Mat::Random(batch, 1);
+	NN::Layer l1(std::make_pair(batch, width), width, activation);
+	NN::Layer l2(std::make_pair(batch, width), width, activation);
+	NN::Layer l3(std::make_pair(batch, width), 1, "linear");
+	NN::Network net(activation, "L2", {l1, l2, l3});
+	net.setActivations(std::list<std::string>{activation, activation, "linear"});
+	net.setUpdateParams(1.0e-9, 0.0);
+	net.setNumThreads(threads);
+
+	//per layer, GEMMs of 2 (in+1) out flops per sample
+	const double l12 = 2.0 * batch * (width + 1) * width;
+	const double l3f = 2.0 * batch * (width + 1);
+	const double forwardFlops = 2 * l12 + l3f;
+	//forward, every layer's gradient, and the errors of layers 1 and 2
+	const double trainFlops = 2 * forwardFlops + l12 + l3f;
+
+	json.record("network_predict", width, batch, activation, threads, forwardFlops,
+		    measure([&]{ net.predictBatch(x); }, opts.minTime));
+
+	json.record("network_train_step", width, batch, activation, threads, trainFlops,
+		    measure([&]{ net.trainStep(x, y); }, opts.minTime));
+
+	const NN::InferenceModel model(net);
+	Mat out(batch, 1);
+	json.record("inference_predict", width, batch, activation, threads, forwardFlops,
+		    measure([&]{ model.predict(x, out); }, opts.minTime));
+}
+
+int main(int argc, char** argv){
+	const Options opts = parseOptions(argc, argv);
+
+	std::ofstream file;
+	if(not opts.out.empty()){
+		file.open(opts.out);
+	}
+	std::ostream& os = opts.out.empty() ? std::cout : file;
+
+	{
+		JsonWriter json(os);
+		for(int threads : opts.threads){
+			for(const auto& activation : opts.activations){
+				for(NN::int_t width : opts.widths){
+					for(NN::int_t batch : opts.batches){
+						benchLayer(json, opts, width, batch, activation, threads);
+						benchNetwork(json, opts, width, batch, activation, threads);
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
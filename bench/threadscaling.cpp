@@ -0,0 +1,57 @@
+#include "../include/Network.hpp"
+#include "../include/Layer.hpp"
+#include <Eigen/Core>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+/*
+ * training-step throughput of a narrow 64-64-64-1 network on one large batch,
+ * for 1..maxThreads threads in each Parallelism mode. Usage:
+ *   scaling [maxThreads] [batchRows]
+ * */
+
+using Mat = NN::Mat;
+
+double samplesPerSecond(NN::Network& net, const Mat& x, const Mat& y, int steps)
+{
+	net.trainStep(x, y);
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < steps; i++){
+		net.trainStep(x, y);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return steps * x.rows() / elapsed.count();
+}
+
+int main(int argc, char** argv){
+	int maxThreads = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+	NN::int_t rows = argc > 2 ? std::atol(argv[2]) : 8192;
+	const int steps = 20;
+
+	Mat x = Mat::Random(rows, 64);
+	Mat y = Mat::Random(rows, 1);
+
+	NN::Layer l1(std::make_pair(rows, 64), 64, "relu");
+	NN::Layer l2(std::make_pair(rows, 64), 64, "relu");
+	NN::Layer l3(std::make_pair(rows, 64), 1, "linear");
+
+	std::cout << "mode   threads  samples/s     speedup\n";
+	for(auto mode : {NN::Parallelism::Gemm, NN::Parallelism::Batch}){
+		double base = 0.0;
+		for(int t = 1; t <= maxThreads; t *= 2){
+			NN::Network net("relu", "L2", {l1, l2, l3});
+			net.setActivations(std::list<std::string>{"relu", "relu", "linear"});
+			net.setUpdateParams(1.0e-6, 0.0);
+			net.setNumThreads(t, mode);
+			double rate = samplesPerSecond(net, x, y, steps);
+			if(t == 1){
+				base = rate;
+			}
+			std::cout << (mode == NN::Parallelism::Gemm ? "gemm   " : "batch  ") << t
+				  << "        " << rate << "     " << rate / base << '\n';
+		}
+	}
+	return 0;
+}
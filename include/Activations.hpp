@@ -0,0 +1,400 @@
+#ifndef ACTIVATIONS_HPP
+#define ACTIVATIONS_HPP
+#include <Eigen/Core>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <string>
+#include <cmath>
+
+/*
+ * Activation kernels.
+ *
+ * Each activation is a tag type (Linear, Sigmoid, Tanh, Relu, Softplus) with
+ * static forward/backward kernels that work on whole matrices. The elementwise
+ * ops below carry packetOp()s, so Eigen vectorizes them instead of making one
+ * indirect call per element. Layers pick a kernel by name once (see
+ * activationKernel()), and the per-element work never goes through a
+ * std::function.
+ *
+ * With AVX2 (or AVX-512) the exponential is a range-reduced polynomial that
+ * builds 2^n directly in the exponent bits. Define DNN_EXACT_ACTIVATIONS to use
+ * Eigen's pexp instead.
+ * */
+
+namespace NN
+{
+  template<typename Scalar>
+  using RowMat = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+  namespace internal
+  {
+    using namespace Eigen::internal;
+
+    //2^n for integral-valued n in the normal exponent range
+    template<typename Packet>
+    EIGEN_STRONG_INLINE Packet pexp2int(const Packet& n)
+    {
+      return pldexp(pset1<Packet>(1), n);
+    }
+
+#ifdef EIGEN_VECTORIZE_AVX2
+    template<>
+    EIGEN_STRONG_INLINE Packet4d pexp2int<Packet4d>(const Packet4d& n)
+    {
+      const __m256i e = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+      return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(e, _mm256_set1_epi64x(1023)), 52));
+    }
+
+    template<>
+    EIGEN_STRONG_INLINE Packet8f pexp2int<Packet8f>(const Packet8f& n)
+    {
+      const __m256i e = _mm256_cvtps_epi32(n);
+      return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23));
+    }
+#endif
+
+#ifdef EIGEN_VECTORIZE_AVX512
+    template<>
+    EIGEN_STRONG_INLINE Packet8d pexp2int<Packet8d>(const Packet8d& n)
+    {
+      const __m512i e = _mm512_cvtepi32_epi64(_mm512_cvtpd_epi32(n));
+      return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_add_epi64(e, _mm512_set1_epi64(1023)), 52));
+    }
+
+    template<>
+    EIGEN_STRONG_INLINE Packet16f pexp2int<Packet16f>(const Packet16f& n)
+    {
+      const __m512i e = _mm512_cvtps_epi32(n);
+      return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(e, _mm512_set1_epi32(127)), 23));
+    }
+#endif
+
+    /*
+     * exp(x) = 2^n * exp(r), n = round(x/ln2), |r| <= ln2/2.
+     * exp(r) is a Taylor polynomial: degree 7 for float (~3e-9 truncation error)
+     * and degree 11 for double (~6e-15). Inputs are clamped so 2^n stays normal.
+     * */
+    template<typename Packet>
+    EIGEN_STRONG_INLINE Packet pfastexp(const Packet& _x)
+    {
+      using Scalar = typename unpacket_traits<Packet>::type;
+      constexpr bool isFloat = std::is_same<Scalar, float>::value;
+      const Packet bound = pset1<Packet>(isFloat ? Scalar(87.0) : Scalar(708.0));
+      const Packet x = pmax(pmin(_x, bound), pnegate(bound));
+
+      const Packet n = print(pmul(x, pset1<Packet>(Scalar(1.4426950408889634))));
+      Packet r = pmadd(n, pset1<Packet>(Scalar(-0.693145751953125)), x);
+      r = pmadd(n, pset1<Packet>(Scalar(-1.4286068203094172e-06)), r);
+
+      //1/k! for k = 11..0, Horner order
+      static constexpr Scalar coeffs[12] = {
+	Scalar(2.505210838544172e-08), Scalar(2.755731922398589e-07), Scalar(2.755731922398589e-06),
+	Scalar(2.48015873015873e-05), Scalar(1.984126984126984e-04), Scalar(1.388888888888889e-03),
+	Scalar(8.333333333333333e-03), Scalar(4.166666666666666e-02), Scalar(1.666666666666667e-01),
+	Scalar(0.5), Scalar(1.0), Scalar(1.0)
+      };
+      constexpr int first = isFloat ? 4 : 0;
+      Packet p = pset1<Packet>(coeffs[first]);
+      for(int k = first + 1; k < 12; ++k){
+	p = pmadd(p, r, pset1<Packet>(coeffs[k]));
+      }
+      return pmul(p, pexp2int(n));
+    }
+
+    template<typename Packet>
+    EIGEN_STRONG_INLINE Packet pactexp(const Packet& x)
+    {
+#ifdef DNN_EXACT_ACTIVATIONS
+      return pexp(x);
+#else
+      return pfastexp(x);
+#endif
+    }
+  }//end namespace internal
+
+  /*
+   * elementwise ops; operator() handles the unvectorized tail
+   * */
+  template<typename Scalar>
+  struct SigmoidOp
+  {
+    EIGEN_STRONG_INLINE Scalar operator()(const Scalar& x) const
+    {
+      return Scalar(1)/(Scalar(1) + std::exp(-x));
+    }
+
+    template<typename Packet>
+    EIGEN_STRONG_INLINE Packet packetOp(const Packet& x) const
+    {
+      using namespace internal;
+      const Packet one = pset1<Packet>(Scalar(1));
+      return pdiv(one, padd(one, pactexp(pnegate(x))));
+    }
+  };
+
+  //tanh(x) = 1 - 2/(exp(2x) + 1)
+  template<typename Scalar>
+  struct TanhOp
+  {
+    EIGEN_STRONG_INLINE Scalar operator()(const Scalar& x) const
+    {
+      return std::tanh(x);
+    }
+
+    template<typename Packet>
+    EIGEN_STRONG_INLINE Packet packetOp(const Packet& x) const
+    {
+      using namespace internal;
+      const Packet one = pset1<Packet>(Scalar(1));
+      const Packet two = pset1<Packet>(Scalar(2));
+      return psub(one, pdiv(two, padd(pactexp(pmul(two, x)), one)));
+    }
+  };
+
+  template<typename Scalar>
+  struct ReluOp
+  {
+    EIGEN_STRONG_INLINE Scalar operator()(const Scalar& x) const
+    {
+      return x > Scalar(0) ? x : Scalar(0);
+    }
+
+    template<typename Packet>
+    EIGEN_STRONG_INLINE Packet packetOp(const Packet& x) const
+    {
+      return internal::pmax(x, internal::pset1<Packet>(Scalar(0)));
+    }
+  };
+
+  //log(1 + exp(x)) = max(x,0) + log(1 + exp(-|x|)), which does not overflow
+  template<typename Scalar>
+  struct SoftplusOp
+  {
+    EIGEN_STRONG_INLINE Scalar operator()(const Scalar& x) const
+    {
+      return std::max(x, Scalar(0)) + std::log1p(std::exp(-std::abs(x)));
+    }
+
+    template<typename Packet>
+    EIGEN_STRONG_INLINE Packet packetOp(const Packet& x) const
+    {
+      using namespace internal;
+      const Packet one = pset1<Packet>(Scalar(1));
+      const Packet zero = pset1<Packet>(Scalar(0));
+      return padd(pmax(x, zero), plog(padd(one, pactexp(pnegate(pabs(x))))));
+    }
+  };
+
+  //(delta, preactivation) -> delta if preactivation > 0 else 0
+  template<typename Scalar>
+  struct ReluGradOp
+  {
+    EIGEN_STRONG_INLINE Scalar operator()(const Scalar& delta, const Scalar& x) const
+    {
+      return x > Scalar(0) ? delta : Scalar(0);
+    }
+
+    template<typename Packet>
+    EIGEN_STRONG_INLINE Packet packetOp(const Packet& delta, const Packet& x) const
+    {
+      using namespace internal;
+      return pand(delta, pcmp_lt(pset1<Packet>(Scalar(0)), x));
+    }
+  };
+
+  /*
+   * Activation tags. forward() maps preactivations to outputs (post may alias
+   * pre); backward() multiplies delta in place by the derivative of the
+   * activation, evaluated from the preactivations and/or outputs.
+   * */
+  struct Linear
+  {
+    static constexpr const char* name = "linear";
+
+    template<typename Scalar>
+    static void forward(Eigen::Ref<const RowMat<Scalar>> pre, Eigen::Ref<RowMat<Scalar>> post)
+    {
+      post = pre;
+    }
+
+    template<typename Scalar>
+    static void backward(Eigen::Ref<const RowMat<Scalar>>, Eigen::Ref<const RowMat<Scalar>>,
+			 Eigen::Ref<RowMat<Scalar>>)
+    {
+    }
+  };
+
+  struct Sigmoid
+  {
+    static constexpr const char* name = "sigmoid";
+
+    template<typename Scalar>
+    static void forward(Eigen::Ref<const RowMat<Scalar>> pre, Eigen::Ref<RowMat<Scalar>> post)
+    {
+      post = pre.unaryExpr(SigmoidOp<Scalar>());
+    }
+
+    template<typename Scalar>
+    static void backward(Eigen::Ref<const RowMat<Scalar>>, Eigen::Ref<const RowMat<Scalar>> post,
+			 Eigen::Ref<RowMat<Scalar>> delta)
+    {
+      delta.array() *= post.array() * (Scalar(1) - post.array());
+    }
+  };
+
+  struct Tanh
+  {
+    static constexpr const char* name = "tanh";
+
+    template<typename Scalar>
+    static void forward(Eigen::Ref<const RowMat<Scalar>> pre, Eigen::Ref<RowMat<Scalar>> post)
+    {
+      post = pre.unaryExpr(TanhOp<Scalar>());
+    }
+
+    template<typename Scalar>
+    static void backward(Eigen::Ref<const RowMat<Scalar>>, Eigen::Ref<const RowMat<Scalar>> post,
+			 Eigen::Ref<RowMat<Scalar>> delta)
+    {
+      delta.array() *= Scalar(1) - post.array().square();
+    }
+  };
+
+  struct Relu
+  {
+    static constexpr const char* name = "relu";
+
+    template<typename Scalar>
+    static void forward(Eigen::Ref<const RowMat<Scalar>> pre, Eigen::Ref<RowMat<Scalar>> post)
+    {
+      post = pre.unaryExpr(ReluOp<Scalar>());
+    }
+
+    template<typename Scalar>
+    static void backward(Eigen::Ref<const RowMat<Scalar>> pre, Eigen::Ref<const RowMat<Scalar>>,
+			 Eigen::Ref<RowMat<Scalar>> delta)
+    {
+      delta = delta.binaryExpr(pre, ReluGradOp<Scalar>());
+    }
+  };
+
+  struct Softplus
+  {
+    static constexpr const char* name = "softplus";
+
+    template<typename Scalar>
+    static void forward(Eigen::Ref<const RowMat<Scalar>> pre, Eigen::Ref<RowMat<Scalar>> post)
+    {
+      post = pre.unaryExpr(SoftplusOp<Scalar>());
+    }
+
+    //d/dx softplus(x) = sigmoid(x)
+    template<typename Scalar>
+    static void backward(Eigen::Ref<const RowMat<Scalar>> pre, Eigen::Ref<const RowMat<Scalar>>,
+			 Eigen::Ref<RowMat<Scalar>> delta)
+    {
+      delta.array() *= pre.unaryExpr(SigmoidOp<Scalar>()).array();
+    }
+  };
+
+  /*
+   * Runtime handle to a pair of whole-matrix kernels. A Layer resolves its
+   * kernel once (by name, or by wrapping a user-supplied elementwise function),
+   * so dispatch costs one call per layer per pass.
+   * */
+  template<typename Scalar>
+  struct ActivationKernel
+  {
+    using MatType = RowMat<Scalar>;
+    using ConstRef = Eigen::Ref<const MatType>;
+    using Ref = Eigen::Ref<MatType>;
+
+    std::string name;
+
+    std::function<void(ConstRef, Ref)> forward;
+
+    std::function<void(ConstRef, ConstRef, Ref)> backward;
+  };
+
+  template<typename Tag, typename Scalar>
+  ActivationKernel<Scalar> makeActivationKernel()
+  {
+    return {Tag::name, &Tag::template forward<Scalar>, &Tag::template backward<Scalar>};
+  }
+
+  template<typename Scalar>
+  ActivationKernel<Scalar> activationKernel(const std::string& name)
+  {
+    if(name == Linear::name){
+      return makeActivationKernel<Linear, Scalar>();
+    } else if(name == Sigmoid::name){
+      return makeActivationKernel<Sigmoid, Scalar>();
+    } else if(name == Tanh::name){
+      return makeActivationKernel<Tanh, Scalar>();
+    } else if(name == Relu::name){
+      return makeActivationKernel<Relu, Scalar>();
+    } else if(name == Softplus::name){
+      return makeActivationKernel<Softplus, Scalar>();
+    }
+    throw "Error: unknown activation name.";
+  }
+
+  /*
+   * wraps an elementwise activation and a derivative taking (preactivation, output)
+   * pairs. This is the slow path: the activation is called once per element.
+   * */
+  template<typename Scalar>
+  ActivationKernel<Scalar>
+  customActivationKernel(const std::function<Scalar(Scalar)>& act,
+			 const std::function<RowMat<Scalar>(std::pair<Eigen::Ref<const RowMat<Scalar>>,
+								       Eigen::Ref<const RowMat<Scalar>>>)>& act_grad)
+  {
+    using ConstRef = typename ActivationKernel<Scalar>::ConstRef;
+    using Ref = typename ActivationKernel<Scalar>::Ref;
+    return {"custom",
+	    [act](ConstRef pre, Ref post){ post = pre.unaryExpr(act); },
+	    [act_grad](ConstRef pre, ConstRef post, Ref delta){
+	      delta.array() *= act_grad(std::make_pair(pre, post)).array();
+	    }};
+  }
+
+}//end namespace NN
+
+namespace Eigen
+{
+  namespace internal
+  {
+    template<typename Scalar>
+    struct functor_traits<NN::SigmoidOp<Scalar>>
+    {
+      enum { Cost = 8 * NumTraits<Scalar>::MulCost, PacketAccess = packet_traits<Scalar>::HasDiv };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<NN::TanhOp<Scalar>>
+    {
+      enum { Cost = 8 * NumTraits<Scalar>::MulCost, PacketAccess = packet_traits<Scalar>::HasDiv };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<NN::ReluOp<Scalar>>
+    {
+      enum { Cost = NumTraits<Scalar>::AddCost, PacketAccess = packet_traits<Scalar>::HasMax };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<NN::SoftplusOp<Scalar>>
+    {
+      enum { Cost = 12 * NumTraits<Scalar>::MulCost,
+	     PacketAccess = packet_traits<Scalar>::HasLog && packet_traits<Scalar>::HasAbs };
+    };
+
+    template<typename Scalar>
+    struct functor_traits<NN::ReluGradOp<Scalar>>
+    {
+      enum { Cost = NumTraits<Scalar>::AddCost, PacketAccess = packet_traits<Scalar>::HasCmp };
+    };
+  }
+}
+#endif //ACTIVATIONS_HPP
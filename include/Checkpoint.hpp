@@ -0,0 +1,235 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "Layer.hpp"
+#include "Network.hpp"
+#include <Eigen/Core>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Binary checkpoints.
+ *
+ * Layout (native byte order, every offset from the start of the file):
+ *
+ *   CheckpointHeader                         64 bytes
+ *   CheckpointLayerRecord x numLayers        192 bytes each
+ *   per layer: weights, optimizer state      row-major (inputs+1) x outputs,
+ *                                            each starting on a 64-byte boundary;
+ *                                            the second state buffer only for
+ *                                            rules that use one
+ *   loss history                             numLoss doubles, 64-byte aligned
+ *
+ * Because every tensor is 64-byte aligned and stored exactly as a RowMat, a
+ * memory-mapped file can be used in place through Eigen::Map.
+ * */
+
+namespace NN
+{
+  constexpr char CHECKPOINT_MAGIC[8] = {'D','N','N','C','K','P','T','\0'};
+
+  //2 added the optimizer rule, its hyperparameters and second state buffer
+  constexpr uint32_t CHECKPOINT_VERSION = 2;
+
+  constexpr uint64_t CHECKPOINT_ALIGNMENT = 64;
+
+  struct CheckpointHeader
+  {
+    char magic[8];
+
+    uint32_t version;
+
+    //sizeof(Scalar) of the stored tensors
+    uint32_t scalarBytes;
+
+    uint64_t numLayers;
+
+    uint64_t numLoss;
+
+    uint64_t lossOffset;
+
+    uint64_t fileBytes;
+
+    uint8_t reserved[16];
+  };
+
+  struct CheckpointLayerRecord
+  {
+    int64_t batchRows;
+
+    int64_t inputSize;
+
+    int64_t outputSize;
+
+    char activation[32];
+
+    double learningRate;
+
+    double momentum;
+
+    //UpdateRule
+    uint32_t updateRule;
+
+    uint32_t reserved0;
+
+    uint64_t weightsOffset;
+
+    uint64_t weightUpdateOffset;
+
+    //0 when the rule keeps no second state buffer
+    uint64_t secondMomentOffset;
+
+    int64_t updateStep;
+
+    double beta2;
+
+    double epsilon;
+
+    double weightDecay;
+
+    uint8_t reserved[56];
+  };
+
+  static_assert(sizeof(CheckpointHeader) == 64, "checkpoint header must be 64 bytes");
+  static_assert(sizeof(CheckpointLayerRecord) == 192, "checkpoint layer record must be 192 bytes");
+
+  /*
+   * writes net's layers, weights, optimizer state and loss history to
+   * path.tmp and renames it over path once it is on disk, so a process
+   * that has path mapped keeps reading the old, complete file
+   * */
+  template<typename Scalar>
+  void saveCheckpoint(const BasicNetwork<Scalar>& net, const std::string& path);
+
+  //replaces net's layers (and loss history) with the ones stored in path
+  template<typename Scalar>
+  void loadCheckpoint(BasicNetwork<Scalar>& net, const std::string& path);
+
+
+  /*
+   * A checkpoint mapped read-only into memory. weights() are views straight
+   * into the mapping, so opening a checkpoint costs an mmap and a header
+   * check, and the pages are shared between processes mapping the same file.
+   * */
+  template<typename Scalar>
+  class BasicMappedCheckpoint
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using MatRef = Eigen::Ref<Mat>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+    using WeightMap = Eigen::Map<const Mat, Eigen::Aligned64>;
+
+  protected:
+
+    const unsigned char* base = nullptr;
+
+    size_t length = 0;
+
+    const CheckpointHeader* header = nullptr;
+
+    const CheckpointLayerRecord* records = nullptr;
+
+    std::vector<ActivationKernel<Scalar>> activations;
+
+    //ping-pong buffers for predict()
+    Mat scratch[2];
+
+    void unmap() noexcept;
+
+  public:
+
+    explicit BasicMappedCheckpoint(const std::string& path);
+
+    ~BasicMappedCheckpoint();
+
+    BasicMappedCheckpoint(const BasicMappedCheckpoint&) = delete;
+
+    BasicMappedCheckpoint& operator=(const BasicMappedCheckpoint&) = delete;
+
+    BasicMappedCheckpoint(BasicMappedCheckpoint&& other) noexcept;
+
+    BasicMappedCheckpoint& operator=(BasicMappedCheckpoint&& other) noexcept;
+
+    int_t numLayers() const noexcept
+    {
+      return header->numLayers;
+    }
+
+    const CheckpointLayerRecord& layerRecord(int_t layer) const noexcept
+    {
+      return records[layer];
+    }
+
+    //(inputs+1) x outputs, bias in the last row
+    WeightMap weights(int_t layer) const noexcept
+    {
+      const auto& r = records[layer];
+      return WeightMap(reinterpret_cast<const Scalar*>(base + r.weightsOffset),
+		       r.inputSize + 1, r.outputSize);
+    }
+
+    WeightMap weightUpdate(int_t layer) const noexcept
+    {
+      const auto& r = records[layer];
+      return WeightMap(reinterpret_cast<const Scalar*>(base + r.weightUpdateOffset),
+		       r.inputSize + 1, r.outputSize);
+    }
+
+    //empty when the layer's rule keeps no second state buffer
+    WeightMap secondMoment(int_t layer) const noexcept
+    {
+      const auto& r = records[layer];
+      if(r.secondMomentOffset == 0){
+	return WeightMap(nullptr, 0, 0);
+      }
+      return WeightMap(reinterpret_cast<const Scalar*>(base + r.secondMomentOffset),
+		       r.inputSize + 1, r.outputSize);
+    }
+
+    OptimizerParams optimizer(int_t layer) const noexcept
+    {
+      const auto& r = records[layer];
+      return {static_cast<UpdateRule>(r.updateRule), r.learningRate, r.momentum,
+	      r.beta2, r.epsilon, r.weightDecay};
+    }
+
+    const ActivationKernel<Scalar>& activation(int_t layer) const noexcept
+    {
+      return activations[layer];
+    }
+
+    Eigen::Map<const Eigen::VectorXd> lossHistory() const noexcept
+    {
+      return Eigen::Map<const Eigen::VectorXd>(reinterpret_cast<const double*>(base + header->lossOffset),
+					       header->numLoss);
+    }
+
+    int_t numOutputs() const noexcept
+    {
+      return records[header->numLayers - 1].outputSize;
+    }
+
+    /*
+     * runs batch through the stored layers into out (batch.rows() x
+     * numOutputs()) using the mapped weights. Reuses internal scratch
+     * buffers, so one checkpoint object should not predict on two threads.
+     * */
+    void predict(ConstMatRef batch, MatRef out);
+  };
+
+  using MappedCheckpoint = BasicMappedCheckpoint<double>;
+
+  using MappedCheckpointf = BasicMappedCheckpoint<float>;
+
+  extern template class BasicMappedCheckpoint<double>;
+
+  extern template class BasicMappedCheckpoint<float>;
+
+}//end namespace NN
+#endif //CHECKPOINT_HPP
@@ -0,0 +1,175 @@
+#ifndef CONV_HPP
+#define CONV_HPP
+
+#include "Activations.hpp"
+#include "Profiler.hpp"
+#include "ScratchArena.hpp"
+#include <Eigen/Core>
+#include <cstdint>
+
+/*
+ * Convolution and pooling over NHWC samples.
+ *
+ * A sample is still one row of the batch matrix: its height x width x
+ * channels values with the channels fastest, so a layer's output row is the
+ * next layer's input row and convolutional layers chain with dense ones in
+ * a Network. One-dimensional signals have height 1.
+ *
+ * A convolution is a dense layer applied to every patch of its input. Its
+ * weights are (kernelH * kernelW * channels + 1) x filters, bias in the last
+ * row like a dense layer's, with the patch entries ordered (ky, kx, c). The
+ * patches of a block of output positions are copied into scratch (im2col)
+ * and multiplied by the weights with the packed GEMM, so the output comes
+ * out NHWC without a transpose. Blocks are sized to keep the patches in
+ * cache, and the backward pass reuses the same blocking.
+ *
+ * Pooling layers have no weights. Padded positions are skipped: a max pool
+ * never picks them and an average pool divides by the positions it covers.
+ * */
+
+namespace NN
+{
+  //what a BasicLayer computes; the normalizations are in Normalization.hpp
+  enum class LayerKind
+    {
+     Dense,
+     Conv,
+     MaxPool,
+     AvgPool,
+     BatchNorm,
+     LayerNorm
+    };
+
+  //one sample's dimensions
+  struct SpatialShape
+  {
+    int_fast64_t height = 1;
+
+    int_fast64_t width = 1;
+
+    int_fast64_t channels = 1;
+
+    int_fast64_t size() const noexcept
+    {
+      return height * width * channels;
+    }
+  };
+
+  //the geometry of a convolution or pooling layer
+  struct ConvSpec
+  {
+    LayerKind kind = LayerKind::Conv;
+
+    SpatialShape input;
+
+    //output channels of a convolution; a pool keeps its input's
+    int_fast64_t filters = 1;
+
+    int_fast64_t kernelH = 1;
+
+    int_fast64_t kernelW = 1;
+
+    int_fast64_t strideH = 1;
+
+    int_fast64_t strideW = 1;
+
+    //zeros on each side
+    int_fast64_t padH = 0;
+
+    int_fast64_t padW = 0;
+
+    SpatialShape output() const noexcept
+    {
+      return {(input.height + 2 * padH - kernelH) / strideH + 1, (input.width + 2 * padW - kernelW) / strideW + 1,
+	      kind == LayerKind::Conv ? filters : input.channels};
+    }
+
+    //entries of one patch: the rows of a convolution's weights, bias excluded
+    int_fast64_t patchSize() const noexcept
+    {
+      return kernelH * kernelW * input.channels;
+    }
+
+    //throws on a geometry that gives no output or pools only padding
+    void validate() const;
+  };
+
+  inline ConvSpec conv2d(SpatialShape input, int_fast64_t filters, int_fast64_t kernel, int_fast64_t stride=1,
+			 int_fast64_t padding=0)
+  {
+    return {LayerKind::Conv, input, filters, kernel, kernel, stride, stride, padding, padding};
+  }
+
+  inline ConvSpec conv1d(int_fast64_t length, int_fast64_t channels, int_fast64_t filters, int_fast64_t kernel,
+			 int_fast64_t stride=1, int_fast64_t padding=0)
+  {
+    return {LayerKind::Conv, {1, length, channels}, filters, 1, kernel, 1, stride, 0, padding};
+  }
+
+  //stride 0 means non-overlapping windows
+  inline ConvSpec maxPool2d(SpatialShape input, int_fast64_t window, int_fast64_t stride=0)
+  {
+    stride = stride ? stride : window;
+    return {LayerKind::MaxPool, input, input.channels, window, window, stride, stride, 0, 0};
+  }
+
+  inline ConvSpec avgPool2d(SpatialShape input, int_fast64_t window, int_fast64_t stride=0)
+  {
+    stride = stride ? stride : window;
+    return {LayerKind::AvgPool, input, input.channels, window, window, stride, stride, 0, 0};
+  }
+
+  inline ConvSpec maxPool1d(int_fast64_t length, int_fast64_t channels, int_fast64_t window, int_fast64_t stride=0)
+  {
+    return {LayerKind::MaxPool, {1, length, channels}, channels, 1, window, 1, stride ? stride : window, 0, 0};
+  }
+
+  inline ConvSpec avgPool1d(int_fast64_t length, int_fast64_t channels, int_fast64_t window, int_fast64_t stride=0)
+  {
+    return {LayerKind::AvgPool, {1, length, channels}, channels, 1, window, 1, stride ? stride : window, 0, 0};
+  }
+
+  /*
+   * out = activation(conv or pool of x), the counterpart of denseForward
+   * for the layer spec describes; weights are ignored by pools. preact must
+   * be contiguous. Rows are split among numThreads threads if splitRows.
+   * */
+  template<typename Scalar>
+  void spatialForward(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> weights,
+		      const ConvSpec& spec, const ActivationKernel<Scalar>& activation,
+		      Eigen::Ref<RowMat<Scalar>> preact, Eigen::Ref<RowMat<Scalar>> out,
+		      int numThreads=1, bool splitRows=false, LayerProfile* profile=nullptr,
+		      ScratchArena* scratch=nullptr);
+
+
+  namespace internal
+  {
+    //patch rows of the output positions [firstPos, firstPos + count) of the batch x
+    template<typename Scalar>
+    void im2col(Eigen::Ref<const RowMat<Scalar>> x, const ConvSpec& spec, int_fast64_t firstPos,
+		int_fast64_t count, Scalar* patches) noexcept;
+
+    //the adjoint of im2col: adds each patch entry back onto the input it came from
+    template<typename Scalar>
+    void col2imAccumulate(const Scalar* patches, const ConvSpec& spec, int_fast64_t firstPos,
+			  int_fast64_t count, Eigen::Ref<RowMat<Scalar>> dx) noexcept;
+
+    //grad += d(conv)/d(weights) for the errors e (contiguous) of the outputs of x
+    template<typename Scalar>
+    void convGradient(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> e,
+		      const ConvSpec& spec, Eigen::Ref<RowMat<Scalar>> grad, ScratchArena& scratch);
+
+    //dx += the error e (contiguous) sent back through a convolution
+    template<typename Scalar>
+    void convBackwardData(Eigen::Ref<const RowMat<Scalar>> e, Eigen::Ref<const RowMat<Scalar>> weights,
+			  const ConvSpec& spec, Eigen::Ref<RowMat<Scalar>> dx, ScratchArena& scratch);
+
+    //dx += the error e sent back through a pool that took x to pooled
+    template<typename Scalar>
+    void poolBackwardData(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> pooled,
+			  Eigen::Ref<const RowMat<Scalar>> e, const ConvSpec& spec,
+			  Eigen::Ref<RowMat<Scalar>> dx) noexcept;
+
+  }//end namespace internal
+}//end namespace NN
+#endif //CONV_HPP
@@ -0,0 +1,100 @@
+#ifndef DATA_PARALLEL_HPP
+#define DATA_PARALLEL_HPP
+
+#include "Layer.hpp"
+#include "LayerGraph.hpp"
+#include "Network.hpp"
+#include "ParameterArena.hpp"
+#include <Eigen/Core>
+#include <list>
+#include <memory>
+#include <vector>
+
+namespace NN
+{
+  /*
+   * Data-parallel training of one network on several threads.
+   *
+   * Each thread owns a replica of the network's layers: its own activation,
+   * error and gradient buffers, but weights that are views into the
+   * network's arena, so there is one copy of the weights and nothing to
+   * broadcast after an update. A step shards the batch by rows, runs each
+   * shard's forward and backward pass on its own replica, then sums the
+   * replicas' Gradients regions into the network's. The sum is split by
+   * 64-byte lines of the region, so each thread adds up its own slice of
+   * every replica with no locks, in a fixed order. One fused
+   * updateWeights() on the network follows.
+   *
+   * Gradients and losses are summed over the whole batch, as in
+   * Network::trainStep. The exception is a batch norm: each replica
+   * normalizes its shard with the shard's own statistics (a ghost batch
+   * norm), so its gradients are not the single-threaded ones; only the
+   * running statistics are averaged over the replicas after each step. The
+   * replicas point into the network's arena, so call sync() after anything
+   * that recompiles the network.
+   * */
+  template<typename Scalar>
+  class BasicDataParallel
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+    using Layer = BasicLayer<Scalar>;
+
+  protected:
+
+    struct Replica
+    {
+      std::list<Layer> layers;
+
+      BasicLayerGraph<Scalar> graph;
+
+      //only the Gradients region is written; the weights are the network's
+      BasicParameterArena<Scalar> arena;
+
+      //dL/d(outputs) for the shard
+      Mat lossGrad;
+
+      double loss = 0;
+    };
+
+    BasicNetwork<Scalar>& net;
+
+    int numThreads;
+
+    std::vector<std::unique_ptr<Replica>> replicas;
+
+  public:
+
+    BasicDataParallel(BasicNetwork<Scalar>& _net, int _numThreads);
+
+    auto getNumThreads() const noexcept
+    {
+      return numThreads;
+    }
+
+    //rebuilds the replicas from the network's current layers
+    void sync();
+
+    /*
+     * one gradient step on a batch split across the threads, with the same
+     * meaning and checks as Network::trainStep but for batch norms, which
+     * see only their shard. Returns the batch loss, which is also appended
+     * to the network's loss history.
+     * */
+    double trainStep(ConstMatRef batchInputs, ConstMatRef batchTargets);
+  };
+
+  using DataParallel = BasicDataParallel<double>;
+
+  using DataParallelf = BasicDataParallel<float>;
+
+  extern template class BasicDataParallel<double>;
+
+  extern template class BasicDataParallel<float>;
+
+}//end namespace NN
+#endif //DATA_PARALLEL_HPP
@@ -0,0 +1,234 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include "Network.hpp"
+#include "ParameterArena.hpp"
+#include <Eigen/Core>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace NN
+{
+  /*
+   * A ring of processes on one machine, linked by Unix-domain stream
+   * sockets: each rank sends to rank+1 and receives from rank-1. Sockets
+   * rather than shared memory so that the same ring can later run over TCP
+   * between nodes.
+   *
+   * launch() forks the ranks and hands each its end of the ring. Processes
+   * started separately (one per NUMA node under numactl, say) meet through
+   * socket files instead, with the (prefix, rank, size) constructor.
+   *
+   * Every collective must be called by all ranks in the same order.
+   * */
+  class ProcessGroup
+  {
+  protected:
+
+    int rank = 0;
+
+    int size = 1;
+
+    //receives from rank-1
+    int leftFd = -1;
+
+    //sends to rank+1
+    int rightFd = -1;
+
+    //one incoming chunk of an all-reduce
+    std::vector<char> scratch;
+
+    //sends and receives at once, so neither side of a link blocks the other
+    void exchange(const void* sendData, size_t sendBytes, void* recvData, size_t recvBytes);
+
+    void closeLinks() noexcept;
+
+  public:
+
+    ProcessGroup() = default;
+
+    ProcessGroup(int _rank, int _size, int _leftFd, int _rightFd)
+      : rank(_rank),
+	size(_size),
+	leftFd(_leftFd),
+	rightFd(_rightFd)
+    {
+    };
+
+    /*
+     * joins a ring of size processes started separately: rank r listens on
+     * socketPrefix.r and connects to socketPrefix.(r+1), waiting up to
+     * timeoutSeconds for it to appear
+     * */
+    ProcessGroup(const std::string& socketPrefix, int _rank, int _size, double timeoutSeconds=30);
+
+    ProcessGroup(const ProcessGroup&) = delete;
+
+    ProcessGroup& operator=(const ProcessGroup&) = delete;
+
+    ProcessGroup(ProcessGroup&& other) noexcept
+      : rank(other.rank),
+	size(other.size),
+	leftFd(std::exchange(other.leftFd, -1)),
+	rightFd(std::exchange(other.rightFd, -1)),
+	scratch(std::move(other.scratch))
+    {
+    };
+
+    ProcessGroup& operator=(ProcessGroup&& other) noexcept;
+
+    ~ProcessGroup()
+    {
+      closeLinks();
+    }
+
+    /*
+     * forks worldSize - 1 children and runs body on every rank, rank 0 in
+     * the calling process. A child exits with body's return value, or 1 if
+     * it throws. Returns 0 when every rank returned 0, else the first
+     * non-zero status. Call it before any OpenMP region has run: forked
+     * children don't inherit a working thread pool.
+     * */
+    static int launch(int worldSize, const std::function<int(ProcessGroup&)>& body);
+
+    int getRank() const noexcept
+    {
+      return rank;
+    }
+
+    int getSize() const noexcept
+    {
+      return size;
+    }
+
+    //sums data over all ranks in place, by a ring reduce-scatter and all-gather
+    template<typename Scalar>
+    void allReduce(Scalar* data, size_t n);
+
+    //copies root's bytes to every other rank
+    void broadcast(void* data, size_t bytes, int root=0);
+
+    void barrier();
+  };
+
+  extern template void ProcessGroup::allReduce(double*, size_t);
+
+  extern template void ProcessGroup::allReduce(float*, size_t);
+
+
+  /*
+   * Data-parallel training of one network replica per process. Each rank
+   * calls trainStep on its own shard of the global batch; the Gradients
+   * regions are summed over the ring, so every rank takes the same step the
+   * whole batch would have given one process.
+   *
+   * The reduction overlaps the backward pass. The Gradients region is cut
+   * into buckets of whole layers, last layers first, and a communication
+   * thread all-reduces each bucket as soon as backward has finished its
+   * layers, while the earlier layers are still running. Bucket boundaries
+   * depend only on the layer shapes, so every rank reduces the same
+   * segments in the same order.
+   *
+   * A batch norm sends back error from its own copy of its gradient sums
+   * (see BasicLayer::normErrSums), so reducing a bucket never changes what
+   * an earlier layer's backward reads. Each rank normalizes with its own
+   * shard's statistics; the running statistics are averaged over the ranks
+   * after every step, so every rank keeps the same inference weights.
+   *
+   * Construction and sync() are collective, and copy rank 0's weights,
+   * optimizer state and running statistics to every rank.
+   * */
+  template<typename Scalar>
+  class BasicDistributedDataParallel
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+  protected:
+
+    BasicNetwork<Scalar>& net;
+
+    ProcessGroup& group;
+
+    size_t bucketBytes;
+
+    //[begin, end) of each bucket in the Gradients region, in reduction order
+    std::vector<std::pair<size_t, size_t>> buckets;
+
+    //the bucket a node completes, or -1
+    std::vector<int> bucketOfNode;
+
+    //the arena the buckets were made for
+    const Scalar* syncedWeights = nullptr;
+
+    std::thread worker;
+
+    std::mutex mtx;
+
+    std::condition_variable cv;
+
+    size_t postedBuckets = 0;
+
+    size_t reducedBuckets = 0;
+
+    bool stopping = false;
+
+    std::exception_ptr workerError;
+
+    //every batch norm's running statistics, back to back
+    std::vector<Scalar> runningStats;
+
+    void workerLoop();
+
+    //copies the batch norms' running statistics into runningStats
+    void gatherRunningStats();
+
+    //and back out to the layers
+    void scatterRunningStats();
+
+  public:
+
+    BasicDistributedDataParallel(BasicNetwork<Scalar>& _net, ProcessGroup& _group,
+				 size_t _bucketBytes=(1 << 18));
+
+    ~BasicDistributedDataParallel();
+
+    BasicDistributedDataParallel(const BasicDistributedDataParallel&) = delete;
+
+    BasicDistributedDataParallel& operator=(const BasicDistributedDataParallel&) = delete;
+
+    size_t numBuckets() const noexcept
+    {
+      return buckets.size();
+    }
+
+    //recuts the buckets after the network changes and re-broadcasts rank 0's parameters
+    void sync();
+
+    /*
+     * one gradient step on this rank's shard of the batch. Returns the loss
+     * summed over every rank's shard, which is also appended to the
+     * network's loss history.
+     * */
+    double trainStep(ConstMatRef batchInputs, ConstMatRef batchTargets);
+  };
+
+  using DistributedDataParallel = BasicDistributedDataParallel<double>;
+
+  using DistributedDataParallelf = BasicDistributedDataParallel<float>;
+
+  extern template class BasicDistributedDataParallel<double>;
+
+  extern template class BasicDistributedDataParallel<float>;
+
+}//end namespace NN
+#endif //DISTRIBUTED_HPP
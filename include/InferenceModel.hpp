@@ -0,0 +1,111 @@
+#ifndef INFERENCE_MODEL_HPP
+#define INFERENCE_MODEL_HPP
+
+#include "Layer.hpp"
+#include "Network.hpp"
+#include "Checkpoint.hpp"
+#include <Eigen/Core>
+#include <vector>
+
+namespace NN
+{
+  /*
+   * A frozen copy of a trained network's dense layers for serving.
+   *
+   * The model is immutable after construction, so one instance (and one copy
+   * of the weights) can be shared by any number of threads calling predict()
+   * at once. Intermediate activations live in a per-thread scratch arena that
+   * grows to fit the widest layer the first time a thread predicts, and is
+   * reused afterwards. That includes the GEMM's packing workspace, which
+   * Eigen would otherwise allocate on every large product, so a warmed-up
+   * predict() allocates nothing. It evaluates no loss.
+   *
+   * Batches are run rowChunk rows at a time, so scratch size is independent
+   * of the batch size. When many threads serve requests concurrently, call
+   * Eigen::setNbThreads(1) so each request's GEMMs stay on its own thread.
+   * */
+  template<typename Scalar>
+  class BasicInferenceModel
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using MatRef = Eigen::Ref<Mat>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+  protected:
+
+    struct FrozenLayer
+    {
+      //(inputs+1) x outputs, bias in the last row
+      Mat weights;
+
+      ActivationKernel<Scalar> activation;
+    };
+
+    std::vector<FrozenLayer> layers;
+
+    int_t rowChunk;
+
+    //widest hidden (non-final) layer, which sizes the activation buffers
+    int_t maxHidden = 0;
+
+    //scalars of scratch a predict() needs: two activation buffers of
+    //rowChunk x maxHidden, then the GEMM packing workspace
+    size_t scratchSize = 0;
+
+    void addLayer(const Mat& weights, const ActivationKernel<Scalar>& activation);
+
+    void sizeScratch();
+
+    //calling thread's scratch, holding at least count scalars
+    static Scalar* threadScratch(size_t count);
+
+  public:
+
+    explicit BasicInferenceModel(const BasicNetwork<Scalar>& net, int_t _rowChunk=256);
+
+    explicit BasicInferenceModel(const BasicMappedCheckpoint<Scalar>& checkpoint, int_t _rowChunk=256);
+
+    int_t numLayers() const noexcept
+    {
+      return layers.size();
+    }
+
+    int_t inputSize() const noexcept
+    {
+      return layers.front().weights.rows() - 1;
+    }
+
+    int_t numOutputs() const noexcept
+    {
+      return layers.back().weights.cols();
+    }
+
+    const Mat& getWeights(int_t layer) const noexcept
+    {
+      return layers[layer].weights;
+    }
+
+    //sizes the calling thread's scratch so its first predict() doesn't allocate
+    void reserveThreadScratch() const;
+
+    /*
+     * out = network(batch), with out batch.rows() x numOutputs(). Safe to
+     * call from several threads at once on the same model.
+     * */
+    void predict(ConstMatRef batch, MatRef out) const;
+  };
+
+  using InferenceModel = BasicInferenceModel<double>;
+
+  using InferenceModelf = BasicInferenceModel<float>;
+
+  extern template class BasicInferenceModel<double>;
+
+  extern template class BasicInferenceModel<float>;
+
+}//end namespace NN
+#endif //INFERENCE_MODEL_HPP
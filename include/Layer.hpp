@@ -4,6 +4,14 @@
 #define EIGEN_VECTORIZE
 #include <Eigen/Core>
 #include <Eigen/Dense>
+#include "Activations.hpp"
+#include "Conv.hpp"
+#include "Normalization.hpp"
+#include "Optimizers.hpp"
+#include "ParameterArena.hpp"
+#include "Profiler.hpp"
+#include "ScratchArena.hpp"
+#include "SparseWeights.hpp"
 #include <unordered_map>
 #include <functional>
 #include <utility>
@@ -11,150 +19,411 @@
 #include <cmath>
 #include <random>
 #include <memory>
+#include <type_traits>
+#include <vector>
 #include <omp.h>
 #include <iostream>
 //#include <mkl.h>
 
 namespace NN
 {
-  using Mat = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+  using Mat = RowMat<double>;
   using Vec = Eigen::VectorXd;
   using MatRef = Eigen::Ref<Mat>;
   using ConstMatRef = Eigen::Ref<const Mat>;
+  using ConstMatMap = Eigen::Map<const Mat, Eigen::Unaligned, Eigen::OuterStride<>>;
+  using Matf = RowMat<float>;
+  using Vecf = Eigen::VectorXf;
   using int_t = int_fast64_t;
 
   
-  //namespace-level variable for activations
-  static std::unordered_map<std::string, std::function<double(double)>>
-  ACTIVATIONS = {
-		 {"linear", [](double x){ return x;}},
-		 {"sigmoid", [](double x){ return 1.0/(1.0 + exp(-x));}},
-		 {"tanh", [](double x){ return tanh(x);}},
-		 {"relu", [](double x){ return x > 0 ? x : 0.0;}},
-		 {"softplus", [](double x){ return log(exp(x) + 1);}}
+  //elementwise activations, for callers that want a plain function.
+  //Layers use the vectorized kernels from Activations.hpp instead.
+  template<typename Scalar>
+  inline std::unordered_map<std::string, std::function<Scalar(Scalar)>>
+  BASIC_ACTIVATIONS = {
+		 {"linear", [](Scalar x){ return x;}},
+		 {"sigmoid", [](Scalar x){ return Scalar(1)/(Scalar(1) + std::exp(-x));}},
+		 {"tanh", [](Scalar x){ return std::tanh(x);}},
+		 {"relu", [](Scalar x){ return x > 0 ? x : Scalar(0);}},
+		 {"softplus", [](Scalar x){ return std::log(std::exp(x) + Scalar(1));}}
   };
 	
   /*
    * takes pairs of (input, output)
    * */
-  static std::unordered_map<std::string, std::function<Mat(std::pair<ConstMatRef,ConstMatRef>)>>
-  ACTIVATION_DERIVATIVES = {
-			    {"linear", [](std::pair<ConstMatRef,ConstMatRef> x) -> Mat { 
-					 return Mat::Ones(x.second.rows(), x.second.cols());
+  template<typename Scalar>
+  inline std::unordered_map<std::string,
+			    std::function<RowMat<Scalar>(std::pair<Eigen::Ref<const RowMat<Scalar>>,
+							   Eigen::Ref<const RowMat<Scalar>>>)>>
+  BASIC_ACTIVATION_DERIVATIVES = [](){
+    using M = RowMat<Scalar>;
+    using P = std::pair<Eigen::Ref<const M>, Eigen::Ref<const M>>;
+    return std::unordered_map<std::string, std::function<M(P)>>{
+			    {"linear", [](P x) -> M { 
+					 return M::Ones(x.second.rows(), x.second.cols());
 				       } },
-			    {"sigmoid", [](std::pair<ConstMatRef,ConstMatRef> x) -> Mat {
-					  return x.second.cwiseProduct((Mat::Ones(x.second.rows(), x.second.cols())- x.second));
+			    {"sigmoid", [](P x) -> M {
+					  return x.second.cwiseProduct((M::Ones(x.second.rows(), x.second.cols())- x.second));
 					} },
-			    {"tanh",   [](std::pair<ConstMatRef,ConstMatRef> x) -> Mat {
-					 return Mat::Ones(x.second.rows(), x.second.cols()) - x.second.cwiseProduct(x.second);
+			    {"tanh",   [](P x) -> M {
+					 return M::Ones(x.second.rows(), x.second.cols()) - x.second.cwiseProduct(x.second);
 				       } },
-			    {"relu", [](std::pair<ConstMatRef,ConstMatRef> x) -> Mat { 
-				       return x.first.unaryExpr([](double y){
-								  return y > 0.0 ? 1.0 : 0.0; }); } },
-			    {"softplus", [](std::pair<ConstMatRef,ConstMatRef> x) -> Mat { 
-					   return x.first.unaryExpr([](double y){return 1/(exp(-y)+1);});
+			    {"relu", [](P x) -> M { 
+				       return x.first.unaryExpr([](Scalar y){
+								  return y > Scalar(0) ? Scalar(1) : Scalar(0); }); } },
+			    {"softplus", [](P x) -> M { 
+					   return x.first.unaryExpr([](Scalar y){return Scalar(1)/(std::exp(-y)+Scalar(1));});
 					 } }
 			    
-  };
+    };
+  }();
+
+  static auto& ACTIVATIONS = BASIC_ACTIVATIONS<double>;
+
+  static auto& ACTIVATION_DERIVATIVES = BASIC_ACTIVATION_DERIVATIVES<double>;
   
-  enum class UpdateRule
+  /*
+   * How a layer uses its threads. Gemm leaves them to Eigen's GEMM (sized by
+   * Eigen::setNbThreads), Batch splits the batch rows among the threads,
+   * each running serial GEMMs, and Auto splits the batch only when every
+   * thread gets enough rows. A pass never does both.
+   * */
+  enum class Parallelism
     {
-     NesterovAccGrad//simple momentum update
+     Gemm,
+     Batch,
+     Auto
     };
 
+  /*
+   * How a layer draws its initial weights. Uniform draws from [-1, 1];
+   * Xavier from [-l, l] with l = sqrt(6 / (fanIn + fanOut)), which keeps
+   * the variance of tanh, sigmoid and linear layers' outputs near their
+   * inputs'; He with l = sqrt(6 / fanIn), the same for relu and softplus,
+   * which zero half their inputs. Both start the bias at zero. Auto picks
+   * Xavier or He by the activation.
+   * */
+  enum class WeightInit
+    {
+     Uniform,
+     Xavier,
+     He,
+     Auto
+    };
 
-  class Layer
+  /*
+   * out = activation(x * weights[0:n,:] + weights[n,:]) with n = x.cols(),
+   * i.e. the bias is the last row of weights. preact receives the
+   * preactivations and may be the same matrix as out. If splitRows, the rows
+   * are divided among numThreads threads. A profile, if given, gets the
+   * Forward and Activation phases, and the GEMMs pack into scratch, if given.
+   * If sparse is given, it holds the nonzeros of weights (bias row
+   * excluded) and the product runs over those alone; it needs scratch.
+   * */
+  template<typename Scalar>
+  void denseForward(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> weights,
+		    const ActivationKernel<Scalar>& activation,
+		    Eigen::Ref<RowMat<Scalar>> preact, Eigen::Ref<RowMat<Scalar>> out,
+		    int numThreads=1, bool splitRows=false, LayerProfile* profile=nullptr,
+		    ScratchArena* scratch=nullptr, const SparseWeights<Scalar>* sparse=nullptr);
+
+  namespace internal
   {
-    
+    template<typename T>
+    struct IsRef : std::false_type {};
+
+    template<typename P, int O, typename S>
+    struct IsRef<Eigen::Ref<P, O, S>> : std::true_type {};
+
+    /*
+     * whether view, a Ref made from inputData (a T&&), reads storage that
+     * outlives the call: not when Ref had to copy an expression or a layout
+     * it can't view, nor when inputData is an rvalue matrix or Ref, which
+     * may hold the only copy of its values
+     * */
+    template<typename T, typename View>
+    bool viewsCallerStorage(const std::remove_reference_t<T>& inputData, const View& view) noexcept
+    {
+      using Plain = std::decay_t<T>;
+      constexpr bool owning = IsRef<Plain>::value or std::is_base_of_v<Eigen::PlainObjectBase<Plain>, Plain>;
+      if constexpr(bool(Eigen::internal::traits<Plain>::Flags & Eigen::DirectAccessBit)
+		   and (std::is_lvalue_reference_v<T> or not owning)){
+	return view.data() == inputData.data();
+      }
+      return false;
+    }
+  }
+
+  //density at or below which a pruned layer runs sparse kernels; about where
+  //they overtake the dense GEMM on AVX2
+  constexpr double DEFAULT_SPARSE_THRESHOLD = 0.2;
+
+  /*
+   * Fully connected layer over Scalar (float or double) batch matrices, one
+   * sample per row. Layer and Layerf name the double and float versions.
+   * Built from a ConvSpec, the layer is a convolution or a pool over NHWC
+   * rows instead (see Conv.hpp), and from a NormSpec a batch or layer norm
+   * (see Normalization.hpp); either chains with dense layers in a Network.
+   * */
+  template<typename Scalar>
+  class BasicLayer
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using MatRef = Eigen::Ref<Mat>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+    using ConstMatMap = Eigen::Map<const Mat, Eigen::Unaligned, Eigen::OuterStride<>>;
+
+    using ActivationFunc = std::function<Scalar(Scalar)>;
+
+    using ActivationGrad = std::function<Mat(std::pair<ConstMatRef,ConstMatRef>)>;
+
   protected:
 
     std::pair<int_t, int_t> input_shape;
 
     int_t output_size;
 
-    std::function<double(double)> activation;
-
-    std::function<Mat(std::pair<ConstMatRef,ConstMatRef>)> activation_grad;
+    ActivationKernel<Scalar> activation;
 
     Mat actVals;
 
-    Mat weights;
-
-    Mat weightUpdate = Mat::Zero(input_shape.second+1, output_size);
-
-    Mat gradient;
+    //weights, gradient and optimizer state; views into the owning
+    //network's arena, or into the layer's own block when standalone
+    LayerParameters<Scalar> params;
 
     Mat outputs;
 
     Mat inputs;
 
-    Mat inputMat;
+    //input read by forwardPass(inputData) without a copy; nullptr means
+    //the layer reads its own copy in inputs
+    const Scalar* boundInputs = nullptr;
+
+    int_t boundStride = 0;
 
     Mat err;
 
     Mat Jacobian;
 
-    std::tuple<double,double> updateParams;
+    OptimizerParams optimizer;
+
+    //updates applied under the current rule
+    int64_t updateStep = 0;
 
     std::string name="Layer";
 
-    UpdateRule update=UpdateRule::NesterovAccGrad;
+    int numThreads = 1;
+
+    Parallelism parallelism = Parallelism::Auto;
+
+    //per-thread gradients when the batch is split
+    std::vector<Mat> partialGrads;
+
+    //written only in DNN_PROFILE builds
+    LayerProfile profile;
+
+    //resizes a buffer, counting the bytes when it reallocates
+    void resizeBuffer(Mat& m, int_t rows, int_t cols);
+
+    //temporaries of passes not run by a LayerGraph, which brings its own
+    ScratchArena scratch;
+
+    //kept weights of a pruned layer; empty when unpruned
+    SparseWeights<Scalar> sparse;
+
+    double sparseThreshold = DEFAULT_SPARSE_THRESHOLD;
+
+    LayerKind kind = LayerKind::Dense;
+
+    //geometry of a convolution or pool; unused by dense layers
+    ConvSpec spec;
+
+    NormSpec norm;
+
+    //a normalization's normalized inputs and the statistics it used
+    //(see internal::normStatistics)
+    Mat normalized;
+
+    Mat normStats;
+
+    //a batch norm's [sum(e * normalized); sum(e)] over its last batch, which
+    //its propagated error needs; a copy, since data-parallel trainers reduce
+    //the gradient in place while the previous layer still reads it
+    Mat normErrSums;
+
+    //a batch norm's running means and variances
+    Mat runningStats;
+
+    //batch norms use their batch's statistics while training and their
+    //running ones otherwise
+    bool training = true;
+
+    WeightInit init = WeightInit::Uniform;
+
+
+    void bindInputs(ConstMatRef _inputs);
+
+    //owned parameters of weightShape(), filled by fillWeights()
+    void initWeights()
+    {
+      params.allocate(weightShape().first, weightShape().second);
+      fillWeights();
+    }
 
+    //random weights drawn as init says, wherever params views them; a
+    //normalization starts as the identity, with fresh running statistics
+    void fillWeights();
+
+    //the kept weights if passes should use them, else nullptr
+    const SparseWeights<Scalar>* sparseKernels() const noexcept
+    {
+      return usesSparseKernels() ? &sparse : nullptr;
+    }
+
+    //lossGradRows(first, count) fills those rows of err with dL/d(outputs)
+    template<typename F>
+    void finishBackward(F&& lossGradRows, ScratchArena& passScratch) noexcept;
+
+    //dx = rows [first, first + count) of err sent back to this layer's inputs
+    void propagateRows(int_t first, int_t count, MatRef dx, ScratchArena& passScratch) const noexcept;
+
+    //multiply-adds per batch row of forming the gradient and of propagateRows()
+    double gradientWork() const noexcept;
+
+    double propagationWork() const noexcept;
+
+    //the forward pass over the bound inputs, dense or spatial
+    void forwardRows(bool splitRows, ScratchArena& passScratch);
+
+    void normForward(bool splitRows);
+
+    //forwardPass() over inputData, read in place
+    void forwardBound(ConstMatRef inputData);
+
+    ConstMatMap inputView() const noexcept
+    {
+      if(boundInputs){
+	return ConstMatMap(boundInputs, input_shape.first, input_shape.second,
+			   Eigen::OuterStride<>(boundStride));
+      }
+      return ConstMatMap(inputs.data(), inputs.rows(), inputs.cols(),
+			 Eigen::OuterStride<>(inputs.cols()));
+    }
 
   public:
 
+    using ParamMap = typename LayerParameters<Scalar>::Map;
+
+    //[input, 1]; the forward pass reads the bias row of weights directly instead
     static Mat makeInputMat(ConstMatRef input);
     
 		
-    Layer(std::pair<int_t, int_t> _input_shape,
+    BasicLayer(std::pair<int_t, int_t> _input_shape,
 	  int_t _output_size,
-	  const std::function<double(double)>& _activation=NN::ACTIVATIONS["relu"],
-	  const std::function<Mat(std::pair<ConstMatRef,ConstMatRef>)>&
-	  _activation_grad=NN::ACTIVATION_DERIVATIVES["relu"]) :
+	  const ActivationFunc& _activation,
+	  const ActivationGrad& _activation_grad) :
       input_shape(_input_shape),
       output_size(_output_size),
-      activation(_activation),
-      activation_grad(_activation_grad)
+      activation(customActivationKernel<Scalar>(_activation, _activation_grad))
     {
-      weights = Mat::Random(input_shape.second + 1, output_size);
+      initWeights();
     };
 
-    Layer(std::pair<int_t, int_t> _input_shape,
+    BasicLayer(std::pair<int_t, int_t> _input_shape,
 	  int_t _output_size,
-	  std::string _activation, bool initWeights=true) : 
+	  std::string _activation="relu", bool initWeights=true) : 
       input_shape(_input_shape),
-      output_size(_output_size)
+      output_size(_output_size),
+      activation(activationKernel<Scalar>(_activation))
     {
-      activation = NN::ACTIVATIONS[_activation];
-      activation_grad = NN::ACTIVATION_DERIVATIVES[_activation];
       if(initWeights){
-	weights = Mat::Random(input_shape.second +1, output_size);
+	this->initWeights();
+      } else {
+	params.allocate(input_shape.second + 1, output_size);
+      }
+    };
+
+    /*
+     * a dense layer of _output_size outputs whose input shape is not known
+     * yet. It holds no weights until it gets one: from setInputShape() or
+     * its first forward pass when standalone, or, in a Network, from the
+     * layer before it or the first batch, when the network draws the
+     * weights directly in its arena.
+     * */
+    explicit BasicLayer(int_t _output_size, std::string _activation="relu",
+			WeightInit _init=WeightInit::Auto) :
+      input_shape(0, 0),
+      output_size(_output_size),
+      activation(activationKernel<Scalar>(_activation)),
+      init(_init)
+    {
+      if(output_size <= 0){
+	throw "Error: a layer needs a positive output size.";
       }
     };
 
-    Layer(const Mat& _inputs,
+    //a convolution or pool over batches of batchRows samples
+    BasicLayer(int_t batchRows, const ConvSpec& _spec, std::string _activation="relu") :
+      input_shape(std::make_pair(batchRows, _spec.input.size())),
+      output_size(_spec.output().size()),
+      activation(activationKernel<Scalar>(_activation)),
+      kind(_spec.kind),
+      spec(_spec)
+    {
+      spec.validate();
+      initWeights();
+    };
+
+    //a batch or layer norm over batches of batchRows samples
+    BasicLayer(int_t batchRows, const NormSpec& _norm, std::string _activation="linear") :
+      input_shape(std::make_pair(batchRows, _norm.features)),
+      output_size(_norm.features),
+      activation(activationKernel<Scalar>(_activation)),
+      kind(_norm.kind),
+      norm(_norm)
+    {
+      norm.validate();
+      initWeights();
+    };
+
+    BasicLayer(const Mat& _inputs,
 	  int_t _output_size,
 	  const Mat& _weights,
-	  const std::function<double(double)>& _activation=NN::ACTIVATIONS["relu"],
-	  std::function<Mat(std::pair<ConstMatRef,ConstMatRef>)>
-	  _activation_grad=NN::ACTIVATION_DERIVATIVES["relu"])  :
+	  const ActivationFunc& _activation,
+	  const ActivationGrad& _activation_grad)  :
       input_shape(std::make_pair(_inputs.rows(), _inputs.cols())),
       output_size(_output_size),
-      activation(_activation),
-      activation_grad(_activation_grad),
-      weights(_weights),
+      activation(customActivationKernel<Scalar>(_activation, _activation_grad)),
       inputs(_inputs)
     {
-      inputMat = makeInputMat(inputs);
+      setWeights(_weights);
     };
 
+    BasicLayer(const Mat& _inputs,
+	  int_t _output_size,
+	  const Mat& _weights,
+	  std::string _activation="relu")  :
+      input_shape(std::make_pair(_inputs.rows(), _inputs.cols())),
+      output_size(_output_size),
+      activation(activationKernel<Scalar>(_activation)),
+      inputs(_inputs)
+    {
+      setWeights(_weights);
+    };
 
-    auto getWeights() const noexcept
+
+    const ParamMap& getWeights() const noexcept
     {
-      return weights;
+      return params.weights;
     }
 
-    auto getOutputs() const noexcept
+    const Mat& getOutputs() const noexcept
     {
       return outputs;
     }
@@ -169,7 +438,62 @@ namespace NN
       return output_size;
     }
 
-    auto getName()
+    LayerKind getKind() const noexcept
+    {
+      return kind;
+    }
+
+    const ConvSpec& getConvSpec() const noexcept
+    {
+      return spec;
+    }
+
+    const NormSpec& getNormSpec() const noexcept
+    {
+      return norm;
+    }
+
+    bool normalizes() const noexcept
+    {
+      return kind == LayerKind::BatchNorm or kind == LayerKind::LayerNorm;
+    }
+
+    //false for a dense layer still waiting for its input shape
+    bool hasInputShape() const noexcept
+    {
+      return input_shape.second > 0;
+    }
+
+    WeightInit getWeightInit() const noexcept
+    {
+      return init;
+    }
+
+    //used by the next initialization, e.g. setInputShape's
+    void setWeightInit(WeightInit _init) noexcept
+    {
+      init = _init;
+    }
+
+    //(inputs + 1) x outputs when dense, (patch + 1) x filters for a
+    //convolution, 2 x parameters for a normalization and 0 x 0 for a pool,
+    //the bias (or beta) always the last row
+    std::pair<int_t, int_t> weightShape() const noexcept
+    {
+      switch(kind){
+      case LayerKind::Dense:
+	return {input_shape.second + 1, output_size};
+      case LayerKind::Conv:
+	return {spec.patchSize() + 1, spec.filters};
+      case LayerKind::BatchNorm:
+      case LayerKind::LayerNorm:
+	return {2, norm.parameters()};
+      default:
+	return {0, 0};
+      }
+    }
+
+    const std::string& getName() const noexcept
     {
       return name;
     }
@@ -185,9 +509,57 @@ namespace NN
     }
 
 
-    void setWeights(const Mat& _weights) noexcept
+    //weights of a new shape get fresh storage (and zero optimizer state),
+    //detaching the layer from its network's arena until the network repacks.
+    //New weights are unpruned.
+    void setWeights(const Mat& _weights)
+    {
+      if(_weights.rows() != params.rows() or _weights.cols() != params.cols()){
+	params.allocate(_weights.rows(), _weights.cols());
+      }
+      params.weights = _weights;
+      sparse = SparseWeights<Scalar>();
+    }
+
+    //first optimizer state buffer: velocity, or Adam's first moment
+    const ParamMap& getWeightUpdate() const noexcept
+    {
+      return params.firstState;
+    }
+
+    void setWeightUpdate(const Mat& _weightUpdate);
+
+    //storage of the parameters: weights, gradient, first and second state
+    const LayerParameters<Scalar>& getParameters() const noexcept
     {
-      weights = _weights;
+      return params;
+    }
+
+    //moves the parameters into external tensors shaped like getWeights()
+    void bindParameters(Scalar* w, Scalar* grad, Scalar* first, Scalar* second)
+    {
+      params.bind(w, grad, first, second);
+    }
+
+    /*
+     * views external tensors shaped like getWeights() without copying into
+     * them, e.g. a replica reading another network's weights while writing
+     * its own gradient
+     * */
+    void viewParameters(Scalar* w, Scalar* grad, Scalar* first, Scalar* second) noexcept
+    {
+      params.view(w, grad, first, second);
+    }
+
+    /*
+     * views zeroed external tensors of weightShape() and draws the initial
+     * weights in them, for a layer that holds no weights yet; the layer
+     * never allocates its own
+     * */
+    void placeParameters(Scalar* w, Scalar* grad, Scalar* first, Scalar* second)
+    {
+      params.place(w, grad, first, second, weightShape().first, weightShape().second);
+      fillWeights();
     }
 
     void setInputShape(std::pair<int_t, int_t> _input_shape, bool reinitWeights=true); 
@@ -197,53 +569,254 @@ namespace NN
       output_size = _num_outputs;
     }
 
-    void setInputs(ConstMatRef _inputs, bool usemakeInputMat=true);
+    //copies _inputs into the layer
+    void setInputs(ConstMatRef _inputs);
 
+    //sizes the activation, error and gradient buffers for batches of batchRows,
+    //so passes over batches of that size don't allocate
+    void reserve(int_t batchRows);
 
-    Mat getJacobian() const
+
+    const Mat& getJacobian() const noexcept
     {
       return Jacobian;
     }
 
-    Mat getGradient() const
+    const ParamMap& getGradient() const noexcept
     {
-      return gradient;
+      return params.gradient;
     }
 
-    Mat getErr() const
+    const Mat& getErr() const noexcept
     {
       return err;
     }
 
+    //learning rate and momentum of the current update rule
     void setUpdateParams(double learningrate, double momentum) noexcept {
-      updateParams = std::tuple<double,double>(learningrate,momentum);
+      optimizer.learningRate = learningrate;
+      optimizer.momentum = momentum;
     }
 
+    //switching to a different rule starts its state from zero
+    void setUpdateParams(const OptimizerParams& _optimizer);
+
     std::tuple<double,double> getUpdateParams() const noexcept
     {
-      return updateParams;
+      return std::make_tuple(optimizer.learningRate, optimizer.momentum);
+    }
+
+    const OptimizerParams& getOptimizer() const noexcept
+    {
+      return optimizer;
     }
 
+    //second optimizer state buffer (see Optimizers.hpp)
+    const ParamMap& getSecondMoment() const noexcept
+    {
+      return params.secondState;
+    }
+
+    //an empty matrix clears the buffer
+    void setSecondMoment(const Mat& _secondMoment);
+
+    //whether the parameters live in external storage such as an arena
+    bool parametersBound() const noexcept
+    {
+      return params.isBound();
+    }
+
+    auto getUpdateStep() const noexcept
+    {
+      return updateStep;
+    }
+
+    void setUpdateStep(int64_t step) noexcept
+    {
+      updateStep = step;
+    }
+
+    //resolves the activation kernel once; unknown names throw
     void setActivation(std::string actName);
 
-    void forwardPass(ConstMatRef inputData);
+    void setNumThreads(int n, Parallelism mode=Parallelism::Auto);
+
+    auto getNumThreads() const noexcept
+    {
+      return numThreads;
+    }
+
+    auto getParallelism() const noexcept
+    {
+      return parallelism;
+    }
+
+    //cycles, calls and FLOPs per phase; see Profiler.hpp
+    const LayerProfile& getProfile() const noexcept
+    {
+      return profile;
+    }
+
+    void resetProfile() noexcept
+    {
+      profile.reset();
+    }
+
+    //charges this layer its share of an update the network ran over its
+    //whole parameter arena at once
+    void addFusedUpdate(uint64_t cycles, uint64_t flops) noexcept
+    {
+      profile.add(Phase::Update, cycles, flops);
+    }
+
+    auto getActivation() const noexcept
+    {
+      return activation.name;
+    }
+
+    /*
+     * Magnitude pruning: zeroes the smallest weights (bias excluded) until
+     * at least sparsity of them are zero, along with their optimizer state,
+     * and keeps them at zero from then on. Pruning is cumulative, so
+     * prune(0) just re-derives the pattern from the weights' zeros, e.g.
+     * after loading a checkpoint of a pruned network.
+     * */
+    void prune(double sparsity);
+
+    bool isPruned() const noexcept
+    {
+      return not sparse.empty();
+    }
+
+    //kept fraction of the weights, bias excluded
+    double getDensity() const noexcept
+    {
+      return sparse.density();
+    }
+
+    const SparseWeights<Scalar>& getSparseWeights() const noexcept
+    {
+      return sparse;
+    }
+
+    //a pruned layer whose density is at most threshold runs sparse
+    //kernels; denser ones stay on the dense GEMM
+    void setSparseThreshold(double threshold) noexcept
+    {
+      sparseThreshold = threshold;
+    }
+
+    double getSparseThreshold() const noexcept
+    {
+      return sparseThreshold;
+    }
+
+    //only dense layers have sparse kernels; a pruned convolution keeps
+    //its zeros but runs the dense GEMM
+    bool usesSparseKernels() const noexcept
+    {
+      return kind == LayerKind::Dense and isPruned() and sparse.density() <= sparseThreshold;
+    }
+
+    //switches batch norms between batch and running statistics
+    void setTraining(bool _training) noexcept
+    {
+      training = _training;
+    }
+
+    bool isTraining() const noexcept
+    {
+      return training;
+    }
+
+    //a batch norm's running [means; variances], one column per channel
+    const Mat& getRunningStats() const noexcept
+    {
+      return runningStats;
+    }
+
+    void setRunningStats(const Mat& stats)
+    {
+      if(stats.rows() != runningStats.rows() or stats.cols() != runningStats.cols()){
+	throw "Error: running statistics must have the shape of the layer's.";
+      }
+      runningStats = stats;
+    }
+
+    //whether this batch norm folds into prev, a linear dense layer or
+    //convolution producing its inputs
+    bool foldsInto(const BasicLayer& prev) const noexcept;
+
+    /*
+     * prevWeights, those of a layer foldsInto() accepts, with this batch
+     * norm's inference-time affine map folded into them: the linear layer
+     * with the result computes what the pair computes with running
+     * statistics.
+     * */
+    Mat foldInto(const Mat& prevWeights) const;
+
+    //zeroes the gradient of pruned weights; updateWeights() calls it
+    void maskGradient() noexcept
+    {
+      if(isPruned()){
+	sparse.mask(params.gradient.topRows(sparse.rows()));
+      }
+    }
+
+    /*
+     * outputs = activation(inputData * weights[0:n,:] + weights[n,:]).
+     * Row-major storage the caller holds (a matrix, block or map) is read in
+     * place, not copied, so it must outlive the following backwardPass().
+     * Anything else, an expression, a column-major matrix or a temporary, is
+     * copied into the layer's own inputs first.
+     * */
+    template<typename T>
+    void forwardPass(T&& inputData)
+    {
+      const ConstMatRef view(inputData);
+      if(internal::viewsCallerStorage<T>(inputData, view)){
+	forwardBound(view);
+      } else {
+	inputs = view;
+	forwardBound(inputs);
+      }
+    }
 
     void forwardPass();
 
-    Mat makeActDerivs() const noexcept
+    /*
+     * forwardPass(inputData) for a layer whose buffers reserve() has sized
+     * for inputData's rows and whose weights are known to match, as in a
+     * compiled LayerGraph: no shape checks, and splitRows decides threading.
+     * */
+    void forwardPlanned(ConstMatRef inputData, bool splitRows, ScratchArena& passScratch) noexcept;
+
+    //whether passes over batches of rows split them among the threads
+    bool splitsBatch(int_t rows) const noexcept;
+
+    //derivative of the activation at the current preactivations
+    Mat makeActDerivs() const
     {
-      auto actPair = std::make_pair(inputMat, outputs);
-      return activation_grad(actPair);
+      Mat actDerivs = Mat::Ones(outputs.rows(), outputs.cols());
+      activation.backward(actVals, outputs, actDerivs);
+      return actDerivs;
     }
 
 
-    Mat computeJacobian() noexcept;
+    //d(outputs)/d([inputs, 1]) rows, kept until the next call; dense layers only
+    const Mat& computeJacobian();
 
-    void backwardPass(const Layer& next) noexcept;
+    void backwardPass(const BasicLayer& next) noexcept;
     
 
     void backwardPass(ConstMatRef loss_grad) noexcept;
 
+    //the same, with temporaries taken from a pass-wide arena
+    void backwardPass(const BasicLayer& next, ScratchArena& passScratch) noexcept;
+
+    void backwardPass(ConstMatRef loss_grad, ScratchArena& passScratch) noexcept;
+
+    //one fused optimizer step over weights, gradient and state
     void updateWeights();
 
     void updateWeights(double mult);
@@ -251,13 +824,21 @@ namespace NN
 
     void updateWeights(const std::tuple<double,double>& params)
     {
-      updateParams = params;
+      setUpdateParams(std::get<0>(params), std::get<1>(params));
       updateWeights();
     }
 
     void visualizeLayer(std::ostream& ostr = std::cout);
 		
-  };//end class Layer
+  };//end class BasicLayer
+
+  using Layer = BasicLayer<double>;
+
+  using Layerf = BasicLayer<float>;
+
+  extern template class BasicLayer<double>;
+
+  extern template class BasicLayer<float>;
 
 
 }//end namespace NN
@@ -0,0 +1,157 @@
+#ifndef LAYER_GRAPH_HPP
+#define LAYER_GRAPH_HPP
+
+#include "Layer.hpp"
+#include "Profiler.hpp"
+#include <Eigen/Core>
+#include <functional>
+#include <list>
+#include <vector>
+
+namespace NN
+{
+  /*
+   * A network's layers compiled into a flat execution plan.
+   *
+   * Compiling checks once that each node's inputs match the node it reads,
+   * so forward() and backward() walk a contiguous array of nodes without
+   * shape checks or throws. plan() sizes every layer's buffers for a batch
+   * size and decides per node whether its passes split the batch among
+   * threads.
+   *
+   * Each node names the node whose outputs it reads. Networks are still
+   * sequential (node i reads node i-1), but the plan is indexed by node
+   * rather than by list position so branches can be added without
+   * changing how nodes are run.
+   *
+   * The nodes point into the layer list they were compiled from, which must
+   * outlive the graph and keep its layers' shapes; recompile after changing
+   * either.
+   * */
+  template<typename Scalar>
+  class BasicLayerGraph
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+    using Layer = BasicLayer<Scalar>;
+
+    struct Node
+    {
+      Layer* layer;
+
+      //node whose outputs feed this one; -1 for the network's inputs
+      int input;
+
+      int_t inputSize;
+
+      int_t outputSize;
+
+      //whether the forward pass splits the planned batch among threads
+      bool splitRows = false;
+    };
+
+  protected:
+
+    std::vector<Node> nodes;
+
+    int_t inputSize = 0;
+
+    int_t outputSize = 0;
+
+    //sum of the layers' widths: activation scalars per batch row
+    int_t activationWidth = 0;
+
+    int_t plannedRows = 0;
+
+    //temporaries of one pass, taken back at the start of the next
+    ScratchArena scratch;
+
+  public:
+
+    BasicLayerGraph() = default;
+
+    //throws if a layer's input size differs from its predecessor's outputs
+    explicit BasicLayerGraph(std::list<Layer>& layers);
+
+    size_t size() const noexcept
+    {
+      return nodes.size();
+    }
+
+    const Node& operator[](size_t i) const noexcept
+    {
+      return nodes[i];
+    }
+
+    auto begin() const noexcept
+    {
+      return nodes.begin();
+    }
+
+    auto end() const noexcept
+    {
+      return nodes.end();
+    }
+
+    int_t getInputSize() const noexcept
+    {
+      return inputSize;
+    }
+
+    int_t getOutputSize() const noexcept
+    {
+      return outputSize;
+    }
+
+    //scalars per batch row held by the layers' output buffers
+    int_t getActivationWidth() const noexcept
+    {
+      return activationWidth;
+    }
+
+    int_t getPlannedRows() const noexcept
+    {
+      return plannedRows;
+    }
+
+    const ScratchArena& getScratch() const noexcept
+    {
+      return scratch;
+    }
+
+    //sizes every layer's buffers for batches of batchRows
+    void plan(int_t batchRows);
+
+    /*
+     * runs every node on a batch of plan()'s size with getInputSize()
+     * columns, read in place. Returns the last node's outputs. Each node's
+     * pass is a span of trace, if given and recording.
+     * */
+    const Mat& forward(ConstMatRef batchInputs, TraceRecorder* trace=nullptr) noexcept;
+
+    //backpropagates dL/d(outputs) of the last node through every node
+    void backward(ConstMatRef lossGrad, TraceRecorder* trace=nullptr) noexcept;
+
+    /*
+     * the same, calling nodeDone(i) as soon as node i's gradient is final,
+     * from the last node down to node 0, e.g. to start reducing it while the
+     * earlier nodes are still running
+     * */
+    void backward(ConstMatRef lossGrad, const std::function<void(size_t)>& nodeDone,
+		  TraceRecorder* trace=nullptr);
+  };
+
+  using LayerGraph = BasicLayerGraph<double>;
+
+  using LayerGraphf = BasicLayerGraph<float>;
+
+  extern template class BasicLayerGraph<double>;
+
+  extern template class BasicLayerGraph<float>;
+
+}//end namespace NN
+#endif //LAYER_GRAPH_HPP
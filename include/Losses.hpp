@@ -0,0 +1,248 @@
+#ifndef LOSSES_HPP
+#define LOSSES_HPP
+#include "Activations.hpp"
+#include <Eigen/Core>
+#include <functional>
+#include <algorithm>
+#include <string>
+#include <cmath>
+
+/*
+ * Loss kernels.
+ *
+ * Each loss is a tag type with a static evaluate() that takes a batch of
+ * predictions and targets (one sample per row) and, in one pass over the
+ * batch, returns the loss summed over every row while writing dL/d(pred)
+ * into grad. Rows are contiguous, so each row is a fused loop that loads
+ * the prediction and target once and stores the gradient once; targets may
+ * be a strided view, e.g. some columns of a larger matrix.
+ *
+ *   L2 (mse)       0.5 (p - y)^2                   p - y
+ *   mae            |p - y|                         sign(p - y)
+ *   huber          0.5 r^2, or d(|r| - d/2)        r clamped to [-d, d]
+ *   bce_logits     log(1 + e^p) - y p              sigmoid(p) - y
+ *   softmax_ce     logsumexp(p) sum(y) - y.p       softmax(p) sum(y) - y
+ *
+ * bce_logits and softmax_ce take logits, so they go after a linear final
+ * layer. Both are written to stay finite for logits of any size: BCE as
+ * max(p, 0) - y p + log(1 + e^-|p|), and softmax as exp(p - max(p)) with the
+ * log-sum-exp carried through. For one-hot rows sum(y) is 1.
+ * */
+
+namespace NN
+{
+  template<typename Scalar>
+  struct LossKernel
+  {
+    using MatType = RowMat<Scalar>;
+    using ConstRef = Eigen::Ref<const MatType>;
+    using Ref = Eigen::Ref<MatType>;
+
+    std::string name;
+
+    //(predictions, targets, grad) -> summed loss, filling grad
+    std::function<double(ConstRef, ConstRef, Ref)> evaluate;
+  };
+
+  struct SquaredError
+  {
+    static constexpr const char* name = "L2";
+
+    template<typename Scalar>
+    static double evaluate(Eigen::Ref<const RowMat<Scalar>> pred, Eigen::Ref<const RowMat<Scalar>> target,
+			   Eigen::Ref<RowMat<Scalar>> grad)
+    {
+      const std::ptrdiff_t n = pred.cols();
+      double total = 0;
+      for(std::ptrdiff_t r = 0; r < pred.rows(); r++){
+	const Scalar* __restrict p = pred.row(r).data();
+	const Scalar* __restrict y = target.row(r).data();
+	Scalar* __restrict g = grad.row(r).data();
+	Scalar sum = 0;
+        #pragma omp simd reduction(+:sum)
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar d = p[i] - y[i];
+	  g[i] = d;
+	  sum += d * d;
+	}
+	total += sum;
+      }
+      return 0.5 * total;
+    }
+  };
+
+  struct AbsoluteError
+  {
+    static constexpr const char* name = "mae";
+
+    template<typename Scalar>
+    static double evaluate(Eigen::Ref<const RowMat<Scalar>> pred, Eigen::Ref<const RowMat<Scalar>> target,
+			   Eigen::Ref<RowMat<Scalar>> grad)
+    {
+      const std::ptrdiff_t n = pred.cols();
+      double total = 0;
+      for(std::ptrdiff_t r = 0; r < pred.rows(); r++){
+	const Scalar* __restrict p = pred.row(r).data();
+	const Scalar* __restrict y = target.row(r).data();
+	Scalar* __restrict g = grad.row(r).data();
+	Scalar sum = 0;
+        #pragma omp simd reduction(+:sum)
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar d = p[i] - y[i];
+	  g[i] = d > 0 ? Scalar(1) : (d < 0 ? Scalar(-1) : Scalar(0));
+	  sum += std::abs(d);
+	}
+	total += sum;
+      }
+      return total;
+    }
+  };
+
+  //quadratic within delta of the target, linear beyond
+  struct Huber
+  {
+    static constexpr const char* name = "huber";
+
+    template<typename Scalar>
+    static double evaluate(Eigen::Ref<const RowMat<Scalar>> pred, Eigen::Ref<const RowMat<Scalar>> target,
+			   Eigen::Ref<RowMat<Scalar>> grad, Scalar delta=1)
+    {
+      const std::ptrdiff_t n = pred.cols();
+      double total = 0;
+      for(std::ptrdiff_t r = 0; r < pred.rows(); r++){
+	const Scalar* __restrict p = pred.row(r).data();
+	const Scalar* __restrict y = target.row(r).data();
+	Scalar* __restrict g = grad.row(r).data();
+	Scalar sum = 0;
+        #pragma omp simd reduction(+:sum)
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar d = p[i] - y[i];
+	  const Scalar c = std::min(std::max(d, -delta), delta);
+	  g[i] = c;
+	  //equals 0.5 d^2 inside the band and delta (|d| - delta/2) outside
+	  sum += c * (d - Scalar(0.5) * c);
+	}
+	total += sum;
+      }
+      return total;
+    }
+  };
+
+  struct BinaryCrossEntropyLogits
+  {
+    static constexpr const char* name = "bce_logits";
+
+    template<typename Scalar>
+    static double evaluate(Eigen::Ref<const RowMat<Scalar>> pred, Eigen::Ref<const RowMat<Scalar>> target,
+			   Eigen::Ref<RowMat<Scalar>> grad)
+    {
+      const std::ptrdiff_t n = pred.cols();
+      double total = 0;
+      for(std::ptrdiff_t r = 0; r < pred.rows(); r++){
+	const Scalar* __restrict p = pred.row(r).data();
+	const Scalar* __restrict y = target.row(r).data();
+	Scalar* __restrict g = grad.row(r).data();
+	Scalar sum = 0;
+        #pragma omp simd reduction(+:sum)
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  //e = exp(-|p|) is in (0, 1], so neither term can overflow
+	  const Scalar e = std::exp(-std::abs(p[i]));
+	  const Scalar inv = Scalar(1) / (Scalar(1) + e);
+	  const Scalar sigmoid = p[i] >= 0 ? inv : e * inv;
+	  g[i] = sigmoid - y[i];
+	  sum += std::max(p[i], Scalar(0)) - y[i] * p[i] + std::log1p(e);
+	}
+	total += sum;
+      }
+      return total;
+    }
+  };
+
+  struct SoftmaxCrossEntropy
+  {
+    static constexpr const char* name = "softmax_ce";
+
+    template<typename Scalar>
+    static double evaluate(Eigen::Ref<const RowMat<Scalar>> pred, Eigen::Ref<const RowMat<Scalar>> target,
+			   Eigen::Ref<RowMat<Scalar>> grad)
+    {
+      double total = 0;
+      for(std::ptrdiff_t r = 0; r < pred.rows(); r++){
+	const auto p = pred.row(r).array();
+	const auto y = target.row(r).array();
+	auto g = grad.row(r).array();
+	const Scalar m = p.maxCoeff();
+	//the row stays in L1 between these passes
+	g = (p - m).exp();
+	const Scalar z = g.sum();
+	const Scalar ySum = y.sum();
+	total += (m + std::log(z)) * ySum - (y * p).sum();
+	g = g * (ySum / z) - y;
+      }
+      return total;
+    }
+  };
+
+  template<typename Tag, typename Scalar>
+  LossKernel<Scalar> makeLossKernel()
+  {
+    return {Tag::name, &Tag::template evaluate<Scalar>};
+  }
+
+  //Huber loss with a band of the given half-width
+  template<typename Scalar>
+  LossKernel<Scalar> huberLoss(Scalar delta)
+  {
+    if(not (delta > 0)){
+      throw "Error: the Huber loss needs a positive delta.";
+    }
+    using ConstRef = typename LossKernel<Scalar>::ConstRef;
+    using Ref = typename LossKernel<Scalar>::Ref;
+    return {Huber::name, [delta](ConstRef pred, ConstRef target, Ref grad){
+			   return Huber::evaluate<Scalar>(pred, target, grad, delta);
+			 }};
+  }
+
+  template<typename Scalar>
+  LossKernel<Scalar> lossKernel(const std::string& name)
+  {
+    if(name == SquaredError::name or name == "mse"){
+      return makeLossKernel<SquaredError, Scalar>();
+    } else if(name == AbsoluteError::name){
+      return makeLossKernel<AbsoluteError, Scalar>();
+    } else if(name == Huber::name){
+      return huberLoss<Scalar>(1);
+    } else if(name == BinaryCrossEntropyLogits::name){
+      return makeLossKernel<BinaryCrossEntropyLogits, Scalar>();
+    } else if(name == SoftmaxCrossEntropy::name){
+      return makeLossKernel<SoftmaxCrossEntropy, Scalar>();
+    }
+    throw "Error: unknown loss name.";
+  }
+
+  /*
+   * wraps a loss and its derivative on whole flattened vectors (prediction,
+   * target). This is the slow path: it copies the batch into vectors.
+   * */
+  template<typename Scalar>
+  LossKernel<Scalar>
+  customLossKernel(const std::function<double(Eigen::Matrix<Scalar, Eigen::Dynamic, 1>,
+					      Eigen::Matrix<Scalar, Eigen::Dynamic, 1>)>& loss,
+		   const std::function<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>
+		   (Eigen::Matrix<Scalar, Eigen::Dynamic, 1>, Eigen::Matrix<Scalar, Eigen::Dynamic, 1>)>& deriv)
+  {
+    using ConstRef = typename LossKernel<Scalar>::ConstRef;
+    using Ref = typename LossKernel<Scalar>::Ref;
+    using Vec = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+    return {"custom", [loss, deriv](ConstRef pred, ConstRef target, Ref grad){
+			const RowMat<Scalar> p = pred, y = target;
+			const Vec pv = Eigen::Map<const Vec>(p.data(), p.size());
+			const Vec yv = Eigen::Map<const Vec>(y.data(), y.size());
+			const Vec g = deriv(pv, yv);
+			grad = Eigen::Map<const RowMat<Scalar>>(g.data(), grad.rows(), grad.cols());
+			return loss(pv, yv);
+		      }};
+  }
+
+}//end namespace NN
+#endif //LOSSES_HPP
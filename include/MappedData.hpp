@@ -0,0 +1,160 @@
+#ifndef MAPPED_DATA_HPP
+#define MAPPED_DATA_HPP
+
+#include "Layer.hpp"
+#include "Trainer.hpp"
+#include <Eigen/Core>
+#include <cstdint>
+#include <string>
+
+/*
+ * Memory-mapped datasets.
+ *
+ * Layout (native byte order, every offset from the start of the file):
+ *
+ *   DataFileHeader         64 bytes
+ *   features               rows x featureCols, row-major, 64-byte aligned
+ *   targets                rows x targetCols, row-major, 64-byte aligned
+ *
+ * Features and targets are separate blocks so any run of consecutive rows
+ * is one strided view of each, which is how MappedDataSource hands
+ * unshuffled batches to the network without copying them. Nothing is read
+ * until it is touched, so a file can be far larger than memory; the
+ * BatchLoader's worker faults in (or, shuffled, gathers) the next batch
+ * while the current one trains.
+ * */
+
+namespace NN
+{
+  constexpr char DATA_FILE_MAGIC[8] = {'D','N','N','D','A','T','A','\0'};
+
+  constexpr uint32_t DATA_FILE_VERSION = 1;
+
+  constexpr uint64_t DATA_FILE_ALIGNMENT = 64;
+
+  struct DataFileHeader
+  {
+    char magic[8];
+
+    uint32_t version;
+
+    //sizeof(Scalar) of the stored values
+    uint32_t scalarBytes;
+
+    int64_t rows;
+
+    int64_t featureCols;
+
+    int64_t targetCols;
+
+    uint64_t featureOffset;
+
+    uint64_t targetOffset;
+
+    uint64_t fileBytes;
+  };
+
+  static_assert(sizeof(DataFileHeader) == 64, "data file header must be 64 bytes");
+
+  //writes features and targets (same number of rows) to a data file
+  template<typename Scalar>
+  void writeDataFile(const std::string& path, Eigen::Ref<const RowMat<Scalar>> features,
+		     Eigen::Ref<const RowMat<Scalar>> targets);
+
+  /*
+   * converts a CSV of numbers, one sample per line, into a data file. The
+   * last targetCols columns are the targets. The CSV is streamed twice (to
+   * count the rows, then to write them), never held in memory. Returns the
+   * number of rows written.
+   * */
+  template<typename Scalar>
+  int_t convertCsv(const std::string& csvPath, const std::string& dataPath,
+		   int_t targetCols, bool skipHeader=false);
+
+
+  /*
+   * A data file mapped read-only. gather() copies rows out of the mapping;
+   * viewRows() points straight into it.
+   * */
+  template<typename Scalar>
+  class BasicMappedDataSource : public BasicDataSource<Scalar>
+  {
+  public:
+
+    using typename BasicDataSource<Scalar>::Mat;
+
+    using typename BasicDataSource<Scalar>::MatRef;
+
+    using DataMap = Eigen::Map<const Mat, Eigen::Aligned64>;
+
+  protected:
+
+    const unsigned char* base = nullptr;
+
+    size_t length = 0;
+
+    const DataFileHeader* header = nullptr;
+
+    const Scalar* featureData = nullptr;
+
+    const Scalar* targetData = nullptr;
+
+    void unmap() noexcept;
+
+  public:
+
+    explicit BasicMappedDataSource(const std::string& path);
+
+    ~BasicMappedDataSource();
+
+    BasicMappedDataSource(const BasicMappedDataSource&) = delete;
+
+    BasicMappedDataSource& operator=(const BasicMappedDataSource&) = delete;
+
+    int_t size() const override
+    {
+      return header->rows;
+    }
+
+    int_t featureCount() const override
+    {
+      return header->featureCols;
+    }
+
+    int_t targetCount() const override
+    {
+      return header->targetCols;
+    }
+
+    //the whole feature block, in place
+    DataMap features() const noexcept
+    {
+      return DataMap(featureData, header->rows, header->featureCols);
+    }
+
+    DataMap targets() const noexcept
+    {
+      return DataMap(targetData, header->rows, header->targetCols);
+    }
+
+    void gather(const int_t* idx, int_t count,
+		MatRef batchFeatures, MatRef batchTargets) const override;
+
+    bool viewRows(int_t first, int_t count, const Scalar*& batchFeatures, int_t& featureStride,
+		  const Scalar*& batchTargets, int_t& targetStride) const override;
+
+    //asks the kernel for the rows' pages and touches them, so they are
+    //resident before the training thread reads them
+    void willNeed(int_t first, int_t count) const override;
+  };
+
+  using MappedDataSource = BasicMappedDataSource<double>;
+
+  using MappedDataSourcef = BasicMappedDataSource<float>;
+
+  extern template class BasicMappedDataSource<double>;
+
+  extern template class BasicMappedDataSource<float>;
+
+}//end namespace NN
+#endif //MAPPED_DATA_HPP
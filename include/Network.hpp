@@ -2,8 +2,12 @@
 #define NETWORK_HPP
 
 #include "Layer.hpp"
+#include "LayerGraph.hpp"
+#include "Losses.hpp"
+#include "Profiler.hpp"
 #include <Eigen/Core>
 #include <Eigen/Dense>
+#include <algorithm>
 #include <unordered_map>
 #include <functional>
 #include <optional>
@@ -22,22 +26,93 @@
 
 namespace NN
 {
-  std::unordered_map<std::string, std::function<double(Eigen::Ref<const Vec>, Eigen::Ref<const Vec>)>>
-  VECTOR_LOSS = {
-		 {"L2", [](Eigen::Ref<const Vec> pred, Eigen::Ref<const Vec> obs) -> double {
-			  Vec resid = pred - obs;
-			  return 0.5 * resid.dot(resid);
+  template<typename Scalar>
+  using LossFunc = std::function<double(Eigen::Ref<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>,
+					Eigen::Ref<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>)>;
+
+  template<typename Scalar>
+  using LossDerivative = std::function<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>
+				       (Eigen::Ref<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>,
+					Eigen::Ref<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>)>;
+
+  template<typename Scalar>
+  inline std::unordered_map<std::string, LossFunc<Scalar>>
+  BASIC_VECTOR_LOSS = {
+		 {"L2", [](auto pred, auto obs) -> double {
+			  return 0.5 * (pred - obs).squaredNorm();
 			}
 		 }
   };
 
-  std::unordered_map<std::string, std::function<Vec(Eigen::Ref<const Vec>, Eigen::Ref<const Vec>)>>
-  VECTOR_LOSS_DERIVATIVE = {
-											  {"L2", [](Eigen::Ref<const Vec> pred, Eigen::Ref<const Vec> obs) -> Vec { return pred - obs; } }
+  template<typename Scalar>
+  inline std::unordered_map<std::string, LossDerivative<Scalar>>
+  BASIC_VECTOR_LOSS_DERIVATIVE = {
+				  {"L2", [](auto pred, auto obs) -> Eigen::Matrix<Scalar, Eigen::Dynamic, 1> { return pred - obs; } }
   };
 
-  class Network
+  static auto& VECTOR_LOSS = BASIC_VECTOR_LOSS<double>;
+
+  static auto& VECTOR_LOSS_DERIVATIVE = BASIC_VECTOR_LOSS_DERIVATIVE<double>;
+
+  /*
+   * Gradual magnitude pruning during training. From update startStep to
+   * endStep, every frequency updates, each layer is pruned to
+   * finalSparsity * (1 - (1 - progress)^3), progress running from 0 to 1
+   * over the interval: the cubic schedule of Zhu and Gupta, which prunes
+   * fast while the network still has redundancy and slowly at the end.
+   * */
+  struct PruningSchedule
   {
+    double finalSparsity = 0;
+
+    size_t startStep = 0;
+
+    size_t endStep = 0;
+
+    size_t frequency = 100;
+
+    double sparsityAt(size_t step) const noexcept
+    {
+      const double progress = endStep > startStep
+	? std::min(1.0, double(step - std::min(step, startStep)) / (endStep - startStep)) : 1.0;
+      return finalSparsity * (1 - std::pow(1 - progress, 3));
+    }
+
+    //whether the update numbered step prunes
+    bool prunesAt(size_t step) const noexcept
+    {
+      return finalSparsity > 0 and step >= startStep and step <= endStep
+	and ((step - startStep) % frequency == 0 or step == endStep);
+    }
+  };
+
+  template<typename Scalar>
+  class BasicDataParallel;
+
+  template<typename Scalar>
+  class BasicDistributedDataParallel;
+
+  /*
+   * A sequence of BasicLayer<Scalar>s trained against a vector loss.
+   * Network and Networkf name the double and float versions.
+   * */
+  template<typename Scalar>
+  class BasicNetwork
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using Vec = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+    using MatRef = Eigen::Ref<Mat>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+    using ConstVecRef = Eigen::Ref<const Vec>;
+
+    using Layer = BasicLayer<Scalar>;
+
   protected:
 		
     std::pair<int_t, int_t> input_shape;
@@ -46,106 +121,148 @@ namespace NN
 
     int_t num_outputs;
 
-    Vec outputs;
-
     Vec target;
 
     std::list<Layer> layers;
 
     std::list<std::pair<int_t, int_t>> layer_input_shapes;
 
-    std::function<double(Eigen::Ref<const Vec>,Eigen::Ref<const Vec>)> vector_loss_func;
-
-    std::function<Vec(Eigen::Ref<const Vec>,Eigen::Ref<const Vec>)> vector_loss_derivative;
+    LossKernel<Scalar> loss_kernel = lossKernel<Scalar>("L2");
 
+    //dL/d(outputs), planned_rows x num_outputs
     Vec loss_deriv;
 
     double scalar_loss;
 
     std::vector<double> trainingLoss;
 
-    Vec resid;
-
     Mat gradient;
 
-    UpdateRule update = UpdateRule::NesterovAccGrad;
+    //batch size the layer buffers are currently sized for
+    int_t planned_rows = 0;
+
+    //every layer's weights, gradients and optimizer state, one tensor per layer
+    BasicParameterArena<Scalar> arena;
+
+    //the layers as a flat, shape-checked execution plan
+    BasicLayerGraph<Scalar> graph;
+
+    //the fused optimizer pass and the arena; the layers keep their own
+    LayerProfile networkProfile;
+
+    //layer passes, while startTrace() is in effect
+    TraceRecorder trace;
+
+    PruningSchedule pruning;
+
+    //runs this network's passes on its own replicas
+    friend class BasicDataParallel<Scalar>;
+
+    friend class BasicDistributedDataParallel<Scalar>;
+
+    /*
+     * The passes predict(), predictBatch(), trainStep() and train() are
+     * made of. A subclass with an output layer past the layers, such as
+     * BasicPlapNetwork, overrides these, backwardPass(), getOutputs() and
+     * getNumOutputs() to run it.
+     * */
+
+    //runs the layers on batchInputs, read in place; returns the network's outputs
+    virtual const Mat& forward(ConstMatRef batchInputs);
+
+    //scalar_loss and loss_deriv for the last forward pass, in one pass
+    virtual void evaluateLoss(ConstMatRef targets);
+
+    //the layers' profiles and the network's, named for export
+    std::vector<ProfileEntry> profileEntries() const;
+
+    //gives each layer without an input shape its predecessor's outputs;
+    //false while the first layer's input shape is unknown
+    bool inferShapes();
+
+    //the first layer's input shape from the first batch, if still unknown
+    void inferInputShape(ConstMatRef batchInputs);
 
   public:
 
-    Network(std::pair<int_t, int_t> _input_shape,
+    BasicNetwork(std::pair<int_t, int_t> _input_shape,
 	    int_t _num_outputs,
 	    std::string activation,
 	    std::string loss="L2")
       : input_shape(_input_shape),
 	num_outputs(_num_outputs),
-	vector_loss_func(VECTOR_LOSS[loss]),
-	vector_loss_derivative(VECTOR_LOSS_DERIVATIVE[loss])
+	loss_kernel(lossKernel<Scalar>(loss))
 
     {
       Layer finalLayer(input_shape, num_outputs, activation);
       layers.push_back({finalLayer});
 
-      layer_input_shapes.push_back({input_shape});
-
-      Eigen::setNbThreads(0);
+      compile();
     };
 
-    Network(std::initializer_list<Layer> _layers)
+    BasicNetwork(std::initializer_list<Layer> _layers)
       : layers(_layers) 
     {
-      for(const auto& it : layers){
-	layer_input_shapes.push_back(it.getInputShape());
-      }
-      input_shape = layer_input_shapes.front();
-
-      num_outputs = layers.back().getOutputSize();
-
-      Eigen::setNbThreads(0);
-
+      compile();
     };
 
-    Network(std::string activation,
+    BasicNetwork(std::string activation,
 	    std::string loss,
 	    std::initializer_list<Layer> _layers)
       : layers(_layers),
-	vector_loss_func(VECTOR_LOSS[loss]),
-	vector_loss_derivative(VECTOR_LOSS_DERIVATIVE[loss])
+	loss_kernel(lossKernel<Scalar>(loss))
 
     {
       for(auto& it : layers){
-	layer_input_shapes.push_back(it.getInputShape());
 	it.setActivation(activation);
       }
-      input_shape = layer_input_shapes.front();
-
-      num_outputs = layers.back().getOutputSize();
-
-      Eigen::setNbThreads(0);
-
+      compile();
     };
 
-    Network(std::string activation,
+    /*
+     * dense layers of the given activation between a list of shapes: each
+     * entry but the last is a layer's input shape, so a layer's outputs are
+     * the next entry's columns, and the last is the network's output shape
+     * */
+    BasicNetwork(std::string activation,
 	    std::string loss,
 	    const std::list<std::pair<int_t, int_t>> _layer_input_shapes) :
-      layer_input_shapes(_layer_input_shapes),
-      vector_loss_func(VECTOR_LOSS[loss]),
-      vector_loss_derivative(VECTOR_LOSS_DERIVATIVE[loss])
+      loss_kernel(lossKernel<Scalar>(loss))
     {
-      std::list<Layer> layerList;
-      for(const auto& lis : layer_input_shapes){
-	layerList.push_back(Layer(lis, lis.first, activation));
+      if(_layer_input_shapes.size() < 2){
+	throw "Error: need the input shape of at least one layer and the output shape.";
+      }
+      for(auto it = _layer_input_shapes.begin(); std::next(it) != _layer_input_shapes.end(); it++){
+	layers.push_back(Layer(*it, std::next(it)->second, activation));
       }
-      layers = layerList;
-      num_outputs = layers.back().getOutputSize();
+      compile();
+    };
+
+    /*
+     * a network with no layers yet, for building with addDense() and
+     * addLayer(). Until the first batch, or setInputs(), gives the first
+     * layer its input shape, the network holds no weights and has no plan.
+     * */
+    explicit BasicNetwork(std::string loss)
+      : input_shape(0, 0),
+	num_outputs(0),
+	loss_kernel(lossKernel<Scalar>(loss))
+    {
+    };
 
-      input_shape = layer_input_shapes.front();
+    //copies get their own arena
+    BasicNetwork(const BasicNetwork& other);
 
-      Eigen::setNbThreads(0);
+    BasicNetwork& operator=(const BasicNetwork& other);
 
-    };
+    BasicNetwork(BasicNetwork&&) = default;
+
+    BasicNetwork& operator=(BasicNetwork&&) = default;
+
+    virtual ~BasicNetwork() = default;
 
 
-    auto getLayers() const noexcept
+    const std::list<Layer>& getLayers() const noexcept
     {
       return layers;
     }
@@ -160,14 +277,27 @@ namespace NN
       return input_shape;
     }
 
-    auto getNumOutputs() const noexcept
+    //values per row of the network's outputs and targets
+    virtual int_t getNumOutputs() const noexcept
     {
       return num_outputs;
     }
 
-    auto getOutputs() const
+    /*
+     * whether the network's outputs come from an output layer of a subclass
+     * past its layers. The data-parallel trainers and the frozen models run
+     * the layers alone, and refuse such networks.
+     * */
+    virtual bool hasOutputLayer() const noexcept
     {
-      return outputs;
+      return false;
+    }
+
+    //last pass's outputs, flattened row by row
+    virtual Vec getOutputs() const
+    {
+      const Mat& out = layers.back().getOutputs();
+      return Eigen::Map<const Vec>(out.data(), out.size());
     }
 
     auto getTarget() const
@@ -195,18 +325,130 @@ namespace NN
       return trainingLoss;
     }
 
+    void setLossHistory(const std::vector<double>& history)
+    {
+      trainingLoss = history;
+    }
+
     //gets weights for first layer
-    auto getFirstWeights() const
+    const typename Layer::ParamMap& getFirstWeights() const noexcept
     {
       return layers.front().getWeights();
     }
 
-    void setNumThreads(int n) {
-      Eigen::setNbThreads(n);
+    /*
+     * checks the layer shapes, packs the parameters and rebuilds the
+     * execution plan. Every change to the layer list or a layer's shape
+     * recompiles; throws if a layer's inputs don't match its predecessor.
+     * Layers built from an output size alone get their input shapes here,
+     * from the layers before them; while the first one's is unknown,
+     * compiling waits for the first batch.
+     * */
+    void compile();
+
+    //whether every layer's shape is known, so the network holds its weights
+    bool hasShapes() const noexcept
+    {
+      return not layer_input_shapes.empty();
+    }
+
+    /*
+     * appends a layer and recompiles; returns the network, so layers chain:
+     * Network net("L2"); net.addDense(64).addDense(64).addDense(1, "linear");
+     * */
+    BasicNetwork& addLayer(const Layer& layer)
+    {
+      layers.push_back(layer);
+      compile();
+      return *this;
+    }
+
+    //a dense layer of the given outputs, its inputs those of the layer before
+    BasicNetwork& addDense(int_t outputs, std::string activation="relu", WeightInit init=WeightInit::Auto)
+    {
+      return addLayer(Layer(outputs, activation, init));
+    }
+
+    const BasicLayerGraph<Scalar>& getGraph() const noexcept
+    {
+      return graph;
+    }
+
+    /*
+     * moves every layer's parameters into one fresh arena, in layer order.
+     * A layer that holds no weights yet gets them drawn in place there.
+     * Layers taken out of the network by copy get their own storage back.
+     * */
+    void packParameters();
+
+    //whether every layer currently views its tensors in the arena
+    bool parametersPacked() const noexcept;
+
+    const BasicParameterArena<Scalar>& getParameterArena() const noexcept
+    {
+      return arena;
+    }
+
+    //e.g. for reducing the Gradients region in place
+    BasicParameterArena<Scalar>& getParameterArena() noexcept
+    {
+      return arena;
+    }
+
+    //a copy of the whole Weights region, one memcpy
+    AlignedBuffer<Scalar> snapshotWeights() const;
+
+    //undoes training since snapshotWeights(); optimizer state is untouched
+    void restoreWeights(const AlignedBuffer<Scalar>& snapshot);
+
+    /*
+     * n threads for every current layer. Eigen's GEMM gets n threads unless the mode
+     * is Parallelism::Batch, where the layers split the batch themselves.
+     * Eigen's thread count is process-wide.
+     * */
+    void setNumThreads(int n, Parallelism mode=Parallelism::Auto)
+    {
+      for(auto& l : layers){
+	l.setNumThreads(n, mode);
+      }
+      Eigen::setNbThreads(mode == Parallelism::Batch ? 1 : n);
+      //the plan's batch splitting depends on the thread count
+      planned_rows = 0;
     }
 
+    //batch norms use their batch's statistics, and update their running
+    //ones, while training, and the running statistics otherwise
+    void setTraining(bool training) noexcept
+    {
+      for(auto& l : layers){
+	l.setTraining(training);
+      }
+    }
+
+    /*
+     * Merges every batch norm that follows a linear dense layer or
+     * convolution into that layer's weights and bias, where it costs nothing
+     * at serving time; the layer takes the norm's activation. The network
+     * then computes what it computed in inference mode. Returns the number
+     * of norms folded.
+     * */
+    int foldBatchNorm();
+
     void setInputs(ConstMatRef _inputs, bool overrideInputShape=false);
 
+    /*
+     * allocates every layer's activation, error and gradient buffers for
+     * batches of batchRows. predict() calls this whenever the batch size
+     * changes; after that, each layer reads the previous layer's output
+     * buffer in place and steps over same-sized batches reuse the buffers.
+     * */
+    void plan(int_t batchRows);
+
+    /*
+     * targets for predict(): num_outputs values for each row of the inputs,
+     * row after row. With overrideTargetSize, a target of another width
+     * resizes the last layer to match.
+     * */
     void setTarget(Eigen::Ref<const Vec> _target, bool overrideTargetSize=false);
 
     void setLayers(const std::list<Layer>& newLayers);
@@ -251,6 +493,17 @@ namespace NN
     //different args for each layer
     void setUpdateParams(const std::list<std::tuple<double,double>>& argsList);
 
+    //same update rule for each layer, e.g. setUpdateParams(adam(1e-3))
+    void setUpdateParams(const OptimizerParams& params)
+    {
+      for(auto& l : layers){
+	l.setUpdateParams(params);
+      }
+    }
+
+    //a rule for each layer
+    void setUpdateParams(const std::list<OptimizerParams>& paramsList);
+
     //same activation for each layer
     void setActivations(std::string activations) noexcept
     {
@@ -261,36 +514,66 @@ namespace NN
 
     void setActivations(const std::list<std::string>& activations);
 
+    //one of the losses in Losses.hpp, e.g. "softmax_ce"; unknown names throw
     void setLossFunc(std::string loss)
     {
-      vector_loss_func = VECTOR_LOSS[loss];
-      vector_loss_derivative = VECTOR_LOSS_DERIVATIVE[loss];
+      loss_kernel = lossKernel<Scalar>(loss);
     }
-		
+
+    void setLossFunc(const LossKernel<Scalar>& kernel)
+    {
+      loss_kernel = kernel;
+    }
+
+    //loss and derivative on the flattened batch; slower than a LossKernel
     void setLossFunc(const std::function<double(Vec,Vec)>& _vector_loss_func,
 		     const std::function<Vec(Vec,Vec)>& _vector_loss_derivative)
     {
-      vector_loss_func = _vector_loss_func;
-      vector_loss_derivative = _vector_loss_derivative;
+      loss_kernel = customLossKernel<Scalar>(_vector_loss_func, _vector_loss_derivative);
+    }
+
+    auto getLossName() const
+    {
+      return loss_kernel.name;
     }
 
-    //runs a forward pass through the layers, returning the output if desired
-    void predict(std::optional<Mat> inputData=std::nullopt,
-		 std::optional<Vec> _target=std::nullopt);
+    /*
+     * runs a forward pass through the layers, returning the output if desired.
+     * New inputs/targets are viewed, not copied, until setInputs/setTarget
+     * store them; for data that doesn't fit in memory use a Trainer with a
+     * MappedDataSource.
+     * */
+    void predict(std::optional<ConstMatRef> inputData=std::nullopt,
+		 std::optional<ConstVecRef> _target=std::nullopt);
 		
+    /*
+     * forward pass on a batch read in place, without evaluating a loss.
+     * Returns the outputs (batchInputs.rows() x getNumOutputs()),
+     * valid until the next pass.
+     * */
+    const Mat& predictBatch(ConstMatRef batchInputs);
+
     //same as predict(), but returns the output
-    Vec predictVal(std::optional<Mat> inputData=std::nullopt,
-		   std::optional<Vec> _target=std::nullopt);
+    Vec predictVal(std::optional<ConstMatRef> inputData=std::nullopt,
+		   std::optional<ConstVecRef> _target=std::nullopt);
 
     //computes gradient of network
-    void backwardPass();
-
-    void updateWeights()
-    {
-      for(auto& l : layers){
-	l.updateWeights();
-      }
-    }
+    virtual void backwardPass();
+
+    /*
+     * one gradient step on a batch: predict, backwardPass and updateWeights
+     * on views of the caller's buffers, which are not copied. batchTargets
+     * holds getNumOutputs() values per row of batchInputs. Losses and gradients
+     * are summed over the batch, so the learning rate applies to the sum.
+     * Returns the batch loss, which is also appended to the loss history.
+     * */
+    double trainStep(ConstMatRef batchInputs, ConstMatRef batchTargets);
+
+    /*
+     * one optimizer step for every layer. When all layers share an update
+     * rule and step count, this is a single fused pass over the arena.
+     * */
+    void updateWeights();
 
     void updateWeights(const std::list<std::tuple<double,double>>& argsList)
     {
@@ -306,16 +589,80 @@ namespace NN
 
     void train(double stopTol=1.0e-5, 
 	       size_t maxIter=1.0e3,
-	       std::optional<Mat> inputData=std::nullopt,
-	       std::optional<Vec> _newtarget=std::nullopt,
+	       std::optional<ConstMatRef> inputData=std::nullopt,
+	       std::optional<ConstVecRef> _newtarget=std::nullopt,
 	       bool noprint=false);		
 
+    //magnitude-prunes every layer to at least sparsity; see BasicLayer::prune
+    void prune(double sparsity);
+
+    /*
+     * prunes on schedule from within updateWeights(), and so from train(),
+     * trainStep() and the data-parallel trainers alike. DataParallel
+     * replicas keep running their old pattern, which is still correct,
+     * until the next sync().
+     * */
+    void setPruning(const PruningSchedule& schedule);
+
+    const PruningSchedule& getPruning() const noexcept
+    {
+      return pruning;
+    }
+
     void summary();
 
+    //zeroes every layer's counters and the network's
+    void resetProfile() noexcept;
+
+    //records up to maxEvents layer passes, replacing any earlier trace
+    void startTrace(size_t maxEvents=(1 << 16))
+    {
+      trace.start(maxEvents);
+    }
+
+    void stopTrace() noexcept
+    {
+      trace.stop();
+    }
+
+    /*
+     * per-layer, per-phase cycles, calls and FLOPs and bytes allocated, as
+     * JSON. All zero unless the library was built with DNN_PROFILE.
+     * */
+    void writeProfile(std::ostream& ostr) const;
+
+    //the passes recorded since startTrace(), in Chrome's trace event format
+    void writeTrace(std::ostream& ostr) const;
+
     void visualizeNetwork();
 
   };
 
+  using Network = BasicNetwork<double>;
+
+  using Networkf = BasicNetwork<float>;
+
+  extern template class BasicNetwork<double>;
+
+  extern template class BasicNetwork<float>;
+
+
+  namespace internal
+  {
+    //a copy of net with its batch norms folded, or nothing if it has none
+    template<typename Scalar>
+    std::optional<BasicNetwork<Scalar>> withBatchNormFolded(const BasicNetwork<Scalar>& net)
+    {
+      const auto& layers = net.getLayers();
+      if(std::none_of(layers.begin(), layers.end(),
+		      [](const auto& l){ return l.getKind() == LayerKind::BatchNorm; })){
+	return std::nullopt;
+      }
+      std::optional<BasicNetwork<Scalar>> folded(net);
+      folded->foldBatchNorm();
+      return folded;
+    }
+  }//end namespace internal
 
 }//end namespace NN
 #endif
@@ -0,0 +1,105 @@
+#ifndef NORMALIZATION_HPP
+#define NORMALIZATION_HPP
+
+#include "Activations.hpp"
+#include "Conv.hpp"
+#include <Eigen/Core>
+#include <cstdint>
+
+/*
+ * Batch and layer normalization.
+ *
+ * Both normalize their inputs to zero mean and unit variance and then
+ * scale and shift them by learned gamma and beta: the layer's weights are
+ * 2 x parameters, gamma in the first row and beta in the last, where the
+ * bias of the other layers goes.
+ *
+ * A batch norm's statistics are taken per channel, over the batch and,
+ * for NHWC rows, over every position, so one channel shares one gamma and
+ * beta. Training uses the statistics of the batch and updates running
+ * ones, which inference uses instead; those are linear in the input and
+ * fold into the weights of a linear layer before the norm. A layer norm's
+ * statistics are taken per sample over all its features, so it behaves
+ * the same in training and inference, and gamma and beta are per feature.
+ * */
+
+namespace NN
+{
+  struct NormSpec
+  {
+    LayerKind kind = LayerKind::BatchNorm;
+
+    //values per sample
+    int_fast64_t features = 1;
+
+    //batch norm channels, the fastest-varying index of a row; features for dense inputs
+    int_fast64_t channels = 1;
+
+    double epsilon = 1e-5;
+
+    //weight of each new batch in a batch norm's running statistics
+    double momentum = 0.1;
+
+    //columns of gamma and beta
+    int_fast64_t parameters() const noexcept
+    {
+      return kind == LayerKind::BatchNorm ? channels : features;
+    }
+
+    //throws on a spec whose channels do not divide its features
+    void validate() const;
+  };
+
+  //channels 0 means one per feature, as after a dense layer
+  inline NormSpec batchNorm(int_fast64_t features, int_fast64_t channels=0, double momentum=0.1,
+			    double epsilon=1e-5)
+  {
+    return {LayerKind::BatchNorm, features, channels ? channels : features, epsilon, momentum};
+  }
+
+  inline NormSpec layerNorm(int_fast64_t features, double epsilon=1e-5)
+  {
+    return {LayerKind::LayerNorm, features, features, epsilon, 0};
+  }
+
+
+  namespace internal
+  {
+    /*
+     * The statistics of x a normalization uses: stats = [mean; 1/sqrt(var +
+     * epsilon)] with one column per row of x for a layer norm, and [mean;
+     * 1/sqrt(var + epsilon); var] with one column per channel, over all rows
+     * and positions, for a batch norm. Variances are biased.
+     * */
+    template<typename Scalar>
+    void normStatistics(Eigen::Ref<const RowMat<Scalar>> x, const NormSpec& spec,
+			Eigen::Ref<RowMat<Scalar>> stats) noexcept;
+
+    //normalized = (x - mean) * invStd; preact = gamma * normalized + beta.
+    //A layer norm's stats are those of the rows of x.
+    template<typename Scalar>
+    void normalize(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> stats,
+		   Eigen::Ref<const RowMat<Scalar>> weights, const NormSpec& spec,
+		   Eigen::Ref<RowMat<Scalar>> normalized, Eigen::Ref<RowMat<Scalar>> preact) noexcept;
+
+    //grad += [sum(e * normalized); sum(e)], summed per parameter column
+    template<typename Scalar>
+    void normGradient(Eigen::Ref<const RowMat<Scalar>> normalized, Eigen::Ref<const RowMat<Scalar>> e,
+		      const NormSpec& spec, Eigen::Ref<RowMat<Scalar>> grad) noexcept;
+
+    /*
+     * dx = the error e of rows of the batch sent back through the
+     * normalization. A batch norm that used its batch's statistics needs
+     * the batch's whole gradient, errSums, and its row count, since every
+     * input moved them; one that used running statistics is a fixed affine
+     * map.
+     * */
+    template<typename Scalar>
+    void normBackwardData(Eigen::Ref<const RowMat<Scalar>> normalized, Eigen::Ref<const RowMat<Scalar>> e,
+			  Eigen::Ref<const RowMat<Scalar>> stats, Eigen::Ref<const RowMat<Scalar>> weights,
+			  Eigen::Ref<const RowMat<Scalar>> errSums, int_fast64_t batchRows, bool batchStatistics,
+			  const NormSpec& spec, Eigen::Ref<RowMat<Scalar>> dx) noexcept;
+
+  }//end namespace internal
+}//end namespace NN
+#endif //NORMALIZATION_HPP
@@ -0,0 +1,276 @@
+#ifndef OPTIMIZERS_HPP
+#define OPTIMIZERS_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Parameter update rules.
+ *
+ * Each rule is a tag with a static step() that updates a contiguous run of
+ * parameters and its optimizer state in one fused pass: every element is
+ * loaded once, updated in registers and stored once. Row slices of a
+ * row-major weight matrix are contiguous, so a layer can hand each thread
+ * its own slice. The gradient g is whatever the layer accumulated (for
+ * batches, the sum over rows).
+ *
+ * State per rule, in terms of a layer's two state buffers:
+ *
+ *   Momentum         velocity in first
+ *   NesterovAccGrad  velocity in first
+ *   Adam, AdamW      first and second moments in first, second
+ *   RMSProp          mean square gradient in second
+ *   Adagrad          sum of squared gradients in second
+ * */
+
+namespace NN
+{
+  enum class UpdateRule : uint32_t
+    {
+     Momentum,//u = m u - lr g; w += u
+     NesterovAccGrad,//momentum evaluated at the look-ahead point
+     Adam,
+     AdamW,//Adam with weight decay decoupled from the gradient
+     RMSProp,
+     Adagrad
+    };
+
+  /*
+   * hyperparameters of an update rule. momentum doubles as Adam's beta1;
+   * beta2 is Adam's second moment decay and RMSProp's decay rate.
+   * weightDecay is only used by AdamW.
+   * */
+  struct OptimizerParams
+  {
+    UpdateRule rule = UpdateRule::Momentum;
+
+    double learningRate = 0.0;
+
+    double momentum = 0.0;
+
+    double beta2 = 0.999;
+
+    double epsilon = 1.0e-8;
+
+    double weightDecay = 0.0;
+  };
+
+  inline bool operator==(const OptimizerParams& a, const OptimizerParams& b) noexcept
+  {
+    return a.rule == b.rule and a.learningRate == b.learningRate and a.momentum == b.momentum and
+      a.beta2 == b.beta2 and a.epsilon == b.epsilon and a.weightDecay == b.weightDecay;
+  }
+
+  inline bool operator!=(const OptimizerParams& a, const OptimizerParams& b) noexcept
+  {
+    return not (a == b);
+  }
+
+  inline OptimizerParams momentumSGD(double lr, double momentum)
+  {
+    return {UpdateRule::Momentum, lr, momentum};
+  }
+
+  inline OptimizerParams nesterov(double lr, double momentum)
+  {
+    return {UpdateRule::NesterovAccGrad, lr, momentum};
+  }
+
+  inline OptimizerParams adam(double lr, double beta1=0.9, double beta2=0.999, double eps=1.0e-8)
+  {
+    return {UpdateRule::Adam, lr, beta1, beta2, eps};
+  }
+
+  inline OptimizerParams adamW(double lr, double weightDecay, double beta1=0.9,
+			       double beta2=0.999, double eps=1.0e-8)
+  {
+    return {UpdateRule::AdamW, lr, beta1, beta2, eps, weightDecay};
+  }
+
+  inline OptimizerParams rmsProp(double lr, double decay=0.9, double eps=1.0e-8)
+  {
+    return {UpdateRule::RMSProp, lr, 0.0, decay, eps};
+  }
+
+  inline OptimizerParams adagrad(double lr, double eps=1.0e-8)
+  {
+    return {UpdateRule::Adagrad, lr, 0.0, 0.0, eps};
+  }
+
+  //whether rule keeps anything in the first/second state buffer
+  constexpr bool usesFirstState(UpdateRule rule) noexcept
+  {
+    return rule == UpdateRule::Momentum or rule == UpdateRule::NesterovAccGrad or
+      rule == UpdateRule::Adam or rule == UpdateRule::AdamW;
+  }
+
+  constexpr bool usesSecondState(UpdateRule rule) noexcept
+  {
+    return rule == UpdateRule::Adam or rule == UpdateRule::AdamW or
+      rule == UpdateRule::RMSProp or rule == UpdateRule::Adagrad;
+  }
+
+  namespace optim
+  {
+    /*
+     * Everything a step needs besides the arrays, in Scalar and with the
+     * step-dependent factors (Adam's bias corrections) already worked out,
+     * so the inner loops hold no pow() or double/float conversions.
+     * */
+    template<typename Scalar>
+    struct StepConstants
+    {
+      Scalar lr, momentum, beta2, epsilon, weightDecay;
+
+      //Adam: 1/(1 - beta1^t), 1/(1 - beta2^t)
+      Scalar correction1, correction2;
+
+      StepConstants(const OptimizerParams& p, int64_t step)
+	: lr(p.learningRate),
+	  momentum(p.momentum),
+	  beta2(p.beta2),
+	  epsilon(p.epsilon),
+	  weightDecay(p.weightDecay),
+	  correction1(1.0 / (1.0 - std::pow(p.momentum, double(step)))),
+	  correction2(1.0 / (1.0 - std::pow(p.beta2, double(step))))
+      {
+      };
+    };
+
+    struct Momentum
+    {
+      template<typename Scalar>
+      static void step(const StepConstants<Scalar>& c, std::ptrdiff_t n, Scalar* __restrict w,
+		       const Scalar* __restrict g, Scalar* __restrict u, Scalar*)
+      {
+        #pragma omp simd
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar ui = c.momentum * u[i] - c.lr * g[i];
+	  u[i] = ui;
+	  w[i] += ui;
+	}
+      }
+    };
+
+    //Sutskever et al.'s form, written for the stored (not look-ahead) weights
+    struct NesterovAccGrad
+    {
+      template<typename Scalar>
+      static void step(const StepConstants<Scalar>& c, std::ptrdiff_t n, Scalar* __restrict w,
+		       const Scalar* __restrict g, Scalar* __restrict u, Scalar*)
+      {
+        #pragma omp simd
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar ui = c.momentum * u[i] - c.lr * g[i];
+	  u[i] = ui;
+	  w[i] += c.momentum * ui - c.lr * g[i];
+	}
+      }
+    };
+
+    struct Adam
+    {
+      template<typename Scalar>
+      static void step(const StepConstants<Scalar>& c, std::ptrdiff_t n, Scalar* __restrict w,
+		       const Scalar* __restrict g, Scalar* __restrict m, Scalar* __restrict v)
+      {
+	const Scalar b1 = c.momentum;
+	const Scalar b2 = c.beta2;
+        #pragma omp simd
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar mi = b1 * m[i] + (1 - b1) * g[i];
+	  const Scalar vi = b2 * v[i] + (1 - b2) * g[i] * g[i];
+	  m[i] = mi;
+	  v[i] = vi;
+	  w[i] -= c.lr * (mi * c.correction1) / (std::sqrt(vi * c.correction2) + c.epsilon);
+	}
+      }
+    };
+
+    struct AdamW
+    {
+      template<typename Scalar>
+      static void step(const StepConstants<Scalar>& c, std::ptrdiff_t n, Scalar* __restrict w,
+		       const Scalar* __restrict g, Scalar* __restrict m, Scalar* __restrict v)
+      {
+	const Scalar b1 = c.momentum;
+	const Scalar b2 = c.beta2;
+        #pragma omp simd
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar mi = b1 * m[i] + (1 - b1) * g[i];
+	  const Scalar vi = b2 * v[i] + (1 - b2) * g[i] * g[i];
+	  m[i] = mi;
+	  v[i] = vi;
+	  w[i] -= c.lr * ((mi * c.correction1) / (std::sqrt(vi * c.correction2) + c.epsilon)
+			  + c.weightDecay * w[i]);
+	}
+      }
+    };
+
+    struct RMSProp
+    {
+      template<typename Scalar>
+      static void step(const StepConstants<Scalar>& c, std::ptrdiff_t n, Scalar* __restrict w,
+		       const Scalar* __restrict g, Scalar*, Scalar* __restrict s)
+      {
+	const Scalar rho = c.beta2;
+        #pragma omp simd
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar si = rho * s[i] + (1 - rho) * g[i] * g[i];
+	  s[i] = si;
+	  w[i] -= c.lr * g[i] / (std::sqrt(si) + c.epsilon);
+	}
+      }
+    };
+
+    struct Adagrad
+    {
+      template<typename Scalar>
+      static void step(const StepConstants<Scalar>& c, std::ptrdiff_t n, Scalar* __restrict w,
+		       const Scalar* __restrict g, Scalar*, Scalar* __restrict s)
+      {
+        #pragma omp simd
+	for(std::ptrdiff_t i = 0; i < n; i++){
+	  const Scalar si = s[i] + g[i] * g[i];
+	  s[i] = si;
+	  w[i] -= c.lr * g[i] / (std::sqrt(si) + c.epsilon);
+	}
+      }
+    };
+  }//end namespace optim
+
+  /*
+   * one update of n contiguous parameters w with gradient g and state
+   * buffers first/second (either may be null if the rule doesn't use it).
+   * step counts updates, starting at 1.
+   * */
+  template<typename Scalar>
+  void optimizerStep(const OptimizerParams& params, int64_t step, std::ptrdiff_t n,
+		     Scalar* w, const Scalar* g, Scalar* first, Scalar* second)
+  {
+    const optim::StepConstants<Scalar> c(params, step);
+    switch(params.rule){
+    case UpdateRule::Momentum:
+      optim::Momentum::step(c, n, w, g, first, second);
+      break;
+    case UpdateRule::NesterovAccGrad:
+      optim::NesterovAccGrad::step(c, n, w, g, first, second);
+      break;
+    case UpdateRule::Adam:
+      optim::Adam::step(c, n, w, g, first, second);
+      break;
+    case UpdateRule::AdamW:
+      optim::AdamW::step(c, n, w, g, first, second);
+      break;
+    case UpdateRule::RMSProp:
+      optim::RMSProp::step(c, n, w, g, first, second);
+      break;
+    case UpdateRule::Adagrad:
+      optim::Adagrad::step(c, n, w, g, first, second);
+      break;
+    }
+  }
+
+}//end namespace NN
+#endif //OPTIMIZERS_HPP
@@ -0,0 +1,357 @@
+#ifndef PARAMETER_ARENA_HPP
+#define PARAMETER_ARENA_HPP
+
+#include "Activations.hpp"
+#include <Eigen/Core>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+ * Parameter storage.
+ *
+ * A layer's weights, gradient and two optimizer state buffers are Eigen::Maps
+ * (LayerParameters). A standalone layer points them into a block it owns; a
+ * Network packs all of its layers into one ParameterArena and points every
+ * layer's maps into that:
+ *
+ *   [ weights of layer 0 | layer 1 | ... ]  Weights region
+ *   [ gradient of layer 0 | layer 1 | ... ]  Gradients region
+ *   [ first state ... ]                      FirstState region
+ *   [ second state ... ]                     SecondState region
+ *
+ * Each tensor starts on a 64-byte boundary, and the padding between tensors
+ * is kept at zero, so a region can be treated as one flat array: one
+ * optimizer pass over all weights, one buffer to all-reduce for gradients,
+ * one memcpy to snapshot.
+ * */
+
+namespace NN
+{
+  constexpr size_t PARAMETER_ALIGNMENT = 64;
+
+  //n rounded up to whole 64-byte lines of Scalar
+  template<typename Scalar>
+  constexpr size_t paddedCount(size_t n) noexcept
+  {
+    constexpr size_t perLine = PARAMETER_ALIGNMENT / sizeof(Scalar);
+    return (n + perLine - 1) / perLine * perLine;
+  }
+
+  //zero-initialized, 64-byte aligned array of Scalar; copies are deep
+  template<typename Scalar>
+  class AlignedBuffer
+  {
+  protected:
+
+    Scalar* ptr = nullptr;
+
+    size_t count = 0;
+
+  public:
+
+    AlignedBuffer() = default;
+
+    explicit AlignedBuffer(size_t n)
+      : count(n)
+    {
+      if(n){
+	ptr = static_cast<Scalar*>(std::aligned_alloc(PARAMETER_ALIGNMENT,
+						      paddedCount<Scalar>(n) * sizeof(Scalar)));
+	if(not ptr){
+	  throw std::bad_alloc();
+	}
+	std::memset(ptr, 0, n * sizeof(Scalar));
+      }
+    };
+
+    AlignedBuffer(const AlignedBuffer& other)
+      : AlignedBuffer(other.count)
+    {
+      if(count){
+	std::memcpy(ptr, other.ptr, count * sizeof(Scalar));
+      }
+    };
+
+    AlignedBuffer(AlignedBuffer&& other) noexcept
+      : ptr(other.ptr),
+	count(other.count)
+    {
+      other.ptr = nullptr;
+      other.count = 0;
+    };
+
+    AlignedBuffer& operator=(AlignedBuffer other) noexcept
+    {
+      std::swap(ptr, other.ptr);
+      std::swap(count, other.count);
+      return *this;
+    }
+
+    ~AlignedBuffer()
+    {
+      std::free(ptr);
+    }
+
+    Scalar* data() noexcept
+    {
+      return ptr;
+    }
+
+    const Scalar* data() const noexcept
+    {
+      return ptr;
+    }
+
+    size_t size() const noexcept
+    {
+      return count;
+    }
+  };
+
+
+  /*
+   * The four parameter tensors of a dense layer, all (inputs+1) x outputs.
+   * Copying gives the copy its own storage holding the same values, so a
+   * layer copied out of a Network no longer aliases the network's arena.
+   * */
+  template<typename Scalar>
+  struct LayerParameters
+  {
+    using Map = Eigen::Map<RowMat<Scalar>, Eigen::Aligned64>;
+
+    Map weights{nullptr, 0, 0};
+
+    Map gradient{nullptr, 0, 0};
+
+    //velocity, or Adam's first moment
+    Map firstState{nullptr, 0, 0};
+
+    Map secondState{nullptr, 0, 0};
+
+    //storage while not bound to an arena
+    AlignedBuffer<Scalar> own;
+
+    LayerParameters() = default;
+
+    LayerParameters(const LayerParameters& other)
+    {
+      copyFrom(other);
+    };
+
+    LayerParameters& operator=(const LayerParameters& other)
+    {
+      if(this != &other){
+	copyFrom(other);
+      }
+      return *this;
+    }
+
+    LayerParameters(LayerParameters&& other) noexcept
+      : own(std::move(other.own))
+    {
+      //the owned block moved with its address, so the maps stay valid
+      point(other.weights.data(), other.gradient.data(), other.firstState.data(),
+	    other.secondState.data(), other.weights.rows(), other.weights.cols());
+    };
+
+    LayerParameters& operator=(LayerParameters&& other) noexcept
+    {
+      own = std::move(other.own);
+      point(other.weights.data(), other.gradient.data(), other.firstState.data(),
+	    other.secondState.data(), other.weights.rows(), other.weights.cols());
+      return *this;
+    }
+
+    int_fast64_t rows() const noexcept
+    {
+      return weights.rows();
+    }
+
+    int_fast64_t cols() const noexcept
+    {
+      return weights.cols();
+    }
+
+    //repoints the maps; Eigen's documented way to rebind a Map
+    void point(Scalar* w, Scalar* g, Scalar* first, Scalar* second,
+	       int_fast64_t rows, int_fast64_t cols) noexcept
+    {
+      new (&weights) Map(w, rows, cols);
+      new (&gradient) Map(g, rows, cols);
+      new (&firstState) Map(first, rows, cols);
+      new (&secondState) Map(second, rows, cols);
+    }
+
+    //fresh owned storage of the given shape, all zero
+    void allocate(int_fast64_t rows, int_fast64_t cols)
+    {
+      const size_t tensor = paddedCount<Scalar>(rows * cols);
+      own = AlignedBuffer<Scalar>(4 * tensor);
+      Scalar* p = own.data();
+      point(p, p + tensor, p + 2 * tensor, p + 3 * tensor, rows, cols);
+    }
+
+    //moves the current values to the given tensors and views them there
+    void bind(Scalar* w, Scalar* g, Scalar* first, Scalar* second)
+    {
+      const size_t n = weights.size() * sizeof(Scalar);
+      if(n){
+	std::memcpy(w, weights.data(), n);
+	std::memcpy(g, gradient.data(), n);
+	std::memcpy(first, firstState.data(), n);
+	std::memcpy(second, secondState.data(), n);
+      }
+      point(w, g, first, second, rows(), cols());
+      own = AlignedBuffer<Scalar>();
+    }
+
+    //views the given tensors as they are, dropping any owned storage
+    void view(Scalar* w, Scalar* g, Scalar* first, Scalar* second) noexcept
+    {
+      point(w, g, first, second, rows(), cols());
+      own = AlignedBuffer<Scalar>();
+    }
+
+    //views the given tensors as a new shape, dropping any owned storage
+    void place(Scalar* w, Scalar* g, Scalar* first, Scalar* second,
+	       int_fast64_t rows, int_fast64_t cols) noexcept
+    {
+      point(w, g, first, second, rows, cols);
+      own = AlignedBuffer<Scalar>();
+    }
+
+    //true when the maps view external storage
+    bool isBound() const noexcept
+    {
+      return own.size() == 0 and weights.data() != nullptr;
+    }
+
+  protected:
+
+    void copyFrom(const LayerParameters& other)
+    {
+      allocate(other.rows(), other.cols());
+      if(weights.size()){
+	weights = other.weights;
+	gradient = other.gradient;
+	firstState = other.firstState;
+	secondState = other.secondState;
+      }
+    }
+  };
+
+
+  /*
+   * One 64-byte aligned block holding the Weights, Gradients, FirstState and
+   * SecondState regions for a list of (rows, cols) tensors, laid out as
+   * described at the top of this file.
+   * */
+  template<typename Scalar>
+  class BasicParameterArena
+  {
+  public:
+
+    enum Region
+      {
+       Weights,
+       Gradients,
+       FirstState,
+       SecondState
+      };
+
+    static constexpr int numRegions = 4;
+
+    using VecMap = Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>, Eigen::Aligned64>;
+
+    using ConstVecMap = Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>, Eigen::Aligned64>;
+
+  protected:
+
+    AlignedBuffer<Scalar> buffer;
+
+    //scalars per region, padding included
+    size_t regionSize = 0;
+
+    //start of each tensor within a region
+    std::vector<size_t> offsets;
+
+    std::vector<std::pair<int_fast64_t, int_fast64_t>> shapes;
+
+  public:
+
+    BasicParameterArena() = default;
+
+    //allocates zeroed regions for tensors of the given shapes
+    explicit BasicParameterArena(const std::vector<std::pair<int_fast64_t, int_fast64_t>>& _shapes)
+      : shapes(_shapes)
+    {
+      for(const auto& s : shapes){
+	offsets.push_back(regionSize);
+	regionSize += paddedCount<Scalar>(s.first * s.second);
+      }
+      buffer = AlignedBuffer<Scalar>(numRegions * regionSize);
+    };
+
+    size_t numTensors() const noexcept
+    {
+      return shapes.size();
+    }
+
+    //scalars in one region, padding included
+    size_t getRegionSize() const noexcept
+    {
+      return regionSize;
+    }
+
+    size_t sizeInBytes() const noexcept
+    {
+      return buffer.size() * sizeof(Scalar);
+    }
+
+    Scalar* region(Region r) noexcept
+    {
+      return buffer.data() + r * regionSize;
+    }
+
+    const Scalar* region(Region r) const noexcept
+    {
+      return buffer.data() + r * regionSize;
+    }
+
+    //a whole region as one vector, e.g. all gradients for an all-reduce
+    VecMap regionView(Region r) noexcept
+    {
+      return VecMap(region(r), regionSize);
+    }
+
+    ConstVecMap regionView(Region r) const noexcept
+    {
+      return ConstVecMap(region(r), regionSize);
+    }
+
+    Scalar* tensor(Region r, size_t i) noexcept
+    {
+      return region(r) + offsets[i];
+    }
+
+    const Scalar* tensor(Region r, size_t i) const noexcept
+    {
+      return region(r) + offsets[i];
+    }
+
+    size_t offset(size_t i) const noexcept
+    {
+      return offsets[i];
+    }
+
+    const std::pair<int_fast64_t, int_fast64_t>& shape(size_t i) const noexcept
+    {
+      return shapes[i];
+    }
+  };
+
+}//end namespace NN
+#endif //PARAMETER_ARENA_HPP
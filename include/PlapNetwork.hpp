@@ -3,95 +3,190 @@
 
 #include "Layer.hpp"
 #include "Network.hpp"
+#include <Eigen/Core>
 #include <utility>
 #include <string>
 #include <cmath>
 
 namespace NN
 {
+  /*
+   * p-Laplacian output layer: each row x of a batch maps to the scalar
+   * a * ||x||^(p-2), with no parameters of its own. p must be at least 2,
+   * so that a zero row has a finite value.
+   *
+   * The pass works on whole columns: one rowwise squared norm s = ||x||^2,
+   * then s^((p-2)/2). When p is an integer the power is a few multiplies
+   * (of s for even p, of sqrt(s) for odd p); otherwise it is
+   * exp((p-2)/2 log s), which Eigen vectorizes. The backward pass reuses
+   * the outputs: d/dx a||x||^(p-2) = (p-2) out / s * x.
+   * */
+  template<typename Scalar>
+  class BasicPlapFinalLayer
+  {
+  public:
 
-	template<UpdateRule update, typename... updateArgs>
-	class PlapFinalLayer : protected Layer<update, updateArgs...>
-	{
-	protected:
+    using Mat = RowMat<Scalar>;
 
-		double p = 2.0;
+    using Vec = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
 
-		double a = 1.0;
+    using ConstMatRef = Eigen::Ref<const Mat>;
 
-		Vec actVals;
-		
-		std::function<double(double)> activation;
+    using ConstMatMap = Eigen::Map<const Mat, Eigen::Unaligned, Eigen::OuterStride<>>;
 
-		std::function<Mat(std::pair<Mat, Mat>)> activation_grad;
+  protected:
 
-		Vec output;
+    double p = 2.0;
 
-		Mat inputs;
+    double a = 1.0;
 
-		Mat Jacobian;
+    //(p-2)/2 when it is a whole number, else -1
+    int evenPower = -1;
 
-	public:
-		PlapFinalLayer(std::pair<int_t, int_t> _input_shape,
-					   int_t num_outputs=1,
-					   std::string _activation="sigmoid",
-					   double _p=2.0,
-					   double _a=1.0) :
-								Layer<update, updateArgs...>(_input_shape, num_outputs, _activation, false),
-								p(_p),
-								a(_a),
-								activation(ACTIVATIONS[_activation]),
-								activation_grad(ACTIVATION_DERIVATIVES[_activation])
-		{
+    //p-2 when p is an odd whole number >= 3, else -1
+    int oddPower = -1;
 
-		};
+    //input read by the last forwardPass, in place
+    const Scalar* boundInputs = nullptr;
 
-		void setInputs(const Mat& _inputs)
-		{
-			Layer<update, updateArgs...>::setInputs(_inputs, false);
-			inputs = _inputs;
-		}
+    int_t boundRows = 0;
 
-		auto getOutput()
-		{
-			return output;
-		}
+    int_t boundCols = 0;
 
-		void forwardPass()
-		{
-			actVals = Vec::Zero(inputs.cols());
-			int_t count = 0;
-			for(auto& col : inputs.colwise()){
-				double aval = col.squaredNorm();
-				actVals[count] = aval;
-				count++;
-			}
-			//make activation
-			output = actVals;
-			count = 0;
-			for(auto& it : actVals){
-				output[count] = a * pow(it, (p-2)*0.5);
-				count++;
-			}
-		}
+    int_t boundStride = 0;
 
+    //squared row norms of the inputs
+    Vec squaredNorms;
 
-		void forwardPass(const Mat& inputData)
-		{
-			setInputs(inputData);
-			forwardPass();
-		}
+    //batch rows x 1
+    Mat outputs;
 
-		void computeJacobian()
-		{
-			
+    //dL/d(inputs) from the last backward pass
+    Mat err;
 
+    ConstMatMap inputView() const noexcept
+    {
+      return ConstMatMap(boundInputs, boundRows, boundCols, Eigen::OuterStride<>(boundStride));
+    }
 
+  public:
 
+    explicit BasicPlapFinalLayer(double _p=2.0, double _a=1.0);
 
+    auto getP() const noexcept
+    {
+      return p;
+    }
 
-	};
+    auto getA() const noexcept
+    {
+      return a;
+    }
 
+    const Mat& getOutputs() const noexcept
+    {
+      return outputs;
+    }
 
-}
+    const Mat& getErr() const noexcept
+    {
+      return err;
+    }
+
+    //sizes the buffers for batches of batchRows x inputSize
+    void reserve(int_t batchRows, int_t inputSize);
+
+    //outputs = a * ||row||^(p-2) for each row of inputData, read in place
+    void forwardPass(ConstMatRef inputData);
+
+    //err = dL/d(inputs) given dL/d(outputs), one value per row
+    void backwardPass(ConstMatRef lossGrad);
+  };
+
+  using PlapFinalLayer = BasicPlapFinalLayer<double>;
+
+  using PlapFinalLayerf = BasicPlapFinalLayer<float>;
+
+
+  /*
+   * A network of dense layers followed by a PlapFinalLayer, so its output is
+   * one value per row and targets hold one value per row. It overrides the
+   * passes of BasicNetwork, so predict(), predictBatch(), trainStep(),
+   * train() and a Trainer fitting it as a BasicNetwork& all run the whole
+   * stack.
+   * */
+  template<typename Scalar>
+  class BasicPlapNetwork : public BasicNetwork<Scalar>
+  {
+  public:
+
+    using Base = BasicNetwork<Scalar>;
+
+    using typename Base::Mat;
+
+    using typename Base::ConstMatRef;
+
+    using typename Base::Layer;
+
+  protected:
+
+    BasicPlapFinalLayer<Scalar> plap;
+
+    //dL/d(plap outputs), batch rows x 1
+    Mat plapLossGrad;
+
+    //the layers, then the p-Laplacian layer on their outputs
+    const Mat& forward(ConstMatRef batchInputs) override;
+
+    //against the p-Laplacian layer's outputs
+    void evaluateLoss(ConstMatRef targets) override;
+
+  public:
+
+    BasicPlapNetwork(double p, double a,
+		     std::string activation,
+		     std::string loss,
+		     std::initializer_list<Layer> _layers)
+      : Base(activation, loss, _layers),
+	plap(p, a)
+    {
+    };
+
+    const BasicPlapFinalLayer<Scalar>& getPlapLayer() const noexcept
+    {
+      return plap;
+    }
+
+    int_t getNumOutputs() const noexcept override
+    {
+      return 1;
+    }
+
+    bool hasOutputLayer() const noexcept override
+    {
+      return true;
+    }
+
+    typename Base::Vec getOutputs() const override
+    {
+      return plap.getOutputs().col(0);
+    }
+
+    //through the p-Laplacian layer, then the layers
+    void backwardPass() override;
+  };
+
+  using PlapNetwork = BasicPlapNetwork<double>;
+
+  using PlapNetworkf = BasicPlapNetwork<float>;
+
+  extern template class BasicPlapFinalLayer<double>;
+
+  extern template class BasicPlapFinalLayer<float>;
+
+  extern template class BasicPlapNetwork<double>;
+
+  extern template class BasicPlapNetwork<float>;
+
+}//end namespace NN
 #endif //PLAP_NETWORK_HPP
@@ -0,0 +1,321 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Hot-path instrumentation.
+ *
+ * Every layer carries a LayerProfile: cycles, calls and FLOPs for each phase
+ * of its passes, summed over threads, and the bytes its buffers allocated.
+ * When a Network updates all its parameters in one pass over its arena,
+ * each layer is charged the share of that pass's cycles its part of the
+ * arena spans. A Network can also record a trace of whole layer passes. Both are written
+ * only when the library is built with -DDNN_PROFILE (make PROFILE=1);
+ * otherwise the timers below compile to nothing and the counters stay zero.
+ * profilingEnabled() says which build is running.
+ *
+ * Network::writeProfile exports the counters as JSON and Network::writeTrace
+ * the recorded passes in Chrome's trace event format, for chrome://tracing
+ * or Perfetto.
+ * */
+
+#ifdef DNN_PROFILE
+#define DNN_PROFILING true
+#else
+#define DNN_PROFILING false
+#endif
+
+namespace NN
+{
+  /*
+   * Forward is the GEMM and bias add, Activation the activation applied to
+   * its result. Activation and Update are elementwise and count one FLOP
+   * per element.
+   * */
+  enum class Phase
+    {
+     Forward,
+     Activation,
+     Backward,
+     Update
+    };
+
+  constexpr int numPhases = 4;
+
+  const char* phaseName(Phase phase) noexcept;
+
+  //whether the library was built with DNN_PROFILE
+  bool profilingEnabled() noexcept;
+
+  //time stamp counter where there is one, else nanoseconds
+  inline uint64_t cycleCount() noexcept
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  struct PhaseStats
+  {
+    uint64_t cycles = 0;
+
+    uint64_t calls = 0;
+
+    uint64_t flops = 0;
+  };
+
+  //safe to add to from the threads of a split batch
+  class LayerProfile
+  {
+  protected:
+
+    std::atomic<uint64_t> cycles[numPhases] = {};
+
+    std::atomic<uint64_t> calls[numPhases] = {};
+
+    std::atomic<uint64_t> flops[numPhases] = {};
+
+    std::atomic<uint64_t> bytes{0};
+
+  public:
+
+    LayerProfile() = default;
+
+    LayerProfile(const LayerProfile& other) noexcept
+    {
+      *this = other;
+    };
+
+    LayerProfile& operator=(const LayerProfile& other) noexcept
+    {
+      for(int p = 0; p < numPhases; p++){
+	cycles[p] = other.cycles[p].load(std::memory_order_relaxed);
+	calls[p] = other.calls[p].load(std::memory_order_relaxed);
+	flops[p] = other.flops[p].load(std::memory_order_relaxed);
+      }
+      bytes = other.bytes.load(std::memory_order_relaxed);
+      return *this;
+    }
+
+    void add(Phase phase, uint64_t phaseCycles, uint64_t phaseFlops) noexcept
+    {
+      const int p = static_cast<int>(phase);
+      cycles[p].fetch_add(phaseCycles, std::memory_order_relaxed);
+      calls[p].fetch_add(1, std::memory_order_relaxed);
+      flops[p].fetch_add(phaseFlops, std::memory_order_relaxed);
+    }
+
+    void addBytes(uint64_t n) noexcept
+    {
+      bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    PhaseStats get(Phase phase) const noexcept
+    {
+      const int p = static_cast<int>(phase);
+      return {cycles[p].load(std::memory_order_relaxed), calls[p].load(std::memory_order_relaxed),
+	      flops[p].load(std::memory_order_relaxed)};
+    }
+
+    uint64_t bytesAllocated() const noexcept
+    {
+      return bytes.load(std::memory_order_relaxed);
+    }
+
+    void reset() noexcept
+    {
+      *this = LayerProfile();
+    }
+  };
+
+
+  struct TraceEvent
+  {
+    //-1 for passes over the whole network
+    int layer;
+
+    Phase phase;
+
+    //nanoseconds since the trace started
+    int64_t start;
+
+    int64_t duration;
+  };
+
+  /*
+   * Spans of whole layer passes, recorded into a buffer reserved by start()
+   * so recording never allocates. Spans past the capacity are counted as
+   * dropped.
+   * */
+  class TraceRecorder
+  {
+  protected:
+
+    std::vector<TraceEvent> events;
+
+    bool recording = false;
+
+    uint64_t dropped = 0;
+
+    std::chrono::steady_clock::time_point origin;
+
+  public:
+
+    void start(size_t capacity)
+    {
+      events.clear();
+      events.reserve(capacity);
+      dropped = 0;
+      origin = std::chrono::steady_clock::now();
+      recording = true;
+    }
+
+    void stop() noexcept
+    {
+      recording = false;
+    }
+
+    bool isRecording() const noexcept
+    {
+      return recording;
+    }
+
+    int64_t now() const noexcept
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void record(int layer, Phase phase, int64_t start, int64_t end) noexcept
+    {
+      if(not recording){
+	return;
+      }
+      if(events.size() == events.capacity()){
+	dropped++;
+	return;
+      }
+      events.push_back({layer, phase, start, end - start});
+    }
+
+    const std::vector<TraceEvent>& getEvents() const noexcept
+    {
+      return events;
+    }
+
+    uint64_t getDropped() const noexcept
+    {
+      return dropped;
+    }
+  };
+
+
+  namespace internal
+  {
+    //adds the cycles of its scope to one phase of a profile, if any
+    class PhaseTimer
+    {
+#if DNN_PROFILING
+    protected:
+
+      LayerProfile* profile;
+
+      Phase phase;
+
+      uint64_t flops;
+
+      uint64_t begin;
+
+    public:
+
+      PhaseTimer(LayerProfile* _profile, Phase _phase, uint64_t _flops) noexcept
+	: profile(_profile),
+	  phase(_phase),
+	  flops(_flops),
+	  begin(cycleCount())
+      {
+      };
+
+      ~PhaseTimer()
+      {
+	if(profile){
+	  profile->add(phase, cycleCount() - begin, flops);
+	}
+      }
+#else
+    public:
+
+      PhaseTimer(LayerProfile*, Phase, uint64_t) noexcept
+      {
+      };
+#endif
+    };
+
+    //records its scope as one span of a trace, if any
+    class TraceSpan
+    {
+#if DNN_PROFILING
+    protected:
+
+      TraceRecorder* trace;
+
+      int layer;
+
+      Phase phase;
+
+      int64_t begin;
+
+    public:
+
+      TraceSpan(TraceRecorder* _trace, int _layer, Phase _phase) noexcept
+	: trace(_trace and _trace->isRecording() ? _trace : nullptr),
+	  layer(_layer),
+	  phase(_phase),
+	  begin(trace ? trace->now() : 0)
+      {
+      };
+
+      ~TraceSpan()
+      {
+	if(trace){
+	  trace->record(layer, phase, begin, trace->now());
+	}
+      }
+#else
+    public:
+
+      TraceSpan(TraceRecorder*, int, Phase) noexcept
+      {
+      };
+#endif
+    };
+
+  }//end namespace internal
+
+  //one layer's counters under a name, for export
+  struct ProfileEntry
+  {
+    std::string name;
+
+    const LayerProfile* profile;
+  };
+
+  void writeProfileJson(std::ostream& ostr, const std::vector<ProfileEntry>& entries);
+
+  void writeChromeTrace(std::ostream& ostr, const std::vector<ProfileEntry>& entries,
+			const TraceRecorder& trace);
+
+}//end namespace NN
+#endif //PROFILER_HPP
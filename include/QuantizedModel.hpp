@@ -0,0 +1,163 @@
+#ifndef QUANTIZED_MODEL_HPP
+#define QUANTIZED_MODEL_HPP
+
+#include "InferenceModel.hpp"
+#include "Network.hpp"
+#include "ParameterArena.hpp"
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+
+namespace NN
+{
+  //how far a quantized model's outputs are from the full-precision ones
+  struct QuantizationError
+  {
+    double maxAbsError = 0;
+
+    //root mean square of the output differences
+    double rmsError = 0;
+
+    //root mean square of the reference outputs, to put rmsError in scale
+    double referenceRms = 0;
+
+    double relativeError() const noexcept
+    {
+      return referenceRms > 0 ? rmsError / referenceRms : rmsError;
+    }
+  };
+
+  /*
+   * A network's dense layers quantized to 8 bits after training, for
+   * serving.
+   *
+   * Weights become int8 with one symmetric scale per output column. Each
+   * layer's input becomes uint8 with one scale and zero point per layer,
+   * calibrated from the range that layer sees on a sample batch run through
+   * the full-precision network; inputs outside the calibrated range are
+   * clamped. The product accumulates in int32 and is dequantized with the
+   * bias added, in Scalar, before the activation, which stays in Scalar.
+   *
+   * With AVX2 the int8 GEMM multiplies 32 input bytes by 32 weight bytes at
+   * a time with vpmaddubsw and widens the pairs with vpmaddwd. vpmaddubsw
+   * saturates its int16 pair sums, so the weights are kept to 7 bits
+   * ([-63, 63]): then 2 * 255 * 63 fits and no product is ever clipped.
+   * Without AVX2 the same integers are summed by a scalar loop, so results
+   * are identical either way.
+   *
+   * Like BasicInferenceModel the model is immutable, predict() may be called
+   * from several threads at once and uses a per-thread scratch, and batches
+   * run rowChunk rows at a time.
+   * */
+  template<typename Scalar>
+  class BasicQuantizedModel
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using MatRef = Eigen::Ref<Mat>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+    using RowVec = Eigen::Matrix<Scalar, 1, Eigen::Dynamic>;
+
+  protected:
+
+    struct QuantizedLayer
+    {
+      int_t inputs;
+
+      int_t outputs;
+
+      //inputs rounded up to whole 32-byte vectors
+      int_t paddedInputs;
+
+      //outputs x paddedInputs, one output's weights per row, zero padded
+      AlignedBuffer<int8_t> weights;
+
+      //input = inputScale * (q - inputZero)
+      Scalar inputScale;
+
+      Scalar invInputScale;
+
+      int32_t inputZero;
+
+      //inputScale times each output's weight scale
+      RowVec outputScale;
+
+      //inputZero times the sum of each output's quantized weights
+      RowVec zeroCorrection;
+
+      RowVec bias;
+
+      ActivationKernel<Scalar> activation;
+    };
+
+    std::vector<QuantizedLayer> layers;
+
+    int_t rowChunk;
+
+    int_t maxPaddedInputs = 0;
+
+    int_t maxOutputs = 0;
+
+    //widest hidden (non-final) layer
+    int_t maxHidden = 0;
+
+    //bytes of scratch a predict() needs: quantized inputs, int32 sums and
+    //two activation buffers
+    size_t scratchBytes = 0;
+
+    //calling thread's scratch, holding at least bytes
+    static unsigned char* threadScratch(size_t bytes);
+
+  public:
+
+    /*
+     * quantizes net's weights and calibrates each layer's input range on
+     * calibration, which should look like the data the model will serve
+     * */
+    BasicQuantizedModel(const BasicNetwork<Scalar>& net, ConstMatRef calibration, int_t _rowChunk=256);
+
+    int_t numLayers() const noexcept
+    {
+      return layers.size();
+    }
+
+    int_t inputSize() const noexcept
+    {
+      return layers.front().inputs;
+    }
+
+    int_t numOutputs() const noexcept
+    {
+      return layers.back().outputs;
+    }
+
+    //bytes of quantized weights, scales and biases held
+    size_t weightBytes() const noexcept;
+
+    //sizes the calling thread's scratch so its first predict() doesn't allocate
+    void reserveThreadScratch() const;
+
+    /*
+     * out = network(batch) in 8-bit arithmetic, with out batch.rows() x
+     * numOutputs(). Safe to call from several threads at once.
+     * */
+    void predict(ConstMatRef batch, MatRef out) const;
+
+    //this model's error on batch against reference, normally the same network at full precision
+    QuantizationError compare(const BasicInferenceModel<Scalar>& reference, ConstMatRef batch) const;
+  };
+
+  using QuantizedModel = BasicQuantizedModel<double>;
+
+  using QuantizedModelf = BasicQuantizedModel<float>;
+
+  extern template class BasicQuantizedModel<double>;
+
+  extern template class BasicQuantizedModel<float>;
+
+}//end namespace NN
+#endif //QUANTIZED_MODEL_HPP
@@ -0,0 +1,213 @@
+#ifndef SCRATCH_ARENA_HPP
+#define SCRATCH_ARENA_HPP
+
+#include "ParameterArena.hpp"
+#include <Eigen/Core>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace NN
+{
+  /*
+   * Bump allocator for the temporaries of a pass: GEMM packing panels and
+   * the like. take() hands out 64-byte aligned pieces of one block and
+   * reset() takes them all back at once. A pass that needs more than the
+   * block gets separate overflow allocations, and the next reset() grows
+   * the block to the high-water mark, so from the second pass of a given
+   * shape on nothing is allocated. getAllocations() counts the heap
+   * allocations the arena has made, to check that.
+   *
+   * take() may be called from several threads at once; reset() may not.
+   * Copies start empty.
+   * */
+  class ScratchArena
+  {
+  protected:
+
+    AlignedBuffer<unsigned char> block;
+
+    std::atomic<size_t> used{0};
+
+    //bytes taken since the last reset, overflow included
+    std::atomic<size_t> demand{0};
+
+    std::vector<AlignedBuffer<unsigned char>> overflow;
+
+    std::mutex overflowMtx;
+
+    uint64_t allocations = 0;
+
+  public:
+
+    ScratchArena() = default;
+
+    ScratchArena(const ScratchArena&)
+    {
+    };
+
+    ScratchArena& operator=(const ScratchArena&)
+    {
+      return *this;
+    }
+
+    //count scalars that stay valid until the next reset()
+    template<typename T>
+    T* take(size_t count)
+    {
+      const size_t bytes = paddedCount<unsigned char>(count * sizeof(T));
+      demand.fetch_add(bytes, std::memory_order_relaxed);
+      const size_t at = used.fetch_add(bytes, std::memory_order_relaxed);
+      if(at + bytes <= block.size()){
+	return reinterpret_cast<T*>(block.data() + at);
+      }
+      std::lock_guard<std::mutex> lock(overflowMtx);
+      overflow.emplace_back(bytes);
+      allocations++;
+      return reinterpret_cast<T*>(overflow.back().data());
+    }
+
+    //frees everything taken, growing the block if the last pass overflowed
+    void reset()
+    {
+      if(not overflow.empty()){
+	overflow.clear();
+	block = AlignedBuffer<unsigned char>(demand.load(std::memory_order_relaxed));
+	allocations++;
+      }
+      used = 0;
+      demand = 0;
+    }
+
+    size_t capacity() const noexcept
+    {
+      return block.size();
+    }
+
+    uint64_t getAllocations() const noexcept
+    {
+      return allocations;
+    }
+  };
+
+
+  /*
+   * The packed products below call Eigen 3.4's internal GEMM, whose run()
+   * signature 3.3 doesn't have; with an older Eigen every product is
+   * Eigen's own.
+   * */
+#ifndef DNN_PACKED_GEMM
+#define DNN_PACKED_GEMM EIGEN_VERSION_AT_LEAST(3, 4, 0)
+#endif
+
+  namespace internal
+  {
+    /*
+     * Eigen's GEMM blocking with its packed panels placed in caller-owned
+     * memory. Eigen runs a row-major product as the transposed column-major
+     * one, so mc follows the result's columns and nc its rows, as in its own
+     * gemm_blocking_space.
+     * */
+    template<typename Scalar>
+    class ScratchBlocking : public Eigen::internal::level3_blocking<Scalar, Scalar>
+    {
+    public:
+
+      ScratchBlocking(int_fast64_t rows, int_fast64_t cols, int_fast64_t depth)
+      {
+	this->m_mc = cols;
+	this->m_nc = rows;
+	this->m_kc = depth;
+	Eigen::internal::computeProductBlockingSizes<Scalar, Scalar, 1, Eigen::Index>(this->m_kc, this->m_mc,
+									this->m_nc, 1);
+      };
+
+      //scalars of packing space the product needs
+      size_t workspace() const
+      {
+	return paddedCount<Scalar>(this->m_mc * this->m_kc) + paddedCount<Scalar>(this->m_kc * this->m_nc);
+      }
+
+      void place(Scalar* space)
+      {
+	this->m_blockA = space;
+	this->m_blockB = space + paddedCount<Scalar>(this->m_mc * this->m_kc);
+      }
+    };
+
+    //scalars of packing space a rows x cols x depth product needs
+    template<typename Scalar>
+    size_t gemmWorkspace(int_fast64_t rows, int_fast64_t cols, int_fast64_t depth)
+    {
+      return ScratchBlocking<Scalar>(rows, cols, depth).workspace();
+    }
+
+    /*
+     * whether gemmAccumulate packs a product of this shape itself. Products
+     * Eigen would run as a GEMV or coefficient-wise pack nothing, and those
+     * it would spread over its own threads are left to it.
+     * */
+    inline bool packsIntoScratch(int_fast64_t rows, int_fast64_t cols, int_fast64_t depth)
+    {
+      if(not DNN_PACKED_GEMM or rows <= 1 or cols <= 1 or depth == 0 or rows + cols + depth < 20){
+	return false;
+      }
+#ifdef _OPENMP
+      //Eigen gives each of its threads at least 50000 multiply-adds
+      return Eigen::nbThreads() == 1 or omp_in_parallel() or double(rows) * cols * depth < 100000;
+#else
+      return true;
+#endif
+    }
+
+    /*
+     * dst += lhs * rhs for a row-major dst and operands of either storage
+     * order with unit inner stride, e.g. a transposed map. Eigen allocates
+     * the packing panels of every large product; this packs into workspace,
+     * of gemmWorkspace() scalars, instead. Without a workspace, or when
+     * packsIntoScratch() says no, the product is Eigen's.
+     * */
+    template<typename Lhs, typename Rhs, typename Dst>
+    void gemmAccumulate(const Lhs& lhs, const Rhs& rhs, Dst&& dst, typename Lhs::Scalar* workspace)
+    {
+      using Scalar = typename Lhs::Scalar;
+      const Eigen::Index rows = dst.rows();
+      const Eigen::Index cols = dst.cols();
+      const Eigen::Index depth = lhs.cols();
+      if(not workspace or not packsIntoScratch(rows, cols, depth)){
+	dst.noalias() += lhs * rhs;
+	return;
+      }
+#if DNN_PACKED_GEMM
+      using Gemm = Eigen::internal::general_matrix_matrix_product<Eigen::Index,
+		       Scalar, Lhs::IsRowMajor ? Eigen::RowMajor : Eigen::ColMajor, false,
+		       Scalar, Rhs::IsRowMajor ? Eigen::RowMajor : Eigen::ColMajor, false,
+		       Eigen::RowMajor, 1>;
+      ScratchBlocking<Scalar> blocking(rows, cols, depth);
+      blocking.place(workspace);
+      Gemm::run(rows, cols, depth, lhs.data(), lhs.outerStride(), rhs.data(), rhs.outerStride(),
+		dst.data(), 1, dst.outerStride(), Scalar(1), blocking);
+#endif
+    }
+
+    //the same, taking the workspace from scratch
+    template<typename Lhs, typename Rhs, typename Dst>
+    void gemmAccumulate(const Lhs& lhs, const Rhs& rhs, Dst&& dst, ScratchArena& scratch)
+    {
+      using Scalar = typename Lhs::Scalar;
+      const Eigen::Index rows = dst.rows();
+      const Eigen::Index cols = dst.cols();
+      const Eigen::Index depth = lhs.cols();
+      Scalar* workspace = packsIntoScratch(rows, cols, depth)
+	? scratch.take<Scalar>(gemmWorkspace<Scalar>(rows, cols, depth)) : nullptr;
+      gemmAccumulate(lhs, rhs, std::forward<Dst>(dst), workspace);
+    }
+
+  }//end namespace internal
+}//end namespace NN
+#endif //SCRATCH_ARENA_HPP
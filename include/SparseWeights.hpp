@@ -0,0 +1,155 @@
+#ifndef SPARSE_WEIGHTS_HPP
+#define SPARSE_WEIGHTS_HPP
+
+#include "Activations.hpp"
+#include "ScratchArena.hpp"
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+
+namespace NN
+{
+  /*
+   * The nonzeros of a pruned weight matrix (inputs x outputs, bias row
+   * excluded) in CSR form: one row per input, column indices ascending.
+   * The same entries are also kept by column (CSC), so that the forward
+   * product, which sums over inputs, and the backward one, which sums over
+   * outputs, can both accumulate each result in registers.
+   *
+   * The layer's dense weights stay the parameters the optimizer, arena and
+   * checkpoints see, with the pruned entries held at zero. values is a
+   * packed copy of the kept entries for the kernels below, refreshed from
+   * the dense weights before each forward pass.
+   * */
+  template<typename Scalar>
+  class SparseWeights
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+    using MatRef = Eigen::Ref<Mat>;
+
+  protected:
+
+    int_fast64_t numRows = 0;
+
+    int_fast64_t numCols = 0;
+
+    //row k's entries are [rowStart[k], rowStart[k+1])
+    std::vector<int32_t> rowStart;
+
+    std::vector<int32_t> colIndex;
+
+    std::vector<Scalar> values;
+
+    //column j's entries are [colStart[j], colStart[j+1])
+    std::vector<int32_t> colStart;
+
+    std::vector<int32_t> rowIndex;
+
+    std::vector<Scalar> colValues;
+
+  public:
+
+    SparseWeights() = default;
+
+    //the pattern of dense's nonzero entries
+    explicit SparseWeights(ConstMatRef dense);
+
+    bool empty() const noexcept
+    {
+      return numRows == 0;
+    }
+
+    int_fast64_t rows() const noexcept
+    {
+      return numRows;
+    }
+
+    int_fast64_t cols() const noexcept
+    {
+      return numCols;
+    }
+
+    int_fast64_t nonZeros() const noexcept
+    {
+      return colIndex.size();
+    }
+
+    //kept fraction of the entries
+    double density() const noexcept
+    {
+      return numRows * numCols > 0 ? double(nonZeros()) / (numRows * numCols) : 1.0;
+    }
+
+    const int32_t* rowStarts() const noexcept
+    {
+      return rowStart.data();
+    }
+
+    const int32_t* colIndices() const noexcept
+    {
+      return colIndex.data();
+    }
+
+    const Scalar* valueData() const noexcept
+    {
+      return values.data();
+    }
+
+    const int32_t* colStarts() const noexcept
+    {
+      return colStart.data();
+    }
+
+    const int32_t* rowIndices() const noexcept
+    {
+      return rowIndex.data();
+    }
+
+    const Scalar* colValueData() const noexcept
+    {
+      return colValues.data();
+    }
+
+    //copies the kept entries of dense, shaped like the pattern, into both orders
+    void refresh(ConstMatRef dense) noexcept;
+
+    //zeroes the entries of dense outside the pattern
+    void mask(MatRef dense) const noexcept;
+  };
+
+  extern template class SparseWeights<double>;
+
+  extern template class SparseWeights<float>;
+
+
+  namespace internal
+  {
+    /*
+     * Sparse-dense products, each on a block of batch rows. They work on
+     * panels of 32 rows transposed into scratch, so the inner loops run
+     * over the batch with unit stride and vectorize whatever the pattern.
+     * */
+
+    //dst += x * W
+    template<typename Scalar>
+    void spmmAccumulate(Eigen::Ref<const RowMat<Scalar>> x, const SparseWeights<Scalar>& w,
+			Eigen::Ref<RowMat<Scalar>> dst, ScratchArena& scratch);
+
+    //dst += e * W^T
+    template<typename Scalar>
+    void spmmTransposedAccumulate(Eigen::Ref<const RowMat<Scalar>> e, const SparseWeights<Scalar>& w,
+				  Eigen::Ref<RowMat<Scalar>> dst, ScratchArena& scratch);
+
+    //grad += x^T * e at the entries of W's pattern only; the rest are left alone
+    template<typename Scalar>
+    void sddmmAccumulate(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> e,
+			 const SparseWeights<Scalar>& w, Eigen::Ref<RowMat<Scalar>> grad, ScratchArena& scratch);
+
+  }//end namespace internal
+}//end namespace NN
+#endif //SPARSE_WEIGHTS_HPP
@@ -0,0 +1,44 @@
+#ifndef THREADING_HPP
+#define THREADING_HPP
+
+#include <cstdint>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace NN
+{
+  namespace internal
+  {
+    //parameter entries below which updates stay on one thread
+    constexpr int_fast64_t minParallelUpdate = 1 << 15;
+
+    /*
+     * calls f(firstRow, numRows, thread) on one contiguous slice of n rows per
+     * thread, or once on all rows if not split. Returns the number of slices.
+     * */
+    template<typename F>
+    int forRowSlices(int_fast64_t n, int numThreads, bool split, F&& f)
+    {
+      int slices = 1;
+#ifdef _OPENMP
+      if(split){
+	#pragma omp parallel num_threads(numThreads)
+	{
+	  const int t = omp_get_thread_num();
+	  const int nt = omp_get_num_threads();
+	  if(t == 0){
+	    slices = nt;
+	  }
+	  const int_fast64_t r0 = n * t / nt;
+	  f(r0, n * (t + 1) / nt - r0, t);
+	}
+	return slices;
+      }
+#endif
+      f(0, n, 0);
+      return slices;
+    }
+  }//end namespace internal
+}//end namespace NN
+#endif //THREADING_HPP
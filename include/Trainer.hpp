@@ -0,0 +1,351 @@
+#ifndef TRAINER_HPP
+#define TRAINER_HPP
+
+#include "DataParallel.hpp"
+#include "Layer.hpp"
+#include "Network.hpp"
+#include <Eigen/Core>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+namespace NN
+{
+  /*
+   * A random-access set of samples. Row i of the features goes with row i of
+   * the targets. Sources hand out rows on request, so the whole set never has
+   * to exist as one matrix.
+   * */
+  template<typename Scalar>
+  class BasicDataSource
+  {
+  public:
+
+    using Mat = RowMat<Scalar>;
+
+    using MatRef = Eigen::Ref<Mat>;
+
+    virtual ~BasicDataSource() = default;
+
+    //number of samples
+    virtual int_t size() const = 0;
+
+    virtual int_t featureCount() const = 0;
+
+    virtual int_t targetCount() const = 0;
+
+    //copies samples idx[0..count) into the first count rows of features/targets
+    virtual void gather(const int_t* idx, int_t count,
+			MatRef features, MatRef targets) const = 0;
+
+    /*
+     * points features/targets at samples [first, first+count) where the
+     * source stores them, as row-major rows with the given strides, so a
+     * batch of consecutive samples needs no copy. Sources that can't return
+     * false and are gathered instead.
+     * */
+    virtual bool viewRows(int_t, int_t, const Scalar*&, int_t&, const Scalar*&, int_t&) const
+    {
+      return false;
+    }
+
+    //called on the loader's worker for rows about to be viewed in place
+    virtual void willNeed(int_t, int_t) const
+    {
+    }
+  };
+
+
+  //samples held in existing matrices, which are viewed, not copied, and must
+  //outlive the source
+  template<typename Scalar>
+  class BasicMatrixSource : public BasicDataSource<Scalar>
+  {
+  public:
+
+    using typename BasicDataSource<Scalar>::Mat;
+
+    using typename BasicDataSource<Scalar>::MatRef;
+
+    using ConstMatRef = Eigen::Ref<const Mat>;
+
+  protected:
+
+    ConstMatRef features;
+
+    ConstMatRef targets;
+
+  public:
+
+    BasicMatrixSource(ConstMatRef _features, ConstMatRef _targets)
+      : features(_features),
+	targets(_targets)
+    {
+      if(features.rows() != targets.rows()){
+	throw "Error: features and targets must have the same number of rows";
+      }
+    };
+
+    int_t size() const override
+    {
+      return features.rows();
+    }
+
+    int_t featureCount() const override
+    {
+      return features.cols();
+    }
+
+    int_t targetCount() const override
+    {
+      return targets.cols();
+    }
+
+    void gather(const int_t* idx, int_t count,
+		MatRef batchFeatures, MatRef batchTargets) const override;
+
+    bool viewRows(int_t first, int_t count, const Scalar*& batchFeatures, int_t& featureStride,
+		  const Scalar*& batchTargets, int_t& targetStride) const override;
+  };
+
+
+  /*
+   * One batch: rows samples, either gathered into the features/targets
+   * buffers or viewed in place in the source. featureView()/targetView()
+   * give the batch either way.
+   * */
+  template<typename Scalar>
+  struct BasicBatch
+  {
+    using ConstMatMap = Eigen::Map<const RowMat<Scalar>, Eigen::Unaligned, Eigen::OuterStride<>>;
+
+    RowMat<Scalar> features;
+
+    RowMat<Scalar> targets;
+
+    int_t rows = 0;
+
+    const Scalar* featureRows = nullptr;
+
+    int_t featureStride = 0;
+
+    const Scalar* targetRows = nullptr;
+
+    int_t targetStride = 0;
+
+    //false when the batch is a view into the source
+    bool gathered = true;
+
+    ConstMatMap featureView() const noexcept
+    {
+      return ConstMatMap(featureRows, rows, features.cols(), Eigen::OuterStride<>(featureStride));
+    }
+
+    ConstMatMap targetView() const noexcept
+    {
+      return ConstMatMap(targetRows, rows, targets.cols(), Eigen::OuterStride<>(targetStride));
+    }
+  };
+
+
+  /*
+   * Cuts an ordering of a DataSource into batches. Two batch buffers are
+   * allocated up front and reused. With prefetching on, a worker thread
+   * gathers the next batch while the caller trains on the current one.
+   * A batch of consecutive samples from a source that can view them in
+   * place (an unshuffled epoch, say) is not copied; the worker only calls
+   * willNeed() on it.
+   * */
+  template<typename Scalar>
+  class BasicBatchLoader
+  {
+  public:
+
+    using Batch = BasicBatch<Scalar>;
+
+  protected:
+
+    const BasicDataSource<Scalar>& source;
+
+    int_t batchSize;
+
+    bool prefetch;
+
+    std::vector<int_t> order;
+
+    //first sample (in order) of the next batch to gather
+    int_t cursor = 0;
+
+    Batch buffers[2];
+
+    //buffer the next call to next() hands out
+    int current = 0;
+
+    std::thread worker;
+
+    std::mutex mtx;
+
+    std::condition_variable cv;
+
+    bool fillRequested = false;
+
+    bool fillDone = true;
+
+    bool stopping = false;
+
+    int fillTarget = 0;
+
+    int_t fillStart = 0;
+
+    void fill(int buf, int_t start);
+
+    void requestFill(int buf);
+
+    void waitForFill();
+
+    void workerLoop();
+
+  public:
+
+    BasicBatchLoader(const BasicDataSource<Scalar>& _source, int_t _batchSize, bool _prefetch=true);
+
+    ~BasicBatchLoader();
+
+    BasicBatchLoader(const BasicBatchLoader&) = delete;
+
+    BasicBatchLoader& operator=(const BasicBatchLoader&) = delete;
+
+    //starts handing out samples in the given order
+    void startEpoch(const std::vector<int_t>& _order);
+
+    //the next batch, or nullptr once the epoch is exhausted. The batch stays
+    //valid until the following call.
+    const Batch* next();
+  };
+
+
+  /*
+   * Mini-batch SGD over a DataSource: each epoch visits every sample once, in
+   * a fresh random order if shuffling is on, and calls Network::trainStep on
+   * each batch in place. A DataParallel model splits each batch across its
+   * threads instead.
+   * */
+  class Trainer
+  {
+  protected:
+
+    int_t batchSize = 32;
+
+    size_t epochs = 1;
+
+    bool shuffle = true;
+
+    bool prefetch = true;
+
+    bool dropLast = false;
+
+    uint64_t seed = 0;
+
+    //mean batch loss of each epoch
+    std::vector<double> epochLoss;
+
+    //the epoch loop, for anything with trainStep(inputs, targets)
+    template<typename Model, typename Scalar>
+    void fitModel(Model& model, const BasicDataSource<Scalar>& data);
+
+  public:
+
+    Trainer() = default;
+
+    Trainer(int_t _batchSize, size_t _epochs)
+      : batchSize(_batchSize),
+	epochs(_epochs)
+    {
+    };
+
+    void setBatchSize(int_t _batchSize)
+    {
+      if(_batchSize <= 0){
+	throw "Error: batch size must be positive.";
+      }
+      batchSize = _batchSize;
+    }
+
+    void setEpochs(size_t _epochs) noexcept
+    {
+      epochs = _epochs;
+    }
+
+    void setShuffle(bool _shuffle) noexcept
+    {
+      shuffle = _shuffle;
+    }
+
+    //gather the next batch on a background thread
+    void setPrefetch(bool _prefetch) noexcept
+    {
+      prefetch = _prefetch;
+    }
+
+    //skip the final batch of an epoch if it is smaller than the batch size
+    void setDropLast(bool _dropLast) noexcept
+    {
+      dropLast = _dropLast;
+    }
+
+    void setSeed(uint64_t _seed) noexcept
+    {
+      seed = _seed;
+    }
+
+    auto getBatchSize() const noexcept
+    {
+      return batchSize;
+    }
+
+    const std::vector<double>& getEpochLoss() const noexcept
+    {
+      return epochLoss;
+    }
+
+    template<typename Scalar>
+    void fit(BasicNetwork<Scalar>& net, const BasicDataSource<Scalar>& data);
+
+    template<typename Scalar>
+    void fit(BasicDataParallel<Scalar>& model, const BasicDataSource<Scalar>& data);
+  };
+
+  using DataSource = BasicDataSource<double>;
+
+  using MatrixSource = BasicMatrixSource<double>;
+
+  using Batch = BasicBatch<double>;
+
+  using BatchLoader = BasicBatchLoader<double>;
+
+  using DataSourcef = BasicDataSource<float>;
+
+  using MatrixSourcef = BasicMatrixSource<float>;
+
+  using BatchLoaderf = BasicBatchLoader<float>;
+
+  extern template class BasicMatrixSource<double>;
+
+  extern template class BasicMatrixSource<float>;
+
+  extern template class BasicBatchLoader<double>;
+
+  extern template class BasicBatchLoader<float>;
+
+  extern template void Trainer::fit(BasicNetwork<double>&, const BasicDataSource<double>&);
+
+  extern template void Trainer::fit(BasicNetwork<float>&, const BasicDataSource<float>&);
+
+  extern template void Trainer::fit(BasicDataParallel<double>&, const BasicDataSource<double>&);
+
+  extern template void Trainer::fit(BasicDataParallel<float>&, const BasicDataSource<float>&);
+
+}//end namespace NN
+#endif //TRAINER_HPP
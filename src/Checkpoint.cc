@@ -0,0 +1,351 @@
+#include "Checkpoint.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace NN
+{
+  namespace
+  {
+    uint64_t alignUp(uint64_t offset)
+    {
+      return (offset + CHECKPOINT_ALIGNMENT - 1) & ~(CHECKPOINT_ALIGNMENT - 1);
+    }
+
+    void writeAt(std::ofstream& file, uint64_t offset, const void* data, uint64_t bytes)
+    {
+      file.seekp(offset);
+      file.write(static_cast<const char*>(data), bytes);
+    }
+  }
+
+  template<typename Scalar>
+  void saveCheckpoint(const BasicNetwork<Scalar>& net, const std::string& path)
+  {
+    if(not net.hasShapes()){
+      throw "Error: the network holds no weights until its first batch.";
+    }
+    const auto& layers = net.getLayers();
+    const auto lossHistory = net.getLossHistory();
+
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.scalarBytes = sizeof(Scalar);
+    header.numLayers = layers.size();
+    header.numLoss = lossHistory.size();
+
+    //lay out the records first so every tensor offset is known before writing
+    std::vector<CheckpointLayerRecord> records(layers.size());
+    uint64_t offset = sizeof(CheckpointHeader) + records.size() * sizeof(CheckpointLayerRecord);
+    bool anySecond = false;
+    size_t i = 0;
+    for(const auto& l : layers){
+      auto& r = records[i++];
+      const auto name = l.getActivation();
+      if(name == "custom"){
+	throw "Error: layers with custom activations cannot be checkpointed.";
+      }
+      if(l.getKind() != LayerKind::Dense){
+	throw "Error: only dense layers can be checkpointed.";
+      }
+      if(name.size() >= sizeof(r.activation)){
+	throw "Error: activation name too long for a checkpoint.";
+      }
+      std::memcpy(r.activation, name.c_str(), name.size() + 1);
+      r.batchRows = l.getInputShape().first;
+      r.inputSize = l.getInputShape().second;
+      r.outputSize = l.getOutputSize();
+      const auto& opt = l.getOptimizer();
+      r.updateRule = static_cast<uint32_t>(opt.rule);
+      r.learningRate = opt.learningRate;
+      r.momentum = opt.momentum;
+      r.beta2 = opt.beta2;
+      r.epsilon = opt.epsilon;
+      r.weightDecay = opt.weightDecay;
+      r.updateStep = l.getUpdateStep();
+      anySecond = anySecond or usesSecondState(opt.rule);
+    }
+
+    /*
+     * A packed network's regions go out as three blocks (weights, first
+     * state, second state) with the records pointing into them; the arena's
+     * tensors are 64-byte aligned, so the record offsets are too. Otherwise
+     * each tensor is laid out on its own.
+     * */
+    const bool packed = net.parametersPacked();
+    const auto& arena = net.getParameterArena();
+    const uint64_t regionBytes = arena.getRegionSize() * sizeof(Scalar);
+    uint64_t weightsBase = 0, firstBase = 0, secondBase = 0;
+    if(packed){
+      weightsBase = alignUp(offset);
+      firstBase = alignUp(weightsBase + regionBytes);
+      offset = firstBase + regionBytes;
+      if(anySecond){
+	secondBase = alignUp(offset);
+	offset = secondBase + regionBytes;
+      }
+    }
+    i = 0;
+    for(const auto& l : layers){
+      auto& r = records[i];
+      const uint64_t tensorBytes = (r.inputSize + 1) * r.outputSize * sizeof(Scalar);
+      //rules without a second buffer leave it unsaved
+      const bool second = usesSecondState(l.getOptimizer().rule);
+      if(packed){
+	const uint64_t at = arena.offset(i) * sizeof(Scalar);
+	r.weightsOffset = weightsBase + at;
+	r.weightUpdateOffset = firstBase + at;
+	r.secondMomentOffset = second ? secondBase + at : 0;
+      } else {
+	r.weightsOffset = alignUp(offset);
+	r.weightUpdateOffset = alignUp(r.weightsOffset + tensorBytes);
+	offset = r.weightUpdateOffset + tensorBytes;
+	if(second){
+	  r.secondMomentOffset = alignUp(offset);
+	  offset = r.secondMomentOffset + tensorBytes;
+	}
+      }
+      i++;
+    }
+    header.lossOffset = alignUp(offset);
+    header.fileBytes = header.lossOffset + lossHistory.size() * sizeof(double);
+
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if(not file){
+      throw "Error: could not open checkpoint file for writing.";
+    }
+    writeAt(file, 0, &header, sizeof(header));
+    writeAt(file, sizeof(header), records.data(), records.size() * sizeof(CheckpointLayerRecord));
+    if(packed){
+      writeAt(file, weightsBase, arena.region(arena.Weights), regionBytes);
+      writeAt(file, firstBase, arena.region(arena.FirstState), regionBytes);
+      if(anySecond){
+	writeAt(file, secondBase, arena.region(arena.SecondState), regionBytes);
+      }
+    } else {
+      i = 0;
+      for(const auto& l : layers){
+	const auto& r = records[i++];
+	const uint64_t tensorBytes = (r.inputSize + 1) * r.outputSize * sizeof(Scalar);
+	writeAt(file, r.weightsOffset, l.getWeights().data(), tensorBytes);
+	writeAt(file, r.weightUpdateOffset, l.getWeightUpdate().data(), tensorBytes);
+	if(r.secondMomentOffset){
+	  writeAt(file, r.secondMomentOffset, l.getSecondMoment().data(), tensorBytes);
+	}
+      }
+    }
+    writeAt(file, header.lossOffset, lossHistory.data(), lossHistory.size() * sizeof(double));
+    //pad out to fileBytes when the tail is empty
+    if(lossHistory.empty() and header.fileBytes > 0){
+      const char zero = 0;
+      writeAt(file, header.fileBytes - 1, &zero, 1);
+    }
+    file.close();
+    //on disk before it replaces path, or a crash could leave path empty
+    bool written = static_cast<bool>(file);
+    const int fd = written ? open(tmpPath.c_str(), O_RDONLY | O_CLOEXEC) : -1;
+    written = fd >= 0 and fsync(fd) == 0;
+    if(fd >= 0){
+      close(fd);
+    }
+    if(not written or std::rename(tmpPath.c_str(), path.c_str()) != 0){
+      std::remove(tmpPath.c_str());
+      throw "Error: failed writing checkpoint.";
+    }
+  }
+
+  template<typename Scalar>
+  void loadCheckpoint(BasicNetwork<Scalar>& net, const std::string& path)
+  {
+    using Layer = BasicLayer<Scalar>;
+    using Mat = RowMat<Scalar>;
+
+    BasicMappedCheckpoint<Scalar> ckpt(path);
+    std::list<Layer> layers;
+    for(int_t i = 0; i < ckpt.numLayers(); i++){
+      const auto& r = ckpt.layerRecord(i);
+      Layer l(std::pair<int_t, int_t>(r.batchRows, r.inputSize), r.outputSize,
+	      std::string(r.activation), false);
+      l.setWeights(Mat(ckpt.weights(i)));
+      l.setUpdateParams(ckpt.optimizer(i));
+      l.setWeightUpdate(Mat(ckpt.weightUpdate(i)));
+      l.setSecondMoment(Mat(ckpt.secondMoment(i)));
+      l.setUpdateStep(r.updateStep);
+      layers.push_back(std::move(l));
+    }
+    net.setLayers(layers);
+
+    const auto loss = ckpt.lossHistory();
+    net.setLossHistory(std::vector<double>(loss.data(), loss.data() + loss.size()));
+  }
+
+
+  template<typename Scalar>
+  BasicMappedCheckpoint<Scalar>::BasicMappedCheckpoint(const std::string& path)
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+      throw "Error: could not open checkpoint file.";
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 or st.st_size < static_cast<off_t>(sizeof(CheckpointHeader))){
+      close(fd);
+      throw "Error: checkpoint file is truncated.";
+    }
+    length = st.st_size;
+    void* m = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    //the mapping keeps the file alive
+    close(fd);
+    if(m == MAP_FAILED){
+      length = 0;
+      throw "Error: could not map checkpoint file.";
+    }
+    base = static_cast<const unsigned char*>(m);
+    header = reinterpret_cast<const CheckpointHeader*>(base);
+
+    //validate everything up front so the accessors need no checks
+    const char* problem = nullptr;
+    if(std::memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0){
+      problem = "Error: not a checkpoint file.";
+    } else if(header->version != CHECKPOINT_VERSION){
+      problem = "Error: unsupported checkpoint version.";
+    } else if(header->scalarBytes != sizeof(Scalar)){
+      problem = "Error: checkpoint was saved with a different scalar type.";
+    } else if(header->fileBytes != length or header->numLayers == 0 or
+	      header->numLayers > (length - sizeof(CheckpointHeader)) / sizeof(CheckpointLayerRecord)){
+      problem = "Error: checkpoint file is truncated.";
+    } else if(header->lossOffset % CHECKPOINT_ALIGNMENT != 0 or header->lossOffset > length or
+	      header->numLoss > (length - header->lossOffset) / sizeof(double)){
+      problem = "Error: corrupt checkpoint loss history.";
+    }
+    if(not problem){
+      records = reinterpret_cast<const CheckpointLayerRecord*>(base + sizeof(CheckpointHeader));
+      int_t prevOutputs = records[0].inputSize;
+      for(uint64_t i = 0; i < header->numLayers and not problem; i++){
+	const auto& r = records[i];
+	if(r.inputSize <= 0 or r.outputSize <= 0 or r.inputSize != prevOutputs){
+	  problem = "Error: checkpoint layer shapes do not chain.";
+	  break;
+	}
+	prevOutputs = r.outputSize;
+	//bounded first, so the size of a tensor can't wrap around
+	if(static_cast<uint64_t>(r.inputSize) >= length or
+	   static_cast<uint64_t>(r.outputSize) > length / sizeof(Scalar) / (r.inputSize + 1)){
+	  problem = "Error: checkpoint layer is larger than the file.";
+	  break;
+	}
+	const uint64_t tensorBytes = (r.inputSize + 1) * r.outputSize * sizeof(Scalar);
+	for(uint64_t off : {r.weightsOffset, r.weightUpdateOffset, r.secondMomentOffset}){
+	  if(off % CHECKPOINT_ALIGNMENT != 0 or off > length or tensorBytes > length - off){
+	    problem = "Error: corrupt checkpoint tensor offset.";
+	  }
+	}
+	if(r.updateRule > static_cast<uint32_t>(UpdateRule::Adagrad)){
+	  problem = "Error: unknown update rule in checkpoint.";
+	}
+	if(std::memchr(r.activation, '\0', sizeof(r.activation)) == nullptr){
+	  problem = "Error: corrupt checkpoint activation name.";
+	}
+      }
+    }
+    if(problem){
+      unmap();
+      throw problem;
+    }
+
+    try{
+      for(uint64_t i = 0; i < header->numLayers; i++){
+	activations.push_back(activationKernel<Scalar>(records[i].activation));
+      }
+    } catch(...){
+      unmap();
+      throw;
+    }
+  }
+
+  template<typename Scalar>
+  BasicMappedCheckpoint<Scalar>::~BasicMappedCheckpoint()
+  {
+    unmap();
+  }
+
+  template<typename Scalar>
+  BasicMappedCheckpoint<Scalar>::BasicMappedCheckpoint(BasicMappedCheckpoint&& other) noexcept
+    : base(other.base),
+      length(other.length),
+      header(other.header),
+      records(other.records),
+      activations(std::move(other.activations))
+  {
+    other.base = nullptr;
+    other.length = 0;
+  }
+
+  template<typename Scalar>
+  BasicMappedCheckpoint<Scalar>& BasicMappedCheckpoint<Scalar>::operator=(BasicMappedCheckpoint&& other) noexcept
+  {
+    if(this != &other){
+      unmap();
+      base = other.base;
+      length = other.length;
+      header = other.header;
+      records = other.records;
+      activations = std::move(other.activations);
+      other.base = nullptr;
+      other.length = 0;
+    }
+    return *this;
+  }
+
+  template<typename Scalar>
+  void BasicMappedCheckpoint<Scalar>::unmap() noexcept
+  {
+    if(base){
+      munmap(const_cast<unsigned char*>(base), length);
+    }
+    base = nullptr;
+    length = 0;
+  }
+
+  template<typename Scalar>
+  void BasicMappedCheckpoint<Scalar>::predict(ConstMatRef batch, MatRef out)
+  {
+    const int_t n = numLayers();
+    if(batch.cols() != records[0].inputSize){
+      throw "Error: batch width does not match the checkpoint's input size.";
+    }
+    if(out.rows() != batch.rows() or out.cols() != numOutputs()){
+      throw "Error: output must be batch rows x numOutputs().";
+    }
+    for(int_t i = 0; i < n; i++){
+      ConstMatRef x = i == 0 ? batch : ConstMatRef(scratch[(i - 1) % 2]);
+      if(i == n - 1){
+	denseForward<Scalar>(x, weights(i), activations[i], out, out);
+	break;
+      }
+      //the activation runs in place on the pre-activation buffer
+      Mat& buf = scratch[i % 2];
+      buf.resize(batch.rows(), records[i].outputSize);
+      denseForward<Scalar>(x, weights(i), activations[i], buf, buf);
+    }
+  }
+
+  template void saveCheckpoint(const BasicNetwork<double>&, const std::string&);
+
+  template void saveCheckpoint(const BasicNetwork<float>&, const std::string&);
+
+  template void loadCheckpoint(BasicNetwork<double>&, const std::string&);
+
+  template void loadCheckpoint(BasicNetwork<float>&, const std::string&);
+
+  template class BasicMappedCheckpoint<double>;
+
+  template class BasicMappedCheckpoint<float>;
+
+}//end namespace NN
@@ -0,0 +1,362 @@
+#include "Conv.hpp"
+#include "Threading.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace NN
+{
+  namespace
+  {
+    using int_t = int_fast64_t;
+
+    //output positions per im2col block: about 32K patch scalars, so the
+    //patches stay in L2 between the copy and the GEMM
+    int_t positionBlock(int_t patchSize) noexcept
+    {
+      return std::max<int_t>(64, (1 << 15) / std::max<int_t>(patchSize, 1));
+    }
+
+    /*
+     * one packing workspace for the products over total positions taken a
+     * block at a time, sized for the full and the remainder block;
+     * shape(nb) gives a block's (rows, cols, depth)
+     * */
+    template<typename Scalar, typename Shape>
+    Scalar* blockWorkspace(ScratchArena& scratch, int_t total, int_t block, Shape&& shape)
+    {
+      size_t need = 0;
+      for(int_t nb : {std::min(block, total), total % block}){
+	if(nb > 0){
+	  const auto [rows, cols, depth] = shape(nb);
+	  if(internal::packsIntoScratch(rows, cols, depth)){
+	    need = std::max(need, internal::gemmWorkspace<Scalar>(rows, cols, depth));
+	  }
+	}
+      }
+      return need ? scratch.take<Scalar>(need) : nullptr;
+    }
+
+    //preact = conv(x) + bias for the rows of x, preact contiguous
+    template<typename Scalar>
+    void convRows(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> weights,
+		  const ConvSpec& spec, Eigen::Ref<RowMat<Scalar>> preact, ScratchArena& scratch)
+    {
+      using Block = Eigen::Map<RowMat<Scalar>>;
+      const int_t k = spec.patchSize();
+      const int_t f = spec.filters;
+      const int_t total = x.rows() * spec.output().height * spec.output().width;
+      const int_t block = positionBlock(k);
+      const auto w = weights.topRows(k);
+      const auto bias = weights.row(k);
+      Scalar* patches = scratch.take<Scalar>(std::min(block, total) * k);
+      Scalar* workspace = blockWorkspace<Scalar>(scratch, total, block, [&](int_t nb){
+	return std::make_tuple(nb, f, k);
+      });
+      for(int_t p = 0; p < total; p += block){
+	const int_t nb = std::min(block, total - p);
+	internal::im2col<Scalar>(x, spec, p, nb, patches);
+	Block act(preact.data() + p * f, nb, f);
+	act.setZero();
+	internal::gemmAccumulate(Block(patches, nb, k), w, act, workspace);
+	act.rowwise() += bias;
+      }
+    }
+
+    //preact = max or mean over each window of x, padding skipped
+    template<typename Scalar>
+    void poolRows(Eigen::Ref<const RowMat<Scalar>> x, const ConvSpec& spec,
+		  Eigen::Ref<RowMat<Scalar>> preact) noexcept
+    {
+      const SpatialShape in = spec.input;
+      const SpatialShape o = spec.output();
+      const int_t c = in.channels;
+      const bool isMax = spec.kind == LayerKind::MaxPool;
+      for(int_t s = 0; s < x.rows(); s++){
+	const Scalar* xs = x.data() + s * x.outerStride();
+	Scalar* dst = preact.data() + s * preact.outerStride();
+	for(int_t oy = 0; oy < o.height; oy++){
+	  const int_t y0 = std::max<int_t>(oy * spec.strideH - spec.padH, 0);
+	  const int_t y1 = std::min(oy * spec.strideH - spec.padH + spec.kernelH, in.height);
+	  for(int_t ox = 0; ox < o.width; ox++, dst += c){
+	    const int_t x0 = std::max<int_t>(ox * spec.strideW - spec.padW, 0);
+	    const int_t x1 = std::min(ox * spec.strideW - spec.padW + spec.kernelW, in.width);
+	    std::fill(dst, dst + c, isMax ? -std::numeric_limits<Scalar>::infinity() : Scalar(0));
+	    for(int_t iy = y0; iy < y1; iy++){
+	      for(int_t ix = x0; ix < x1; ix++){
+		const Scalar* src = xs + (iy * in.width + ix) * c;
+		if(isMax){
+		  for(int_t ch = 0; ch < c; ch++){
+		    dst[ch] = std::max(dst[ch], src[ch]);
+		  }
+		} else {
+		  for(int_t ch = 0; ch < c; ch++){
+		    dst[ch] += src[ch];
+		  }
+		}
+	      }
+	    }
+	    if(not isMax){
+	      const Scalar scale = Scalar(1) / ((y1 - y0) * (x1 - x0));
+	      for(int_t ch = 0; ch < c; ch++){
+		dst[ch] *= scale;
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+  void ConvSpec::validate() const
+  {
+    if(kind != LayerKind::Conv and kind != LayerKind::MaxPool and kind != LayerKind::AvgPool){
+      throw "Error: a convolution spec must describe a convolution or a pool.";
+    }
+    if(input.height <= 0 or input.width <= 0 or input.channels <= 0 or filters <= 0){
+      throw "Error: convolution input and filter counts must be positive.";
+    }
+    if(kernelH <= 0 or kernelW <= 0 or strideH <= 0 or strideW <= 0){
+      throw "Error: kernel sizes and strides must be positive.";
+    }
+    if(padH < 0 or padW < 0 or padH >= kernelH or padW >= kernelW){
+      throw "Error: padding must be non-negative and smaller than the kernel.";
+    }
+    if(kernelH > input.height + 2 * padH or kernelW > input.width + 2 * padW){
+      throw "Error: kernel larger than the padded input.";
+    }
+  }
+
+  template<typename Scalar>
+  void spatialForward(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> weights,
+		      const ConvSpec& spec, const ActivationKernel<Scalar>& activation,
+		      Eigen::Ref<RowMat<Scalar>> preact, Eigen::Ref<RowMat<Scalar>> out,
+		      int numThreads, bool splitRows, LayerProfile* profile, ScratchArena* scratch)
+  {
+    const SpatialShape o = spec.output();
+    const int_t positions = o.height * o.width;
+    //multiply-adds (or comparisons) per row
+    const int_t rowWork = spec.kind == LayerKind::Conv
+      ? positions * (spec.patchSize() * spec.filters + spec.filters) : positions * spec.patchSize();
+    ScratchArena local;
+    ScratchArena& arena = scratch ? *scratch : local;
+    internal::forRowSlices(x.rows(), numThreads, splitRows, [&](int_t first, int_t count, int){
+      auto act = preact.middleRows(first, count);
+      {
+	internal::PhaseTimer timer(profile, Phase::Forward,
+				   count * (spec.kind == LayerKind::Conv ? 2 * rowWork : rowWork));
+	if(spec.kind == LayerKind::Conv){
+	  convRows<Scalar>(x.middleRows(first, count), weights, spec, act, arena);
+	} else {
+	  poolRows<Scalar>(x.middleRows(first, count), spec, act);
+	}
+      }
+      internal::PhaseTimer timer(profile, Phase::Activation, count * o.size());
+      activation.forward(act, out.middleRows(first, count));
+    });
+  }
+
+
+  namespace internal
+  {
+    template<typename Scalar>
+    void im2col(Eigen::Ref<const RowMat<Scalar>> x, const ConvSpec& spec, int_fast64_t firstPos,
+		int_fast64_t count, Scalar* patches) noexcept
+    {
+      const SpatialShape in = spec.input;
+      const SpatialShape o = spec.output();
+      const int_t c = in.channels;
+      const int_t rowLength = spec.kernelW * c;
+      const int_t positions = o.height * o.width;
+      for(int_t p = firstPos; p < firstPos + count; p++){
+	const Scalar* xs = x.data() + (p / positions) * x.outerStride();
+	const int_t oy = p % positions / o.width;
+	const int_t ox = p % o.width;
+	const int_t ix0 = ox * spec.strideW - spec.padW;
+	for(int_t ky = 0; ky < spec.kernelH; ky++, patches += rowLength){
+	  const int_t iy = oy * spec.strideH - spec.padH + ky;
+	  if(iy < 0 or iy >= in.height){
+	    std::fill(patches, patches + rowLength, Scalar(0));
+	    continue;
+	  }
+	  //the kernel row's inputs are contiguous apart from the padding at either end
+	  const int_t lo = std::max<int_t>(0, -ix0);
+	  const int_t hi = std::min(spec.kernelW, in.width - ix0);
+	  std::fill(patches, patches + lo * c, Scalar(0));
+	  std::copy(xs + (iy * in.width + ix0 + lo) * c, xs + (iy * in.width + ix0 + hi) * c, patches + lo * c);
+	  std::fill(patches + hi * c, patches + rowLength, Scalar(0));
+	}
+      }
+    }
+
+    template<typename Scalar>
+    void col2imAccumulate(const Scalar* patches, const ConvSpec& spec, int_fast64_t firstPos,
+			  int_fast64_t count, Eigen::Ref<RowMat<Scalar>> dx) noexcept
+    {
+      const SpatialShape in = spec.input;
+      const SpatialShape o = spec.output();
+      const int_t c = in.channels;
+      const int_t rowLength = spec.kernelW * c;
+      const int_t positions = o.height * o.width;
+      for(int_t p = firstPos; p < firstPos + count; p++){
+	Scalar* ds = dx.data() + (p / positions) * dx.outerStride();
+	const int_t oy = p % positions / o.width;
+	const int_t ox = p % o.width;
+	const int_t ix0 = ox * spec.strideW - spec.padW;
+	const int_t lo = std::max<int_t>(0, -ix0);
+	const int_t hi = std::min(spec.kernelW, in.width - ix0);
+	for(int_t ky = 0; ky < spec.kernelH; ky++, patches += rowLength){
+	  const int_t iy = oy * spec.strideH - spec.padH + ky;
+	  if(iy < 0 or iy >= in.height){
+	    continue;
+	  }
+	  Scalar* d = ds + (iy * in.width + ix0 + lo) * c;
+	  const Scalar* src = patches + lo * c;
+	  for(int_t j = 0; j < (hi - lo) * c; j++){
+	    d[j] += src[j];
+	  }
+	}
+      }
+    }
+
+    template<typename Scalar>
+    void convGradient(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> e,
+		      const ConvSpec& spec, Eigen::Ref<RowMat<Scalar>> grad, ScratchArena& scratch)
+    {
+      using Block = Eigen::Map<const RowMat<Scalar>>;
+      const int_t k = spec.patchSize();
+      const int_t f = spec.filters;
+      const int_t total = x.rows() * spec.output().height * spec.output().width;
+      const int_t block = positionBlock(k);
+      auto g = grad.topRows(k);
+      Scalar* patches = scratch.take<Scalar>(std::min(block, total) * k);
+      Scalar* workspace = blockWorkspace<Scalar>(scratch, total, block, [&](int_t nb){
+	return std::make_tuple(k, f, nb);
+      });
+      for(int_t p = 0; p < total; p += block){
+	const int_t nb = std::min(block, total - p);
+	im2col<Scalar>(x, spec, p, nb, patches);
+	const Block eb(e.data() + p * f, nb, f);
+	gemmAccumulate(Block(patches, nb, k).transpose(), eb, g, workspace);
+	grad.row(k) += eb.colwise().sum();
+      }
+    }
+
+    template<typename Scalar>
+    void convBackwardData(Eigen::Ref<const RowMat<Scalar>> e, Eigen::Ref<const RowMat<Scalar>> weights,
+			  const ConvSpec& spec, Eigen::Ref<RowMat<Scalar>> dx, ScratchArena& scratch)
+    {
+      const int_t k = spec.patchSize();
+      const int_t f = spec.filters;
+      const int_t total = e.rows() * spec.output().height * spec.output().width;
+      const int_t block = positionBlock(k);
+      const auto w = weights.topRows(k);
+      Scalar* patches = scratch.take<Scalar>(std::min(block, total) * k);
+      Scalar* workspace = blockWorkspace<Scalar>(scratch, total, block, [&](int_t nb){
+	return std::make_tuple(nb, k, f);
+      });
+      for(int_t p = 0; p < total; p += block){
+	const int_t nb = std::min(block, total - p);
+	Eigen::Map<RowMat<Scalar>> cols(patches, nb, k);
+	cols.setZero();
+	gemmAccumulate(Eigen::Map<const RowMat<Scalar>>(e.data() + p * f, nb, f), w.transpose(), cols, workspace);
+	col2imAccumulate<Scalar>(patches, spec, p, nb, dx);
+      }
+    }
+
+    template<typename Scalar>
+    void poolBackwardData(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> pooled,
+			  Eigen::Ref<const RowMat<Scalar>> e, const ConvSpec& spec,
+			  Eigen::Ref<RowMat<Scalar>> dx) noexcept
+    {
+      const SpatialShape in = spec.input;
+      const SpatialShape o = spec.output();
+      const int_t c = in.channels;
+      const bool isMax = spec.kind == LayerKind::MaxPool;
+      for(int_t s = 0; s < x.rows(); s++){
+	const Scalar* xs = x.data() + s * x.outerStride();
+	const Scalar* ps = pooled.data() + s * pooled.outerStride();
+	const Scalar* es = e.data() + s * e.outerStride();
+	Scalar* ds = dx.data() + s * dx.outerStride();
+	for(int_t oy = 0; oy < o.height; oy++){
+	  const int_t y0 = std::max<int_t>(oy * spec.strideH - spec.padH, 0);
+	  const int_t y1 = std::min(oy * spec.strideH - spec.padH + spec.kernelH, in.height);
+	  for(int_t ox = 0; ox < o.width; ox++, ps += c, es += c){
+	    const int_t x0 = std::max<int_t>(ox * spec.strideW - spec.padW, 0);
+	    const int_t x1 = std::min(ox * spec.strideW - spec.padW + spec.kernelW, in.width);
+	    if(isMax){
+	      //the error goes to the first input that took the max, as the
+	      //forward pass kept the first of equal values
+	      for(int_t ch = 0; ch < c; ch++){
+		bool found = false;
+		for(int_t iy = y0; iy < y1 and not found; iy++){
+		  for(int_t ix = x0; ix < x1; ix++){
+		    const int_t at = (iy * in.width + ix) * c + ch;
+		    if(xs[at] == ps[ch]){
+		      ds[at] += es[ch];
+		      found = true;
+		      break;
+		    }
+		  }
+		}
+	      }
+	    } else {
+	      const Scalar scale = Scalar(1) / ((y1 - y0) * (x1 - x0));
+	      for(int_t iy = y0; iy < y1; iy++){
+		for(int_t ix = x0; ix < x1; ix++){
+		  Scalar* d = ds + (iy * in.width + ix) * c;
+		  for(int_t ch = 0; ch < c; ch++){
+		    d[ch] += scale * es[ch];
+		  }
+		}
+	      }
+	    }
+	  }
+	}
+      }
+    }
+
+    template void im2col<double>(Eigen::Ref<const RowMat<double>>, const ConvSpec&, int_fast64_t,
+				 int_fast64_t, double*) noexcept;
+
+    template void im2col<float>(Eigen::Ref<const RowMat<float>>, const ConvSpec&, int_fast64_t,
+				int_fast64_t, float*) noexcept;
+
+    template void col2imAccumulate<double>(const double*, const ConvSpec&, int_fast64_t, int_fast64_t,
+					   Eigen::Ref<RowMat<double>>) noexcept;
+
+    template void col2imAccumulate<float>(const float*, const ConvSpec&, int_fast64_t, int_fast64_t,
+					  Eigen::Ref<RowMat<float>>) noexcept;
+
+    template void convGradient<double>(Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+				       const ConvSpec&, Eigen::Ref<RowMat<double>>, ScratchArena&);
+
+    template void convGradient<float>(Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+				      const ConvSpec&, Eigen::Ref<RowMat<float>>, ScratchArena&);
+
+    template void convBackwardData<double>(Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+					   const ConvSpec&, Eigen::Ref<RowMat<double>>, ScratchArena&);
+
+    template void convBackwardData<float>(Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+					  const ConvSpec&, Eigen::Ref<RowMat<float>>, ScratchArena&);
+
+    template void poolBackwardData<double>(Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+					   Eigen::Ref<const RowMat<double>>, const ConvSpec&,
+					   Eigen::Ref<RowMat<double>>) noexcept;
+
+    template void poolBackwardData<float>(Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+					  Eigen::Ref<const RowMat<float>>, const ConvSpec&,
+					  Eigen::Ref<RowMat<float>>) noexcept;
+
+  }//end namespace internal
+
+  template void spatialForward<double>(Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+				       const ConvSpec&, const ActivationKernel<double>&,
+				       Eigen::Ref<RowMat<double>>, Eigen::Ref<RowMat<double>>,
+				       int, bool, LayerProfile*, ScratchArena*);
+
+  template void spatialForward<float>(Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+				      const ConvSpec&, const ActivationKernel<float>&,
+				      Eigen::Ref<RowMat<float>>, Eigen::Ref<RowMat<float>>,
+				      int, bool, LayerProfile*, ScratchArena*);
+
+}//end namespace NN
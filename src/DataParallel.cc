@@ -0,0 +1,137 @@
+#include "DataParallel.hpp"
+#include <omp.h>
+
+namespace NN
+{
+  template<typename Scalar>
+  BasicDataParallel<Scalar>::BasicDataParallel(BasicNetwork<Scalar>& _net, int _numThreads)
+    : net(_net),
+      numThreads(_numThreads)
+  {
+    if(numThreads <= 0){
+      throw "Error: number of threads must be positive.";
+    }
+    if(not net.hasShapes()){
+      throw "Error: the network holds no weights until its first batch.";
+    } else if(net.hasOutputLayer()){
+      throw "Error: data-parallel replicas run the layers alone, not an output layer past them.";
+    }
+    sync();
+  }
+
+  template<typename Scalar>
+  void BasicDataParallel<Scalar>::sync()
+  {
+    auto& arena = net.arena;
+    std::vector<std::pair<int_fast64_t, int_fast64_t>> shapes;
+    for(size_t i = 0; i < arena.numTensors(); i++){
+      shapes.push_back(arena.shape(i));
+    }
+    replicas.clear();
+    for(int t = 0; t < numThreads; t++){
+      auto r = std::make_unique<Replica>();
+      r->layers = net.layers;
+      r->arena = BasicParameterArena<Scalar>(shapes);
+      size_t i = 0;
+      for(auto& l : r->layers){
+	//each thread runs its shard serially; the threads are the parallelism
+	l.setNumThreads(1, Parallelism::Gemm);
+	l.viewParameters(arena.tensor(arena.Weights, i), r->arena.tensor(arena.Gradients, i),
+			 r->arena.tensor(arena.FirstState, i), r->arena.tensor(arena.SecondState, i));
+	i++;
+      }
+      r->graph = BasicLayerGraph<Scalar>(r->layers);
+      replicas.push_back(std::move(r));
+    }
+  }
+
+  template<typename Scalar>
+  double BasicDataParallel<Scalar>::trainStep(ConstMatRef batchInputs, ConstMatRef batchTargets)
+  {
+    if(batchInputs.cols() != net.input_shape.second){
+      throw "Error: batch inputs must have input_shape.second columns";
+    } else if(batchTargets.rows() != batchInputs.rows() or batchTargets.cols() != net.num_outputs){
+      throw "Error: batch targets must have one row of num_outputs values per input row";
+    } else if(not net.parametersPacked() or replicas.front()->layers.front().getWeights().data()
+	      != net.arena.tensor(net.arena.Weights, 0)){
+      throw "Error: the network changed since its replicas were made; call sync()";
+    }
+    const int_t rows = batchInputs.rows();
+    const int shards = static_cast<int>(std::min<int_t>(numThreads, rows));
+    auto& arena = net.arena;
+    constexpr int_fast64_t perLine = PARAMETER_ALIGNMENT / sizeof(Scalar);
+    const int_fast64_t regionSize = arena.getRegionSize();
+    const int_fast64_t lines = regionSize / perLine;
+    const auto& loss = net.loss_kernel;
+
+    #pragma omp parallel num_threads(shards)
+    {
+      const int t = omp_get_thread_num();
+      const int nt = omp_get_num_threads();
+      //a team smaller than asked for still covers every shard
+      for(int s = t; s < shards; s += nt){
+	Replica& r = *replicas[s];
+	const int_t r0 = rows * s / shards;
+	const int_t count = rows * (s + 1) / shards - r0;
+	if(r.graph.getPlannedRows() != count){
+	  r.graph.plan(count);
+	  r.lossGrad.resize(count, net.num_outputs);
+	}
+	const Mat& out = r.graph.forward(batchInputs.middleRows(r0, count));
+	r.loss = loss.evaluate(out, batchTargets.middleRows(r0, count), r.lossGrad);
+	r.graph.backward(r.lossGrad);
+      }
+      #pragma omp barrier
+      //each thread sums its slice of every replica's gradients, in replica order
+      const int_fast64_t first = lines * t / nt * perLine;
+      const int_fast64_t last = lines * (t + 1) / nt * perLine;
+      Scalar* __restrict g = arena.region(arena.Gradients);
+      const Scalar* __restrict g0 = replicas[0]->arena.region(arena.Gradients);
+      #pragma omp simd
+      for(int_fast64_t i = first; i < last; i++){
+	g[i] = g0[i];
+      }
+      for(int s = 1; s < shards; s++){
+	const Scalar* __restrict gs = replicas[s]->arena.region(arena.Gradients);
+        #pragma omp simd
+	for(int_fast64_t i = first; i < last; i++){
+	  g[i] += gs[i];
+	}
+      }
+    }
+
+    //each replica's batch norms saw only its shard; the network keeps the
+    //mean of their running statistics, and the replicas go on from it
+    size_t i = 0;
+    for(auto& l : net.layers){
+      if(l.getKind() == LayerKind::BatchNorm){
+	Mat stats = Mat::Zero(l.getRunningStats().rows(), l.getRunningStats().cols());
+	for(int s = 0; s < shards; s++){
+	  stats += std::next(replicas[s]->layers.begin(), i)->getRunningStats();
+	}
+	stats /= Scalar(shards);
+	l.setRunningStats(stats);
+	for(auto& r : replicas){
+	  std::next(r->layers.begin(), i)->setRunningStats(stats);
+	}
+      }
+      i++;
+    }
+
+    double total = 0;
+    for(int s = 0; s < shards; s++){
+      total += replicas[s]->loss;
+    }
+    net.scalar_loss = total;
+    net.gradient = net.layers.front().getGradient();
+    net.trainingLoss.push_back(total);
+    net.updateWeights();
+    return total;
+  }
+
+
+  template class BasicDataParallel<double>;
+
+  template class BasicDataParallel<float>;
+
+}//end namespace NN
@@ -0,0 +1,495 @@
+#include "Distributed.hpp"
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace NN
+{
+  namespace
+  {
+    bool wouldBlock() noexcept
+    {
+      return errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR;
+    }
+
+  }
+
+  void ProcessGroup::closeLinks() noexcept
+  {
+    if(leftFd >= 0){
+      close(leftFd);
+    }
+    if(rightFd >= 0){
+      close(rightFd);
+    }
+    leftFd = rightFd = -1;
+  }
+
+  ProcessGroup& ProcessGroup::operator=(ProcessGroup&& other) noexcept
+  {
+    if(this != &other){
+      closeLinks();
+      rank = other.rank;
+      size = other.size;
+      leftFd = std::exchange(other.leftFd, -1);
+      rightFd = std::exchange(other.rightFd, -1);
+      scratch = std::move(other.scratch);
+    }
+    return *this;
+  }
+
+  ProcessGroup::ProcessGroup(const std::string& socketPrefix, int _rank, int _size, double timeoutSeconds)
+    : rank(_rank),
+      size(_size)
+  {
+    if(size <= 0 or rank < 0 or rank >= size){
+      throw "Error: rank must be in [0, size).";
+    }
+    if(size == 1){
+      return;
+    }
+    auto address = [&](int r){
+      sockaddr_un a{};
+      a.sun_family = AF_UNIX;
+      const std::string path = socketPrefix + "." + std::to_string(r);
+      if(path.size() >= sizeof(a.sun_path)){
+	throw "Error: socket path is too long.";
+      }
+      std::strcpy(a.sun_path, path.c_str());
+      return a;
+    };
+    const sockaddr_un own = address(rank);
+    const sockaddr_un next = address((rank + 1) % size);
+
+    unlink(own.sun_path);
+    const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listener < 0 or bind(listener, reinterpret_cast<const sockaddr*>(&own), sizeof(own)) != 0
+       or listen(listener, 1) != 0){
+      if(listener >= 0){
+	close(listener);
+      }
+      throw "Error: could not listen on the rank's socket.";
+    }
+    auto fail = [&](const char* problem){
+      close(listener);
+      unlink(own.sun_path);
+      closeLinks();
+      throw problem;
+    };
+
+    //the next rank may not be listening yet
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeoutSeconds);
+    while(true){
+      rightFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if(rightFd < 0){
+	fail("Error: could not create a socket.");
+      }
+      if(connect(rightFd, reinterpret_cast<const sockaddr*>(&next), sizeof(next)) == 0){
+	break;
+      }
+      close(rightFd);
+      rightFd = -1;
+      if(std::chrono::steady_clock::now() > deadline){
+	fail("Error: timed out connecting to the next rank.");
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    pollfd pending{listener, POLLIN, 0};
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    if(poll(&pending, 1, std::max<int>(0, left.count())) != 1){
+      fail("Error: timed out waiting for the previous rank.");
+    }
+    leftFd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    close(listener);
+    unlink(own.sun_path);
+    if(leftFd < 0){
+      closeLinks();
+      throw "Error: could not accept the previous rank.";
+    }
+  }
+
+  int ProcessGroup::launch(int worldSize, const std::function<int(ProcessGroup&)>& body)
+  {
+    if(worldSize <= 0){
+      throw "Error: a process group needs at least one rank.";
+    }
+    //link k carries rank k's sends to rank k+1; links[k][0] is rank k's end
+    std::vector<std::array<int, 2>> links(worldSize > 1 ? worldSize : 0, {-1, -1});
+    auto closeAll = [&](int keepLeft, int keepRight){
+      for(auto& l : links){
+	for(int fd : l){
+	  if(fd >= 0 and fd != keepLeft and fd != keepRight){
+	    close(fd);
+	  }
+	}
+      }
+    };
+    for(auto& l : links){
+      if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, l.data()) != 0){
+	closeAll(-1, -1);
+	throw "Error: could not create the process ring.";
+      }
+    }
+    auto makeRank = [&](int r){
+      if(worldSize == 1){
+	return ProcessGroup(0, 1, -1, -1);
+      }
+      const int left = links[(r + worldSize - 1) % worldSize][1];
+      const int right = links[r][0];
+      closeAll(left, right);
+      return ProcessGroup(r, worldSize, left, right);
+    };
+
+    //anything still buffered would be written once per process
+    std::cout.flush();
+    std::fflush(nullptr);
+    std::vector<pid_t> children;
+    for(int r = 1; r < worldSize; r++){
+      const pid_t pid = fork();
+      if(pid < 0){
+	closeAll(-1, -1);
+	for(pid_t c : children){
+	  waitpid(c, nullptr, 0);
+	}
+	throw "Error: could not fork a rank.";
+      }
+      if(pid == 0){
+	int status = 1;
+	{
+	  ProcessGroup group = makeRank(r);
+	  try{
+	    status = body(group);
+	  } catch(const char* e){
+	    std::cerr << "rank " << r << ": " << e << '\n';
+	  } catch(...){
+	    std::cerr << "rank " << r << " threw\n";
+	  }
+	}
+	std::cout.flush();
+	std::fflush(nullptr);
+	_exit(status);
+      }
+      children.push_back(pid);
+    }
+
+    int status = 1;
+    std::exception_ptr error;
+    {
+      //closing rank 0's links on the way out unblocks any waiting child
+      ProcessGroup group = makeRank(0);
+      try{
+	status = body(group);
+      } catch(...){
+	error = std::current_exception();
+      }
+    }
+    for(pid_t c : children){
+      int ws = 0;
+      waitpid(c, &ws, 0);
+      const int childStatus = WIFEXITED(ws) ? WEXITSTATUS(ws) : 1;
+      if(status == 0){
+	status = childStatus;
+      }
+    }
+    if(error){
+      std::rethrow_exception(error);
+    }
+    return status;
+  }
+
+  void ProcessGroup::exchange(const void* sendData, size_t sendBytes, void* recvData, size_t recvBytes)
+  {
+    const char* out = static_cast<const char*>(sendData);
+    char* in = static_cast<char*>(recvData);
+    size_t sent = 0;
+    size_t got = 0;
+    while(sent < sendBytes or got < recvBytes){
+      pollfd fds[2];
+      int nfds = 0;
+      int sendIdx = -1;
+      int recvIdx = -1;
+      if(sent < sendBytes){
+	fds[nfds] = {rightFd, POLLOUT, 0};
+	sendIdx = nfds++;
+      }
+      if(got < recvBytes){
+	fds[nfds] = {leftFd, POLLIN, 0};
+	recvIdx = nfds++;
+      }
+      if(poll(fds, nfds, -1) < 0){
+	if(errno == EINTR){
+	  continue;
+	}
+	throw "Error: poll failed on the process ring.";
+      }
+      if(sendIdx >= 0 and fds[sendIdx].revents){
+	const ssize_t k = send(rightFd, out + sent, sendBytes - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if(k >= 0){
+	  sent += k;
+	} else if(not wouldBlock()){
+	  throw "Error: lost the connection to the next rank.";
+	}
+      }
+      if(recvIdx >= 0 and fds[recvIdx].revents){
+	const ssize_t k = recv(leftFd, in + got, recvBytes - got, MSG_DONTWAIT);
+	if(k > 0){
+	  got += k;
+	} else if(k == 0 or not wouldBlock()){
+	  throw "Error: lost the connection to the previous rank.";
+	}
+      }
+    }
+  }
+
+  /*
+   * chunk k is [n*k/size, n*(k+1)/size). In step s of the reduce-scatter
+   * rank r passes its partial sum of chunk r-s to the right and adds the
+   * left rank's chunk r-s-1 into its own, so after size-1 steps it holds the
+   * full sum of chunk r+1. The all-gather then passes the finished chunks
+   * around the ring, and every rank ends with the same bytes.
+   * */
+  template<typename Scalar>
+  void ProcessGroup::allReduce(Scalar* data, size_t n)
+  {
+    if(size == 1 or n == 0){
+      return;
+    }
+    auto begin = [&](int k){
+      return n * static_cast<size_t>(k) / size;
+    };
+    auto chunkBytes = [&](int k){
+      return (begin(k + 1) - begin(k)) * sizeof(Scalar);
+    };
+    scratch.resize((n / size + 1) * sizeof(Scalar));
+    Scalar* incoming = reinterpret_cast<Scalar*>(scratch.data());
+    for(int s = 0; s < size - 1; s++){
+      const int sendChunk = (rank - s + size) % size;
+      const int recvChunk = (rank - s - 1 + 2 * size) % size;
+      exchange(data + begin(sendChunk), chunkBytes(sendChunk), incoming, chunkBytes(recvChunk));
+      Scalar* __restrict target = data + begin(recvChunk);
+      const size_t count = begin(recvChunk + 1) - begin(recvChunk);
+      for(size_t i = 0; i < count; i++){
+	target[i] += incoming[i];
+      }
+    }
+    for(int s = 0; s < size - 1; s++){
+      const int sendChunk = (rank + 1 - s + size) % size;
+      const int recvChunk = (rank - s + size) % size;
+      exchange(data + begin(sendChunk), chunkBytes(sendChunk), data + begin(recvChunk), chunkBytes(recvChunk));
+    }
+  }
+
+  void ProcessGroup::broadcast(void* data, size_t bytes, int root)
+  {
+    if(size == 1){
+      return;
+    }
+    //down the ring from root, each rank forwarding what it received
+    if(rank != root){
+      exchange(nullptr, 0, data, bytes);
+    }
+    if((rank + 1) % size != root){
+      exchange(data, bytes, nullptr, 0);
+    }
+  }
+
+  void ProcessGroup::barrier()
+  {
+    if(size == 1){
+      return;
+    }
+    //the first lap tells rank 0 everyone arrived, the second releases them
+    char token = 0;
+    for(int lap = 0; lap < 2; lap++){
+      if(rank == 0){
+	exchange(&token, 1, nullptr, 0);
+	exchange(nullptr, 0, &token, 1);
+      } else {
+	exchange(nullptr, 0, &token, 1);
+	exchange(&token, 1, nullptr, 0);
+      }
+    }
+  }
+
+
+  template<typename Scalar>
+  BasicDistributedDataParallel<Scalar>::BasicDistributedDataParallel(BasicNetwork<Scalar>& _net,
+								     ProcessGroup& _group,
+								     size_t _bucketBytes)
+    : net(_net),
+      group(_group),
+      bucketBytes(_bucketBytes)
+  {
+    sync();
+    worker = std::thread(&BasicDistributedDataParallel::workerLoop, this);
+  }
+
+  template<typename Scalar>
+  BasicDistributedDataParallel<Scalar>::~BasicDistributedDataParallel()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+  }
+
+  template<typename Scalar>
+  void BasicDistributedDataParallel<Scalar>::sync()
+  {
+    if(not net.parametersPacked()){
+      throw "Error: the network's parameters are not packed.";
+    } else if(net.hasOutputLayer()){
+      throw "Error: data-parallel replicas run the layers alone, not an output layer past them.";
+    }
+    auto& arena = net.arena;
+    buckets.clear();
+    bucketOfNode.assign(arena.numTensors(), -1);
+    //whole layers from the back, until a bucket holds bucketBytes
+    size_t end = arena.getRegionSize();
+    for(size_t i = arena.numTensors(); i-- > 0;){
+      const size_t begin = arena.offset(i);
+      if((end - begin) * sizeof(Scalar) >= bucketBytes or i == 0){
+	bucketOfNode[i] = buckets.size();
+	buckets.emplace_back(begin, end);
+	end = begin;
+      }
+    }
+    //weights and both optimizer states; the Gradients region comes along
+    group.broadcast(arena.region(arena.Weights),
+		    arena.numRegions * arena.getRegionSize() * sizeof(Scalar), 0);
+    syncedWeights = arena.region(arena.Weights);
+    gatherRunningStats();
+    if(not runningStats.empty()){
+      group.broadcast(runningStats.data(), runningStats.size() * sizeof(Scalar), 0);
+      scatterRunningStats();
+    }
+  }
+
+  template<typename Scalar>
+  void BasicDistributedDataParallel<Scalar>::gatherRunningStats()
+  {
+    runningStats.clear();
+    for(const auto& l : net.layers){
+      if(l.getKind() == LayerKind::BatchNorm){
+	const Mat& stats = l.getRunningStats();
+	runningStats.insert(runningStats.end(), stats.data(), stats.data() + stats.size());
+      }
+    }
+  }
+
+  template<typename Scalar>
+  void BasicDistributedDataParallel<Scalar>::scatterRunningStats()
+  {
+    size_t offset = 0;
+    for(auto& l : net.layers){
+      if(l.getKind() == LayerKind::BatchNorm){
+	const Mat& current = l.getRunningStats();
+	l.setRunningStats(Eigen::Map<const Mat>(runningStats.data() + offset, current.rows(), current.cols()));
+	offset += current.size();
+      }
+    }
+  }
+
+  template<typename Scalar>
+  void BasicDistributedDataParallel<Scalar>::workerLoop()
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    while(true){
+      cv.wait(lock, [this]{ return stopping or reducedBuckets < postedBuckets; });
+      if(stopping){
+	return;
+      }
+      const auto bucket = buckets[reducedBuckets];
+      const bool failed = static_cast<bool>(workerError);
+      lock.unlock();
+      if(not failed){
+	try{
+	  group.allReduce(net.arena.region(net.arena.Gradients) + bucket.first,
+			  bucket.second - bucket.first);
+	} catch(...){
+	  lock.lock();
+	  workerError = std::current_exception();
+	  lock.unlock();
+	}
+      }
+      lock.lock();
+      reducedBuckets++;
+      cv.notify_all();
+    }
+  }
+
+  template<typename Scalar>
+  double BasicDistributedDataParallel<Scalar>::trainStep(ConstMatRef batchInputs, ConstMatRef batchTargets)
+  {
+    if(batchInputs.cols() != net.input_shape.second){
+      throw "Error: batch inputs must have input_shape.second columns";
+    } else if(batchTargets.rows() != batchInputs.rows() or batchTargets.cols() != net.num_outputs){
+      throw "Error: batch targets must have one row of num_outputs values per input row";
+    } else if(not net.parametersPacked() or syncedWeights != net.arena.region(net.arena.Weights)){
+      throw "Error: the network changed since its buckets were cut; call sync()";
+    }
+    net.forward(batchInputs);
+    net.evaluateLoss(batchTargets);
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      postedBuckets = reducedBuckets = 0;
+      workerError = nullptr;
+    }
+    net.graph.backward(Eigen::Map<const Mat>(net.loss_deriv.data(), net.planned_rows, net.num_outputs),
+		       [this](size_t i){
+			 if(bucketOfNode[i] >= 0){
+			   {
+			     std::lock_guard<std::mutex> lock(mtx);
+			     postedBuckets++;
+			   }
+			   cv.notify_all();
+			 }
+		       }, &net.trace);
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [this]{ return reducedBuckets == buckets.size(); });
+    }
+    if(workerError){
+      std::rethrow_exception(workerError);
+    }
+    net.gradient = net.layers.front().getGradient();
+
+    double loss = net.scalar_loss;
+    group.allReduce(&loss, 1);
+    net.scalar_loss = loss;
+    //the mean of the ranks' running statistics, like the replicas' in DataParallel
+    gatherRunningStats();
+    if(not runningStats.empty()){
+      group.allReduce(runningStats.data(), runningStats.size());
+      const Scalar ranks = group.getSize();
+      for(auto& v : runningStats){
+	v /= ranks;
+      }
+      scatterRunningStats();
+    }
+    net.trainingLoss.push_back(loss);
+    net.updateWeights();
+    return loss;
+  }
+
+
+  template void ProcessGroup::allReduce(double*, size_t);
+
+  template void ProcessGroup::allReduce(float*, size_t);
+
+  template class BasicDistributedDataParallel<double>;
+
+  template class BasicDistributedDataParallel<float>;
+
+}//end namespace NN
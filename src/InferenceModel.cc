@@ -0,0 +1,172 @@
+#include "InferenceModel.hpp"
+#include <algorithm>
+
+namespace NN
+{
+  namespace
+  {
+    constexpr size_t scratchAlign = 64;
+
+    template<typename Scalar>
+    size_t alignedCount(size_t count)
+    {
+      constexpr size_t perLine = scratchAlign / sizeof(Scalar);
+      return (count + perLine - 1) / perLine * perLine;
+    }
+
+    //y = activation([x, 1] * weights), packing into workspace
+    template<typename Scalar, typename In, typename Out>
+    void frozenDense(const In& x, const RowMat<Scalar>& weights, const ActivationKernel<Scalar>& activation,
+		     Out& y, Scalar* workspace)
+    {
+      const int_t in = x.cols();
+      //the GEMM accumulates onto the broadcast bias
+      y.rowwise() = weights.row(in);
+      if(not DNN_PACKED_GEMM or y.rows() == 1){
+	//Eigen's GEMV beats packing for a single row, and packs nothing;
+	//without DNN_PACKED_GEMM every batch takes this path
+	y.noalias() += x * weights.topRows(in);
+	activation.forward(y, y);
+	return;
+      }
+#if DNN_PACKED_GEMM
+      using Gemm = Eigen::internal::general_matrix_matrix_product<Eigen::Index, Scalar, Eigen::RowMajor, false,
+								  Scalar, Eigen::RowMajor, false,
+								  Eigen::RowMajor, 1>;
+      internal::ScratchBlocking<Scalar> blocking(y.rows(), y.cols(), in);
+      blocking.place(workspace);
+      Gemm::run(y.rows(), y.cols(), in, x.data(), x.outerStride(), weights.data(), weights.outerStride(),
+		y.data(), 1, y.outerStride(), Scalar(1), blocking);
+      activation.forward(y, y);
+#endif
+    }
+  }
+
+  template<typename Scalar>
+  BasicInferenceModel<Scalar>::BasicInferenceModel(const BasicNetwork<Scalar>& net, int_t _rowChunk)
+    : rowChunk(_rowChunk)
+  {
+    if(rowChunk <= 0){
+      throw "Error: rowChunk must be positive.";
+    }
+    if(not net.hasShapes()){
+      throw "Error: the network holds no weights until its first batch.";
+    } else if(net.hasOutputLayer()){
+      throw "Error: a frozen model runs the layers alone, not an output layer past them.";
+    }
+    //batch norms are folded into the layers before them
+    const auto folded = internal::withBatchNormFolded(net);
+    for(const auto& l : (folded ? *folded : net).getLayers()){
+      if(l.getActivation() == "custom"){
+	throw "Error: custom activations cannot be frozen; their kernels may hold state.";
+      }
+      if(l.getKind() != LayerKind::Dense){
+	throw "Error: only dense layers, and batch norms after them, can be frozen.";
+      }
+      addLayer(l.getWeights(), activationKernel<Scalar>(l.getActivation()));
+    }
+    sizeScratch();
+  }
+
+  template<typename Scalar>
+  BasicInferenceModel<Scalar>::BasicInferenceModel(const BasicMappedCheckpoint<Scalar>& checkpoint,
+						   int_t _rowChunk)
+    : rowChunk(_rowChunk)
+  {
+    if(rowChunk <= 0){
+      throw "Error: rowChunk must be positive.";
+    }
+    for(int_t i = 0; i < checkpoint.numLayers(); i++){
+      addLayer(checkpoint.weights(i), checkpoint.activation(i));
+    }
+    sizeScratch();
+  }
+
+  template<typename Scalar>
+  void BasicInferenceModel<Scalar>::addLayer(const Mat& weights, const ActivationKernel<Scalar>& activation)
+  {
+    if(not layers.empty()){
+      const int_t prevOutputs = layers.back().weights.cols();
+      if(weights.rows() != prevOutputs + 1){
+	throw "Error: layer shapes do not chain.";
+      }
+      maxHidden = std::max(maxHidden, prevOutputs);
+    }
+    layers.push_back({weights, activation});
+  }
+
+  template<typename Scalar>
+  void BasicInferenceModel<Scalar>::sizeScratch()
+  {
+    //blocking sizes depend on the row count, and a batch's last chunk can
+    //have any count up to rowChunk
+    size_t gemmSpace = 0;
+    for(const auto& l : layers){
+      for(int_t rows = 1; rows <= rowChunk; rows++){
+	gemmSpace = std::max(gemmSpace, internal::ScratchBlocking<Scalar>(rows, l.weights.cols(),
+								l.weights.rows() - 1).workspace());
+      }
+    }
+    scratchSize = 2 * alignedCount<Scalar>(rowChunk * maxHidden) + gemmSpace;
+  }
+
+  template<typename Scalar>
+  Scalar* BasicInferenceModel<Scalar>::threadScratch(size_t count)
+  {
+    //shared by every model of this scalar type on the thread; nothing in it
+    //outlives a predict() call
+    thread_local std::vector<Scalar, Eigen::aligned_allocator<Scalar>> scratch;
+    if(scratch.size() < count){
+      scratch.resize(count);
+    }
+    return scratch.data();
+  }
+
+  template<typename Scalar>
+  void BasicInferenceModel<Scalar>::reserveThreadScratch() const
+  {
+    threadScratch(scratchSize);
+  }
+
+  template<typename Scalar>
+  void BasicInferenceModel<Scalar>::predict(ConstMatRef batch, MatRef out) const
+  {
+    if(batch.cols() != inputSize()){
+      throw "Error: batch must have one column per model input.";
+    }
+    if(out.rows() != batch.rows() or out.cols() != numOutputs()){
+      throw "Error: output must be batch rows x numOutputs().";
+    }
+    using InputMap = Eigen::Map<const Mat, Eigen::Unaligned, Eigen::OuterStride<>>;
+    Scalar* scratch = threadScratch(scratchSize);
+    const size_t half = alignedCount<Scalar>(rowChunk * maxHidden);
+    Scalar* workspace = scratch + 2 * half;
+    const int_t n = layers.size();
+
+    for(int_t r = 0; r < batch.rows(); r += rowChunk){
+      const int_t rows = std::min(rowChunk, batch.rows() - r);
+      //each layer reads the previous one's scratch buffer in place
+      const Scalar* xData = batch.data() + r * batch.outerStride();
+      int_t xCols = batch.cols();
+      int_t xStride = batch.outerStride();
+      for(int_t i = 0; i < n; i++){
+	const auto& l = layers[i];
+	const InputMap x(xData, rows, xCols, Eigen::OuterStride<>(xStride));
+	if(i == n - 1){
+	  auto y = out.middleRows(r, rows);
+	  frozenDense(x, l.weights, l.activation, y, workspace);
+	  break;
+	}
+	Eigen::Map<Mat> y(scratch + (i % 2) * half, rows, l.weights.cols());
+	frozenDense(x, l.weights, l.activation, y, workspace);
+	xData = y.data();
+	xCols = xStride = y.cols();
+      }
+    }
+  }
+
+  template class BasicInferenceModel<double>;
+
+  template class BasicInferenceModel<float>;
+
+}//end namespace NN
@@ -1,143 +1,620 @@
 #include <Layer.hpp>
+#include "Threading.hpp"
+#include <algorithm>
 
 
 namespace NN
 { 
-  Mat Layer::makeInputMat(ConstMatRef input)
+  namespace
+  {
+    //batch rows per thread below which Parallelism::Auto leaves threading to Eigen
+    constexpr int_t minRowsPerThread = 32;
+
+  }
+
+  using internal::forRowSlices;
+
+  using internal::minParallelUpdate;
+
+  template<typename Scalar>
+  void denseForward(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> weights,
+		    const ActivationKernel<Scalar>& activation,
+		    Eigen::Ref<RowMat<Scalar>> preact, Eigen::Ref<RowMat<Scalar>> out,
+		    int numThreads, bool splitRows, LayerProfile* profile, ScratchArena* scratch,
+		    const SparseWeights<Scalar>* sparse)
+  {
+    const int_t in = x.cols();
+    const int_t outputSize = weights.cols();
+    const auto w = weights.topRows(in);
+    const auto bias = weights.row(in);
+    //multiply-adds per row of the product
+    const int_t rowWork = sparse ? sparse->nonZeros() : in * outputSize;
+    //GEMM one block of rows at a time so the bias and activation run on
+    //each block while it is still in cache
+    const int_t rowBlock = std::max<int_t>(64, (1 << 15) / std::max<int_t>(outputSize, 1));
+    forRowSlices(x.rows(), numThreads, splitRows, [&](int_t first, int_t count, int){
+      //one packing workspace per slice, reused by each of its row blocks
+      Scalar* workspace = nullptr;
+      const int_t fullBlock = std::min(rowBlock, count);
+      if(scratch and not sparse and internal::packsIntoScratch(fullBlock, outputSize, in)){
+	size_t need = internal::gemmWorkspace<Scalar>(fullBlock, outputSize, in);
+	if(count % rowBlock and count > rowBlock){
+	  need = std::max(need, internal::gemmWorkspace<Scalar>(count % rowBlock, outputSize, in));
+	}
+	workspace = scratch->take<Scalar>(need);
+      }
+      for(int_t r = first; r < first + count; r += rowBlock){
+	const int_t nb = std::min(rowBlock, first + count - r);
+	auto act = preact.middleRows(r, nb);
+	{
+	  internal::PhaseTimer timer(profile, Phase::Forward, nb * (2 * rowWork + outputSize));
+	  act.setZero();
+	  if(sparse){
+	    internal::spmmAccumulate<Scalar>(x.middleRows(r, nb), *sparse, act, *scratch);
+	  } else {
+	    internal::gemmAccumulate(x.middleRows(r, nb), w, act, workspace);
+	  }
+	  act.rowwise() += bias;
+	}
+	internal::PhaseTimer timer(profile, Phase::Activation, nb * outputSize);
+	activation.forward(act, out.middleRows(r, nb));
+      }
+    });
+  }
+
+  template<typename Scalar>
+  typename BasicLayer<Scalar>::Mat BasicLayer<Scalar>::makeInputMat(ConstMatRef input)
   {
     Mat ipm(input.rows(), input.cols() + 1);
     ipm << input, Mat::Ones(input.rows(),1);
     return ipm;
   }
 
-  void Layer::setInputShape(std::pair<int_t, int_t> _input_shape,
+  template<typename Scalar>
+  void BasicLayer<Scalar>::setInputShape(std::pair<int_t, int_t> _input_shape,
 			    bool reinitWeights)
   {
     if(_input_shape.first <= 0 or _input_shape.second <= 0){
       throw  "Error: both elements of input_shape must be positive.";
     }
+    if(kind != LayerKind::Dense and _input_shape.second != (normalizes() ? norm.features : spec.input.size())){
+      throw "Error: a convolution, pooling or normalization layer's input size is fixed by its spec.";
+    }
     input_shape = _input_shape;
     //if input shape is changed, reinitialize the weights as random
     if(reinitWeights){
-      weights = Mat::Random(input_shape.second +1, output_size);
+      initWeights();
+    }
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::fillWeights()
+  {
+    sparse = SparseWeights<Scalar>();
+    if(normalizes()){
+      params.weights.row(0).setOnes();
+      params.weights.row(1).setZero();
+      runningStats.resize(2, norm.parameters());
+      runningStats.row(0).setZero();
+      runningStats.row(1).setOnes();
+      return;
+    }
+    params.weights.setRandom();
+    if(init == WeightInit::Uniform or params.weights.size() == 0){
+      return;
+    }
+    //a convolution's output position sums a patch and feeds a kernel per filter
+    const int_t fanIn = params.rows() - 1;
+    const int_t fanOut = kind == LayerKind::Conv ? spec.filters * spec.kernelH * spec.kernelW : output_size;
+    const bool he = init == WeightInit::He
+      or (init == WeightInit::Auto and (activation.name == "relu" or activation.name == "softplus"));
+    const Scalar limit = std::sqrt(Scalar(6) / (he ? fanIn : fanIn + fanOut));
+    params.weights.topRows(fanIn) *= limit;
+    params.weights.row(fanIn).setZero();
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::bindInputs(ConstMatRef _inputs)
+  {
+    if(_inputs.cols() != input_shape.second){
+      setInputShape(std::make_pair(_inputs.rows(), _inputs.cols()));
+    } else {
+      input_shape.first = _inputs.rows();
+    }
+    if(_inputs.data() == inputs.data()){
+      boundInputs = nullptr;
+    } else {
+      boundInputs = _inputs.data();
+      boundStride = _inputs.outerStride();
     }
   }
 
-  void Layer::setInputs(ConstMatRef _inputs, bool usemakeInputMat)
+  template<typename Scalar>
+  void BasicLayer<Scalar>::setInputs(ConstMatRef _inputs)
   {
     inputs = _inputs;
-    if(usemakeInputMat){
-      inputMat = makeInputMat(inputs);
+    bindInputs(inputs);
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::resizeBuffer(Mat& m, int_t rows, int_t cols)
+  {
+    if(DNN_PROFILING and m.size() != rows * cols){
+      profile.addBytes(rows * cols * sizeof(Scalar));
+    }
+    m.resize(rows, cols);
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::reserve(int_t batchRows)
+  {
+    resizeBuffer(actVals, batchRows, output_size);
+    resizeBuffer(outputs, batchRows, output_size);
+    resizeBuffer(err, batchRows, output_size);
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::setWeightUpdate(const Mat& _weightUpdate)
+  {
+    if(_weightUpdate.rows() != params.rows() or _weightUpdate.cols() != params.cols()){
+      throw "Error: weight update must have the shape of the weights.";
     }
-    setInputShape(std::make_pair(inputs.rows(), inputs.cols()));
+    params.firstState = _weightUpdate;
   }
 
-  void Layer::setActivation(std::string actName)
+  template<typename Scalar>
+  void BasicLayer<Scalar>::setSecondMoment(const Mat& _secondMoment)
   {
-    activation = ACTIVATIONS[actName];
-    activation_grad = ACTIVATION_DERIVATIVES[actName];
+    if(_secondMoment.size() == 0){
+      params.secondState.setZero();
+    } else if(_secondMoment.rows() != params.rows() or _secondMoment.cols() != params.cols()){
+      throw "Error: optimizer state must have the shape of the weights.";
+    } else {
+      params.secondState = _secondMoment;
+    }
   }
 
-  void Layer::forwardPass(ConstMatRef inputData)
+  template<typename Scalar>
+  void BasicLayer<Scalar>::setActivation(std::string actName)
   {
-    setInputs(inputData);
-    if(weights.rows() != input_shape.second + 1){
+    activation = activationKernel<Scalar>(actName);
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::forwardBound(ConstMatRef inputData)
+  {
+    bindInputs(inputData);
+    if(params.rows() != weightShape().first){
       throw "Input size error";
-    } else if(weights.cols() != output_size){
+    } else if(params.cols() != weightShape().second){
       throw "Output size error";
     }
-    //make activation values for each neuron
-    #pragma omp parallel
-    {
-      actVals = inputMat * weights;
+    const int_t n = input_shape.first;
+    resizeBuffer(actVals, n, output_size);
+    resizeBuffer(outputs, n, output_size);
+    scratch.reset();
+    forwardRows(splitsBatch(n), scratch);
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::forwardPass()
+  {
+    forwardBound(inputs);
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::forwardPlanned(ConstMatRef inputData, bool splitRows,
+					  ScratchArena& passScratch) noexcept
+  {
+    input_shape.first = inputData.rows();
+    boundInputs = inputData.data();
+    boundStride = inputData.outerStride();
+    forwardRows(splitRows, passScratch);
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::forwardRows(bool splitRows, ScratchArena& passScratch)
+  {
+    if(normalizes()){
+      normForward(splitRows);
+      return;
+    } else if(kind != LayerKind::Dense){
+      spatialForward<Scalar>(inputView(), params.weights, spec, activation, actVals, outputs,
+			     numThreads, splitRows, &profile, &passScratch);
+      return;
+    }
+    if(usesSparseKernels()){
+      sparse.refresh(params.weights);
+    }
+    denseForward<Scalar>(inputView(), params.weights, activation, actVals, outputs,
+			 numThreads, splitRows, &profile, &passScratch, sparseKernels());
+  }
+
+
+  /*
+   * A batch norm takes its statistics over the whole batch first; the rest
+   * of the pass, and all of a layer norm's, is split by rows.
+   * */
+  template<typename Scalar>
+  void BasicLayer<Scalar>::normForward(bool splitRows)
+  {
+    const auto x = inputView();
+    const int_t n = x.rows();
+    const bool perRow = kind == LayerKind::LayerNorm;
+    resizeBuffer(normalized, n, output_size);
+    if(perRow){
+      resizeBuffer(normStats, 2, n);
+    } else {
+      resizeBuffer(normStats, 3, norm.channels);
+    }
+    if(not perRow){
+      if(training){
+	internal::PhaseTimer timer(&profile, Phase::Forward, n * output_size * 5);
+	internal::normStatistics<Scalar>(x, norm, normStats);
+	//the running variance is unbiased
+	const Scalar count = n * (output_size / norm.channels);
+	const Scalar m = norm.momentum;
+	runningStats.row(0) = (1 - m) * runningStats.row(0) + m * normStats.row(0);
+	runningStats.row(1) = (1 - m) * runningStats.row(1) + m * count / std::max<Scalar>(count - 1, 1) * normStats.row(2);
+      } else {
+	normStats.row(0) = runningStats.row(0);
+	normStats.row(1) = (runningStats.row(1).array() + Scalar(norm.epsilon)).rsqrt();
+	normStats.row(2) = runningStats.row(1);
+      }
+    }
+    forRowSlices(n, numThreads, splitRows, [&](int_t first, int_t count, int){
+      {
+	internal::PhaseTimer timer(&profile, Phase::Forward, count * output_size * (perRow ? 9 : 4));
+	if(perRow){
+	  internal::normStatistics<Scalar>(x.middleRows(first, count), norm, normStats.middleCols(first, count));
+	}
+	internal::normalize<Scalar>(x.middleRows(first, count),
+				    perRow ? ConstMatRef(normStats.middleCols(first, count)) : ConstMatRef(normStats),
+				    params.weights, norm, normalized.middleRows(first, count),
+				    actVals.middleRows(first, count));
+      }
+      internal::PhaseTimer timer(&profile, Phase::Activation, count * output_size);
+      activation.forward(actVals.middleRows(first, count), outputs.middleRows(first, count));
+    });
+  }
+
+  template<typename Scalar>
+  const typename BasicLayer<Scalar>::Mat& BasicLayer<Scalar>::computeJacobian()
+  {
+    if(kind != LayerKind::Dense){
+      throw "Error: Jacobians are only formed for dense layers.";
     }
+    scratch.reset();
+    Eigen::Map<Mat> actDerivs(scratch.take<Scalar>(outputs.size()), outputs.rows(), outputs.cols());
+    actDerivs.setOnes();
+    activation.backward(actVals, outputs, actDerivs);
+    Jacobian.resize(outputs.rows(), params.rows());
+    Jacobian.setZero();
+    internal::gemmAccumulate(actDerivs, params.weights.transpose(), Jacobian, scratch);
+    return Jacobian;
+  }
 
-    #pragma omp parallel
-    {
-      outputs = actVals.unaryExpr(activation);
+  template<typename Scalar>
+  bool BasicLayer<Scalar>::splitsBatch(int_t rows) const noexcept
+  {
+    if(numThreads <= 1){
+      return false;
+    }
+    switch(parallelism){
+    case Parallelism::Batch:
+      return true;
+    case Parallelism::Auto:
+      return rows >= minRowsPerThread * numThreads;
+    default:
+      return false;
     }
-    //end omp parallel
   }
 
-  void Layer::forwardPass()
+  /*
+   * err holds dL/d(outputs) on entry. Applies the activation derivative and
+   * forms gradient = [inputs, 1]^T * err without building [inputs, 1]. When
+   * the batch is split, each thread sums its rows into its own partial
+   * gradient and the partials are added afterwards in a fixed order. A
+   * sparse layer only forms the gradient of its kept weights, a convolution
+   * sums it over the output positions and a pool has none.
+   * */
+  template<typename Scalar>
+  template<typename F>
+  void BasicLayer<Scalar>::finishBackward(F&& lossGradRows, ScratchArena& passScratch) noexcept
   {
-    forwardPass(inputs);
+    const auto x = inputView();
+    const int_t n = err.rows();
+    const int_t in = params.rows() - 1;
+    const bool split = splitsBatch(n);
+    if(split and static_cast<int>(partialGrads.size()) < numThreads){
+      if(DNN_PROFILING){
+	profile.addBytes((numThreads - partialGrads.size()) * params.weights.size() * sizeof(Scalar));
+      }
+      partialGrads.resize(numThreads, Mat::Zero(params.rows(), params.cols()));
+    }
+    auto& gradient = params.gradient;
+    const SparseWeights<Scalar>* kept = sparseKernels();
+
+    const int slices = forRowSlices(n, numThreads, split, [&](int_t first, int_t count, int t){
+      lossGradRows(first, count);
+      auto e = err.middleRows(first, count);
+      activation.backward(actVals.middleRows(first, count), outputs.middleRows(first, count), e);
+      if(kind == LayerKind::MaxPool or kind == LayerKind::AvgPool){
+	return;
+      }
+
+      MatRef g = split ? MatRef(partialGrads[t]) : MatRef(gradient);
+      g.topRows(in).setZero();
+      if(kind == LayerKind::Conv){
+	g.row(in).setZero();
+	internal::convGradient<Scalar>(x.middleRows(first, count), e, spec, g, passScratch);
+	return;
+      } else if(normalizes()){
+	g.row(in).setZero();
+	internal::normGradient<Scalar>(normalized.middleRows(first, count), e, norm, g);
+	return;
+      }
+      if(kept){
+	internal::sddmmAccumulate<Scalar>(x.middleRows(first, count), e, *kept, g.topRows(in), passScratch);
+      } else {
+	internal::gemmAccumulate(x.middleRows(first, count).transpose(), e, g.topRows(in), passScratch);
+      }
+      g.row(in) = e.colwise().sum();
+    });
+
+    if(split and params.weights.size()){
+      forRowSlices(in + 1, numThreads, true, [&](int_t first, int_t count, int){
+	auto g = gradient.middleRows(first, count);
+	g = partialGrads[0].middleRows(first, count);
+	for(int k = 1; k < slices; k++){
+	  g += partialGrads[k].middleRows(first, count);
+	}
+      });
+    }
+    if(kind == LayerKind::BatchNorm and training){
+      resizeBuffer(normErrSums, 2, norm.channels);
+      normErrSums = gradient;
+    }
   }
 
+  template<typename Scalar>
+  void BasicLayer<Scalar>::backwardPass(const BasicLayer& next) noexcept
+  {
+    scratch.reset();
+    backwardPass(next, scratch);
+  }
 
-  Mat Layer::computeJacobian() noexcept
+  template<typename Scalar>
+  void BasicLayer<Scalar>::backwardPass(ConstMatRef loss_grad) noexcept
   {
-    auto actDerivs = makeActDerivs();
-    
-    Jacobian = actDerivs * weights.transpose();
-    return Jacobian;
+    scratch.reset();
+    backwardPass(loss_grad, scratch);
   }
 
-  void Layer::backwardPass(const Layer& next) noexcept
+  template<typename Scalar>
+  double BasicLayer<Scalar>::gradientWork() const noexcept
   {
-    Mat loss_g;
-    #pragma omp parallel
-    {
-     loss_g = next.getErr() * next.getWeights().transpose();
+    const SpatialShape o = spec.output();
+    switch(kind){
+    case LayerKind::Dense:
+      return output_size * (input_shape.second * (usesSparseKernels() ? getDensity() : 1.0) + 1);
+    case LayerKind::Conv:
+      return double(o.height) * o.width * params.weights.size();
+    case LayerKind::BatchNorm:
+    case LayerKind::LayerNorm:
+      return output_size;
+    default:
+      return 0;
     }
+  }
 
-    loss_g.conservativeResize(loss_g.rows(), loss_g.cols()-1);
+  template<typename Scalar>
+  double BasicLayer<Scalar>::propagationWork() const noexcept
+  {
+    const SpatialShape o = spec.output();
+    switch(kind){
+    case LayerKind::Dense:
+      return usesSparseKernels() ? sparse.nonZeros() : double(input_shape.second) * output_size;
+    case LayerKind::Conv:
+      return double(o.height) * o.width * spec.patchSize() * spec.filters;
+    case LayerKind::BatchNorm:
+    case LayerKind::LayerNorm:
+      return 2.0 * output_size;
+    default:
+      return double(o.height) * o.width * spec.patchSize();
+    }
+  }
 
-    auto actDerivs = makeActDerivs();
-    err = loss_g.cwiseProduct(actDerivs);
-				
-    gradient = inputMat.transpose() * err;
-	
+  template<typename Scalar>
+  void BasicLayer<Scalar>::propagateRows(int_t first, int_t count, MatRef dx,
+					 ScratchArena& passScratch) const noexcept
+  {
+    const auto e = err.middleRows(first, count);
+    dx.setZero();
+    switch(kind){
+    case LayerKind::Dense:
+      if(const SparseWeights<Scalar>* kept = sparseKernels()){
+	internal::spmmTransposedAccumulate<Scalar>(e, *kept, dx, passScratch);
+      } else {
+	//the bias row doesn't feed back into the inputs
+	internal::gemmAccumulate(e, params.weights.topRows(params.rows() - 1).transpose(), dx, passScratch);
+      }
+      break;
+    case LayerKind::Conv:
+      internal::convBackwardData<Scalar>(e, params.weights, spec, dx, passScratch);
+      break;
+    case LayerKind::BatchNorm:
+    case LayerKind::LayerNorm:
+      //a batch norm's error depends on its whole batch through its error sums
+      internal::normBackwardData<Scalar>(normalized.middleRows(first, count), e,
+					 kind == LayerKind::LayerNorm ? ConstMatRef(normStats.middleCols(first, count))
+					 : ConstMatRef(normStats),
+					 params.weights, normErrSums, err.rows(), training, norm, dx);
+      break;
+    default:
+      internal::poolBackwardData<Scalar>(inputView().middleRows(first, count), actVals.middleRows(first, count),
+					 e, spec, dx);
     }
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::backwardPass(const BasicLayer& next, ScratchArena& passScratch) noexcept
+  {
+    const int_t n = next.getErr().rows();
+    //propagating the error, the gradient product and the activation derivative
+    internal::PhaseTimer timer(&profile, Phase::Backward,
+			       n * (2 * (next.propagationWork() + gradientWork()) + output_size));
+    resizeBuffer(err, n, output_size);
+    finishBackward([&](int_t first, int_t count){
+      next.propagateRows(first, count, err.middleRows(first, count), passScratch);
+    }, passScratch);
+  }
 
-  void Layer::backwardPass(ConstMatRef loss_grad) noexcept
+  template<typename Scalar>
+  void BasicLayer<Scalar>::backwardPass(ConstMatRef loss_grad, ScratchArena& passScratch) noexcept
   {
     //if loss_grad is supplied
-    auto actDerivs = makeActDerivs();
-    err = loss_grad.cwiseProduct(actDerivs);
-			
-    gradient = inputMat.transpose() * err;
+    internal::PhaseTimer timer(&profile, Phase::Backward, loss_grad.rows() * (2 * gradientWork() + output_size));
+    resizeBuffer(err, loss_grad.rows(), loss_grad.cols());
+    finishBackward([&](int_t first, int_t count){
+      err.middleRows(first, count) = loss_grad.middleRows(first, count);
+    }, passScratch);
   }
 
 
-  void Layer::updateWeights()
+  template<typename Scalar>
+  void BasicLayer<Scalar>::setUpdateParams(const OptimizerParams& _optimizer)
   {
-    //if constexpr(update == UpdateRule::NesterovAccGrad){
-	//if we're using Nesterov accelerated grad, params are learning rate, momentum
-    auto [learningRate, momentum] = updateParams;
-	
-    #pragma omp parallel
-    {
-      weightUpdate = momentum * weightUpdate - learningRate * gradient;
-
-      weights += weightUpdate;
+    if(_optimizer.learningRate < 0){
+      throw "Error: learning rate must be non-negative.";
+    }
+    //epsilon also keeps the zero padding of a parameter arena at zero
+    if(usesSecondState(_optimizer.rule) and not (_optimizer.epsilon > 0)){
+      throw "Error: adaptive update rules need a positive epsilon.";
     }
-	//} else {
-	//throw "Error: only NesterovAccGrad is implemented now.";
-	//}
+    if(_optimizer.rule != optimizer.rule){
+      params.firstState.setZero();
+      params.secondState.setZero();
+      updateStep = 0;
+    }
+    optimizer = _optimizer;
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::updateWeights()
+  {
+    internal::PhaseTimer timer(&profile, Phase::Update, params.weights.size());
+    maskGradient();
+    updateStep++;
+    const int_t cols = params.cols();
+    const bool split = numThreads > 1 and params.weights.size() >= minParallelUpdate;
+    forRowSlices(params.rows(), numThreads, split, [&](int_t firstRow, int_t count, int){
+      const int_t offset = firstRow * cols;
+      optimizerStep<Scalar>(optimizer, updateStep, count * cols, params.weights.data() + offset,
+			    params.gradient.data() + offset, params.firstState.data() + offset,
+			    params.secondState.data() + offset);
+    });
   }
 
 
-  void Layer::updateWeights(double mult)
+  template<typename Scalar>
+  void BasicLayer<Scalar>::updateWeights(double mult)
   {
     updateWeights();
-    #pragma omp parallel
-    weights *= mult;
+    params.weights *= Scalar(mult);
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::prune(double sparsity)
+  {
+    if(not (sparsity >= 0 and sparsity < 1)){
+      throw "Error: sparsity must be in [0, 1).";
+    }
+    //pools and normalizations have nothing to prune
+    if(kind != LayerKind::Dense and kind != LayerKind::Conv){
+      return;
+    }
+    const int_t in = params.rows() - 1;
+    auto w = params.weights.topRows(in);
+    const int_t count = sparsity * w.size();
+    if(count > 0){
+      std::vector<Scalar> magnitudes(w.size());
+      Eigen::Map<Mat>(magnitudes.data(), in, w.cols()) = w.cwiseAbs();
+      std::nth_element(magnitudes.begin(), magnitudes.begin() + (count - 1), magnitudes.end());
+      //ties with the threshold go too, so at least count are pruned
+      const Scalar threshold = magnitudes[count - 1];
+      w = (w.array().abs() <= threshold).select(Scalar(0), w);
+    }
+    sparse = SparseWeights<Scalar>(w);
+    sparse.mask(params.gradient.topRows(in));
+    sparse.mask(params.firstState.topRows(in));
+    sparse.mask(params.secondState.topRows(in));
+  }
+
+  template<typename Scalar>
+  bool BasicLayer<Scalar>::foldsInto(const BasicLayer& prev) const noexcept
+  {
+    return kind == LayerKind::BatchNorm and (prev.kind == LayerKind::Dense or prev.kind == LayerKind::Conv)
+      and prev.activation.name == "linear" and prev.output_size == norm.features;
   }
 
-  void Layer::visualizeLayer(std::ostream& ostr) 
+  template<typename Scalar>
+  typename BasicLayer<Scalar>::Mat BasicLayer<Scalar>::foldInto(const Mat& prevWeights) const
+  {
+    if(kind != LayerKind::BatchNorm){
+      throw "Error: only batch norms fold into the layer before them.";
+    } else if(prevWeights.cols() % norm.channels){
+      throw "Error: the weights' outputs do not match the batch norm's channels.";
+    }
+    //per channel, y = x * scale + (beta - mean * scale), scale = gamma / sqrt(var + epsilon)
+    const Scalar epsilon = norm.epsilon;
+    const auto scale = (params.weights.row(0).array() * (runningStats.row(1).array() + epsilon).rsqrt()).eval();
+    const auto shift = (params.weights.row(1).array() - runningStats.row(0).array() * scale).eval();
+    Mat folded = prevWeights;
+    const int_t in = folded.rows() - 1;
+    for(int_t j = 0; j < folded.cols(); j++){
+      const int_t c = j % norm.channels;
+      folded.col(j) *= scale(c);
+      folded(in, j) += shift(c);
+    }
+    return folded;
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::setNumThreads(int n, Parallelism mode)
+  {
+    if(n <= 0){
+      throw "Error: number of threads must be positive.";
+    }
+    numThreads = n;
+    parallelism = mode;
+  }
+
+  template<typename Scalar>
+  void BasicLayer<Scalar>::visualizeLayer(std::ostream& ostr) 
   {
     ostr << "\n================  " << name << "  ================\n\n";
     ostr << " ([inputs,1] * [weights]) -> activation -> outputs   \n";
     ostr << " (             [  bias ])                          \n\n";
-    ostr << " \nInputs:\n" << inputs << '\n';
-    ostr << " \nWeights (last row is bias):\n" << weights << '\n';
+    ostr << " \nInputs:\n" << inputView() << '\n';
+    ostr << " \nWeights (last row is bias):\n" << params.weights << '\n';
     ostr << " \n[inputs,1] * [weights, bias]^T:\n" << actVals << '\n';
     ostr << " \nOutputs:\n" << outputs << '\n';
     ostr << " ===================================================\n";
   }
 
 
-  
+
+  template void denseForward<double>(Eigen::Ref<const Mat>, Eigen::Ref<const Mat>,
+				     const ActivationKernel<double>&, Eigen::Ref<Mat>, Eigen::Ref<Mat>,
+				     int, bool, LayerProfile*, ScratchArena*, const SparseWeights<double>*);
+
+  template void denseForward<float>(Eigen::Ref<const Matf>, Eigen::Ref<const Matf>,
+				    const ActivationKernel<float>&, Eigen::Ref<Matf>, Eigen::Ref<Matf>,
+				    int, bool, LayerProfile*, ScratchArena*, const SparseWeights<float>*);
+
+  template class BasicLayer<double>;
+
+  template class BasicLayer<float>;
 
 }
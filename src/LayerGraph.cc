@@ -0,0 +1,98 @@
+#include "LayerGraph.hpp"
+#include <string>
+
+namespace NN
+{
+  template<typename Scalar>
+  BasicLayerGraph<Scalar>::BasicLayerGraph(std::list<Layer>& layers)
+  {
+    if(layers.empty()){
+      throw "Error: cannot compile a network without layers.";
+    }
+    nodes.reserve(layers.size());
+    for(auto& l : layers){
+      const int_t in = l.getInputShape().second;
+      const int_t out = l.getOutputSize();
+      const auto& w = l.getWeights();
+      //a layer without weights yet gets them when its network packs its parameters
+      if(w.size() and (w.rows() != l.weightShape().first or w.cols() != l.weightShape().second)){
+	throw "Error: a layer's weights do not match its input and output sizes.";
+      }
+      if(not nodes.empty() and nodes.back().outputSize != in){
+	throw "Error: a layer's input size must equal the previous layer's output size.";
+      }
+      nodes.push_back({&l, static_cast<int>(nodes.size()) - 1, in, out});
+      activationWidth += out;
+    }
+    inputSize = nodes.front().inputSize;
+    outputSize = nodes.back().outputSize;
+  }
+
+  template<typename Scalar>
+  void BasicLayerGraph<Scalar>::plan(int_t batchRows)
+  {
+    for(auto& n : nodes){
+      n.layer->reserve(batchRows);
+      n.splitRows = n.layer->splitsBatch(batchRows);
+    }
+    plannedRows = batchRows;
+  }
+
+  template<typename Scalar>
+  const typename BasicLayerGraph<Scalar>::Mat& BasicLayerGraph<Scalar>::forward(ConstMatRef batchInputs,
+										 TraceRecorder* trace) noexcept
+  {
+    scratch.reset();
+    for(const auto& n : nodes){
+      internal::TraceSpan span(trace, &n - nodes.data(), Phase::Forward);
+      if(n.input < 0){
+	n.layer->forwardPlanned(batchInputs, n.splitRows, scratch);
+      } else {
+	n.layer->forwardPlanned(nodes[n.input].layer->getOutputs(), n.splitRows, scratch);
+      }
+    }
+    return nodes.back().layer->getOutputs();
+  }
+
+  template<typename Scalar>
+  void BasicLayerGraph<Scalar>::backward(ConstMatRef lossGrad, TraceRecorder* trace) noexcept
+  {
+    //every node but the last reads the error and weights of the node reading it
+    scratch.reset();
+    size_t i = nodes.size() - 1;
+    {
+      internal::TraceSpan span(trace, i, Phase::Backward);
+      nodes[i].layer->backwardPass(lossGrad, scratch);
+    }
+    while(i-- > 0){
+      internal::TraceSpan span(trace, i, Phase::Backward);
+      nodes[i].layer->backwardPass(*nodes[i + 1].layer, scratch);
+    }
+  }
+
+  template<typename Scalar>
+  void BasicLayerGraph<Scalar>::backward(ConstMatRef lossGrad, const std::function<void(size_t)>& nodeDone,
+					 TraceRecorder* trace)
+  {
+    scratch.reset();
+    size_t i = nodes.size() - 1;
+    {
+      internal::TraceSpan span(trace, i, Phase::Backward);
+      nodes[i].layer->backwardPass(lossGrad, scratch);
+    }
+    nodeDone(i);
+    while(i-- > 0){
+      {
+	internal::TraceSpan span(trace, i, Phase::Backward);
+	nodes[i].layer->backwardPass(*nodes[i + 1].layer, scratch);
+      }
+      nodeDone(i);
+    }
+  }
+
+
+  template class BasicLayerGraph<double>;
+
+  template class BasicLayerGraph<float>;
+
+}//end namespace NN
@@ -0,0 +1,317 @@
+#include "MappedData.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace NN
+{
+  namespace
+  {
+    uint64_t alignUp(uint64_t offset)
+    {
+      return (offset + DATA_FILE_ALIGNMENT - 1) & ~(DATA_FILE_ALIGNMENT - 1);
+    }
+
+    void writeAt(std::ofstream& file, uint64_t offset, const void* data, uint64_t bytes)
+    {
+      file.seekp(offset);
+      file.write(static_cast<const char*>(data), bytes);
+    }
+
+    template<typename Scalar>
+    DataFileHeader makeHeader(int_t rows, int_t featureCols, int_t targetCols)
+    {
+      DataFileHeader header{};
+      std::memcpy(header.magic, DATA_FILE_MAGIC, sizeof(header.magic));
+      header.version = DATA_FILE_VERSION;
+      header.scalarBytes = sizeof(Scalar);
+      header.rows = rows;
+      header.featureCols = featureCols;
+      header.targetCols = targetCols;
+      header.featureOffset = alignUp(sizeof(DataFileHeader));
+      header.targetOffset = alignUp(header.featureOffset + rows * featureCols * sizeof(Scalar));
+      header.fileBytes = header.targetOffset + rows * targetCols * sizeof(Scalar);
+      return header;
+    }
+
+    //splits a CSV line into values; false if a field isn't a number
+    template<typename Scalar>
+    bool parseCsvLine(const std::string& line, std::vector<Scalar>& values)
+    {
+      values.clear();
+      const char* p = line.c_str();
+      while(true){
+	char* end;
+	const double v = std::strtod(p, &end);
+	if(end == p){
+	  return false;
+	}
+	values.push_back(static_cast<Scalar>(v));
+	while(*end == ' ' or *end == '\t' or *end == '\r'){
+	  end++;
+	}
+	if(*end == '\0'){
+	  return true;
+	} else if(*end != ','){
+	  return false;
+	}
+	p = end + 1;
+      }
+    }
+  }
+
+  template<typename Scalar>
+  void writeDataFile(const std::string& path, Eigen::Ref<const RowMat<Scalar>> features,
+		     Eigen::Ref<const RowMat<Scalar>> targets)
+  {
+    if(features.rows() != targets.rows()){
+      throw "Error: features and targets must have the same number of rows";
+    }
+    const DataFileHeader header = makeHeader<Scalar>(features.rows(), features.cols(), targets.cols());
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(not file){
+      throw "Error: could not open data file for writing.";
+    }
+    writeAt(file, 0, &header, sizeof(header));
+    //contiguous matrices go out as one block, strided views row by row
+    for(auto [m, offset] : {std::make_pair(&features, header.featureOffset),
+			    std::make_pair(&targets, header.targetOffset)}){
+      const uint64_t rowBytes = m->cols() * sizeof(Scalar);
+      if(m->outerStride() == m->cols()){
+	writeAt(file, offset, m->data(), m->rows() * rowBytes);
+      } else {
+	for(int_t r = 0; r < m->rows(); r++){
+	  writeAt(file, offset + r * rowBytes, m->row(r).data(), rowBytes);
+	}
+      }
+    }
+    if(not file){
+      throw "Error: failed writing data file.";
+    }
+  }
+
+  template<typename Scalar>
+  int_t convertCsv(const std::string& csvPath, const std::string& dataPath,
+		   int_t targetCols, bool skipHeader)
+  {
+    std::ifstream csv(csvPath);
+    if(not csv){
+      throw "Error: could not open CSV file.";
+    }
+    std::string line;
+    std::vector<Scalar> values;
+    int_t rows = 0;
+    int_t cols = -1;
+    //first pass: count and validate
+    if(skipHeader){
+      std::getline(csv, line);
+    }
+    while(std::getline(csv, line)){
+      if(line.empty() or line == "\r"){
+	continue;
+      }
+      if(not parseCsvLine(line, values)){
+	throw "Error: CSV line is not a list of numbers.";
+      }
+      if(cols < 0){
+	cols = values.size();
+      } else if(cols != static_cast<int_t>(values.size())){
+	throw "Error: CSV lines have different numbers of columns.";
+      }
+      rows++;
+    }
+    if(rows == 0 or targetCols <= 0 or targetCols >= cols){
+      throw "Error: CSV needs at least one row, one feature and targetCols targets.";
+    }
+    const int_t featureCols = cols - targetCols;
+    const DataFileHeader header = makeHeader<Scalar>(rows, featureCols, targetCols);
+
+    std::ofstream file(dataPath, std::ios::binary | std::ios::trunc);
+    if(not file){
+      throw "Error: could not open data file for writing.";
+    }
+    writeAt(file, 0, &header, sizeof(header));
+
+    //second pass: write in chunks of rows, so each block gets large writes
+    csv.clear();
+    csv.seekg(0);
+    if(skipHeader){
+      std::getline(csv, line);
+    }
+    const int_t chunk = 4096;
+    std::vector<Scalar> featureChunk, targetChunk;
+    featureChunk.reserve(chunk * featureCols);
+    targetChunk.reserve(chunk * targetCols);
+    int_t written = 0;
+    auto flush = [&]{
+      const int_t n = targetChunk.size() / targetCols;
+      writeAt(file, header.featureOffset + written * featureCols * sizeof(Scalar),
+	      featureChunk.data(), featureChunk.size() * sizeof(Scalar));
+      writeAt(file, header.targetOffset + written * targetCols * sizeof(Scalar),
+	      targetChunk.data(), targetChunk.size() * sizeof(Scalar));
+      written += n;
+      featureChunk.clear();
+      targetChunk.clear();
+    };
+    while(std::getline(csv, line)){
+      if(line.empty() or line == "\r"){
+	continue;
+      }
+      parseCsvLine(line, values);
+      featureChunk.insert(featureChunk.end(), values.begin(), values.begin() + featureCols);
+      targetChunk.insert(targetChunk.end(), values.begin() + featureCols, values.end());
+      if(static_cast<int_t>(targetChunk.size()) == chunk * targetCols){
+	flush();
+      }
+    }
+    flush();
+    if(not file or written != rows){
+      throw "Error: failed writing data file.";
+    }
+    return rows;
+  }
+
+
+  template<typename Scalar>
+  BasicMappedDataSource<Scalar>::BasicMappedDataSource(const std::string& path)
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+      throw "Error: could not open data file.";
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 or st.st_size < static_cast<off_t>(sizeof(DataFileHeader))){
+      close(fd);
+      throw "Error: data file is truncated.";
+    }
+    length = st.st_size;
+    void* m = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    //the mapping keeps the file alive
+    close(fd);
+    if(m == MAP_FAILED){
+      length = 0;
+      throw "Error: could not map data file.";
+    }
+    base = static_cast<const unsigned char*>(m);
+    header = reinterpret_cast<const DataFileHeader*>(base);
+
+    const char* problem = nullptr;
+    if(std::memcmp(header->magic, DATA_FILE_MAGIC, sizeof(header->magic)) != 0){
+      problem = "Error: not a data file.";
+    } else if(header->version != DATA_FILE_VERSION){
+      problem = "Error: unsupported data file version.";
+    } else if(header->scalarBytes != sizeof(Scalar)){
+      problem = "Error: data file was written with a different scalar type.";
+    } else if(header->rows < 0 or header->featureCols <= 0 or header->targetCols <= 0 or
+	      header->fileBytes != length){
+      problem = "Error: data file is truncated.";
+    } else if(header->rows > 0 and
+	      (uint64_t(header->featureCols) > length / sizeof(Scalar) / header->rows or
+	       uint64_t(header->targetCols) > length / sizeof(Scalar) / header->rows)){
+      //checked before the block sizes are formed, so they can't wrap around
+      problem = "Error: data file blocks are larger than the file.";
+    } else {
+      const uint64_t featureBytes = uint64_t(header->rows) * header->featureCols * sizeof(Scalar);
+      const uint64_t targetBytes = uint64_t(header->rows) * header->targetCols * sizeof(Scalar);
+      for(auto [off, bytes] : {std::make_pair(header->featureOffset, featureBytes),
+			       std::make_pair(header->targetOffset, targetBytes)}){
+	if(off % DATA_FILE_ALIGNMENT != 0 or off > length or bytes > length - off){
+	  problem = "Error: corrupt data file block offset.";
+	}
+      }
+    }
+    if(problem){
+      unmap();
+      throw problem;
+    }
+    featureData = reinterpret_cast<const Scalar*>(base + header->featureOffset);
+    targetData = reinterpret_cast<const Scalar*>(base + header->targetOffset);
+  }
+
+  template<typename Scalar>
+  BasicMappedDataSource<Scalar>::~BasicMappedDataSource()
+  {
+    unmap();
+  }
+
+  template<typename Scalar>
+  void BasicMappedDataSource<Scalar>::unmap() noexcept
+  {
+    if(base){
+      munmap(const_cast<unsigned char*>(base), length);
+      base = nullptr;
+      length = 0;
+    }
+  }
+
+  template<typename Scalar>
+  void BasicMappedDataSource<Scalar>::gather(const int_t* idx, int_t count,
+					     MatRef batchFeatures, MatRef batchTargets) const
+  {
+    const auto f = features();
+    const auto t = targets();
+    for(int_t i = 0; i < count; i++){
+      batchFeatures.row(i) = f.row(idx[i]);
+      batchTargets.row(i) = t.row(idx[i]);
+    }
+  }
+
+  template<typename Scalar>
+  bool BasicMappedDataSource<Scalar>::viewRows(int_t first, int_t count, const Scalar*& batchFeatures,
+					       int_t& featureStride, const Scalar*& batchTargets,
+					       int_t& targetStride) const
+  {
+    if(first < 0 or count < 0 or first + count > header->rows){
+      return false;
+    }
+    batchFeatures = featureData + first * header->featureCols;
+    featureStride = header->featureCols;
+    batchTargets = targetData + first * header->targetCols;
+    targetStride = header->targetCols;
+    return true;
+  }
+
+  template<typename Scalar>
+  void BasicMappedDataSource<Scalar>::willNeed(int_t first, int_t count) const
+  {
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    for(auto [p, cols] : {std::make_pair(featureData, header->featureCols),
+			  std::make_pair(targetData, header->targetCols)}){
+      const auto begin = reinterpret_cast<uintptr_t>(p + first * cols);
+      const auto end = reinterpret_cast<uintptr_t>(p + (first + count) * cols);
+      if(end <= begin){
+	continue;
+      }
+      const uintptr_t start = begin & ~(page - 1);
+      madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+      //one read per page faults it in now, on this thread
+      volatile unsigned char sink = 0;
+      for(uintptr_t a = begin; a < end; a = (a & ~(page - 1)) + page){
+	sink = sink + *reinterpret_cast<const volatile unsigned char*>(a);
+      }
+    }
+  }
+
+
+  template void writeDataFile<double>(const std::string&, Eigen::Ref<const RowMat<double>>,
+				      Eigen::Ref<const RowMat<double>>);
+
+  template void writeDataFile<float>(const std::string&, Eigen::Ref<const RowMat<float>>,
+				     Eigen::Ref<const RowMat<float>>);
+
+  template int_t convertCsv<double>(const std::string&, const std::string&, int_t, bool);
+
+  template int_t convertCsv<float>(const std::string&, const std::string&, int_t, bool);
+
+  template class BasicMappedDataSource<double>;
+
+  template class BasicMappedDataSource<float>;
+
+}//end namespace NN
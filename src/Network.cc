@@ -1,11 +1,242 @@
 #include "Network.hpp"
+#include "Threading.hpp"
 
 namespace NN
 {
+  template<typename Scalar>
+  BasicNetwork<Scalar>::BasicNetwork(const BasicNetwork& other)
+    : input_shape(other.input_shape),
+      inputs(other.inputs),
+      num_outputs(other.num_outputs),
+      target(other.target),
+      layers(other.layers),
+      layer_input_shapes(other.layer_input_shapes),
+      loss_kernel(other.loss_kernel),
+      loss_deriv(other.loss_deriv),
+      scalar_loss(other.scalar_loss),
+      trainingLoss(other.trainingLoss),
+      gradient(other.gradient),
+      planned_rows(other.planned_rows),
+      pruning(other.pruning)
+  {
+    //the copied layers own their parameters; gather them into our own arena
+    //and point the plan at our own layers
+    compile();
+  }
+
+  template<typename Scalar>
+  BasicNetwork<Scalar>& BasicNetwork<Scalar>::operator=(const BasicNetwork& other)
+  {
+    if(this != &other){
+      BasicNetwork copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+  }
+
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::compile()
+  {
+    if(not inferShapes()){
+      //no weights or plan until the first batch
+      graph = BasicLayerGraph<Scalar>();
+      layer_input_shapes.clear();
+      arena = BasicParameterArena<Scalar>();
+      num_outputs = layers.empty() ? 0 : layers.back().getOutputSize();
+      planned_rows = 0;
+      return;
+    }
+    graph = BasicLayerGraph<Scalar>(layers);
+    layer_input_shapes.clear();
+    for(const auto& l : layers){
+      layer_input_shapes.push_back(l.getInputShape());
+    }
+    input_shape = layer_input_shapes.front();
+    num_outputs = graph.getOutputSize();
+    packParameters();
+    //the layers' buffers are sized on the next pass
+    planned_rows = 0;
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::packParameters()
+  {
+    std::vector<std::pair<int_fast64_t, int_fast64_t>> shapes;
+    for(const auto& l : layers){
+      shapes.push_back(l.weightShape());
+    }
+    BasicParameterArena<Scalar> packed(shapes);
+    size_t i = 0;
+    for(auto& l : layers){
+      Scalar* w = packed.tensor(packed.Weights, i);
+      Scalar* g = packed.tensor(packed.Gradients, i);
+      Scalar* first = packed.tensor(packed.FirstState, i);
+      Scalar* second = packed.tensor(packed.SecondState, i);
+      //a deferred layer's weights are allocated once, here
+      if(l.getWeights().size() == 0 and shapes[i].first * shapes[i].second > 0){
+	l.placeParameters(w, g, first, second);
+      } else {
+	l.bindParameters(w, g, first, second);
+      }
+      i++;
+    }
+    if(DNN_PROFILING){
+      networkProfile.addBytes(packed.sizeInBytes());
+    }
+    //the layers have copied out of the old arena, so it can go
+    arena = std::move(packed);
+  }
+
+  template<typename Scalar>
+  bool BasicNetwork<Scalar>::inferShapes()
+  {
+    if(layers.empty() or not layers.front().hasInputShape()){
+      return false;
+    }
+    const Layer* prev = nullptr;
+    for(auto& l : layers){
+      if(not l.hasInputShape()){
+	l.setInputShape(std::make_pair(prev->getInputShape().first, prev->getOutputSize()), false);
+      }
+      prev = &l;
+    }
+    return true;
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::inferInputShape(ConstMatRef batchInputs)
+  {
+    if(layers.empty()){
+      throw "Error: the network has no layers.";
+    }
+    if(not layers.front().hasInputShape()){
+      layers.front().setInputShape(std::make_pair(batchInputs.rows(), batchInputs.cols()), false);
+      compile();
+    }
+  }
+
+  template<typename Scalar>
+  bool BasicNetwork<Scalar>::parametersPacked() const noexcept
+  {
+    if(arena.numTensors() != layers.size()){
+      return false;
+    }
+    size_t i = 0;
+    for(const auto& l : layers){
+      const auto& w = l.getWeights();
+      if(w.data() != arena.tensor(arena.Weights, i) or w.rows() != arena.shape(i).first
+	 or w.cols() != arena.shape(i).second){
+	return false;
+      }
+      i++;
+    }
+    return true;
+  }
 
+  template<typename Scalar>
+  AlignedBuffer<Scalar> BasicNetwork<Scalar>::snapshotWeights() const
+  {
+    AlignedBuffer<Scalar> snapshot(arena.getRegionSize());
+    std::memcpy(snapshot.data(), arena.region(arena.Weights), snapshot.size() * sizeof(Scalar));
+    return snapshot;
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::restoreWeights(const AlignedBuffer<Scalar>& snapshot)
+  {
+    if(not parametersPacked() or snapshot.size() != arena.getRegionSize()){
+      throw "Error: snapshot does not match this network's parameters";
+    }
+    std::memcpy(arena.region(arena.Weights), snapshot.data(), snapshot.size() * sizeof(Scalar));
+  }
 
-  void Network::setInputs(ConstMatRef _inputs, bool overrideInputShape)
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::updateWeights()
   {
+    if(not hasShapes()){
+      throw "Error: weights cannot be updated before the layer shapes are known";
+    }
+    internal::TraceSpan span(&trace, -1, Phase::Update);
+    const Layer& first = *graph[0].layer;
+    bool fused = true;
+    for(const auto& n : graph){
+      fused = fused and n.layer->getOptimizer() == first.getOptimizer()
+	and n.layer->getUpdateStep() == first.getUpdateStep()
+	and n.layer->getNumThreads() == first.getNumThreads();
+    }
+    if(not fused){
+      for(const auto& n : graph){
+	n.layer->updateWeights();
+      }
+      if(pruning.prunesAt(first.getUpdateStep())){
+	prune(pruning.sparsityAt(first.getUpdateStep()));
+      }
+      return;
+    }
+    //padding is zero in every region and stays zero under every rule, so the
+    //whole region updates as one array
+    const uint64_t begin = DNN_PROFILING ? cycleCount() : 0;
+    for(const auto& n : graph){
+      n.layer->maskGradient();
+    }
+    const int64_t step = first.getUpdateStep() + 1;
+    const OptimizerParams& opt = first.getOptimizer();
+    const int_fast64_t n = arena.getRegionSize();
+    //slices of 16 scalars keep each thread on its own cache lines
+    const int_fast64_t lines = n / 16;
+    const int numThreads = first.getNumThreads();
+    const bool split = numThreads > 1 and n >= internal::minParallelUpdate;
+    internal::forRowSlices(lines, numThreads, split, [&](int_fast64_t firstLine, int_fast64_t count, int){
+      const int_fast64_t begin = firstLine * 16;
+      const int_fast64_t end = firstLine + count == lines ? n : begin + count * 16;
+      optimizerStep<Scalar>(opt, step, end - begin, arena.region(arena.Weights) + begin,
+			    arena.region(arena.Gradients) + begin, arena.region(arena.FirstState) + begin,
+			    arena.region(arena.SecondState) + begin);
+    });
+    if(DNN_PROFILING){
+      //each layer's share of the pass is the span of the arena it owns
+      const double cycles = cycleCount() - begin;
+      size_t i = 0;
+      for(auto& l : layers){
+	const size_t end = i + 1 < arena.numTensors() ? arena.offset(i + 1) : n;
+	const size_t span = end - arena.offset(i);
+	l.addFusedUpdate(cycles * span / n, span);
+	i++;
+      }
+    }
+    for(const auto& n : graph){
+      n.layer->setUpdateStep(step);
+    }
+    if(pruning.prunesAt(step)){
+      prune(pruning.sparsityAt(step));
+    }
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::prune(double sparsity)
+  {
+    for(auto& l : layers){
+      l.prune(sparsity);
+    }
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::setPruning(const PruningSchedule& schedule)
+  {
+    if(not (schedule.finalSparsity >= 0 and schedule.finalSparsity < 1)){
+      throw "Error: sparsity must be in [0, 1).";
+    } else if(schedule.endStep < schedule.startStep or schedule.frequency == 0){
+      throw "Error: pruning schedule needs startStep <= endStep and a positive frequency.";
+    }
+    pruning = schedule;
+  }
+
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::setInputs(ConstMatRef _inputs, bool overrideInputShape)
+  {
+    inferInputShape(_inputs);
     if(not overrideInputShape) {
       if(_inputs.rows() != input_shape.first){
 	throw "Error: new input matrix must have number of rows of input_shape.first";
@@ -17,81 +248,55 @@ namespace NN
       inputs = _inputs;
       input_shape = std::make_pair(inputs.rows(), inputs.cols());
       layers.front().setInputs(inputs);
-      layer_input_shapes.front() = input_shape;
+      compile();
     }
   }
 
 
-  void Network::setTarget(Eigen::Ref<const Vec> _target, bool overrideTargetSize)
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::setTarget(Eigen::Ref<const Vec> _target, bool overrideTargetSize)
   {
-    if(_target.size() != num_outputs){
-      if(overrideTargetSize){
-	num_outputs = target.cols();
+    //one row of num_outputs values per input row, flattened
+    const int_t rows = input_shape.first;
+    if(_target.size() != rows * getNumOutputs()){
+      if(overrideTargetSize and not hasOutputLayer() and rows > 0 and _target.size() % rows == 0){
+	num_outputs = _target.size() / rows;
 	layers.back().setOutputSize(num_outputs);
 	layers.back().setInputShape(layer_input_shapes.back());
-	target = _target;
+	compile();
       } else {
-	throw "Error: _target must have length equal to num_outputs";
+	throw "Error: _target must hold num_outputs values for each input row";
       }
-    } else {
-      target = _target;
     }
+    target = _target;
   }
 
-  void Network::setLayers(const std::list<Layer>& newLayers)
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::setLayers(const std::list<Layer>& newLayers)
   {
     layers = newLayers;
-    
-    std::list<std::pair<int_t,int_t>> new_layer_input_shapes;
-
-    for(const auto& it : layers){
-      new_layer_input_shapes.push_back(it.getInputShape());
-    }
-    input_shape = new_layer_input_shapes.front();
-
-    num_outputs = new_layer_input_shapes.back().second;
-
-    layer_input_shapes = new_layer_input_shapes;
+    compile();
   }
 
-  void Network::appendLayers(std::list<Layer>& newLayers)
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::appendLayers(std::list<Layer>& newLayers)
   {
-    for(const auto& it : newLayers){
-      layer_input_shapes.push_back(it.getInputShape());
-    }
-			
-    num_outputs = layer_input_shapes.back().second;
-
     layers.splice(layers.end(), newLayers);
+    compile();
   }
 
 
-  void Network::insertLayer(typename std::list<Layer>::iterator& location,
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::insertLayer(typename std::list<Layer>::iterator& location,
 			    const Layer& newLayer)
   {
-    if(location == layers.end()){
-      //if location is the end
-      layer_input_shapes.push_back(newLayer.getInputShape());
-      layers.push_back(newLayer);
-    } else {
-      layers.insert(location, newLayer);
-
-      std::list<std::pair<int_t,int_t>> new_layer_input_shapes;
-
-      //update shape list
-      for(const auto& it : layers){
-	new_layer_input_shapes.push_back(it.getInputShape());
-      }
-      input_shape = new_layer_input_shapes.front();
-
-      num_outputs = new_layer_input_shapes.back().second;
-
-      layer_input_shapes = new_layer_input_shapes;
-    }
+    layers.insert(location, newLayer);
+    compile();
   }
 
 
-  void Network::setWeights(const std::list<Mat>& weights)
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::setWeights(const std::list<Mat>& weights)
   {
     if(weights.size() != layers.size()){
       throw "Error: must provide exactly one weight matrix for each layer.";
@@ -101,9 +306,14 @@ namespace NN
       l.setWeights(*wit);
       std::advance(wit,1);
     }
+    //a shape change gives the layer its own storage again
+    if(not parametersPacked()){
+      compile();
+    }
   }
 
-  void Network::setUpdateParams(const std::list<std::tuple<double,double>>& argsList)
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::setUpdateParams(const std::list<std::tuple<double,double>>& argsList)
   {
     if(argsList.size() != layers.size()){
       throw "Error: must provide exactly one args tuple for each layer.";
@@ -115,7 +325,21 @@ namespace NN
     }
   }
 
-  void Network::setActivations(const std::list<std::string>& activations)
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::setUpdateParams(const std::list<OptimizerParams>& paramsList)
+  {
+    if(paramsList.size() != layers.size()){
+      throw "Error: must provide exactly one optimizer for each layer.";
+    }
+    auto pit = paramsList.begin();
+    for(auto& l : layers){
+      l.setUpdateParams(*pit);
+      std::advance(pit, 1);
+    }
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::setActivations(const std::list<std::string>& activations)
   {
     if(activations.size() != layers.size()){
       throw "Error: must provide exactly one activation for each layer";
@@ -127,9 +351,41 @@ namespace NN
     }
   }
 
+  template<typename Scalar>
+  int BasicNetwork<Scalar>::foldBatchNorm()
+  {
+    int folded = 0;
+    for(auto it = layers.begin(); it != layers.end(); it++){
+      auto next = std::next(it);
+      while(next != layers.end() and next->foldsInto(*it)){
+	//folding scales whole columns, so a pruned layer keeps its pattern
+	const bool pruned = it->isPruned();
+	it->setWeights(next->foldInto(it->getWeights()));
+	if(pruned){
+	  it->prune(0);
+	}
+	it->setActivation(next->getActivation());
+	next = layers.erase(next);
+	folded++;
+      }
+    }
+    if(folded){
+      compile();
+    }
+    return folded;
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::plan(int_t batchRows)
+  {
+    graph.plan(batchRows);
+    loss_deriv.resize(batchRows * num_outputs);
+    planned_rows = batchRows;
+  }
 
-  void Network::predict(std::optional<Mat> inputData,
-			std::optional<Vec> _target) 
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::predict(std::optional<ConstMatRef> inputData,
+			std::optional<ConstVecRef> _target) 
   {
     if(inputData){
       setInputs(*inputData);
@@ -137,79 +393,89 @@ namespace NN
     if(_target){
       setTarget(*_target);
     }
-			
-    Mat layerOut = inputs;
-    for(auto& l : layers) {
-	l.setInputs(layerOut);
-
-	l.forwardPass();
-	//output of this layer is input to the next layer, then eventually the output
-	layerOut = l.getOutputs();
+    if(not hasShapes() or inputs.cols() != input_shape.second){
+      throw "Error: network inputs have not been set";
     }
-    outputs = layerOut;
-
-    resid = outputs - target;
+    const int_t targetCols = getNumOutputs();
+    if(target.size() != inputs.rows() * targetCols){
+      throw "Error: target must hold num_outputs values per input row";
+    }
+    forward(inputs);
+    evaluateLoss(Eigen::Map<const Mat>(target.data(), inputs.rows(), targetCols));
+  }
 
-    scalar_loss = vector_loss_func(outputs, target);
 
-    loss_deriv = vector_loss_derivative(outputs, target);
+  template<typename Scalar>
+  const typename BasicNetwork<Scalar>::Mat& BasicNetwork<Scalar>::predictBatch(ConstMatRef batchInputs)
+  {
+    inferInputShape(batchInputs);
+    if(batchInputs.cols() != input_shape.second){
+      throw "Error: batch inputs must have input_shape.second columns";
+    }
+    return forward(batchInputs);
   }
 
 
-  Vec Network::predictVal(std::optional<Mat> inputData,
-			  std::optional<Vec> _target) 
+  template<typename Scalar>
+  const typename BasicNetwork<Scalar>::Mat& BasicNetwork<Scalar>::forward(ConstMatRef batchInputs)
   {
-    if(inputData){
-      setInputs(*inputData);
+    if(batchInputs.rows() != planned_rows){
+      plan(batchInputs.rows());
     }
-    if(_target){
-      setTarget(*_target);
-    }
-			
-    Mat layerOut = inputs;
-    for(auto& l : layers)
-      {
-	l.setInputs(layerOut);
+    //each layer reads the previous layer's output buffer in place
+    return graph.forward(batchInputs, &trace);
+  }
 
-	l.forwardPass();
-	//output of this layer is input to the next layer, then eventually the output
-	layerOut = l.getOutputs();
-      }
-    outputs = layerOut;
 
-    resid = outputs - target;
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::evaluateLoss(ConstMatRef targets)
+  {
+    scalar_loss = loss_kernel.evaluate(layers.back().getOutputs(), targets,
+				       Eigen::Map<Mat>(loss_deriv.data(), planned_rows, num_outputs));
+  }
 
-    scalar_loss = vector_loss_func(outputs, target);
 
-    loss_deriv = vector_loss_derivative(outputs, target);
+  template<typename Scalar>
+  double BasicNetwork<Scalar>::trainStep(ConstMatRef batchInputs, ConstMatRef batchTargets)
+  {
+    inferInputShape(batchInputs);
+    if(batchInputs.cols() != input_shape.second){
+      throw "Error: batch inputs must have input_shape.second columns";
+    } else if(batchTargets.rows() != batchInputs.rows() or batchTargets.cols() != getNumOutputs()){
+      throw "Error: batch targets must have one row of num_outputs values per input row";
+    }
+    forward(batchInputs);
+    evaluateLoss(batchTargets);
+    backwardPass();
+    trainingLoss.push_back(scalar_loss);
+    updateWeights();
+    return scalar_loss;
+  }
+
 
-    return outputs;
+  template<typename Scalar>
+  typename BasicNetwork<Scalar>::Vec BasicNetwork<Scalar>::predictVal(std::optional<ConstMatRef> inputData,
+			  std::optional<ConstVecRef> _target) 
+  {
+    predict(std::move(inputData), std::move(_target));
+    return getOutputs();
   }
 
 
-  void Network::backwardPass()
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::backwardPass()
   {
-    //from the second-to-last layer, iterate to the beginning
-    bool isFirst = true;
-    auto prevLayer = layers.back();
-    for(auto l=layers.rbegin(); l != layers.rend(); l++){
-      if(isFirst){
-	l->backwardPass(loss_deriv);
-	isFirst = false;
-      } else {
-	l->backwardPass(prevLayer);
-      }
-      prevLayer = *l;
-    }
+    graph.backward(Eigen::Map<const Mat>(loss_deriv.data(), planned_rows, num_outputs), &trace);
     gradient = layers.front().getGradient();  
   }
 
 
  
-  void Network::train(double stopTol, 
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::train(double stopTol, 
 		      size_t maxIter,
-		      std::optional<Mat> inputData,
-		      std::optional<Vec> _newtarget,
+		      std::optional<ConstMatRef> inputData,
+		      std::optional<ConstVecRef> _newtarget,
 		      bool noprint)
   {
     //run first training round
@@ -232,7 +498,8 @@ namespace NN
     }
   }
 
-  void Network::summary()
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::summary()
   {
     std::cout << "===============================\n";
     std::cout << "      Network Summary:\n\n";
@@ -246,7 +513,43 @@ namespace NN
     std::cout << "===============================\n";
   }
 
-  void Network::visualizeNetwork()
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::resetProfile() noexcept
+  {
+    for(auto& l : layers){
+      l.resetProfile();
+    }
+    networkProfile.reset();
+  }
+
+  template<typename Scalar>
+  std::vector<ProfileEntry> BasicNetwork<Scalar>::profileEntries() const
+  {
+    std::vector<ProfileEntry> entries;
+    for(const auto& l : layers){
+      //unnamed layers go by their position, as in visualizeNetwork
+      const std::string& name = l.getName();
+      entries.push_back({name == "Layer" ? "Layer " + std::to_string(entries.size() + 1) : name,
+			 &l.getProfile()});
+    }
+    entries.push_back({"network", &networkProfile});
+    return entries;
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::writeProfile(std::ostream& ostr) const
+  {
+    writeProfileJson(ostr, profileEntries());
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::writeTrace(std::ostream& ostr) const
+  {
+    writeChromeTrace(ostr, profileEntries(), trace);
+  }
+
+  template<typename Scalar>
+  void BasicNetwork<Scalar>::visualizeNetwork()
   {
     int_t count = 1;
     std::cout << "===============================\n";
@@ -263,4 +566,8 @@ namespace NN
 
 
 
+  template class BasicNetwork<double>;
+
+  template class BasicNetwork<float>;
+
 }//namespace NN
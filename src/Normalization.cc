@@ -0,0 +1,181 @@
+#include "Normalization.hpp"
+
+namespace NN
+{
+  namespace
+  {
+    using int_t = int_fast64_t;
+
+    template<typename Scalar>
+    using RowArray = Eigen::Array<Scalar, 1, Eigen::Dynamic>;
+
+    //row s of m as positions x channels
+    template<typename Scalar>
+    auto sampleMap(const Eigen::Ref<const RowMat<Scalar>>& m, int_t s, int_t channels) noexcept
+    {
+      return Eigen::Map<const RowMat<Scalar>>(m.data() + s * m.outerStride(), m.cols() / channels, channels).array();
+    }
+
+    template<typename Scalar>
+    auto sampleMap(Eigen::Ref<RowMat<Scalar>>& m, int_t s, int_t channels) noexcept
+    {
+      return Eigen::Map<RowMat<Scalar>>(m.data() + s * m.outerStride(), m.cols() / channels, channels).array();
+    }
+  }
+
+  void NormSpec::validate() const
+  {
+    if(kind != LayerKind::BatchNorm and kind != LayerKind::LayerNorm){
+      throw "Error: a normalization spec must describe a batch or layer norm.";
+    }
+    if(features <= 0 or channels <= 0 or features % channels){
+      throw "Error: normalization channels must be positive and divide the features.";
+    }
+    if(not (epsilon > 0) or momentum < 0 or momentum > 1){
+      throw "Error: normalization needs a positive epsilon and a momentum in [0, 1].";
+    }
+  }
+
+
+  namespace internal
+  {
+    template<typename Scalar>
+    void normStatistics(Eigen::Ref<const RowMat<Scalar>> x, const NormSpec& spec,
+			Eigen::Ref<RowMat<Scalar>> stats) noexcept
+    {
+      const Scalar epsilon = spec.epsilon;
+      if(spec.kind == LayerKind::LayerNorm){
+	for(int_t r = 0; r < x.rows(); r++){
+	  const auto row = x.row(r).array();
+	  const Scalar mean = row.mean();
+	  stats(0, r) = mean;
+	  stats(1, r) = Scalar(1) / std::sqrt((row - mean).square().mean() + epsilon);
+	}
+	return;
+      }
+      //two passes, so the variance doesn't cancel catastrophically
+      const int_t c = spec.channels;
+      const Scalar count = x.rows() * (x.cols() / c);
+      RowArray<Scalar> sum = RowArray<Scalar>::Zero(c);
+      for(int_t s = 0; s < x.rows(); s++){
+	sum += sampleMap<Scalar>(x, s, c).colwise().sum();
+      }
+      const RowArray<Scalar> mean = sum / count;
+      sum.setZero();
+      for(int_t s = 0; s < x.rows(); s++){
+	sum += (sampleMap<Scalar>(x, s, c).rowwise() - mean).square().colwise().sum();
+      }
+      stats.row(0) = mean;
+      stats.row(2) = sum / count;
+      stats.row(1) = (stats.row(2).array() + epsilon).rsqrt();
+    }
+
+    template<typename Scalar>
+    void normalize(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> stats,
+		   Eigen::Ref<const RowMat<Scalar>> weights, const NormSpec& spec,
+		   Eigen::Ref<RowMat<Scalar>> normalized, Eigen::Ref<RowMat<Scalar>> preact) noexcept
+    {
+      const auto gamma = weights.row(0).array();
+      const auto beta = weights.row(1).array();
+      if(spec.kind == LayerKind::LayerNorm){
+	for(int_t r = 0; r < x.rows(); r++){
+	  auto n = normalized.row(r).array();
+	  n = (x.row(r).array() - stats(0, r)) * stats(1, r);
+	  preact.row(r).array() = n * gamma + beta;
+	}
+	return;
+      }
+      const int_t c = spec.channels;
+      //per channel, preact = x * (gamma * invStd) + (beta - mean * gamma * invStd)
+      const RowArray<Scalar> scale = gamma * stats.row(1).array();
+      const RowArray<Scalar> shift = beta - stats.row(0).array() * scale;
+      const RowArray<Scalar> mean = stats.row(0).array();
+      const RowArray<Scalar> invStd = stats.row(1).array();
+      for(int_t s = 0; s < x.rows(); s++){
+	const auto xs = sampleMap<Scalar>(x, s, c);
+	sampleMap<Scalar>(normalized, s, c) = (xs.rowwise() - mean).rowwise() * invStd;
+	sampleMap<Scalar>(preact, s, c) = (xs.rowwise() * scale).rowwise() + shift;
+      }
+    }
+
+    template<typename Scalar>
+    void normGradient(Eigen::Ref<const RowMat<Scalar>> normalized, Eigen::Ref<const RowMat<Scalar>> e,
+		      const NormSpec& spec, Eigen::Ref<RowMat<Scalar>> grad) noexcept
+    {
+      const int_t c = spec.parameters();
+      for(int_t s = 0; s < e.rows(); s++){
+	const auto es = sampleMap<Scalar>(e, s, c);
+	grad.row(0).array() += (es * sampleMap<Scalar>(normalized, s, c)).colwise().sum();
+	grad.row(1).array() += es.colwise().sum();
+      }
+    }
+
+    template<typename Scalar>
+    void normBackwardData(Eigen::Ref<const RowMat<Scalar>> normalized, Eigen::Ref<const RowMat<Scalar>> e,
+			  Eigen::Ref<const RowMat<Scalar>> stats, Eigen::Ref<const RowMat<Scalar>> weights,
+			  Eigen::Ref<const RowMat<Scalar>> errSums, int_fast64_t batchRows, bool batchStatistics,
+			  const NormSpec& spec, Eigen::Ref<RowMat<Scalar>> dx) noexcept
+    {
+      const auto gamma = weights.row(0).array();
+      if(spec.kind == LayerKind::LayerNorm){
+	//dx = invStd * (g - mean(g) - normalized * mean(g * normalized)), g = gamma * e
+	for(int_t r = 0; r < e.rows(); r++){
+	  const RowArray<Scalar> g = e.row(r).array() * gamma;
+	  const auto n = normalized.row(r).array();
+	  const Scalar gn = (g * n).mean();
+	  dx.row(r).array() = ((g - g.mean()) - n * gn) * stats(1, r);
+	}
+	return;
+      }
+      const int_t c = spec.channels;
+      const RowArray<Scalar> scale = gamma * stats.row(1).array();
+      if(not batchStatistics){
+	for(int_t s = 0; s < e.rows(); s++){
+	  sampleMap<Scalar>(dx, s, c) = sampleMap<Scalar>(e, s, c).rowwise() * scale;
+	}
+	return;
+      }
+      //the batch's mean error and its projection on normalized, the sums the
+      //gradient of beta and gamma was made of
+      const Scalar count = batchRows * (e.cols() / c);
+      const RowArray<Scalar> meanErr = errSums.row(1).array() / count;
+      const RowArray<Scalar> meanProj = errSums.row(0).array() / count;
+      for(int_t s = 0; s < e.rows(); s++){
+	const auto n = sampleMap<Scalar>(normalized, s, c);
+	sampleMap<Scalar>(dx, s, c) = ((sampleMap<Scalar>(e, s, c).rowwise() - meanErr) - n.rowwise() * meanProj)
+	  .rowwise() * scale;
+      }
+    }
+
+    template void normStatistics<double>(Eigen::Ref<const RowMat<double>>, const NormSpec&,
+					 Eigen::Ref<RowMat<double>>) noexcept;
+
+    template void normStatistics<float>(Eigen::Ref<const RowMat<float>>, const NormSpec&,
+					Eigen::Ref<RowMat<float>>) noexcept;
+
+    template void normalize<double>(Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+				    Eigen::Ref<const RowMat<double>>, const NormSpec&,
+				    Eigen::Ref<RowMat<double>>, Eigen::Ref<RowMat<double>>) noexcept;
+
+    template void normalize<float>(Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+				   Eigen::Ref<const RowMat<float>>, const NormSpec&,
+				   Eigen::Ref<RowMat<float>>, Eigen::Ref<RowMat<float>>) noexcept;
+
+    template void normGradient<double>(Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+				       const NormSpec&, Eigen::Ref<RowMat<double>>) noexcept;
+
+    template void normGradient<float>(Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+				      const NormSpec&, Eigen::Ref<RowMat<float>>) noexcept;
+
+    template void normBackwardData<double>(Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+					   Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+					   Eigen::Ref<const RowMat<double>>, int_fast64_t, bool, const NormSpec&,
+					   Eigen::Ref<RowMat<double>>) noexcept;
+
+    template void normBackwardData<float>(Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+					  Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+					  Eigen::Ref<const RowMat<float>>, int_fast64_t, bool, const NormSpec&,
+					  Eigen::Ref<RowMat<float>>) noexcept;
+
+  }//end namespace internal
+}//end namespace NN
@@ -0,0 +1,122 @@
+#include "PlapNetwork.hpp"
+
+namespace NN
+{
+  namespace
+  {
+    //x^k for a whole k >= 0, by squaring
+    template<typename Array>
+    Array wholePower(const Array& x, int k)
+    {
+      Array result = Array::Ones(x.rows(), x.cols());
+      Array base = x;
+      while(k > 0){
+	if(k & 1){
+	  result *= base;
+	}
+	k >>= 1;
+	if(k){
+	  base *= base;
+	}
+      }
+      return result;
+    }
+  }
+
+  template<typename Scalar>
+  BasicPlapFinalLayer<Scalar>::BasicPlapFinalLayer(double _p, double _a)
+    : p(_p),
+      a(_a)
+  {
+    //below 2 the power of a zero row, and its gradient, are infinite
+    if(not (p >= 2.0)){
+      throw "Error: the p-Laplacian layer needs p >= 2.";
+    }
+    if(p == std::floor(p) and p >= 2.0 and p <= 64.0){
+      const int whole = static_cast<int>(p);
+      if(whole % 2 == 0){
+	evenPower = (whole - 2) / 2;
+      } else {
+	oddPower = whole - 2;
+      }
+    }
+  }
+
+  template<typename Scalar>
+  void BasicPlapFinalLayer<Scalar>::reserve(int_t batchRows, int_t inputSize)
+  {
+    squaredNorms.resize(batchRows);
+    outputs.resize(batchRows, 1);
+    err.resize(batchRows, inputSize);
+  }
+
+  template<typename Scalar>
+  void BasicPlapFinalLayer<Scalar>::forwardPass(ConstMatRef inputData)
+  {
+    boundInputs = inputData.data();
+    boundRows = inputData.rows();
+    boundCols = inputData.cols();
+    boundStride = inputData.outerStride();
+    squaredNorms.resize(boundRows);
+    outputs.resize(boundRows, 1);
+
+    squaredNorms = inputView().rowwise().squaredNorm();
+    const auto s = squaredNorms.array();
+    auto out = outputs.col(0).array();
+    if(evenPower >= 0){
+      out = Scalar(a) * wholePower(s.eval(), evenPower);
+    } else if(oddPower >= 0){
+      out = Scalar(a) * wholePower(s.sqrt().eval(), oddPower);
+    } else {
+      //exp(-inf) = 0 covers zero rows when p > 2
+      out = Scalar(a) * (Scalar(0.5 * (p - 2.0)) * s.log()).exp();
+    }
+  }
+
+  template<typename Scalar>
+  void BasicPlapFinalLayer<Scalar>::backwardPass(ConstMatRef lossGrad)
+  {
+    if(lossGrad.rows() != boundRows or lossGrad.cols() != 1){
+      throw "Error: the p-Laplacian layer takes one loss gradient per row.";
+    }
+    //(p-2) out / s, taken as 0 on zero rows
+    const auto s = squaredNorms.array();
+    const Vec coef = (s > Scalar(0)).select(Scalar(p - 2.0) * lossGrad.col(0).array()
+					    * outputs.col(0).array() / s, Scalar(0));
+    err.resize(boundRows, boundCols);
+    err.array() = inputView().array().colwise() * coef.array();
+  }
+
+
+  template<typename Scalar>
+  const typename BasicPlapNetwork<Scalar>::Mat& BasicPlapNetwork<Scalar>::forward(ConstMatRef batchInputs)
+  {
+    plap.forwardPass(Base::forward(batchInputs));
+    return plap.getOutputs();
+  }
+
+  template<typename Scalar>
+  void BasicPlapNetwork<Scalar>::evaluateLoss(ConstMatRef targets)
+  {
+    plapLossGrad.resize(targets.rows(), 1);
+    this->scalar_loss = this->loss_kernel.evaluate(plap.getOutputs(), targets, plapLossGrad);
+  }
+
+  template<typename Scalar>
+  void BasicPlapNetwork<Scalar>::backwardPass()
+  {
+    plap.backwardPass(plapLossGrad);
+    this->graph.backward(plap.getErr(), &this->trace);
+    this->gradient = this->layers.front().getGradient();
+  }
+
+
+  template class BasicPlapFinalLayer<double>;
+
+  template class BasicPlapFinalLayer<float>;
+
+  template class BasicPlapNetwork<double>;
+
+  template class BasicPlapNetwork<float>;
+
+}//end namespace NN
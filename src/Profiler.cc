@@ -0,0 +1,90 @@
+#include "Profiler.hpp"
+
+namespace NN
+{
+  namespace
+  {
+    //names are ours or the user's layer names, so only quotes and
+    //backslashes need escaping
+    std::string quoted(const std::string& s)
+    {
+      std::string out = "\"";
+      for(char c : s){
+	if(c == '"' or c == '\\'){
+	  out += '\\';
+	}
+	out += c;
+      }
+      return out + '"';
+    }
+
+    //nanoseconds as exact microseconds, which a double at the stream's
+    //default precision would round to 10 us after a second
+    std::string microseconds(int64_t ns)
+    {
+      const char* sign = ns < 0 ? "-" : "";
+      const uint64_t n = ns < 0 ? -uint64_t(ns) : uint64_t(ns);
+      const std::string fraction = std::to_string(n % 1000);
+      return sign + std::to_string(n / 1000) + "." + std::string(3 - fraction.size(), '0') + fraction;
+    }
+
+  }
+
+  const char* phaseName(Phase phase) noexcept
+  {
+    switch(phase){
+    case Phase::Forward:
+      return "forward";
+    case Phase::Activation:
+      return "activation";
+    case Phase::Backward:
+      return "backward";
+    case Phase::Update:
+      return "update";
+    }
+    return "unknown";
+  }
+
+  bool profilingEnabled() noexcept
+  {
+    return DNN_PROFILING;
+  }
+
+  void writeProfileJson(std::ostream& ostr, const std::vector<ProfileEntry>& entries)
+  {
+    ostr << "{\"enabled\": " << (profilingEnabled() ? "true" : "false") << ", \"layers\": [";
+    for(size_t i = 0; i < entries.size(); i++){
+      const LayerProfile& p = *entries[i].profile;
+      ostr << (i ? ",\n  " : "\n  ") << "{\"name\": " << quoted(entries[i].name)
+	   << ", \"bytesAllocated\": " << p.bytesAllocated() << ", \"phases\": {";
+      for(int ph = 0; ph < numPhases; ph++){
+	const PhaseStats s = p.get(static_cast<Phase>(ph));
+	ostr << (ph ? ", " : "") << quoted(phaseName(static_cast<Phase>(ph)))
+	     << ": {\"cycles\": " << s.cycles << ", \"calls\": " << s.calls
+	     << ", \"flops\": " << s.flops << '}';
+      }
+      ostr << "}}";
+    }
+    ostr << "\n]}\n";
+  }
+
+  void writeChromeTrace(std::ostream& ostr, const std::vector<ProfileEntry>& entries,
+			const TraceRecorder& trace)
+  {
+    //complete ("X") events with microsecond times on one thread
+    ostr << "{\"traceEvents\": [";
+    const auto& events = trace.getEvents();
+    for(size_t i = 0; i < events.size(); i++){
+      const TraceEvent& e = events[i];
+      const std::string layer = e.layer >= 0 and static_cast<size_t>(e.layer) < entries.size()
+	? entries[e.layer].name : "network";
+      ostr << (i ? ",\n  " : "\n  ") << "{\"name\": " << quoted(layer + " " + phaseName(e.phase))
+	   << ", \"cat\": " << quoted(phaseName(e.phase)) << ", \"ph\": \"X\", \"ts\": "
+	   << microseconds(e.start) << ", \"dur\": " << microseconds(e.duration)
+	   << ", \"pid\": 0, \"tid\": 0, \"args\": {\"layer\": " << e.layer << "}}";
+    }
+    ostr << "\n], \"displayTimeUnit\": \"ns\", \"otherData\": {\"droppedEvents\": "
+	 << trace.getDropped() << "}}\n";
+  }
+
+}//end namespace NN
@@ -0,0 +1,319 @@
+#include "QuantizedModel.hpp"
+#include <algorithm>
+#include <cmath>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace NN
+{
+  namespace
+  {
+    //bytes per vpmaddubsw operand
+    constexpr int_t laneBytes = 32;
+
+    //largest weight magnitude; 2 * 255 * 63 is the widest pair sum that
+    //vpmaddubsw doesn't saturate
+    constexpr int weightLevels = 63;
+
+    size_t alignedBytes(size_t bytes)
+    {
+      return paddedCount<unsigned char>(bytes);
+    }
+
+    //q = round(clamp(x / scale + zero)) for rows of cols, zero padded to padded
+    template<typename Scalar>
+    void quantizeRows(const Scalar* x, int_t stride, int_t rows, int_t cols, int_t padded,
+		      Scalar invScale, int32_t zero, uint8_t* q)
+    {
+      const Scalar z = zero;
+      for(int_t i = 0; i < rows; i++){
+	const Scalar* xr = x + i * stride;
+	uint8_t* qr = q + i * padded;
+	for(int_t k = 0; k < cols; k++){
+	  //clamped first, so rounding is a truncation of a non-negative value
+	  const Scalar v = std::min(std::max(xr[k] * invScale + z, Scalar(0)), Scalar(255));
+	  qr[k] = static_cast<uint8_t>(static_cast<int32_t>(v + Scalar(0.5)));
+	}
+	std::fill(qr + cols, qr + padded, uint8_t(0));
+      }
+    }
+
+#ifdef __AVX2__
+    //acc += one 32-byte slice of a uint8 x int8 dot product, as 8 int32 partial sums
+    inline __m256i dotStep(__m256i acc, __m256i x, __m256i w, __m256i ones)
+    {
+      return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), ones));
+    }
+
+    inline __m256i load(const void* p)
+    {
+      return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+    }
+
+    //the four totals of a0..a3, in order
+    inline __m128i horizontalSum4(__m256i a0, __m256i a1, __m256i a2, __m256i a3)
+    {
+      //per 128-bit half: [a0, a1, a2, a3] partial sums, then the halves added
+      const __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(a0, a1), _mm256_hadd_epi32(a2, a3));
+      return _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+    }
+
+    inline int32_t horizontalSum(__m256i v)
+    {
+      __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+      s = _mm_hadd_epi32(s, s);
+      s = _mm_hadd_epi32(s, s);
+      return _mm_cvtsi128_si32(s);
+    }
+
+    /*
+     * Rows rows of the product. Each step loads Rows input slices and four
+     * weight slices and issues 4 * Rows multiply-adds on them.
+     * */
+    template<int Rows>
+    void int8Block(const uint8_t* q, const int8_t* w, int_t cols, int_t depth, int32_t* sums)
+    {
+      const __m256i ones = _mm256_set1_epi16(1);
+      int_t j = 0;
+      for(; j + 4 <= cols; j += 4){
+	const int8_t* w0 = w + j * depth;
+	__m256i acc[Rows][4];
+	for(int r = 0; r < Rows; r++){
+	  for(int c = 0; c < 4; c++){
+	    acc[r][c] = _mm256_setzero_si256();
+	  }
+	}
+	for(int_t k = 0; k < depth; k += laneBytes){
+	  const __m256i wv[4] = {load(w0 + k), load(w0 + depth + k), load(w0 + 2 * depth + k),
+				 load(w0 + 3 * depth + k)};
+	  for(int r = 0; r < Rows; r++){
+	    const __m256i x = load(q + r * depth + k);
+	    for(int c = 0; c < 4; c++){
+	      acc[r][c] = dotStep(acc[r][c], x, wv[c], ones);
+	    }
+	  }
+	}
+	for(int r = 0; r < Rows; r++){
+	  _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + r * cols + j),
+			   horizontalSum4(acc[r][0], acc[r][1], acc[r][2], acc[r][3]));
+	}
+      }
+      for(; j < cols; j++){
+	for(int r = 0; r < Rows; r++){
+	  __m256i a = _mm256_setzero_si256();
+	  for(int_t k = 0; k < depth; k += laneBytes){
+	    a = dotStep(a, load(q + r * depth + k), load(w + j * depth + k), ones);
+	  }
+	  sums[r * cols + j] = horizontalSum(a);
+	}
+      }
+    }
+#endif
+
+    /*
+     * sums[i * cols + j] = q row i . w row j over depth bytes, a multiple of
+     * laneBytes, for rows of q each depth bytes long.
+     * */
+    void int8Gemm(const uint8_t* q, int_t rows, const int8_t* w, int_t cols, int_t depth, int32_t* sums)
+    {
+#ifdef __AVX2__
+      int_t i = 0;
+      for(; i + 2 <= rows; i += 2){
+	int8Block<2>(q + i * depth, w, cols, depth, sums + i * cols);
+      }
+      if(i < rows){
+	int8Block<1>(q + i * depth, w, cols, depth, sums + i * cols);
+      }
+#else
+      for(int_t i = 0; i < rows; i++){
+	for(int_t j = 0; j < cols; j++){
+	  int32_t s = 0;
+	  for(int_t k = 0; k < depth; k++){
+	    s += int32_t(q[i * depth + k]) * int32_t(w[j * depth + k]);
+	  }
+	  sums[i * cols + j] = s;
+	}
+      }
+#endif
+    }
+  }
+
+  template<typename Scalar>
+  BasicQuantizedModel<Scalar>::BasicQuantizedModel(const BasicNetwork<Scalar>& net, ConstMatRef calibration,
+						   int_t _rowChunk)
+    : rowChunk(_rowChunk)
+  {
+    if(rowChunk <= 0){
+      throw "Error: rowChunk must be positive.";
+    }
+    if(calibration.rows() == 0){
+      throw "Error: calibration batch is empty.";
+    }
+    if(not net.hasShapes()){
+      throw "Error: the network holds no weights until its first batch.";
+    } else if(net.hasOutputLayer()){
+      throw "Error: a frozen model runs the layers alone, not an output layer past them.";
+    }
+    //each layer's calibration input is the previous layer's full-precision output
+    Mat x = calibration;
+    const auto folded = internal::withBatchNormFolded(net);
+    for(const auto& l : (folded ? *folded : net).getLayers()){
+      if(l.getActivation() == "custom"){
+	throw "Error: custom activations cannot be frozen; their kernels may hold state.";
+      }
+      if(l.getKind() != LayerKind::Dense){
+	throw "Error: only dense layers, and batch norms after them, can be quantized.";
+      }
+      const auto& w = l.getWeights();
+      const int_t in = w.rows() - 1;
+      if(x.cols() != in){
+	throw "Error: layer shapes do not chain.";
+      }
+      QuantizedLayer q;
+      q.inputs = in;
+      q.outputs = w.cols();
+      q.paddedInputs = (in + laneBytes - 1) / laneBytes * laneBytes;
+      q.activation = activationKernel<Scalar>(l.getActivation());
+
+      //asymmetric input range, widened to hold 0 so zero padding stays exact
+      const Scalar lo = std::min(x.minCoeff(), Scalar(0));
+      const Scalar hi = std::max(x.maxCoeff(), Scalar(0));
+      q.inputScale = hi > lo ? (hi - lo) / Scalar(255) : Scalar(1);
+      q.invInputScale = Scalar(1) / q.inputScale;
+      q.inputZero = std::min<int32_t>(255, std::max<int32_t>(0, std::lround(-lo / q.inputScale)));
+
+      //symmetric 7-bit weights, one scale per output
+      q.weights = AlignedBuffer<int8_t>(q.outputs * q.paddedInputs);
+      q.outputScale.resize(q.outputs);
+      q.zeroCorrection.resize(q.outputs);
+      for(int_t j = 0; j < q.outputs; j++){
+	const Scalar maxAbs = w.col(j).head(in).cwiseAbs().maxCoeff();
+	const Scalar scale = maxAbs > 0 ? maxAbs / Scalar(weightLevels) : Scalar(1);
+	int32_t sum = 0;
+	for(int_t k = 0; k < in; k++){
+	  const long v = std::lround(w(k, j) / scale);
+	  const int8_t wq = static_cast<int8_t>(std::min<long>(weightLevels, std::max<long>(-weightLevels, v)));
+	  q.weights.data()[j * q.paddedInputs + k] = wq;
+	  sum += wq;
+	}
+	q.outputScale(j) = q.inputScale * scale;
+	q.zeroCorrection(j) = Scalar(q.inputZero) * Scalar(sum);
+      }
+      q.bias = w.row(in);
+
+      Mat y = x * w.topRows(in);
+      y.rowwise() += w.row(in);
+      q.activation.forward(y, y);
+      x = std::move(y);
+
+      if(not layers.empty()){
+	maxHidden = std::max(maxHidden, in);
+      }
+      maxPaddedInputs = std::max(maxPaddedInputs, q.paddedInputs);
+      maxOutputs = std::max(maxOutputs, q.outputs);
+      layers.push_back(std::move(q));
+    }
+    if(layers.empty()){
+      throw "Error: network has no layers to quantize.";
+    }
+    scratchBytes = alignedBytes(rowChunk * maxPaddedInputs) + alignedBytes(rowChunk * maxOutputs * sizeof(int32_t))
+      + 2 * alignedBytes(rowChunk * maxHidden * sizeof(Scalar));
+  }
+
+  template<typename Scalar>
+  unsigned char* BasicQuantizedModel<Scalar>::threadScratch(size_t bytes)
+  {
+    //shared by every model of this scalar type on the thread; nothing in it
+    //outlives a predict() call
+    thread_local AlignedBuffer<unsigned char> scratch;
+    if(scratch.size() < bytes){
+      scratch = AlignedBuffer<unsigned char>(bytes);
+    }
+    return scratch.data();
+  }
+
+  template<typename Scalar>
+  void BasicQuantizedModel<Scalar>::reserveThreadScratch() const
+  {
+    threadScratch(scratchBytes);
+  }
+
+  template<typename Scalar>
+  size_t BasicQuantizedModel<Scalar>::weightBytes() const noexcept
+  {
+    size_t bytes = 0;
+    for(const auto& l : layers){
+      bytes += l.weights.size() + 3 * l.outputs * sizeof(Scalar);
+    }
+    return bytes;
+  }
+
+  template<typename Scalar>
+  void BasicQuantizedModel<Scalar>::predict(ConstMatRef batch, MatRef out) const
+  {
+    if(batch.cols() != inputSize()){
+      throw "Error: batch must have one column per model input.";
+    }
+    if(out.rows() != batch.rows() or out.cols() != numOutputs()){
+      throw "Error: output must be batch rows x numOutputs().";
+    }
+    using SumMap = Eigen::Map<const RowMat<int32_t>>;
+    using OutMap = Eigen::Map<Mat, Eigen::Unaligned, Eigen::OuterStride<>>;
+    unsigned char* scratch = threadScratch(scratchBytes);
+    uint8_t* quantized = scratch;
+    int32_t* sums = reinterpret_cast<int32_t*>(scratch + alignedBytes(rowChunk * maxPaddedInputs));
+    Scalar* hidden = reinterpret_cast<Scalar*>(reinterpret_cast<unsigned char*>(sums)
+					       + alignedBytes(rowChunk * maxOutputs * sizeof(int32_t)));
+    const size_t half = alignedBytes(rowChunk * maxHidden * sizeof(Scalar)) / sizeof(Scalar);
+    const int_t n = layers.size();
+
+    for(int_t r = 0; r < batch.rows(); r += rowChunk){
+      const int_t rows = std::min(rowChunk, batch.rows() - r);
+      const Scalar* xData = batch.data() + r * batch.outerStride();
+      int_t xStride = batch.outerStride();
+      for(int_t i = 0; i < n; i++){
+	const auto& l = layers[i];
+	quantizeRows(xData, xStride, rows, l.inputs, l.paddedInputs, l.invInputScale, l.inputZero, quantized);
+	int8Gemm(quantized, rows, l.weights.data(), l.outputs, l.paddedInputs, sums);
+	//the last layer writes straight into out
+	OutMap y = i == n - 1
+	  ? OutMap(out.data() + r * out.outerStride(), rows, l.outputs, Eigen::OuterStride<>(out.outerStride()))
+	  : OutMap(hidden + (i % 2) * half, rows, l.outputs, Eigen::OuterStride<>(l.outputs));
+	const SumMap s(sums, rows, l.outputs);
+	y.array() = ((s.template cast<Scalar>().rowwise() - l.zeroCorrection).array().rowwise()
+		     * l.outputScale.array()).rowwise() + l.bias.array();
+	l.activation.forward(y, y);
+	xData = y.data();
+	xStride = y.outerStride();
+      }
+    }
+  }
+
+  template<typename Scalar>
+  QuantizationError BasicQuantizedModel<Scalar>::compare(const BasicInferenceModel<Scalar>& reference,
+							 ConstMatRef batch) const
+  {
+    if(reference.inputSize() != inputSize() or reference.numOutputs() != numOutputs()){
+      throw "Error: reference model has a different shape.";
+    }
+    Mat expected(batch.rows(), numOutputs());
+    Mat actual(batch.rows(), numOutputs());
+    reference.predict(batch, expected);
+    predict(batch, actual);
+    QuantizationError e;
+    if(expected.size() == 0){
+      return e;
+    }
+    const auto diff = (actual - expected).template cast<double>();
+    e.maxAbsError = diff.cwiseAbs().maxCoeff();
+    e.rmsError = std::sqrt(diff.squaredNorm() / expected.size());
+    e.referenceRms = std::sqrt(expected.template cast<double>().squaredNorm() / expected.size());
+    return e;
+  }
+
+  template class BasicQuantizedModel<double>;
+
+  template class BasicQuantizedModel<float>;
+
+}//end namespace NN
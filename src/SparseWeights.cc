@@ -0,0 +1,208 @@
+#include "SparseWeights.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace NN
+{
+  namespace
+  {
+    //batch rows per transposed panel
+    constexpr int_fast64_t panel = 32;
+
+    template<typename Scalar>
+    using PanelVec = Eigen::Matrix<Scalar, panel, 1>;
+
+    template<typename Scalar>
+    using ConstPanelMap = Eigen::Map<const PanelVec<Scalar>>;
+
+    //p[k * panel + b] = m(first + b, k) for b < count, and 0 past count
+    template<typename Scalar>
+    void transposePanel(const Eigen::Ref<const RowMat<Scalar>>& m, int_fast64_t first, int_fast64_t count,
+			Scalar* p) noexcept
+    {
+      const int_fast64_t cols = m.cols();
+      if(count < panel){
+	for(int_fast64_t k = 0; k < cols; k++){
+	  std::fill(p + k * panel + count, p + (k + 1) * panel, Scalar(0));
+	}
+      }
+      for(int_fast64_t b = 0; b < count; b++){
+	const Scalar* row = m.data() + (first + b) * m.outerStride();
+	for(int_fast64_t k = 0; k < cols; k++){
+	  p[k * panel + b] = row[k];
+	}
+      }
+    }
+  }
+
+  template<typename Scalar>
+  SparseWeights<Scalar>::SparseWeights(ConstMatRef dense)
+    : numRows(dense.rows()),
+      numCols(dense.cols())
+  {
+    if(dense.size() > std::numeric_limits<int32_t>::max()){
+      throw "Error: weights too large for 32-bit sparse indices.";
+    }
+    rowStart.reserve(numRows + 1);
+    rowStart.push_back(0);
+    for(int_fast64_t k = 0; k < numRows; k++){
+      for(int_fast64_t j = 0; j < numCols; j++){
+	if(dense(k, j) != Scalar(0)){
+	  colIndex.push_back(j);
+	}
+      }
+      rowStart.push_back(colIndex.size());
+    }
+    values.resize(colIndex.size());
+    //the transpose by counting sort; rows come out ascending in each column
+    colStart.assign(numCols + 1, 0);
+    for(int32_t j : colIndex){
+      colStart[j + 1]++;
+    }
+    for(int_fast64_t j = 0; j < numCols; j++){
+      colStart[j + 1] += colStart[j];
+    }
+    rowIndex.resize(colIndex.size());
+    std::vector<int32_t> next(colStart.begin(), colStart.end() - 1);
+    for(int_fast64_t k = 0; k < numRows; k++){
+      for(int32_t n = rowStart[k]; n < rowStart[k + 1]; n++){
+	rowIndex[next[colIndex[n]]++] = k;
+      }
+    }
+    colValues.resize(colIndex.size());
+    refresh(dense);
+  }
+
+  template<typename Scalar>
+  void SparseWeights<Scalar>::refresh(ConstMatRef dense) noexcept
+  {
+    for(int_fast64_t k = 0; k < numRows; k++){
+      const Scalar* row = dense.data() + k * dense.outerStride();
+      for(int32_t n = rowStart[k]; n < rowStart[k + 1]; n++){
+	values[n] = row[colIndex[n]];
+      }
+    }
+    for(int_fast64_t j = 0; j < numCols; j++){
+      for(int32_t n = colStart[j]; n < colStart[j + 1]; n++){
+	colValues[n] = dense(rowIndex[n], j);
+      }
+    }
+  }
+
+  template<typename Scalar>
+  void SparseWeights<Scalar>::mask(MatRef dense) const noexcept
+  {
+    for(int_fast64_t k = 0; k < numRows; k++){
+      Scalar* row = dense.data() + k * dense.outerStride();
+      int_fast64_t j = 0;
+      for(int32_t n = rowStart[k]; n < rowStart[k + 1]; n++){
+	std::fill(row + j, row + colIndex[n], Scalar(0));
+	j = colIndex[n] + 1;
+      }
+      std::fill(row + j, row + numCols, Scalar(0));
+    }
+  }
+
+
+  namespace internal
+  {
+    template<typename Scalar>
+    void spmmAccumulate(Eigen::Ref<const RowMat<Scalar>> x, const SparseWeights<Scalar>& w,
+			Eigen::Ref<RowMat<Scalar>> dst, ScratchArena& scratch)
+    {
+      const int_fast64_t out = w.cols();
+      const int32_t* colStart = w.colStarts();
+      const int32_t* rowIndex = w.rowIndices();
+      const Scalar* values = w.colValueData();
+      Scalar* xt = scratch.take<Scalar>(w.rows() * panel);
+      for(int_fast64_t first = 0; first < x.rows(); first += panel){
+	const int_fast64_t count = std::min(panel, x.rows() - first);
+	transposePanel<Scalar>(x, first, count, xt);
+	//each output gathers the inputs that feed it, in registers
+	for(int_fast64_t j = 0; j < out; j++){
+	  PanelVec<Scalar> acc = PanelVec<Scalar>::Zero();
+	  for(int32_t n = colStart[j]; n < colStart[j + 1]; n++){
+	    acc.noalias() += values[n] * ConstPanelMap<Scalar>(xt + rowIndex[n] * panel);
+	  }
+	  for(int_fast64_t b = 0; b < count; b++){
+	    dst(first + b, j) += acc(b);
+	  }
+	}
+      }
+    }
+
+    template<typename Scalar>
+    void spmmTransposedAccumulate(Eigen::Ref<const RowMat<Scalar>> e, const SparseWeights<Scalar>& w,
+				  Eigen::Ref<RowMat<Scalar>> dst, ScratchArena& scratch)
+    {
+      const int_fast64_t in = w.rows();
+      const int32_t* rowStart = w.rowStarts();
+      const int32_t* colIndex = w.colIndices();
+      const Scalar* values = w.valueData();
+      Scalar* et = scratch.take<Scalar>(w.cols() * panel);
+      for(int_fast64_t first = 0; first < e.rows(); first += panel){
+	const int_fast64_t count = std::min(panel, e.rows() - first);
+	transposePanel<Scalar>(e, first, count, et);
+	//each input gathers the errors of the outputs it feeds, in registers
+	for(int_fast64_t k = 0; k < in; k++){
+	  PanelVec<Scalar> acc = PanelVec<Scalar>::Zero();
+	  for(int32_t n = rowStart[k]; n < rowStart[k + 1]; n++){
+	    acc.noalias() += values[n] * ConstPanelMap<Scalar>(et + colIndex[n] * panel);
+	  }
+	  for(int_fast64_t b = 0; b < count; b++){
+	    dst(first + b, k) += acc(b);
+	  }
+	}
+      }
+    }
+
+    template<typename Scalar>
+    void sddmmAccumulate(Eigen::Ref<const RowMat<Scalar>> x, Eigen::Ref<const RowMat<Scalar>> e,
+			 const SparseWeights<Scalar>& w, Eigen::Ref<RowMat<Scalar>> grad, ScratchArena& scratch)
+    {
+      const int_fast64_t in = w.rows();
+      const int32_t* rowStart = w.rowStarts();
+      const int32_t* colIndex = w.colIndices();
+      Scalar* xt = scratch.take<Scalar>(in * panel);
+      Scalar* et = scratch.take<Scalar>(w.cols() * panel);
+      for(int_fast64_t first = 0; first < x.rows(); first += panel){
+	const int_fast64_t count = std::min(panel, x.rows() - first);
+	transposePanel<Scalar>(x, first, count, xt);
+	transposePanel<Scalar>(e, first, count, et);
+	//one dot product over the panel per kept weight; the zero padding
+	//of a short panel adds nothing
+	for(int_fast64_t k = 0; k < in; k++){
+	  const ConstPanelMap<Scalar> xk(xt + k * panel);
+	  Scalar* g = grad.data() + k * grad.outerStride();
+	  for(int32_t n = rowStart[k]; n < rowStart[k + 1]; n++){
+	    g[colIndex[n]] += xk.dot(ConstPanelMap<Scalar>(et + colIndex[n] * panel));
+	  }
+	}
+      }
+    }
+
+    template void spmmAccumulate<double>(Eigen::Ref<const RowMat<double>>, const SparseWeights<double>&,
+					 Eigen::Ref<RowMat<double>>, ScratchArena&);
+
+    template void spmmAccumulate<float>(Eigen::Ref<const RowMat<float>>, const SparseWeights<float>&,
+					Eigen::Ref<RowMat<float>>, ScratchArena&);
+
+    template void spmmTransposedAccumulate<double>(Eigen::Ref<const RowMat<double>>, const SparseWeights<double>&,
+						   Eigen::Ref<RowMat<double>>, ScratchArena&);
+
+    template void spmmTransposedAccumulate<float>(Eigen::Ref<const RowMat<float>>, const SparseWeights<float>&,
+						  Eigen::Ref<RowMat<float>>, ScratchArena&);
+
+    template void sddmmAccumulate<double>(Eigen::Ref<const RowMat<double>>, Eigen::Ref<const RowMat<double>>,
+					  const SparseWeights<double>&, Eigen::Ref<RowMat<double>>, ScratchArena&);
+
+    template void sddmmAccumulate<float>(Eigen::Ref<const RowMat<float>>, Eigen::Ref<const RowMat<float>>,
+					 const SparseWeights<float>&, Eigen::Ref<RowMat<float>>, ScratchArena&);
+
+  }//end namespace internal
+
+  template class SparseWeights<double>;
+
+  template class SparseWeights<float>;
+
+}//end namespace NN
@@ -0,0 +1,223 @@
+#include "Trainer.hpp"
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+namespace NN
+{
+
+  template<typename Scalar>
+  void BasicMatrixSource<Scalar>::gather(const int_t* idx, int_t count,
+			    MatRef batchFeatures, MatRef batchTargets) const
+  {
+    for(int_t i = 0; i < count; i++){
+      batchFeatures.row(i) = features.row(idx[i]);
+      batchTargets.row(i) = targets.row(idx[i]);
+    }
+  }
+
+
+  template<typename Scalar>
+  bool BasicMatrixSource<Scalar>::viewRows(int_t first, int_t count, const Scalar*& batchFeatures,
+					   int_t& featureStride, const Scalar*& batchTargets,
+					   int_t& targetStride) const
+  {
+    if(first < 0 or count < 0 or first + count > features.rows()){
+      return false;
+    }
+    batchFeatures = features.data() + first * features.outerStride();
+    featureStride = features.outerStride();
+    batchTargets = targets.data() + first * targets.outerStride();
+    targetStride = targets.outerStride();
+    return true;
+  }
+
+
+  template<typename Scalar>
+  BasicBatchLoader<Scalar>::BasicBatchLoader(const BasicDataSource<Scalar>& _source, int_t _batchSize, bool _prefetch)
+    : source(_source),
+      batchSize(_batchSize),
+      prefetch(_prefetch)
+  {
+    for(auto& b : buffers){
+      b.features.resize(batchSize, source.featureCount());
+      b.targets.resize(batchSize, source.targetCount());
+    }
+    if(prefetch){
+      worker = std::thread(&BasicBatchLoader::workerLoop, this);
+    }
+  }
+
+  template<typename Scalar>
+  BasicBatchLoader<Scalar>::~BasicBatchLoader()
+  {
+    if(worker.joinable()){
+      {
+	std::lock_guard<std::mutex> lock(mtx);
+	stopping = true;
+      }
+      cv.notify_all();
+      worker.join();
+    }
+  }
+
+  template<typename Scalar>
+  void BasicBatchLoader<Scalar>::fill(int buf, int_t start)
+  {
+    auto& b = buffers[buf];
+    b.rows = std::min<int_t>(batchSize, order.size() - start);
+    const int_t* idx = order.data() + start;
+    bool consecutive = true;
+    for(int_t i = 1; i < b.rows and consecutive; i++){
+      consecutive = idx[i] == idx[0] + i;
+    }
+    if(consecutive and source.viewRows(idx[0], b.rows, b.featureRows, b.featureStride,
+				       b.targetRows, b.targetStride)){
+      b.gathered = false;
+      source.willNeed(idx[0], b.rows);
+      return;
+    }
+    source.gather(idx, b.rows, b.features, b.targets);
+    b.gathered = true;
+    b.featureRows = b.features.data();
+    b.featureStride = b.features.cols();
+    b.targetRows = b.targets.data();
+    b.targetStride = b.targets.cols();
+  }
+
+  //gathers the batch at cursor into buf, in the background when prefetching
+  template<typename Scalar>
+  void BasicBatchLoader<Scalar>::requestFill(int buf)
+  {
+    if(cursor >= static_cast<int_t>(order.size())){
+      buffers[buf].rows = 0;
+      return;
+    }
+    const int_t start = cursor;
+    cursor += batchSize;
+    if(not prefetch){
+      fill(buf, start);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      fillTarget = buf;
+      fillStart = start;
+      fillDone = false;
+      fillRequested = true;
+    }
+    cv.notify_all();
+  }
+
+  template<typename Scalar>
+  void BasicBatchLoader<Scalar>::waitForFill()
+  {
+    if(prefetch){
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [this]{ return fillDone; });
+    }
+  }
+
+  template<typename Scalar>
+  void BasicBatchLoader<Scalar>::workerLoop()
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    while(true){
+      cv.wait(lock, [this]{ return fillRequested or stopping; });
+      if(stopping){
+	return;
+      }
+      fillRequested = false;
+      const int buf = fillTarget;
+      const int_t start = fillStart;
+      lock.unlock();
+      fill(buf, start);
+      lock.lock();
+      fillDone = true;
+      cv.notify_all();
+    }
+  }
+
+  template<typename Scalar>
+  void BasicBatchLoader<Scalar>::startEpoch(const std::vector<int_t>& _order)
+  {
+    waitForFill();
+    order = _order;
+    cursor = 0;
+    current = 0;
+    requestFill(current);
+  }
+
+  template<typename Scalar>
+  const typename BasicBatchLoader<Scalar>::Batch* BasicBatchLoader<Scalar>::next()
+  {
+    waitForFill();
+    const int ready = current;
+    if(buffers[ready].rows == 0){
+      return nullptr;
+    }
+    //the caller is done with the other buffer, so it can take the next batch
+    current = 1 - current;
+    requestFill(current);
+    return &buffers[ready];
+  }
+
+
+  template<typename Model, typename Scalar>
+  void Trainer::fitModel(Model& model, const BasicDataSource<Scalar>& data)
+  {
+    if(data.size() == 0){
+      throw "Error: cannot train on an empty data source.";
+    }
+    std::vector<int_t> order(data.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937_64 rng(seed);
+
+    BasicBatchLoader<Scalar> loader(data, batchSize, prefetch);
+    for(size_t epoch = 0; epoch < epochs; epoch++){
+      if(shuffle){
+	std::shuffle(order.begin(), order.end(), rng);
+      }
+      loader.startEpoch(order);
+      double lossSum = 0.0;
+      size_t numBatches = 0;
+      while(const BasicBatch<Scalar>* b = loader.next()){
+	if(dropLast and b->rows < batchSize){
+	  continue;
+	}
+	lossSum += model.trainStep(b->featureView(), b->targetView());
+	numBatches++;
+      }
+      epochLoss.push_back(numBatches ? lossSum / numBatches : 0.0);
+    }
+  }
+
+  template<typename Scalar>
+  void Trainer::fit(BasicNetwork<Scalar>& net, const BasicDataSource<Scalar>& data)
+  {
+    fitModel(net, data);
+  }
+
+  template<typename Scalar>
+  void Trainer::fit(BasicDataParallel<Scalar>& model, const BasicDataSource<Scalar>& data)
+  {
+    fitModel(model, data);
+  }
+
+  template class BasicMatrixSource<double>;
+
+  template class BasicMatrixSource<float>;
+
+  template class BasicBatchLoader<double>;
+
+  template class BasicBatchLoader<float>;
+
+  template void Trainer::fit(BasicNetwork<double>&, const BasicDataSource<double>&);
+
+  template void Trainer::fit(BasicNetwork<float>&, const BasicDataSource<float>&);
+
+  template void Trainer::fit(BasicDataParallel<double>&, const BasicDataSource<double>&);
+
+  template void Trainer::fit(BasicDataParallel<float>&, const BasicDataSource<float>&);
+
+}//end namespace NN
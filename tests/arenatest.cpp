@@ -0,0 +1,99 @@
+#include "../include/Network.hpp"
+#include "../include/ParameterArena.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <cstdint>
+
+using Mat = NN::Mat;
+
+int main(){
+	bool ok = true;
+
+	NN::Layer l1(std::make_pair(8, 5), 7, "tanh");
+	NN::Layer l2(std::make_pair(8, 7), 3, "tanh");
+	NN::Layer l3(std::make_pair(8, 3), 1, "linear");
+	NN::Network net("tanh", "L2", {l1, l2, l3});
+	net.setActivations(std::list<std::string>{"tanh", "tanh", "linear"});
+
+	// every layer's tensors sit in the arena, in order and 64-byte aligned
+	const auto& arena = net.getParameterArena();
+	size_t i = 0;
+	for(const auto& l : net.getLayers()){
+		const double* w = l.getWeights().data();
+		if(w != arena.tensor(arena.Weights, i) or l.getGradient().data() != arena.tensor(arena.Gradients, i)
+		   or reinterpret_cast<std::uintptr_t>(w) % NN::PARAMETER_ALIGNMENT != 0){
+			std::cout << "FAILED: layer " << i << " is not packed into the arena\n";
+			ok = false;
+		}
+		i++;
+	}
+	std::cout << "arena: " << arena.numTensors() << " tensors, " << arena.getRegionSize()
+		  << " scalars per region, " << arena.sizeInBytes() << " bytes\n";
+	if(not net.parametersPacked()){
+		std::cout << "FAILED: network reports unpacked parameters\n";
+		ok = false;
+	}
+
+	// the fused whole-arena update matches layer-by-layer updates
+	Mat x = Mat::Random(8, 5);
+	Mat y = Mat::Random(8, 1);
+	net.setUpdateParams(NN::adam(1e-2));
+	NN::Network perLayer(net);
+	// optimizers that differ only in an unused field still stop the fused path
+	std::list<NN::OptimizerParams> unfused{NN::adam(1e-2), NN::adam(1e-2), NN::adam(1e-2, 0.9, 0.999, 1.0e-8)};
+	unfused.back().weightDecay = 0.5;
+	perLayer.setUpdateParams(unfused);
+	if(perLayer.getLayers().front().getWeights().data() == net.getLayers().front().getWeights().data()){
+		std::cout << "FAILED: a copied network shares its parameters\n";
+		ok = false;
+	}
+	const auto snapshot = net.snapshotWeights();
+	for(int step = 0; step < 10; step++){
+		net.trainStep(x, y);
+		perLayer.trainStep(x, y);
+	}
+	double diff = 0;
+	auto a = net.getLayers().begin();
+	for(const auto& b : perLayer.getLayers()){
+		diff = std::max(diff, (a->getWeights() - b.getWeights()).cwiseAbs().maxCoeff());
+		++a;
+	}
+	std::cout << "max |fused - per layer| after 10 adam steps: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: fused update disagrees with per-layer updates\n";
+		ok = false;
+	}
+
+	// padding between tensors stays zero
+	const auto& w = arena.regionView(arena.Weights);
+	double padding = 0;
+	for(size_t t = 0; t < arena.numTensors(); t++){
+		const size_t end = arena.offset(t) + arena.shape(t).first * arena.shape(t).second;
+		const size_t next = t + 1 < arena.numTensors() ? arena.offset(t + 1) : arena.getRegionSize();
+		for(size_t k = end; k < next; k++){
+			padding = std::max(padding, std::abs(w(k)));
+		}
+	}
+	if(padding != 0){
+		std::cout << "FAILED: arena padding changed during training\n";
+		ok = false;
+	}
+
+	// snapshot and restore
+	net.restoreWeights(snapshot);
+	if(net.getFirstWeights() != l1.getWeights()){
+		std::cout << "FAILED: restored weights differ from the snapshot\n";
+		ok = false;
+	}
+	std::cout << "weights restored from a " << snapshot.size() << " scalar snapshot\n";
+
+	// changing the layers repacks
+	std::list<NN::Layer> more{NN::Layer(std::make_pair(8, 1), 2, "linear")};
+	net.appendLayers(more);
+	if(not net.parametersPacked() or net.getParameterArena().numTensors() != 4){
+		std::cout << "FAILED: appended layer was not packed\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+using Mat = NN::Mat;
+using NN::int_t;
+
+// root mean square of a deep relu stack's outputs on unit inputs
+double depthRms(NN::WeightInit init){
+	const int_t width = 64;
+	NN::Network net("L2");
+	for(int i = 0; i < 8; i++){
+		net.addDense(width, "relu", init);
+	}
+	const Mat x = Mat::Random(128, width) * std::sqrt(3.0);
+	const Mat& out = net.predictBatch(x);
+	return std::sqrt(out.squaredNorm() / out.size());
+}
+
+int main(){
+	bool ok = true;
+	const int_t batchSize = 32;
+	const Mat inputs = Mat::Random(batchSize, 6);
+	const Mat targets = (inputs.leftCols(3).rowwise().sum() - inputs.rightCols(3).rowwise().sum()).array().sin();
+
+	// only output widths; the shapes wait for the first batch
+	NN::Network net("L2");
+	net.addDense(32, "tanh").addDense(32, "relu").addDense(1, "linear");
+	std::cout << "before the first batch: " << net.getLayers().size() << " layers, shapes "
+		  << (net.hasShapes() ? "known" : "unknown") << ", " << net.getParameterArena().sizeInBytes()
+		  << " parameter bytes\n";
+	if(net.hasShapes() or net.getParameterArena().numTensors() != 0 or net.getNumOutputs() != 1){
+		std::cout << "FAILED: the network allocated before seeing its inputs\n";
+		ok = false;
+	}
+
+	net.setUpdateParams(NN::adam(3e-3));
+	double firstLoss = 0;
+	double lastLoss = 0;
+	for(int i = 0; i < 300; i++){
+		lastLoss = net.trainStep(inputs, targets);
+		if(i == 0){
+			firstLoss = lastLoss;
+		}
+	}
+	std::cout << "layer inputs:";
+	for(const auto& s : net.getLayerInputShapes()){
+		std::cout << " " << s.first << "x" << s.second;
+	}
+	std::cout << "; loss " << firstLoss << " -> " << lastLoss << '\n';
+	const auto shapes = net.getLayerInputShapes();
+	if(shapes.front().second != 6 or shapes.back().second != 32 or not net.parametersPacked()
+	   or net.getParameterArena().numTensors() != 3){
+		std::cout << "FAILED: shapes were not inferred from the first batch\n";
+		ok = false;
+	}
+	if(not (lastLoss < 0.1 * firstLoss)){
+		std::cout << "FAILED: the inferred network did not train\n";
+		ok = false;
+	}
+
+	// Xavier for tanh, He for relu, zero biases, drawn in the arena
+	NN::Network fresh("L2");
+	fresh.addDense(32, "tanh").addDense(32, "relu").addDense(1, "linear");
+	fresh.predictBatch(inputs);
+	const auto& layers = fresh.getLayers();
+	const double limits[] = {std::sqrt(6.0 / (6 + 32)), std::sqrt(6.0 / 32), std::sqrt(6.0 / (32 + 1))};
+	int i = 0;
+	for(const auto& l : layers){
+		const auto& w = l.getWeights();
+		const double top = w.topRows(w.rows() - 1).cwiseAbs().maxCoeff();
+		const double bias = w.bottomRows(1).cwiseAbs().maxCoeff();
+		std::cout << "layer " << i << ": max |weight| " << top << " of limit " << limits[i] << ", max |bias| "
+			  << bias << '\n';
+		if(top > limits[i] or top < 0.5 * limits[i] or bias != 0
+		   or w.data() != fresh.getParameterArena().tensor(fresh.getParameterArena().Weights, i)){
+			std::cout << "FAILED: layer " << i << " was not initialized in place\n";
+			ok = false;
+		}
+		i++;
+	}
+
+	// He keeps a deep relu stack's outputs near its inputs' scale; [-1, 1] doesn't
+	const double he = depthRms(NN::WeightInit::Auto);
+	const double uniform = depthRms(NN::WeightInit::Uniform);
+	std::cout << "rms outputs of 8 relu layers on unit inputs: " << he << " with He, " << uniform
+		  << " with [-1, 1]\n";
+	if(he < 0.1 or he > 10 or uniform < 100 * he){
+		std::cout << "FAILED: He initialization did not preserve the scale\n";
+		ok = false;
+	}
+
+	// a convolution fixes its own input shape, so the layers after it are inferred at once
+	const NN::SpatialShape image{6, 6, 2};
+	NN::Network conv("L2");
+	conv.addLayer(NN::Layer(batchSize, NN::conv2d(image, 4, 3, 1, 1), "relu")).addDense(8).addDense(1, "linear");
+	std::cout << "conv -> dense -> dense: shapes " << (conv.hasShapes() ? "known" : "unknown")
+		  << ", second layer input " << conv.getLayerInputShapes().back().second << '\n';
+	if(not conv.hasShapes() or conv.getLayers().begin()->getOutputSize() != 6 * 6 * 4
+	   or std::next(conv.getLayers().begin())->getWeights().rows() != 6 * 6 * 4 + 1){
+		std::cout << "FAILED: layers after a convolution were not inferred\n";
+		ok = false;
+	}
+
+	// the list of shapes: each layer outputs the next entry's columns
+	NN::Network listed("tanh", "L2", std::list<std::pair<int_t, int_t>>{{batchSize, 6}, {batchSize, 16}, {batchSize, 1}});
+	std::cout << "from shapes: " << listed.getLayers().size() << " layers, outputs "
+		  << listed.getLayers().front().getOutputSize() << " then " << listed.getNumOutputs() << '\n';
+	if(listed.getLayers().size() != 2 or listed.getLayers().front().getOutputSize() != 16
+	   or listed.getNumOutputs() != 1 or listed.predictBatch(inputs).cols() != 1){
+		std::cout << "FAILED: the shape list constructor built the wrong layers\n";
+		ok = false;
+	}
+
+	// a standalone layer takes its shape from its first forward pass
+	NN::Layer alone(5, "tanh");
+	alone.forwardPass(inputs);
+	if(alone.getWeights().rows() != 7 or alone.getOutputs().cols() != 5){
+		std::cout << "FAILED: a standalone layer did not infer its inputs\n";
+		ok = false;
+	}
+
+	// a copy before the first batch infers its own shapes
+	NN::Network copy(net);
+	NN::Network unbuilt("L2");
+	unbuilt.addDense(4).addDense(1, "linear");
+	NN::Network unbuiltCopy(unbuilt);
+	unbuiltCopy.predictBatch(Mat::Random(3, 9));
+	unbuilt.predictBatch(inputs);
+	if(unbuiltCopy.getInputShape().second != 9 or unbuilt.getInputShape().second != 6
+	   or (copy.predictBatch(inputs) - net.predictBatch(inputs)).cwiseAbs().maxCoeff() != 0){
+		std::cout << "FAILED: copies of an unbuilt network share shapes\n";
+		ok = false;
+	}
+
+	// standing up a large model: layers allocated then packed, or allocated once in the arena
+	const int_t wide = 2048;
+	auto start = std::chrono::steady_clock::now();
+	NN::Network eager("relu", "L2", {NN::Layer(std::make_pair(batchSize, wide), wide),
+					 NN::Layer(std::make_pair(batchSize, wide), wide),
+					 NN::Layer(std::make_pair(batchSize, wide), wide),
+					 NN::Layer(std::make_pair(batchSize, wide), 1)});
+	const double eagerMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	NN::Network lazy("L2");
+	lazy.addDense(wide).addDense(wide).addDense(wide).addDense(1);
+	lazy.predictBatch(Mat::Zero(batchSize, wide));
+	const double lazyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "4 layers of " << wide << ": " << eagerMs << " ms eager, " << lazyMs
+		  << " ms deferred, including a first pass\n";
+	if(lazy.getParameterArena().sizeInBytes() != eager.getParameterArena().sizeInBytes()){
+		std::cout << "FAILED: the deferred network's arena differs\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include "../include/Checkpoint.hpp"
+#include "../include/Trainer.hpp"
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+using Mat = NN::Mat;
+
+int main(){
+	// train a small network for a few epochs, save it, then check that
+	// a reloaded network and a memory-mapped checkpoint reproduce it
+	const NN::int_t numSamples = 1024;
+	const NN::int_t batchSize = 32;
+	const std::string path = "checkpointtest.ckpt";
+
+	Mat features = Mat::Random(numSamples, 3);
+	Mat targets(numSamples, 1);
+	for(NN::int_t i = 0; i < numSamples; i++){
+		targets(i, 0) = std::cos(features(i, 0)) * features(i, 1) - features(i, 2);
+	}
+
+	NN::Layer hidden(std::make_pair(batchSize, 3), 16, "tanh");
+	NN::Layer hidden2(std::make_pair(batchSize, 16), 8, "relu");
+	NN::Layer output(std::make_pair(batchSize, 8), 1, "linear");
+	NN::Network net("tanh", "L2", {hidden, hidden2, output});
+	net.setActivations(std::list<std::string>{"tanh", "relu", "linear"});
+	net.setUpdateParams(2.0e-3, 0.9);
+
+	NN::MatrixSource data(features, targets);
+	NN::Trainer trainer(batchSize, 5);
+	trainer.setSeed(7);
+	trainer.fit(net, data);
+
+	NN::saveCheckpoint(net, path);
+	std::cout << "saved " << net.getLayers().size() << " layers and "
+		  << net.getLossHistory().size() << " losses to " << path << '\n';
+
+	bool ok = true;
+
+	// reload into a fresh network
+	NN::Network restored(std::make_pair(batchSize, 3), 1, "linear");
+	NN::loadCheckpoint(restored, path);
+	auto origIt = net.getLayers().begin();
+	for(const auto& l : restored.getLayers()){
+		if(l.getWeights() != origIt->getWeights() or
+		   l.getWeightUpdate() != origIt->getWeightUpdate() or
+		   l.getActivation() != origIt->getActivation() or
+		   l.getUpdateParams() != origIt->getUpdateParams()){
+			std::cout << "FAILED: reloaded layer differs\n";
+			ok = false;
+		}
+		++origIt;
+	}
+	if(restored.getLossHistory() != net.getLossHistory()){
+		std::cout << "FAILED: loss history differs\n";
+		ok = false;
+	}
+
+	// the mapped checkpoint predicts from the file's pages directly
+	NN::MappedCheckpoint mapped(path);
+	Mat batch = features.topRows(batchSize);
+	Mat mappedOut(batchSize, mapped.numOutputs());
+	mapped.predict(batch, mappedOut);
+
+	// reference: the trained layers run one after another
+	std::list<NN::Layer> layers = net.getLayers();
+	Mat netOut = batch;
+	for(auto& l : layers){
+		l.forwardPass(netOut);
+		netOut = l.getOutputs();
+	}
+	const double diff = (mappedOut - netOut).cwiseAbs().maxCoeff();
+	std::cout << "max |mapped - network| prediction difference: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: mapped predictions differ\n";
+		ok = false;
+	}
+
+	// training picks up where it left off
+	trainer.setEpochs(1);
+	trainer.fit(restored, data);
+	std::cout << "loss history after resuming: " << restored.getLossHistory().size() << '\n';
+
+	// saving over a mapped checkpoint replaces the file, so the mapping
+	// keeps the old one whole
+	NN::saveCheckpoint(restored, path);
+	Mat remappedOut(batchSize, mapped.numOutputs());
+	mapped.predict(batch, remappedOut);
+	if(remappedOut != mappedOut){
+		std::cout << "FAILED: saving changed a mapped checkpoint\n";
+		ok = false;
+	}
+
+	// loading into the wrong precision is refused
+	try{
+		NN::MappedCheckpointf wrong(path);
+		std::cout << "FAILED: single precision load accepted a double checkpoint\n";
+		ok = false;
+	} catch(const char* e){
+		std::cout << "single precision load refused: " << e << '\n';
+	}
+
+	// a last layer so wide its size wraps around to 0 bytes is refused
+	const std::string corruptPath = path + ".corrupt";
+	{
+		std::ifstream in(path, std::ios::binary);
+		std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		NN::CheckpointHeader header;
+		std::memcpy(&header, bytes.data(), sizeof(header));
+		const int64_t wide = int64_t(1) << 61;
+		std::memcpy(bytes.data() + sizeof(header) + (header.numLayers - 1) * sizeof(NN::CheckpointLayerRecord)
+			    + offsetof(NN::CheckpointLayerRecord, outputSize), &wide, sizeof(wide));
+		std::ofstream(corruptPath, std::ios::binary).write(bytes.data(), bytes.size());
+	}
+	try{
+		NN::MappedCheckpoint corrupt(corruptPath);
+		std::cout << "FAILED: a layer larger than the file was accepted\n";
+		ok = false;
+	} catch(const char* e){
+		std::cout << "oversized layer refused: " << e << '\n';
+	}
+
+	std::remove(corruptPath.c_str());
+	std::remove(path.c_str());
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+using Mat = NN::Mat;
+using NN::int_t;
+
+// the layer's preactivations by direct loops over every output, padding skipped
+Mat naive(const Mat& x, const Mat& w, const NN::ConvSpec& spec){
+	const auto in = spec.input;
+	const auto o = spec.output();
+	Mat out(x.rows(), o.size());
+	for(int_t s = 0; s < x.rows(); s++){
+		for(int_t oy = 0; oy < o.height; oy++){
+			for(int_t ox = 0; ox < o.width; ox++){
+				for(int_t f = 0; f < o.channels; f++){
+					double acc = spec.kind == NN::LayerKind::Conv ? w(spec.patchSize(), f) : 0;
+					if(spec.kind == NN::LayerKind::MaxPool){
+						acc = -std::numeric_limits<double>::infinity();
+					}
+					int_t covered = 0;
+					for(int_t ky = 0; ky < spec.kernelH; ky++){
+						for(int_t kx = 0; kx < spec.kernelW; kx++){
+							const int_t iy = oy * spec.strideH - spec.padH + ky;
+							const int_t ix = ox * spec.strideW - spec.padW + kx;
+							if(iy < 0 or iy >= in.height or ix < 0 or ix >= in.width){
+								continue;
+							}
+							covered++;
+							for(int_t c = 0; c < in.channels; c++){
+								const double v = x(s, (iy * in.width + ix) * in.channels + c);
+								if(spec.kind == NN::LayerKind::Conv){
+									acc += v * w((ky * spec.kernelW + kx) * in.channels + c, f);
+								} else if(spec.kind == NN::LayerKind::MaxPool){
+									acc = c == f ? std::max(acc, v) : acc;
+								} else if(c == f){
+									acc += v;
+								}
+							}
+						}
+					}
+					out(s, (oy * o.width + ox) * o.channels + f) =
+						spec.kind == NN::LayerKind::AvgPool ? acc / covered : acc;
+				}
+			}
+		}
+	}
+	return out;
+}
+
+// forward against the loops, then weight and input gradients against finite differences
+bool check(const char* label, const NN::ConvSpec& spec, int threads){
+	const int_t batchSize = 6;
+	NN::Layer layer(batchSize, spec, "tanh");
+	layer.setNumThreads(threads, NN::Parallelism::Batch);
+	// a linear layer in front receives the error sent back through the layer
+	NN::Layer before(std::make_pair(batchSize, 5), spec.input.size(), "linear");
+	const Mat x0 = Mat::Random(batchSize, 5);
+	before.forwardPass(x0);
+	const Mat x = before.getOutputs();
+	layer.forwardPass(before.getOutputs());
+	const Mat expected = naive(x, layer.getWeights(), spec).array().tanh().matrix();
+	const double forwardErr = (layer.getOutputs() - expected).cwiseAbs().maxCoeff();
+
+	// L = sum(outputs .* g), so dL/d(outputs) = g
+	const Mat g = Mat::Random(batchSize, spec.output().size());
+	layer.backwardPass(g);
+	before.backwardPass(layer);
+	auto loss = [&](const Mat& input, const Mat& w){
+		return naive(input, w, spec).array().tanh().cwiseProduct(g.array()).sum();
+	};
+	const double h = 1e-6;
+	double gradErr = 0;
+	Mat w = layer.getWeights();
+	for(int_t i = 0; i < w.size(); i += std::max<int_t>(1, w.size() / 40)){
+		const double saved = w.data()[i];
+		w.data()[i] = saved + h;
+		const double up = loss(x, w);
+		w.data()[i] = saved - h;
+		const double down = loss(x, w);
+		w.data()[i] = saved;
+		gradErr = std::max(gradErr, std::abs((up - down) / (2 * h) - layer.getGradient().data()[i]));
+	}
+	double inputErr = 0;
+	Mat xp = x;
+	for(int_t i = 0; i < xp.size(); i += std::max<int_t>(1, xp.size() / 60)){
+		const double saved = xp.data()[i];
+		xp.data()[i] = saved + h;
+		const double up = loss(xp, w);
+		xp.data()[i] = saved - h;
+		const double down = loss(xp, w);
+		xp.data()[i] = saved;
+		inputErr = std::max(inputErr, std::abs((up - down) / (2 * h) - before.getErr().data()[i]));
+	}
+	std::cout << label << " (" << threads << " thread" << (threads > 1 ? "s" : "") << "): forward "
+		  << forwardErr << ", gradient " << gradErr << ", input error " << inputErr << '\n';
+	if(forwardErr > 1e-12 or gradErr > 1e-6 or inputErr > 1e-6){
+		std::cout << "FAILED: " << label << " disagrees with the reference\n";
+		return false;
+	}
+	return true;
+}
+
+int main(){
+	bool ok = true;
+
+	const NN::SpatialShape image{7, 6, 3};
+	ok &= check("conv 3x3 stride 2 pad 1", NN::conv2d(image, 4, 3, 2, 1), 1);
+	ok &= check("conv 3x3 stride 2 pad 1", NN::conv2d(image, 4, 3, 2, 1), 3);
+	ok &= check("conv 1x1", NN::conv2d(image, 5, 1), 1);
+	ok &= check("conv1d kernel 5 pad 2", NN::conv1d(12, 2, 3, 5, 1, 2), 1);
+	ok &= check("max pool 2x2", NN::maxPool2d(image, 2), 1);
+	ok &= check("max pool 3x3 stride 2 pad 1", {NN::LayerKind::MaxPool, image, 3, 3, 3, 2, 2, 1, 1}, 2);
+	ok &= check("avg pool 3x3 stride 2 pad 1", {NN::LayerKind::AvgPool, image, 3, 3, 3, 2, 2, 1, 1}, 1);
+	ok &= check("avg pool1d", NN::avgPool1d(12, 2, 3), 1);
+
+	try{
+		NN::Layer bad(4, NN::conv2d({3, 3, 1}, 2, 5), "relu");
+		std::cout << "FAILED: a kernel larger than its input was accepted\n";
+		ok = false;
+	} catch(const char* e){
+		std::cout << "caught: " << e << '\n';
+	}
+
+	// float layers agree with double ones
+	NN::Layer conv(8, NN::conv2d(image, 4, 3, 1, 1), "relu");
+	NN::Layerf convf(8, NN::conv2d(image, 4, 3, 1, 1), "relu");
+	convf.setWeights(conv.getWeights().cast<float>());
+	const Mat xi = Mat::Random(8, image.size());
+	conv.forwardPass(xi);
+	convf.forwardPass(xi.cast<float>());
+	const double floatErr = (convf.getOutputs().cast<double>() - conv.getOutputs()).cwiseAbs().maxCoeff();
+	std::cout << "max |float - double| conv outputs: " << floatErr << '\n';
+	if(floatErr > 1e-4){
+		std::cout << "FAILED: float convolution disagrees\n";
+		ok = false;
+	}
+
+	// conv -> pool -> conv -> pool -> dense learns the mean brightness of each half of an image
+	const int_t batchSize = 64;
+	const NN::SpatialShape digits{8, 8, 1};
+	const auto c1 = NN::conv2d(digits, 8, 3, 1, 1);
+	const auto p1 = NN::maxPool2d(c1.output(), 2);
+	const auto c2 = NN::conv2d(p1.output(), 8, 3, 1, 1);
+	const auto p2 = NN::avgPool2d(c2.output(), 2);
+	NN::Layer l1(batchSize, c1, "relu");
+	NN::Layer l2(batchSize, p1, "linear");
+	NN::Layer l3(batchSize, c2, "relu");
+	NN::Layer l4(batchSize, p2, "linear");
+	NN::Layer l5(std::make_pair(batchSize, p2.output().size()), 2, "linear");
+	for(auto* l : {&l1, &l3}){
+		l->setWeights(l->getWeights() * (1.0 / std::sqrt(double(l->getWeights().rows()))));
+	}
+	l5.setWeights(l5.getWeights() * 0.25);
+	NN::Network net("relu", "L2", {l1, l2, l3, l4, l5});
+	net.setActivations(std::list<std::string>{"relu", "linear", "relu", "linear", "linear"});
+	net.setUpdateParams(NN::adam(3e-3));
+	const Mat images = Mat::Random(batchSize, digits.size());
+	Mat targets(batchSize, 2);
+	targets.col(0) = images.leftCols(32).rowwise().mean();
+	targets.col(1) = images.rightCols(32).rowwise().mean();
+	targets *= 4;
+	double firstLoss = 0;
+	double lastLoss = 0;
+	for(int i = 0; i < 600; i++){
+		const double l = net.trainStep(images, targets);
+		if(i == 0){
+			firstLoss = l;
+		}
+		lastLoss = l;
+	}
+	std::cout << "conv net loss " << firstLoss << " -> " << lastLoss << '\n';
+	if(not (lastLoss < 0.1 * firstLoss)){
+		std::cout << "FAILED: the convolutional network did not train\n";
+		ok = false;
+	}
+
+	// a 3x3 convolution over a batch of 32x32x16 images, for information
+	const auto big = NN::conv2d({32, 32, 16}, 32, 3, 1, 1);
+	NN::Layer bigLayer(64, big, "relu");
+	const Mat xb = Mat::Random(64, big.input.size());
+	const Mat gb = Mat::Random(64, big.output().size());
+	bigLayer.forwardPass(xb);
+	bigLayer.backwardPass(gb);
+	const auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < 5; i++){
+		bigLayer.forwardPass(xb);
+		bigLayer.backwardPass(gb);
+	}
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / 5;
+	const double flops = 2.0 * 2 * 64 * 32 * 32 * big.patchSize() * big.filters;
+	std::cout << "32x32x16 -> 32 conv forward+backward, batch 64: " << ms << " ms, "
+		  << flops / ms * 1e-6 << " GFLOP/s\n";
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+#include "../include/DataParallel.hpp"
+#include "../include/Network.hpp"
+#include "../include/Trainer.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <cmath>
+
+using Mat = NN::Mat;
+
+//two identical networks; srand makes the initial weights match
+NN::Network makeNet(NN::int_t batchSize)
+{
+	srand(11);
+	NN::Layer hidden(std::make_pair(batchSize, 4), 32, "tanh");
+	NN::Layer output(std::make_pair(batchSize, 32), 2, "linear");
+	NN::Network net("tanh", "L2", {hidden, output});
+	net.setActivations(std::list<std::string>{"tanh", "linear"});
+	net.setUpdateParams(NN::adam(1.0e-3));
+	return net;
+}
+
+int main(){
+	bool ok = true;
+	const NN::int_t batchSize = 203;
+	const int steps = 20;
+
+	Mat x = Mat::Random(batchSize, 4);
+	Mat y(batchSize, 2);
+	y.col(0) = (x.col(0).array() * x.col(1).array()).matrix();
+	y.col(1) = x.col(2).array().sin().matrix() - x.col(3);
+
+	NN::Network serial = makeNet(batchSize);
+	NN::Network parallel = makeNet(batchSize);
+	NN::DataParallel dp(parallel, 4);
+
+	// sharded steps give the serial steps' weights up to summation order
+	double serialLoss = 0, parallelLoss = 0;
+	for(int s = 0; s < steps; s++){
+		serialLoss = serial.trainStep(x, y);
+		parallelLoss = dp.trainStep(x, y);
+	}
+	double maxDiff = 0;
+	auto sl = serial.getLayers().begin();
+	for(const auto& pl : parallel.getLayers()){
+		maxDiff = std::max(maxDiff, (pl.getWeights() - (sl++)->getWeights()).cwiseAbs().maxCoeff());
+	}
+	std::cout << "after " << steps << " steps on 4 threads: loss " << parallelLoss << " (serial "
+		  << serialLoss << "), max weight difference " << maxDiff << '\n';
+	if(maxDiff > 1e-10 or std::abs(parallelLoss - serialLoss) > 1e-9 * serialLoss
+	   or parallel.getLossHistory().size() != static_cast<size_t>(steps)){
+		std::cout << "FAILED: data-parallel steps differ from serial steps\n";
+		ok = false;
+	}
+
+	// more threads than rows leaves the extra replicas idle
+	{
+		NN::Network a = makeNet(3), b = makeNet(3);
+		NN::DataParallel wide(b, 8);
+		a.trainStep(x.topRows(3), y.topRows(3));
+		wide.trainStep(x.topRows(3), y.topRows(3));
+		const double d = (a.getLayers().back().getWeights() - b.getLayers().back().getWeights()).cwiseAbs().maxCoeff();
+		std::cout << "3-row batch on 8 threads, max weight difference " << d << '\n';
+		if(d > 1e-12){
+			std::cout << "FAILED: batch smaller than the thread count\n";
+			ok = false;
+		}
+	}
+
+	// the Trainer drives a data-parallel model the same way
+	{
+		NN::Network net = makeNet(batchSize);
+		NN::DataParallel model(net, 3);
+		NN::MatrixSource data(x, y);
+		NN::Trainer trainer(64, 30);
+		trainer.fit(model, data);
+		const auto& loss = trainer.getEpochLoss();
+		std::cout << "trainer epoch loss " << loss.front() << " -> " << loss.back() << '\n';
+		if(not (loss.back() < loss.front())){
+			std::cout << "FAILED: data-parallel training did not reduce the loss\n";
+			ok = false;
+		}
+	}
+
+	// a recompiled network has to be synced first
+	try{
+		parallel.setLayers(parallel.getLayers());
+		dp.trainStep(x, y);
+		std::cout << "FAILED: stale replicas were used\n";
+		ok = false;
+	} catch(const char* e){
+		std::cout << "stale replicas refused: " << e << '\n';
+	}
+	dp.sync();
+	dp.trainStep(x, y);
+
+	return ok ? 0 : 1;
+}
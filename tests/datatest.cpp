@@ -0,0 +1,146 @@
+#include "../include/MappedData.hpp"
+#include "../include/Trainer.hpp"
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+using Mat = NN::Mat;
+
+int main(){
+	bool ok = true;
+	const NN::int_t numSamples = 1000;
+	const NN::int_t batchSize = 50;
+	const std::string dataPath = "datatest.dnndata";
+	const std::string csvPath = "datatest.csv";
+
+	Mat features = Mat::Random(numSamples, 3);
+	Mat targets(numSamples, 1);
+	for(NN::int_t i = 0; i < numSamples; i++){
+		targets(i, 0) = features(i, 0) * features(i, 1) - std::sin(features(i, 2));
+	}
+
+	// a written file maps back to the same values
+	NN::writeDataFile<double>(dataPath, features, targets);
+	{
+		NN::MappedDataSource data(dataPath);
+		if(data.size() != numSamples or data.features() != features or data.targets() != targets){
+			std::cout << "FAILED: mapped data differs from what was written\n";
+			ok = false;
+		}
+		std::cout << "mapped " << data.size() << " samples of " << data.featureCount()
+			  << " features and " << data.targetCount() << " target\n";
+	}
+
+	// CSV conversion gives the same file contents
+	{
+		std::ofstream csv(csvPath);
+		csv << "x0,x1,x2,y\n";
+		csv.precision(17);
+		for(NN::int_t i = 0; i < numSamples; i++){
+			csv << features(i, 0) << ',' << features(i, 1) << ", " << features(i, 2)
+			    << ',' << targets(i, 0) << '\n';
+		}
+	}
+	const std::string convertedPath = "datatest_csv.dnndata";
+	const NN::int_t rows = NN::convertCsv<double>(csvPath, convertedPath, 1, true);
+	{
+		NN::MappedDataSource converted(convertedPath);
+		if(rows != numSamples or converted.features() != features or converted.targets() != targets){
+			std::cout << "FAILED: CSV conversion\n";
+			ok = false;
+		}
+	}
+	std::remove(csvPath.c_str());
+	std::remove(convertedPath.c_str());
+
+	// unshuffled batches are views into the mapping, shuffled ones are gathered
+	NN::MappedDataSource data(dataPath);
+	{
+		NN::BatchLoader loader(data, batchSize, true);
+		std::vector<NN::int_t> order(numSamples);
+		std::iota(order.begin(), order.end(), 0);
+		loader.startEpoch(order);
+		NN::int_t seen = 0;
+		bool views = true;
+		while(const NN::Batch* b = loader.next()){
+			views = views and not b->gathered
+				and b->featureRows == data.features().data() + seen * 3
+				and b->featureView() == features.middleRows(seen, b->rows);
+			seen += b->rows;
+		}
+		std::swap(order[0], order[1]);
+		loader.startEpoch(order);
+		const NN::Batch* b = loader.next();
+		const bool gathered = b->gathered and b->featureView().row(0) == features.row(1);
+		std::cout << "sequential batches viewed in place: " << (views ? "yes" : "no")
+			  << ", reordered batch gathered: " << (gathered ? "yes" : "no") << '\n';
+		if(not views or seen != numSamples or not gathered){
+			std::cout << "FAILED: batch views\n";
+			ok = false;
+		}
+	}
+
+	// training from the mapping matches training from the matrices
+	double losses[2];
+	for(int run = 0; run < 2; run++){
+		srand(7);
+		NN::Layer hidden(std::make_pair(batchSize, 3), 12, "tanh");
+		NN::Layer output(std::make_pair(batchSize, 12), 1, "linear");
+		NN::Network net("tanh", "L2", {hidden, output});
+		net.setActivations(std::list<std::string>{"tanh", "linear"});
+		net.setUpdateParams(2.0e-3, 0.9);
+		NN::Trainer trainer(batchSize, 10);
+		trainer.setSeed(3);
+		NN::MatrixSource inMemory(features, targets);
+		if(run == 0){
+			trainer.fit(net, data);
+		} else {
+			trainer.fit(net, inMemory);
+		}
+		losses[run] = trainer.getEpochLoss().back();
+	}
+	std::cout << "final loss from the mapped file: " << losses[0] << ", from memory: " << losses[1] << '\n';
+	if(losses[0] != losses[1]){
+		std::cout << "FAILED: mapped training differs\n";
+		ok = false;
+	}
+
+	// the wrong scalar type is refused
+	try{
+		NN::MappedDataSourcef wrong(dataPath);
+		std::cout << "FAILED: float source opened a double file\n";
+		ok = false;
+	} catch(const char* e){
+		std::cout << "single precision open refused: " << e << '\n';
+	}
+
+	// a row count whose block sizes wrap around to 0 bytes is refused
+	const std::string corruptPath = dataPath + ".corrupt";
+	{
+		std::ifstream in(dataPath, std::ios::binary);
+		std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		const int64_t rows = int64_t(1) << 61;
+		std::memcpy(bytes.data() + offsetof(NN::DataFileHeader, rows), &rows, sizeof(rows));
+		std::ofstream(corruptPath, std::ios::binary).write(bytes.data(), bytes.size());
+	}
+	try{
+		NN::MappedDataSource corrupt(corruptPath);
+		std::cout << "FAILED: blocks larger than the file were accepted\n";
+		ok = false;
+	} catch(const char* e){
+		std::cout << "oversized blocks refused: " << e << '\n';
+	}
+	std::remove(corruptPath.c_str());
+	std::remove(dataPath.c_str());
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+#include "../include/DataParallel.hpp"
+#include "../include/Distributed.hpp"
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <unistd.h>
+
+using Mat = NN::Mat;
+
+//every rank builds the same network; srand makes the initial weights match
+NN::Network makeNet(NN::int_t batchSize)
+{
+	srand(11);
+	NN::Layer hidden(std::make_pair(batchSize, 4), 48, "tanh");
+	NN::Layer middle(std::make_pair(batchSize, 48), 48, "tanh");
+	NN::Layer output(std::make_pair(batchSize, 48), 2, "linear");
+	NN::Network net("tanh", "L2", {hidden, middle, output});
+	net.setActivations(std::list<std::string>{"tanh", "tanh", "linear"});
+	net.setUpdateParams(NN::adam(1.0e-3));
+	return net;
+}
+
+//the same with a batch norm after each hidden layer
+NN::Network makeNormNet(NN::int_t batchSize)
+{
+	srand(13);
+	NN::Layer hidden(std::make_pair(batchSize, 4), 32, "linear");
+	NN::Layer middle(std::make_pair(batchSize, 32), 32, "linear");
+	NN::Layer output(std::make_pair(batchSize, 32), 2, "linear");
+	NN::Network net("tanh", "L2", {hidden, NN::Layer(batchSize, NN::batchNorm(32), "tanh"), middle,
+				       NN::Layer(batchSize, NN::batchNorm(32), "tanh"), output});
+	net.setActivations(std::list<std::string>{"linear", "tanh", "linear", "tanh", "linear"});
+	net.setUpdateParams(1.0e-4, 0.9);
+	return net;
+}
+
+int main(){
+	const int ranks = 3;
+	const NN::int_t batchSize = 301;
+	const int steps = 10;
+
+	// generated before the fork, so every rank sees the same batch
+	Mat x = Mat::Random(batchSize, 4);
+	Mat y(batchSize, 2);
+	y.col(0) = (x.col(0).array() * x.col(1).array()).matrix();
+	y.col(1) = x.col(2).array().sin().matrix() - x.col(3);
+	const std::string socketPrefix = "/tmp/dnn_mptest_" + std::to_string(getpid());
+
+	const int status = NN::ProcessGroup::launch(ranks, [&](NN::ProcessGroup& group){
+		bool ok = true;
+		const int rank = group.getRank();
+
+		// ring all-reduce of a length that doesn't split evenly
+		std::vector<double> v(1001);
+		for(size_t i = 0; i < v.size(); i++){
+			v[i] = rank + i;
+		}
+		group.allReduce(v.data(), v.size());
+		bool summed = true;
+		for(size_t i = 0; i < v.size(); i++){
+			summed = summed and v[i] == ranks * double(i) + ranks * (ranks - 1) / 2;
+		}
+		if(not summed){
+			std::cout << "FAILED: all-reduce on rank " << rank << '\n';
+			ok = false;
+		}
+
+		// sharded steps match serial steps on the whole batch
+		const NN::int_t first = batchSize * rank / ranks;
+		const NN::int_t rows = batchSize * (rank + 1) / ranks - first;
+		NN::Network serial = makeNet(batchSize);
+		NN::Network local = makeNet(rows);
+		//small buckets, so the reduction runs while backward is still going
+		NN::DistributedDataParallel ddp(local, group, 4096);
+		double serialLoss = 0, loss = 0;
+		for(int s = 0; s < steps; s++){
+			serialLoss = serial.trainStep(x, y);
+			loss = ddp.trainStep(x.middleRows(first, rows), y.middleRows(first, rows));
+		}
+		double maxDiff = 0;
+		auto sl = serial.getLayers().begin();
+		for(const auto& l : local.getLayers()){
+			maxDiff = std::max(maxDiff, (l.getWeights() - (sl++)->getWeights()).cwiseAbs().maxCoeff());
+		}
+		if(rank == 0){
+			std::cout << ranks << " ranks, " << ddp.numBuckets() << " buckets, after " << steps
+				  << " steps: loss " << loss << " (serial " << serialLoss
+				  << "), max weight difference " << maxDiff << '\n';
+		}
+		if(maxDiff > 1e-10 or std::abs(loss - serialLoss) > 1e-9 * serialLoss){
+			std::cout << "FAILED: distributed steps differ on rank " << rank << '\n';
+			ok = false;
+		}
+
+		// with batch norms each rank normalizes its own shard, as each thread
+		// of DataParallel does; one bucket per layer, so some start at a norm
+		NN::Network shared = makeNormNet(batchSize);
+		NN::DataParallel dp(shared, ranks);
+		NN::Network normed = makeNormNet(rows);
+		NN::DistributedDataParallel normDdp(normed, group, 1);
+		for(int s = 0; s < steps; s++){
+			serialLoss = dp.trainStep(x, y);
+			loss = normDdp.trainStep(x.middleRows(first, rows), y.middleRows(first, rows));
+		}
+		double maxNormDiff = 0;
+		double maxStatsDiff = 0;
+		auto dl = shared.getLayers().begin();
+		for(const auto& l : normed.getLayers()){
+			maxNormDiff = std::max(maxNormDiff, (l.getWeights() - dl->getWeights()).cwiseAbs().maxCoeff());
+			if(l.getKind() == NN::LayerKind::BatchNorm){
+				maxStatsDiff = std::max(maxStatsDiff,
+							(l.getRunningStats() - dl->getRunningStats()).cwiseAbs().maxCoeff());
+			}
+			dl++;
+		}
+		if(rank == 0){
+			std::cout << "with batch norms, " << normDdp.numBuckets() << " buckets: loss " << loss
+				  << " (DataParallel " << serialLoss << "), max weight difference " << maxNormDiff
+				  << ", max running statistics difference " << maxStatsDiff << '\n';
+		}
+		if(normDdp.numBuckets() != normed.getLayers().size() or maxNormDiff > 1e-10 or maxStatsDiff > 1e-12
+		   or std::abs(loss - serialLoss) > 1e-9 * serialLoss){
+			std::cout << "FAILED: distributed steps with batch norms differ on rank " << rank << '\n';
+			ok = false;
+		}
+
+		// separately started processes meet through socket files
+		group.barrier();
+		NN::ProcessGroup joined(socketPrefix, rank, ranks);
+		float f = 1.5f;
+		joined.allReduce(&f, 1);
+		if(f != 1.5f * ranks){
+			std::cout << "FAILED: all-reduce over a joined ring on rank " << rank << '\n';
+			ok = false;
+		}
+		if(rank == 0){
+			std::cout << "joined ring through " << socketPrefix << ".*: sum " << f << '\n';
+		}
+		return ok ? 0 : 1;
+	});
+
+	return status;
+}
@@ -0,0 +1,95 @@
+#include "../include/Network.hpp"
+#include "../include/LayerGraph.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+using Mat = NN::Mat;
+
+int main(){
+	bool ok = true;
+
+	NN::Layer l1(std::make_pair(16, 6), 9, "tanh");
+	NN::Layer l2(std::make_pair(16, 9), 4, "relu");
+	NN::Layer l3(std::make_pair(16, 4), 2, "linear");
+
+	// the compiled plan runs the same passes as chaining the layers by hand
+	NN::Network net("tanh", "L2", {l1, l2, l3});
+	net.setActivations(std::list<std::string>{"tanh", "relu", "linear"});
+	const auto& graph = net.getGraph();
+	std::cout << "graph: " << graph.size() << " nodes, " << graph.getInputSize() << " -> "
+		  << graph.getOutputSize() << ", " << graph.getActivationWidth() << " activations per row\n";
+	for(size_t i = 0; i < graph.size(); i++){
+		if(graph[i].input != static_cast<int>(i) - 1){
+			std::cout << "FAILED: node " << i << " does not read its predecessor\n";
+			ok = false;
+		}
+	}
+
+	Mat x = Mat::Random(16, 6);
+	NN::Layer a(l1), b(l2), c(l3);
+	b.setActivation("relu");
+	c.setActivation("linear");
+	a.forwardPass(x);
+	b.forwardPass(a.getOutputs());
+	c.forwardPass(b.getOutputs());
+	const Mat out = net.predictBatch(x);
+	double diff = (out - c.getOutputs()).cwiseAbs().maxCoeff();
+	std::cout << "max |graph - chained layers|: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: compiled forward pass disagrees\n";
+		ok = false;
+	}
+
+	// inputs Eigen::Ref can't view are copied, so backward still reads them
+	const Mat lossGrad = Mat::Random(16, a.getOutputs().cols());
+	a.backwardPass(lossGrad);
+	const Mat viewedGrad = a.getGradient();
+	NN::Layer colMajor(l1), scaled(l1);
+	colMajor.forwardPass(Eigen::MatrixXd(x));
+	scaled.forwardPass(x * 1.0);
+	colMajor.backwardPass(lossGrad);
+	scaled.backwardPass(lossGrad);
+	diff = std::max((colMajor.getGradient() - viewedGrad).cwiseAbs().maxCoeff(),
+			(scaled.getGradient() - viewedGrad).cwiseAbs().maxCoeff());
+	std::cout << "max |gradient of copied inputs - viewed inputs|: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: a layer fed a temporary lost its inputs\n";
+		ok = false;
+	}
+
+	// a different batch size replans; threading changes replan too
+	net.setNumThreads(2, NN::Parallelism::Batch);
+	Mat x2 = Mat::Random(128, 6);
+	net.predictBatch(x2);
+	if(graph.getPlannedRows() != 128 or not graph[0].splitRows){
+		std::cout << "FAILED: plan was not rebuilt for the new batch and threads\n";
+		ok = false;
+	}
+	net.setNumThreads(1);
+
+	// a new layer list recompiles and repacks
+	std::list<NN::Layer> layers = net.getLayers();
+	layers.insert(std::next(layers.begin()), NN::Layer(std::make_pair(16, 9), 9, "tanh"));
+	net.setLayers(layers);
+	if(net.getGraph().size() != 4 or not net.parametersPacked()){
+		std::cout << "FAILED: new layer list was not compiled\n";
+		ok = false;
+	}
+
+	// mismatched layers are refused once, when compiled
+	std::string error;
+	try{
+		NN::Network bad("tanh", "L2", {l1, l3});
+	} catch(const char* e){
+		error = e;
+	}
+	std::cout << "mismatched layers: " << (error.empty() ? "accepted" : error) << '\n';
+	if(error.empty()){
+		std::cout << "FAILED: a 9-output layer fed a 4-input layer\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
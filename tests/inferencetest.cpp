@@ -0,0 +1,91 @@
+#include "../bench/AllocCounter.hpp"
+#include "../include/InferenceModel.hpp"
+#include "../include/Checkpoint.hpp"
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cstdio>
+
+using Mat = NN::Mat;
+
+int main(){
+	// freeze a 3-layer network, then serve it from several threads at once
+	const NN::int_t batchSize = 600;
+	const int numThreads = 4;
+
+	NN::Layer l1(std::make_pair(batchSize, 12), 32, "relu");
+	NN::Layer l2(std::make_pair(batchSize, 32), 24, "tanh");
+	NN::Layer l3(std::make_pair(batchSize, 24), 3, "sigmoid");
+	NN::Network net("relu", "L2", {l1, l2, l3});
+	net.setActivations(std::list<std::string>{"relu", "tanh", "sigmoid"});
+
+	Mat x = Mat::Random(batchSize, 12);
+	Mat expected = net.predictBatch(x);
+
+	bool ok = true;
+
+	// single-threaded serving matches the network, across several row chunks
+	Eigen::setNbThreads(1);
+	const NN::InferenceModel model(net, 128);
+	Mat out(batchSize, model.numOutputs());
+	model.predict(x, out);
+	double diff = (out - expected).cwiseAbs().maxCoeff();
+	std::cout << "max |model - network|: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: frozen model disagrees with the network\n";
+		ok = false;
+	}
+
+	// a warm predict() allocates nothing
+	const auto before = bench::allocationCount();
+	for(int i = 0; i < 10; i++){
+		model.predict(x, out);
+	}
+	const auto allocs = bench::allocationCount() - before;
+	std::cout << "allocations in 10 warm predictions: " << allocs << '\n';
+	if(allocs != 0){
+		std::cout << "FAILED: predict allocated\n";
+		ok = false;
+	}
+
+	// concurrent requests on one shared model, each on its own rows
+	std::vector<Mat> results(numThreads, Mat(batchSize / numThreads, model.numOutputs()));
+	std::vector<std::thread> workers;
+	for(int t = 0; t < numThreads; t++){
+		workers.emplace_back([&, t]{
+			for(int rep = 0; rep < 50; rep++){
+				model.predict(x.middleRows(t * batchSize / numThreads, batchSize / numThreads),
+					      results[t]);
+			}
+		});
+	}
+	for(auto& w : workers){
+		w.join();
+	}
+	for(int t = 0; t < numThreads; t++){
+		diff = (results[t] - expected.middleRows(t * batchSize / numThreads, batchSize / numThreads))
+			.cwiseAbs().maxCoeff();
+		if(diff > 1e-12){
+			std::cout << "FAILED: thread " << t << " got a different answer\n";
+			ok = false;
+		}
+	}
+	std::cout << numThreads << " threads served 50 requests each\n";
+
+	// and from a checkpoint
+	const std::string path = "inferencetest.ckpt";
+	NN::saveCheckpoint(net, path);
+	const NN::InferenceModel fromFile(NN::MappedCheckpoint{path});
+	std::remove(path.c_str());
+	fromFile.predict(x, out);
+	diff = (out - expected).cwiseAbs().maxCoeff();
+	std::cout << "max |checkpoint model - network|: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: model built from a checkpoint disagrees\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#include "../include/Network.hpp"
+#include "../include/Losses.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+
+using Mat = NN::Mat;
+
+int main(){
+	bool ok = true;
+
+	// each kernel's gradient against central differences of its loss
+	const std::vector<std::string> names{"L2", "mae", "huber", "bce_logits", "softmax_ce"};
+	Mat pred = 2 * Mat::Random(6, 4);
+	Mat target = Mat::Random(6, 4).cwiseAbs();
+	// one-hot targets for softmax_ce
+	Mat oneHot = Mat::Zero(6, 4);
+	for(int r = 0; r < 6; r++){
+		oneHot(r, r % 4) = 1;
+	}
+	for(const auto& name : names){
+		const auto kernel = NN::lossKernel<double>(name);
+		const Mat& y = name == "softmax_ce" ? oneHot : target;
+		Mat grad(6, 4), scratch(6, 4);
+		kernel.evaluate(pred, y, grad);
+		double err = 0;
+		const double h = 1e-6;
+		for(int i = 0; i < pred.size(); i++){
+			Mat plus = pred, minus = pred;
+			plus.data()[i] += h;
+			minus.data()[i] -= h;
+			const double fd = (kernel.evaluate(plus, y, scratch) - kernel.evaluate(minus, y, scratch)) / (2 * h);
+			err = std::max(err, std::abs(fd - grad.data()[i]));
+		}
+		std::cout << name << " max |gradient - finite difference|: " << err << '\n';
+		if(err > 1e-6){
+			std::cout << "FAILED: " << name << " gradient\n";
+			ok = false;
+		}
+	}
+
+	// logits far outside exp's range stay finite
+	{
+		Mat logits(2, 3);
+		logits << 1e4, -1e4, 0,
+			  -800, 750, 1e3;
+		Mat y = Mat::Zero(2, 3);
+		y(0, 1) = 1;
+		y(1, 2) = 1;
+		Mat grad(2, 3);
+		const double ce = NN::lossKernel<double>("softmax_ce").evaluate(logits, y, grad);
+		const double bce = NN::lossKernel<double>("bce_logits").evaluate(logits, y, grad);
+		std::cout << "softmax_ce, bce_logits on extreme logits: " << ce << ", " << bce << '\n';
+		if(not std::isfinite(ce) or not std::isfinite(bce) or not grad.allFinite()
+		   or std::abs(ce - 20000) > 1e-9){
+			std::cout << "FAILED: extreme logits\n";
+			ok = false;
+		}
+	}
+
+	// a strided view of the targets gives the same loss as a copy
+	{
+		Mat wide = Mat::Random(6, 8);
+		Mat grad(6, 4), grad2(6, 4);
+		const auto l2 = NN::lossKernel<double>("huber");
+		const double a = l2.evaluate(pred, wide.leftCols(4), grad);
+		const double b = l2.evaluate(pred, Mat(wide.leftCols(4)), grad2);
+		if(a != b or grad != grad2){
+			std::cout << "FAILED: strided targets\n";
+			ok = false;
+		}
+	}
+
+	// three-class classification with softmax cross-entropy on a linear final layer
+	{
+		const NN::int_t n = 300;
+		Mat x = Mat::Random(n, 2);
+		Mat y = Mat::Zero(n, 3);
+		for(NN::int_t i = 0; i < n; i++){
+			const int c = x(i, 0) + x(i, 1) > 0.5 ? 0 : (x(i, 0) - x(i, 1) > 0 ? 1 : 2);
+			y(i, c) = 1;
+		}
+		NN::Layer hidden(std::make_pair(n, 2), 16, "tanh");
+		NN::Layer logits(std::make_pair(n, 16), 3, "linear");
+		NN::Network net("tanh", "softmax_ce", {hidden, logits});
+		net.setActivations(std::list<std::string>{"tanh", "linear"});
+		net.setUpdateParams(NN::adam(1e-2));
+		double loss = 0;
+		for(int step = 0; step < 1500; step++){
+			loss = net.trainStep(x, y);
+		}
+		const Mat& out = net.predictBatch(x);
+		int correct = 0;
+		for(NN::int_t i = 0; i < n; i++){
+			NN::int_t p, t;
+			out.row(i).maxCoeff(&p);
+			y.row(i).maxCoeff(&t);
+			correct += p == t;
+		}
+		std::cout << "softmax_ce: mean loss " << loss / n << ", training accuracy "
+			  << double(correct) / n << '\n';
+		if(correct < 0.9 * n){
+			std::cout << "FAILED: classifier did not learn\n";
+			ok = false;
+		}
+	}
+
+	// the vector-function path still works
+	{
+		NN::Layer l(std::make_pair(4, 3), 2, "linear");
+		NN::Network a("linear", "L2", {l});
+		NN::Network b("linear", "L2", {l});
+		b.setLossFunc(NN::VECTOR_LOSS["L2"], NN::VECTOR_LOSS_DERIVATIVE["L2"]);
+		Mat x = Mat::Random(4, 3), y = Mat::Random(4, 2);
+		if(a.trainStep(x, y) != b.trainStep(x, y) or b.getLossName() != "custom"){
+			std::cout << "FAILED: custom loss functions\n";
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+#include "../include/InferenceModel.hpp"
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using Mat = NN::Mat;
+using NN::int_t;
+
+// preactivations by direct loops; a batch norm with running stats uses those instead of the batch's
+Mat naive(const Mat& x, const Mat& w, const NN::NormSpec& spec, const Mat* running=nullptr){
+	Mat out(x.rows(), x.cols());
+	const double eps = spec.epsilon;
+	if(spec.kind == NN::LayerKind::LayerNorm){
+		for(int_t r = 0; r < x.rows(); r++){
+			const double mean = x.row(r).mean();
+			const double var = (x.row(r).array() - mean).square().mean();
+			for(int_t j = 0; j < x.cols(); j++){
+				out(r, j) = w(0, j) * (x(r, j) - mean) / std::sqrt(var + eps) + w(1, j);
+			}
+		}
+		return out;
+	}
+	const int_t c = spec.channels;
+	for(int_t ch = 0; ch < c; ch++){
+		double mean = 0;
+		double var = 0;
+		int_t count = 0;
+		for(int_t r = 0; r < x.rows(); r++){
+			for(int_t j = ch; j < x.cols(); j += c){
+				mean += x(r, j);
+				count++;
+			}
+		}
+		mean /= count;
+		for(int_t r = 0; r < x.rows(); r++){
+			for(int_t j = ch; j < x.cols(); j += c){
+				var += (x(r, j) - mean) * (x(r, j) - mean);
+			}
+		}
+		var /= count;
+		if(running){
+			mean = (*running)(0, ch);
+			var = (*running)(1, ch);
+		}
+		for(int_t r = 0; r < x.rows(); r++){
+			for(int_t j = ch; j < x.cols(); j += c){
+				out(r, j) = w(0, ch) * (x(r, j) - mean) / std::sqrt(var + eps) + w(1, ch);
+			}
+		}
+	}
+	return out;
+}
+
+// forward against the loops, then gamma, beta and input gradients against finite differences
+bool check(const char* label, const NN::NormSpec& spec, int threads, bool training){
+	const int_t batchSize = 9;
+	NN::Layer layer(batchSize, spec, "tanh");
+	layer.setNumThreads(threads, NN::Parallelism::Batch);
+	Mat w = Mat::Random(2, spec.parameters());
+	w.row(0).array() += 1.5;
+	layer.setWeights(w);
+	Mat running(2, spec.parameters());
+	running.row(0).setRandom();
+	running.row(1) = Mat::Random(1, spec.parameters()).array().abs() + 0.5;
+	if(spec.kind == NN::LayerKind::BatchNorm){
+		layer.setRunningStats(running);
+	}
+	layer.setTraining(training);
+	const Mat* stats = training ? nullptr : &running;
+	NN::Layer before(std::make_pair(batchSize, 4), spec.features, "linear");
+	before.forwardPass(Mat::Random(batchSize, 4));
+	const Mat x = before.getOutputs();
+	layer.forwardPass(before.getOutputs());
+	const double forwardErr = (layer.getOutputs() - naive(x, w, spec, stats).array().tanh().matrix())
+		.cwiseAbs().maxCoeff();
+
+	const Mat g = Mat::Random(batchSize, spec.features);
+	layer.backwardPass(g);
+	before.backwardPass(layer);
+	auto loss = [&](const Mat& input, const Mat& weights){
+		return naive(input, weights, spec, stats).array().tanh().cwiseProduct(g.array()).sum();
+	};
+	const double h = 1e-6;
+	double gradErr = 0;
+	for(int_t i = 0; i < w.size(); i++){
+		const double saved = w.data()[i];
+		w.data()[i] = saved + h;
+		const double up = loss(x, w);
+		w.data()[i] = saved - h;
+		const double down = loss(x, w);
+		w.data()[i] = saved;
+		gradErr = std::max(gradErr, std::abs((up - down) / (2 * h) - layer.getGradient().data()[i]));
+	}
+	double inputErr = 0;
+	Mat xp = x;
+	for(int_t i = 0; i < xp.size(); i++){
+		const double saved = xp.data()[i];
+		xp.data()[i] = saved + h;
+		const double up = loss(xp, w);
+		xp.data()[i] = saved - h;
+		const double down = loss(xp, w);
+		xp.data()[i] = saved;
+		inputErr = std::max(inputErr, std::abs((up - down) / (2 * h) - before.getErr().data()[i]));
+	}
+	std::cout << label << (training ? "" : ", inference") << " (" << threads << " thread"
+		  << (threads > 1 ? "s" : "") << "): forward " << forwardErr << ", gradient " << gradErr
+		  << ", input error " << inputErr << '\n';
+	if(forwardErr > 1e-12 or gradErr > 1e-6 or inputErr > 1e-6){
+		std::cout << "FAILED: " << label << " disagrees with the reference\n";
+		return false;
+	}
+	return true;
+}
+
+int main(){
+	bool ok = true;
+
+	ok &= check("batch norm", NN::batchNorm(6), 1, true);
+	ok &= check("batch norm", NN::batchNorm(6), 3, true);
+	ok &= check("batch norm over 3 channels of NHWC rows", NN::batchNorm(12, 3), 2, true);
+	ok &= check("batch norm", NN::batchNorm(12, 3), 1, false);
+	ok &= check("layer norm", NN::layerNorm(7), 1, true);
+	ok &= check("layer norm", NN::layerNorm(7), 3, true);
+
+	// the running statistics of a batch seen over and over approach its own
+	const int_t rows = 50;
+	NN::Layer bn(rows, NN::batchNorm(5), "linear");
+	const Mat xs = (Mat::Random(rows, 5) * 3).array() + 2;
+	for(int i = 0; i < 200; i++){
+		bn.forwardPass(xs);
+	}
+	const Mat trainOut = bn.getOutputs();
+	bn.setTraining(false);
+	bn.forwardPass(xs);
+	const double drift = (bn.getOutputs() - trainOut).cwiseAbs().maxCoeff();
+	std::cout << "max |inference - training| outputs on the same batch: " << drift << '\n';
+	if(drift > 0.05){
+		std::cout << "FAILED: running statistics did not converge to the batch's\n";
+		ok = false;
+	}
+
+	// dense -> batch norm -> dense -> batch norm over conv channels -> dense, trained, then folded
+	const int_t batchSize = 64;
+	const NN::SpatialShape image{4, 4, 2};
+	NN::Layer d1(std::make_pair(batchSize, 8), image.size(), "linear");
+	NN::Layer n1(batchSize, NN::batchNorm(image.size()), "relu");
+	NN::Layer c1(batchSize, NN::conv2d(image, 3, 3, 1, 1), "linear");
+	NN::Layer n2(batchSize, NN::batchNorm(image.height * image.width * 3, 3), "tanh");
+	NN::Layer d2(std::make_pair(batchSize, image.height * image.width * 3), 1, "linear");
+	c1.setWeights(c1.getWeights() * 0.3);
+	d2.setWeights(d2.getWeights() * 0.1);
+	NN::Network net("relu", "L2", {d1, n1, c1, n2, d2});
+	net.setActivations(std::list<std::string>{"linear", "relu", "linear", "tanh", "linear"});
+	net.setUpdateParams(NN::adam(3e-3));
+	const Mat inputs = Mat::Random(batchSize, 8);
+	const Mat targets = (inputs.leftCols(4).rowwise().sum() - inputs.rightCols(4).rowwise().sum()).array().sin();
+	double firstLoss = 0;
+	double lastLoss = 0;
+	for(int i = 0; i < 400; i++){
+		lastLoss = net.trainStep(inputs, targets);
+		if(i == 0){
+			firstLoss = lastLoss;
+		}
+	}
+	std::cout << "batch-normalized network loss " << firstLoss << " -> " << lastLoss << '\n';
+	if(not (lastLoss < 0.1 * firstLoss)){
+		std::cout << "FAILED: the batch-normalized network did not train\n";
+		ok = false;
+	}
+
+	net.setTraining(false);
+	const Mat before = net.predictBatch(inputs);
+	NN::Network folded(net);
+	const int count = folded.foldBatchNorm();
+	const Mat after = folded.predictBatch(inputs);
+	const double foldErr = (after - before).cwiseAbs().maxCoeff();
+	std::cout << "folded " << count << " batch norms, " << folded.getLayers().size()
+		  << " layers left; max |folded - unfolded| outputs: " << foldErr << '\n';
+	if(count != 2 or folded.getLayers().size() != 3 or foldErr > 1e-10){
+		std::cout << "FAILED: folding changed the network's outputs\n";
+		ok = false;
+	}
+
+	// a dense-only network with batch norms freezes with them folded in
+	NN::Layer f1(std::make_pair(batchSize, 8), 16, "linear");
+	NN::Layer fn(batchSize, NN::batchNorm(16), "relu");
+	NN::Layer f2(std::make_pair(batchSize, 16), 1, "linear");
+	NN::Network dense("relu", "L2", {f1, fn, f2});
+	dense.setActivations(std::list<std::string>{"linear", "relu", "linear"});
+	dense.setUpdateParams(NN::adam(1e-3));
+	for(int i = 0; i < 50; i++){
+		dense.trainStep(inputs, targets);
+	}
+	dense.setTraining(false);
+	const Mat expected = dense.predictBatch(inputs);
+	const NN::InferenceModel model(dense);
+	Mat served(batchSize, 1);
+	model.predict(inputs, served);
+	const double serveErr = (served - expected).cwiseAbs().maxCoeff();
+	std::cout << "max |frozen - network| outputs with a folded batch norm: " << serveErr << '\n';
+	if(serveErr > 1e-10){
+		std::cout << "FAILED: the frozen model disagrees\n";
+		ok = false;
+	}
+
+	// a deep sigmoid network at networktest's update rule, with and without batch norms
+	const Mat classes = 0.15 + 0.7 * (inputs.rowwise().sum().array() > 0).cast<double>();
+	NN::Layer s1(std::make_pair(batchSize, 8), 16, "sigmoid");
+	NN::Layer s2(std::make_pair(batchSize, 16), 16, "sigmoid");
+	NN::Layer s3(std::make_pair(batchSize, 16), 16, "sigmoid");
+	NN::Layer s4(std::make_pair(batchSize, 16), 1, "sigmoid");
+	NN::Network plain("sigmoid", "L2", {s1, s2, s3, s4});
+	NN::Network normed("sigmoid", "L2", {s1, NN::Layer(batchSize, NN::batchNorm(16)), s2,
+					     NN::Layer(batchSize, NN::batchNorm(16)), s3,
+					     NN::Layer(batchSize, NN::batchNorm(16)), s4});
+	normed.setActivations(std::list<std::string>{"linear", "sigmoid", "linear", "sigmoid", "linear", "sigmoid",
+						     "sigmoid"});
+	double plainLoss = 0;
+	double normedLoss = 0;
+	for(auto* n : {&plain, &normed}){
+		n->setUpdateParams(1.0e-3, 0.2);
+		for(int i = 0; i < 3000; i++){
+			(n == &plain ? plainLoss : normedLoss) = n->trainStep(inputs, classes);
+		}
+	}
+	std::cout << "deep sigmoid loss after 3000 steps at lr 1e-3: " << plainLoss << " plain, "
+		  << normedLoss << " with batch norms\n";
+	if(not (normedLoss < plainLoss)){
+		std::cout << "FAILED: batch norms did not speed up training\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
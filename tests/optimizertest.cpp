@@ -0,0 +1,159 @@
+#include "../include/Network.hpp"
+#include "../include/Checkpoint.hpp"
+#include "../include/Optimizers.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+
+using Mat = NN::Mat;
+
+// the networktest problem: a 10-8-5-1 sigmoid network driving two samples to 0.15
+size_t stepsToConverge(const NN::OptimizerParams& opt, const Mat& x, const Mat& y,
+		       const std::list<Mat>& initialWeights, size_t maxSteps, double tol)
+{
+	NN::Layer l1(std::make_pair(2, 10), 8, "sigmoid");
+	NN::Layer l2(std::make_pair(2, 8), 5, "sigmoid");
+	NN::Layer l3(std::make_pair(2, 5), 1, "sigmoid");
+	NN::Network net("sigmoid", "L2", {l1, l2, l3});
+	net.setWeights(initialWeights);
+	net.setUpdateParams(opt);
+	for(size_t step = 1; step <= maxSteps; step++){
+		if(net.trainStep(x, y) < tol){
+			return step;
+		}
+	}
+	return maxSteps + 1;
+}
+
+int main(){
+	bool ok = true;
+
+	// fused kernels against a plain reading of each rule, three steps each
+	{
+		const int n = 37;
+		Eigen::VectorXd g = Eigen::VectorXd::Random(n);
+		const Eigen::VectorXd w0 = Eigen::VectorXd::Random(n);
+		struct Case { std::string name; NN::OptimizerParams p; };
+		std::vector<Case> cases{{"momentum", NN::momentumSGD(0.1, 0.9)},
+					{"nesterov", NN::nesterov(0.1, 0.9)},
+					{"adam", NN::adam(0.01)},
+					{"adamw", NN::adamW(0.01, 0.1)},
+					{"rmsprop", NN::rmsProp(0.01)},
+					{"adagrad", NN::adagrad(0.1)}};
+		for(const auto& c : cases){
+			const auto& p = c.p;
+			Eigen::VectorXd w = w0, s1 = Eigen::VectorXd::Zero(n), s2 = Eigen::VectorXd::Zero(n);
+			Eigen::VectorXd rw = w0, r1 = s1, r2 = s2;
+			for(int t = 1; t <= 3; t++){
+				NN::optimizerStep<double>(p, t, n, w.data(), g.data(), s1.data(), s2.data());
+				for(int i = 0; i < n; i++){
+					const double gi = g(i);
+					switch(p.rule){
+					case NN::UpdateRule::Momentum:
+						r1(i) = p.momentum * r1(i) - p.learningRate * gi;
+						rw(i) += r1(i);
+						break;
+					case NN::UpdateRule::NesterovAccGrad:
+						r1(i) = p.momentum * r1(i) - p.learningRate * gi;
+						rw(i) += p.momentum * r1(i) - p.learningRate * gi;
+						break;
+					case NN::UpdateRule::Adam:
+					case NN::UpdateRule::AdamW: {
+						r1(i) = p.momentum * r1(i) + (1 - p.momentum) * gi;
+						r2(i) = p.beta2 * r2(i) + (1 - p.beta2) * gi * gi;
+						const double mhat = r1(i) / (1 - std::pow(p.momentum, t));
+						const double vhat = r2(i) / (1 - std::pow(p.beta2, t));
+						const double decay = p.rule == NN::UpdateRule::AdamW ? p.weightDecay * rw(i) : 0.0;
+						rw(i) -= p.learningRate * (mhat / (std::sqrt(vhat) + p.epsilon) + decay);
+						break;
+					}
+					case NN::UpdateRule::RMSProp:
+						r2(i) = p.beta2 * r2(i) + (1 - p.beta2) * gi * gi;
+						rw(i) -= p.learningRate * gi / (std::sqrt(r2(i)) + p.epsilon);
+						break;
+					case NN::UpdateRule::Adagrad:
+						r2(i) += gi * gi;
+						rw(i) -= p.learningRate * gi / (std::sqrt(r2(i)) + p.epsilon);
+						break;
+					}
+				}
+			}
+			const double err = (w - rw).cwiseAbs().maxCoeff();
+			std::cout << c.name << " kernel max error after 3 steps: " << err << '\n';
+			if(err > 1e-12){
+				std::cout << "FAILED: " << c.name << " kernel\n";
+				ok = false;
+			}
+		}
+	}
+
+	// steps each rule needs on the networktest problem
+	{
+		Mat x = Mat::Random(2, 10);
+		Mat y = Mat::Constant(2, 1, 0.15);
+		NN::Layer l1(std::make_pair(2, 10), 8, "sigmoid");
+		NN::Layer l2(std::make_pair(2, 8), 5, "sigmoid");
+		NN::Layer l3(std::make_pair(2, 5), 1, "sigmoid");
+		const std::list<Mat> w{l1.getWeights(), l2.getWeights(), l3.getWeights()};
+
+		const size_t maxSteps = 20000;
+		const double tol = 1e-10;
+		struct Case { std::string name; NN::OptimizerParams p; bool mustConverge; };
+		std::vector<Case> cases{{"momentum(1e-3, 0.2)", NN::momentumSGD(1e-3, 0.2), false},
+					{"nesterov(1e-2, 0.9)", NN::nesterov(1e-2, 0.9), false},
+					{"adam(1e-2)", NN::adam(1e-2), true},
+					{"adamw(1e-2, 1e-4)", NN::adamW(1e-2, 1e-4), true},
+					{"rmsprop(1e-3)", NN::rmsProp(1e-3), false},
+					{"adagrad(5e-2)", NN::adagrad(5e-2), false}};
+		std::cout << "steps to a loss below " << tol << " (of at most " << maxSteps << "):\n";
+		for(const auto& c : cases){
+			const size_t steps = stepsToConverge(c.p, x, y, w, maxSteps, tol);
+			std::cout << "  " << c.name << ": ";
+			if(steps > maxSteps){
+				std::cout << "not converged\n";
+			} else {
+				std::cout << steps << '\n';
+			}
+			if(c.mustConverge and steps > maxSteps){
+				std::cout << "FAILED: " << c.name << " did not converge\n";
+				ok = false;
+			}
+		}
+	}
+
+	// per-layer rules, and Adam's state surviving a checkpoint
+	{
+		const std::string path = "optimizertest.ckpt";
+		Mat x = Mat::Random(16, 4);
+		Mat y = Mat::Random(16, 1);
+		NN::Layer l1(std::make_pair(16, 4), 6, "tanh");
+		NN::Layer l2(std::make_pair(16, 6), 1, "linear");
+		NN::Network net("tanh", "L2", {l1, l2});
+		net.setActivations(std::list<std::string>{"tanh", "linear"});
+		net.setUpdateParams(std::list<NN::OptimizerParams>{NN::adam(1e-3), NN::nesterov(1e-3, 0.9)});
+		for(int i = 0; i < 5; i++){
+			net.trainStep(x, y);
+		}
+		NN::saveCheckpoint(net, path);
+		NN::Network restored(std::make_pair(16, 4), 1, "linear");
+		NN::loadCheckpoint(restored, path);
+		std::remove(path.c_str());
+
+		net.trainStep(x, y);
+		restored.trainStep(x, y);
+		auto a = net.getLayers().begin();
+		for(const auto& b : restored.getLayers()){
+			if(a->getWeights() != b.getWeights() or a->getOptimizer().rule != b.getOptimizer().rule){
+				std::cout << "FAILED: training diverged after reloading optimizer state\n";
+				ok = false;
+			}
+			++a;
+		}
+		std::cout << "resumed adam/nesterov training matches after a checkpoint\n";
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include "../include/PlapNetwork.hpp"
+#include "../include/DataParallel.hpp"
+#include "../include/Trainer.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+using Mat = NN::Mat;
+
+int main(){
+	bool ok = true;
+
+	// forward against the formula and backward against finite differences,
+	// on the integer fast paths and the general one
+	Mat x = Mat::Random(5, 3);
+	x.row(2).setZero();
+	const Mat g = Mat::Random(5, 1);
+	for(double p : {2.0, 3.0, 4.0, 5.0, 2.5, 3.7}){
+		NN::PlapFinalLayer plap(p, 0.7);
+		plap.forwardPass(x);
+		double fwd = 0;
+		for(int r = 0; r < x.rows(); r++){
+			const double n = x.row(r).norm();
+			const double expected = n == 0 ? (p == 2.0 ? 0.7 : 0.0) : 0.7 * std::pow(n, p - 2);
+			fwd = std::max(fwd, std::abs(plap.getOutputs()(r, 0) - expected));
+		}
+		plap.backwardPass(g);
+		const Mat err = plap.getErr();
+		double bwd = 0;
+		const double h = 1e-6;
+		for(int i = 0; i < x.size(); i++){
+			if(x.data()[i] == 0){
+				continue;
+			}
+			Mat plus = x, minus = x;
+			plus.data()[i] += h;
+			minus.data()[i] -= h;
+			plap.forwardPass(plus);
+			const double up = (g.array() * plap.getOutputs().array()).sum();
+			plap.forwardPass(minus);
+			const double down = (g.array() * plap.getOutputs().array()).sum();
+			bwd = std::max(bwd, std::abs((up - down) / (2 * h) - err.data()[i]));
+		}
+		std::cout << "p = " << p << ": forward error " << fwd << ", gradient error " << bwd << '\n';
+		if(fwd > 1e-12 or bwd > 1e-6 or not err.allFinite()){
+			std::cout << "FAILED: p = " << p << '\n';
+			ok = false;
+		}
+	}
+
+	// below p = 2 a zero row would map to infinity, so p is refused
+	for(double p : {1.0, 1.5}){
+		try{
+			NN::PlapFinalLayer low(p);
+			std::cout << "FAILED: p = " << p << " accepted\n";
+			ok = false;
+		} catch(const char* e){
+			std::cout << "p = " << p << " refused: " << e << '\n';
+		}
+	}
+
+	// a network ending in the p-Laplacian learns a radial target
+	const NN::int_t n = 64;
+	Mat inputs = Mat::Random(n, 2);
+	Mat targets = inputs.rowwise().squaredNorm();
+	NN::Layer hidden(std::make_pair(n, 2), 8, "tanh");
+	NN::Layer features(std::make_pair(n, 8), 3, "linear");
+	NN::PlapNetwork net(4.0, 1.0, "tanh", "L2", {hidden, features});
+	net.setActivations(std::list<std::string>{"tanh", "linear"});
+	net.setUpdateParams(NN::adam(1e-2));
+	const double first = net.trainStep(inputs, targets);
+	double last = first;
+	for(int step = 0; step < 2000; step++){
+		last = net.trainStep(inputs, targets);
+	}
+	const Mat& out = net.predictBatch(inputs);
+	std::cout << "plap network loss: " << first << " -> " << last << ", prediction rows "
+		  << out.rows() << " x " << out.cols() << '\n';
+	if(not (last < 0.1 * first) or out.cols() != 1){
+		std::cout << "FAILED: p-Laplacian network did not train\n";
+		ok = false;
+	}
+
+	// a Trainer fitting it as a Network runs the p-Laplacian layer too, even
+	// over a last layer of width 1, whose outputs fit the targets' shape
+	NN::Layer narrow(std::make_pair(n, 8), 1, "linear");
+	NN::PlapNetwork fitted(3.0, 1.0, "tanh", "L2", {hidden, narrow});
+	NN::PlapNetwork stepped(fitted);
+	for(auto* m : {&fitted, &stepped}){
+		m->setActivations(std::list<std::string>{"tanh", "linear"});
+		m->setUpdateParams(NN::adam(1e-2));
+	}
+	NN::MatrixSource radial(inputs, targets);
+	NN::Trainer trainer(n, 50);
+	trainer.setShuffle(false);
+	NN::Network& asNetwork = fitted;
+	trainer.fit(asNetwork, radial);
+	for(int step = 0; step < 50; step++){
+		stepped.trainStep(inputs, targets);
+	}
+	double fitDiff = 0;
+	auto sl = stepped.getLayers().begin();
+	for(const auto& l : fitted.getLayers()){
+		fitDiff = std::max(fitDiff, (l.getWeights() - (sl++)->getWeights()).cwiseAbs().maxCoeff());
+	}
+	const Mat viaNetwork = asNetwork.predictBatch(inputs);
+	const Mat direct = fitted.getPlapLayer().getOutputs();
+	std::cout << "Trainer-fitted plap network: final loss " << trainer.getEpochLoss().back()
+		  << ", max weight difference from trainStep " << fitDiff << '\n';
+	if(fitDiff > 1e-12 or trainer.getEpochLoss().back() != stepped.getLossHistory().back()
+	   or viaNetwork != direct or viaNetwork.cols() != 1){
+		std::cout << "FAILED: fitting through a Network& skipped the p-Laplacian layer\n";
+		ok = false;
+	}
+	try{
+		NN::DataParallel replicas(fitted, 2);
+		std::cout << "FAILED: data-parallel replicas accepted a p-Laplacian network\n";
+		ok = false;
+	} catch(const char* e){
+		std::cout << "data-parallel refused: " << e << '\n';
+	}
+
+	// single precision builds and runs
+	NN::PlapFinalLayerf plapf(3.0);
+	plapf.forwardPass(NN::Matf::Random(4, 6));
+	if(not plapf.getOutputs().allFinite()){
+		std::cout << "FAILED: single precision\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
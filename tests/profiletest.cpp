@@ -0,0 +1,92 @@
+#include "../include/Network.hpp"
+#include "../include/Profiler.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using Mat = NN::Mat;
+
+int main(){
+	bool ok = true;
+	const NN::int_t batchSize = 128;
+	const int steps = 5;
+
+	srand(3);
+	NN::Layer hidden(std::make_pair(batchSize, 6), 40, "tanh");
+	NN::Layer output(std::make_pair(batchSize, 40), 1, "linear");
+	hidden.setName("hidden");
+	NN::Network net("tanh", "L2", {hidden, output});
+	net.setActivations(std::list<std::string>{"tanh", "linear"});
+	net.setUpdateParams(NN::adam(1.0e-3));
+
+	Mat x = Mat::Random(batchSize, 6);
+	Mat y = x.rowwise().sum();
+
+	net.startTrace(64);
+	for(int s = 0; s < steps; s++){
+		net.trainStep(x, y);
+	}
+	net.stopTrace();
+	net.trainStep(x, y);
+
+	std::ostringstream profile, trace;
+	net.writeProfile(profile);
+	net.writeTrace(trace);
+
+	const NN::LayerProfile& h = net.getLayers().front().getProfile();
+	const NN::PhaseStats forward = h.get(NN::Phase::Forward);
+	const NN::PhaseStats backward = h.get(NN::Phase::Backward);
+	const NN::PhaseStats update = h.get(NN::Phase::Update);
+	std::cout << "profiling " << (NN::profilingEnabled() ? "enabled" : "compiled out") << '\n';
+	if(NN::profilingEnabled()){
+		std::cout << profile.str();
+		// every forward FLOP of the hidden layer is counted once
+		const uint64_t expectedFlops = (steps + 1) * batchSize * 40 * (2 * 6 + 1);
+		if(forward.flops != expectedFlops or forward.cycles == 0 or backward.calls != steps + 1
+		   or h.bytesAllocated() == 0 or update.calls != steps + 1 or update.flops < (steps + 1) * 7 * 40){
+			std::cout << "FAILED: hidden layer counters\n";
+			ok = false;
+		}
+		// two layer passes each way and one update per traced step
+		int events = 0;
+		for(size_t at = trace.str().find("\"ph\""); at != std::string::npos;
+		    at = trace.str().find("\"ph\"", at + 1)){
+			events++;
+		}
+		if(events != steps * 5 or trace.str().find("hidden backward") == std::string::npos
+		   or trace.str().find("network update") == std::string::npos){
+			std::cout << "FAILED: trace is missing passes\n";
+			ok = false;
+		}
+	} else if(forward.calls != 0 or forward.cycles != 0 or h.bytesAllocated() != 0
+		  or trace.str().find("\"ph\"") != std::string::npos){
+		std::cout << "FAILED: counters written with profiling compiled out\n";
+		ok = false;
+	}
+	if(profile.str().find("\"name\": \"hidden\"") == std::string::npos
+	   or profile.str().find("\"name\": \"Layer 2\"") == std::string::npos
+	   or trace.str().rfind("{\"traceEvents\": [", 0) != 0){
+		std::cout << "FAILED: export format\n";
+		ok = false;
+	}
+
+	// times past a second keep nanosecond resolution
+	NN::TraceRecorder late;
+	late.start(1);
+	late.record(0, NN::Phase::Forward, 1234567891, 1234567991);
+	std::ostringstream lateTrace;
+	NN::writeChromeTrace(lateTrace, {{"hidden", &h}}, late);
+	if(lateTrace.str().find("\"ts\": 1234567.891, \"dur\": 0.100") == std::string::npos){
+		std::cout << "FAILED: trace times lost precision\n";
+		ok = false;
+	}
+
+	net.resetProfile();
+	if(net.getLayers().front().getProfile().get(NN::Phase::Forward).calls != 0){
+		std::cout << "FAILED: reset\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
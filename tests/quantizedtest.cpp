@@ -0,0 +1,101 @@
+#include "../bench/AllocCounter.hpp"
+#include "../include/QuantizedModel.hpp"
+#include "../include/InferenceModel.hpp"
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <chrono>
+#include <iostream>
+
+using Mat = NN::Mat;
+
+int main(){
+	// quantize a 3-layer network calibrated on one batch, then serve another
+	const NN::int_t batchSize = 1024;
+
+	NN::Layer l1(std::make_pair(batchSize, 64), 256, "relu");
+	NN::Layer l2(std::make_pair(batchSize, 256), 256, "relu");
+	NN::Layer l3(std::make_pair(batchSize, 256), 8, "linear");
+	NN::Network net("relu", "L2", {l1, l2, l3});
+	net.setActivations(std::list<std::string>{"relu", "relu", "linear"});
+
+	Eigen::setNbThreads(1);
+	const Mat calibration = Mat::Random(batchSize, 64);
+	const Mat x = Mat::Random(batchSize, 64);
+	const NN::InferenceModel reference(net);
+	const NN::QuantizedModel model(net, calibration);
+
+	bool ok = true;
+
+	// outputs stay close to the double path
+	const NN::QuantizationError err = model.compare(reference, x);
+	std::cout << "max |int8 - double|: " << err.maxAbsError << ", rms " << err.rmsError
+		  << ", relative " << err.relativeError() << '\n';
+	if(err.relativeError() > 0.02){
+		std::cout << "FAILED: quantized outputs are too far from the double ones\n";
+		ok = false;
+	}
+
+	// an eighth of the memory, give or take the per-output scales
+	size_t doubleBytes = 0;
+	for(NN::int_t i = 0; i < reference.numLayers(); i++){
+		doubleBytes += reference.getWeights(i).size() * sizeof(double);
+	}
+	std::cout << "weights: " << doubleBytes << " bytes in double, " << model.weightBytes() << " in int8\n";
+	if(model.weightBytes() * 6 > doubleBytes){
+		std::cout << "FAILED: quantized weights are not much smaller\n";
+		ok = false;
+	}
+
+	// a warm predict() allocates nothing
+	Mat out(batchSize, model.numOutputs());
+	Mat expected(batchSize, model.numOutputs());
+	model.predict(x, out);
+	reference.predict(x, expected);
+	const auto before = bench::allocationCount();
+	for(int i = 0; i < 10; i++){
+		model.predict(x, out);
+	}
+	const auto allocs = bench::allocationCount() - before;
+	std::cout << "allocations in 10 warm predictions: " << allocs << '\n';
+	if(allocs != 0){
+		std::cout << "FAILED: predict allocated\n";
+		ok = false;
+	}
+
+	// uneven chunks and odd widths give the same answer as one big chunk
+	const NN::QuantizedModel chunked(net, calibration, 100);
+	Mat chunkedOut(batchSize, model.numOutputs());
+	chunked.predict(x, chunkedOut);
+	if((chunkedOut - out).cwiseAbs().maxCoeff() != 0){
+		std::cout << "FAILED: row chunking changed the result\n";
+		ok = false;
+	}
+	NN::Layer o1(std::make_pair(batchSize, 37), 13, "tanh");
+	NN::Layer o2(std::make_pair(batchSize, 13), 3, "sigmoid");
+	NN::Network odd("tanh", "L2", {o1, o2});
+	odd.setActivations(std::list<std::string>{"tanh", "sigmoid"});
+	const Mat xOdd = Mat::Random(batchSize, 37);
+	const NN::QuantizationError oddErr = NN::QuantizedModel(odd, xOdd).compare(NN::InferenceModel(odd), xOdd);
+	std::cout << "37-13-3 network: max |int8 - double| " << oddErr.maxAbsError << '\n';
+	if(oddErr.relativeError() > 0.02){
+		std::cout << "FAILED: odd-width network is too far from the double one\n";
+		ok = false;
+	}
+
+	// throughput, for information
+	const int reps = 50;
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < reps; i++){
+		reference.predict(x, expected);
+	}
+	const double doubleTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	for(int i = 0; i < reps; i++){
+		model.predict(x, out);
+	}
+	const double int8Time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "rows/s: double " << reps * batchSize / doubleTime << ", int8 " << reps * batchSize / int8Time
+		  << '\n';
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#include "../bench/AllocCounter.hpp"
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <iostream>
+
+using Mat = NN::Mat;
+
+int main(){
+	bool ok = true;
+	const NN::int_t batchSize = 512;
+	const NN::int_t width = 256;
+	//Eigen allocates for the GEMMs it spreads over its own threads
+	Eigen::setNbThreads(1);
+
+	srand(5);
+	NN::Layer l1(std::make_pair(batchSize, width), width, "tanh");
+	NN::Layer l2(std::make_pair(batchSize, width), width, "sigmoid");
+	NN::Layer l3(std::make_pair(batchSize, width), 1, "linear");
+	NN::Network net("tanh", "L2", {l1, l2, l3});
+	net.setActivations(std::list<std::string>{"tanh", "sigmoid", "linear"});
+	net.setUpdateParams(NN::adam(1.0e-4));
+
+	Mat x = Mat::Random(batchSize, width);
+	Mat y = x.rowwise().mean();
+
+	// the first steps size the layer buffers and grow the scratch arena;
+	// 40 of them also leave the loss history room for the 20 measured
+	for(int s = 0; s < 40; s++){
+		net.trainStep(x, y);
+	}
+	const auto& scratch = net.getGraph().getScratch();
+	const auto arenaBefore = scratch.getAllocations();
+	const auto before = bench::allocationCount();
+	for(int s = 0; s < 20; s++){
+		net.trainStep(x, y);
+	}
+	const auto allocations = bench::allocationCount() - before;
+	std::cout << "scratch arena of " << scratch.capacity() << " bytes after "
+		  << arenaBefore << " allocations; " << allocations << " heap allocations in 20 steps\n";
+	if(allocations != 0 or scratch.getAllocations() != arenaBefore){
+		std::cout << "FAILED: training allocated in steady state\n";
+		ok = false;
+	}
+
+	// a standalone layer reuses its own arena too
+	NN::Layer layer(std::make_pair(batchSize, width), width, "tanh");
+	Mat delta = Mat::Random(batchSize, width);
+	for(int s = 0; s < 2; s++){
+		layer.forwardPass(x);
+		layer.backwardPass(delta);
+		layer.computeJacobian();
+	}
+	const auto layerBefore = bench::allocationCount();
+	for(int s = 0; s < 5; s++){
+		layer.forwardPass(x);
+		layer.backwardPass(delta);
+		layer.computeJacobian();
+	}
+	const auto layerAllocations = bench::allocationCount() - layerBefore;
+	std::cout << layerAllocations << " heap allocations in 5 standalone layer passes\n";
+	if(layerAllocations != 0){
+		std::cout << "FAILED: standalone layer passes allocated\n";
+		ok = false;
+	}
+
+	// the Jacobian still matches its definition
+	const Mat expected = layer.makeActDerivs() * layer.getWeights().transpose();
+	const double jacobianError = (layer.computeJacobian() - expected).cwiseAbs().maxCoeff();
+	std::cout << "Jacobian error " << jacobianError << '\n';
+	if(jacobianError > 1e-12){
+		std::cout << "FAILED: Jacobian\n";
+		ok = false;
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <chrono>
+#include <iostream>
+
+using Mat = NN::Mat;
+
+int main(){
+	const NN::int_t batchSize = 200;
+	bool ok = true;
+
+	// a 90%-pruned layer on sparse kernels agrees with the same weights on the dense GEMM
+	NN::Layer sparse(std::make_pair(batchSize, 96), 80, "tanh");
+	sparse.prune(0.9);
+	NN::Layer dense = sparse;
+	dense.setSparseThreshold(0);
+	std::cout << "density after prune(0.9): " << sparse.getDensity()
+		  << (sparse.usesSparseKernels() ? " (sparse kernels)" : " (dense)") << '\n';
+	if(sparse.getDensity() > 0.1 or not sparse.usesSparseKernels() or dense.usesSparseKernels()){
+		std::cout << "FAILED: pruning left the wrong density or kernel choice\n";
+		ok = false;
+	}
+
+	const Mat x = Mat::Random(batchSize, 96);
+	const Mat lossGrad = Mat::Random(batchSize, 80);
+	sparse.forwardPass(x);
+	dense.forwardPass(x);
+	double diff = (sparse.getOutputs() - dense.getOutputs()).cwiseAbs().maxCoeff();
+	std::cout << "max |sparse - dense| outputs: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: sparse forward pass disagrees\n";
+		ok = false;
+	}
+
+	// the sparse gradient is the dense one at the kept weights and zero elsewhere
+	sparse.backwardPass(lossGrad);
+	dense.backwardPass(lossGrad);
+	Mat masked = dense.getGradient();
+	sparse.getSparseWeights().mask(masked.topRows(96));
+	diff = (sparse.getGradient() - masked).cwiseAbs().maxCoeff();
+	std::cout << "max |sparse - masked dense| gradient: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: sparse gradient disagrees\n";
+		ok = false;
+	}
+
+	// the error sent back through a sparse layer
+	NN::Layer before(std::make_pair(batchSize, 32), 96, "relu");
+	NN::Layer beforeCopy = before;
+	const Mat x0 = Mat::Random(batchSize, 32);
+	before.forwardPass(x0);
+	beforeCopy.forwardPass(x0);
+	before.backwardPass(sparse);
+	beforeCopy.backwardPass(dense);
+	diff = (before.getErr() - beforeCopy.getErr()).cwiseAbs().maxCoeff();
+	std::cout << "max |sparse - dense| propagated error: " << diff << '\n';
+	if(diff > 1e-12){
+		std::cout << "FAILED: error propagated through the sparse layer disagrees\n";
+		ok = false;
+	}
+
+	// pruned weights stay zero through updates, even fed a dense gradient
+	dense.setUpdateParams(NN::adam(1e-2));
+	for(int i = 0; i < 5; i++){
+		dense.forwardPass(x);
+		dense.backwardPass(lossGrad);
+		dense.updateWeights();
+	}
+	Mat kept = dense.getWeights();
+	sparse.getSparseWeights().mask(kept.topRows(96));
+	if((kept - dense.getWeights()).cwiseAbs().maxCoeff() != 0){
+		std::cout << "FAILED: an update regrew pruned weights\n";
+		ok = false;
+	}
+
+	// gradual pruning while a network trains
+	NN::Layer l1(std::make_pair(batchSize, 8), 64, "tanh");
+	NN::Layer l2(std::make_pair(batchSize, 64), 64, "tanh");
+	NN::Layer l3(std::make_pair(batchSize, 64), 1, "linear");
+	NN::Network net("tanh", "L2", {l1, l2, l3});
+	net.setActivations(std::list<std::string>{"tanh", "tanh", "linear"});
+	net.setUpdateParams(NN::adam(1e-3));
+	net.setPruning({0.8, 100, 600, 50});
+	const Mat xs = Mat::Random(batchSize, 8);
+	const Mat ys = (xs.rowwise().sum() * 0.5).array().sin().matrix();
+	double firstLoss = 0;
+	double lastLoss = 0;
+	for(int i = 0; i < 1500; i++){
+		const double loss = net.trainStep(xs, ys);
+		if(i == 0){
+			firstLoss = loss;
+		}
+		lastLoss = loss;
+	}
+	std::cout << "loss " << firstLoss << " -> " << lastLoss << ", densities";
+	for(const auto& l : net.getLayers()){
+		std::cout << ' ' << l.getDensity();
+		if(l.getDensity() > 0.21){
+			ok = false;
+		}
+	}
+	std::cout << '\n';
+	if(not ok or lastLoss > 0.2 * firstLoss){
+		std::cout << "FAILED: the pruned network did not reach its sparsity or did not train\n";
+		ok = false;
+	}
+
+	// dense against 90% sparse on a wide layer, for information
+	const NN::int_t rows = 256;
+	NN::Layer wide(std::make_pair(rows, 1024), 1024, "relu");
+	NN::Layer wideDense = wide;
+	wide.prune(0.9);
+	wideDense.prune(0.9);
+	wideDense.setSparseThreshold(0);
+	const Mat xw = Mat::Random(rows, 1024);
+	const Mat gw = Mat::Random(rows, 1024);
+	for(auto* l : {&wideDense, &wide}){
+		l->forwardPass(xw);
+		l->backwardPass(gw);
+		const auto start = std::chrono::steady_clock::now();
+		for(int i = 0; i < 10; i++){
+			l->forwardPass(xw);
+			l->backwardPass(gw);
+		}
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << (l == &wide ? "sparse" : "dense") << " 1024x1024 forward+backward: " << ms / 10 << " ms\n";
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include "../include/Trainer.hpp"
+#include "../include/Network.hpp"
+#include <Eigen/Core>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+using Mat = NN::Mat;
+
+int main(){
+	// fit y = sin(2 x0) * x1 on 4096 random samples with
+	// mini-batches of 64, a 16-neuron tanh hidden layer and a linear output
+	const NN::int_t numSamples = 4096;
+	const NN::int_t batchSize = 64;
+
+	Mat features = Mat::Random(numSamples, 2);
+	Mat targets(numSamples, 1);
+	for(NN::int_t i = 0; i < numSamples; i++){
+		targets(i, 0) = std::sin(2.0 * features(i, 0)) * features(i, 1);
+	}
+
+	NN::Layer hidden(std::make_pair(batchSize, 2), 16, "tanh");
+	NN::Layer output(std::make_pair(batchSize, 16), 1, "linear");
+	NN::Network net("tanh", "L2", {hidden, output});
+	net.setActivations(std::list<std::string>{"tanh", "linear"});
+
+	//learning rate applies to the loss summed over a batch
+	net.setUpdateParams(2.0e-3, 0.9);
+
+	NN::MatrixSource data(features, targets);
+
+	NN::Trainer trainer(batchSize, 30);
+	trainer.setSeed(42);
+
+	std::cout << "Training for 30 epochs of " << numSamples / batchSize
+		  << " batches of " << batchSize << "\n";
+	trainer.fit(net, data);
+
+	auto epochLoss = trainer.getEpochLoss();
+	for(size_t e = 0; e < epochLoss.size(); e += 5){
+		std::cout << "epoch " << e << ": mean batch loss " << epochLoss[e] << '\n';
+	}
+	std::cout << "epoch " << epochLoss.size() - 1 << ": mean batch loss "
+		  << epochLoss.back() << '\n';
+
+	// the same run without the prefetch thread visits the same batches
+	NN::Layer hidden2(std::make_pair(batchSize, 2), 16, "tanh");
+	NN::Layer output2(std::make_pair(batchSize, 16), 1, "linear");
+	NN::Network net2("tanh", "L2", {hidden2, output2});
+	net2.setActivations(std::list<std::string>{"tanh", "linear"});
+	net2.setWeights(std::list<Mat>{hidden.getWeights(), output.getWeights()});
+	net2.setUpdateParams(2.0e-3, 0.9);
+
+	NN::Trainer syncTrainer(batchSize, 30);
+	syncTrainer.setSeed(42);
+	syncTrainer.setPrefetch(false);
+	syncTrainer.fit(net2, data);
+
+	std::cout << "final loss with prefetch: " << epochLoss.back()
+		  << ", without: " << syncTrainer.getEpochLoss().back() << '\n';
+	const auto& syncLoss = syncTrainer.getEpochLoss();
+	if(syncLoss.size() != epochLoss.size()){
+		std::cout << "FAILED: prefetch changed the number of epochs\n";
+		return 1;
+	}
+	for(size_t e = 0; e < epochLoss.size(); ++e){
+		if(std::abs(syncLoss[e] - epochLoss[e]) > 1.0e-12 * std::max(1.0, std::abs(epochLoss[e]))){
+			std::cout << "FAILED: epoch " << e << " loss differs with and without prefetch\n";
+			return 1;
+		}
+	}
+
+	// single precision
+	NN::Matf featuresf = features.cast<float>();
+	NN::Matf targetsf = targets.cast<float>();
+	NN::Layerf hiddenf(std::make_pair(batchSize, 2), 16, "tanh");
+	NN::Layerf outputf(std::make_pair(batchSize, 16), 1, "linear");
+	NN::Networkf netf("tanh", "L2", {hiddenf, outputf});
+	netf.setActivations(std::list<std::string>{"tanh", "linear"});
+	netf.setUpdateParams(2.0e-3, 0.9);
+
+	NN::MatrixSourcef dataf(featuresf, targetsf);
+	NN::Trainer floatTrainer(batchSize, 30);
+	floatTrainer.setSeed(42);
+	floatTrainer.fit(netf, dataf);
+	std::cout << "final loss in single precision: " << floatTrainer.getEpochLoss().back() << '\n';
+
+	if(epochLoss.back() > 0.25 * epochLoss.front() or
+	   floatTrainer.getEpochLoss().back() > 0.25 * floatTrainer.getEpochLoss().front()){
+		std::cout << "FAILED: loss did not decrease\n";
+		return 1;
+	}
+	return 0;
+}